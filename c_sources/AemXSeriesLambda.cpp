@@ -8,13 +8,31 @@ static constexpr uint32_t rusefi_base = 0x190;
 
 AemXSeriesWideband::AemXSeriesWideband(uint8_t sensorIndex, SensorType type)
 	: CanSensorBase(
-		0,	// ID passed here doesn't matter since we override acceptFrame
+		0,	// ID passed here doesn't matter since we override acceptFrame and register our IDs in registerIds()
 		type,
 		MS2NT(21)	// sensor transmits at 100hz, allow a frame to be missed
 	)
 	, m_sensorIndex(sensorIndex)
 {}
 
+#if EFI_CAN_SUPPORT
+void registerCanSensor(CanSensorBase& sensor, const uint32_t* sampleIds, size_t sampleIdCount);
+void registerCanListenerId(CanListener& listener, uint32_t id);
+
+/**
+ * Registers the sensor for its own IDs only, rather than as a catch-all listener offered every frame
+ * on the bus. Lambda comes from whichever controller is installed, AEM or rusEFI, so both of those IDs
+ * count for sample age and staleness. The rusEFI diagnostic frame does not.
+ */
+void AemXSeriesWideband::registerIds() {
+	uint32_t rusefiBaseId = rusefi_base + 2 * m_sensorIndex;
+	uint32_t sampleIds[] = { aem_base + m_sensorIndex, rusefiBaseId };
+
+	registerCanSensor(*this, sampleIds, efi::size(sampleIds));
+	registerCanListenerId(*this, rusefiBaseId + 1);
+}
+#endif // EFI_CAN_SUPPORT
+
 bool AemXSeriesWideband::acceptFrame(const CANRxFrame& frame) const {
 	if (frame.DLC != 8) {
 		return false;
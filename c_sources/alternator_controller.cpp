@@ -14,6 +14,7 @@
 #include "efi_pid.h"
 #include "local_version_holder.h"
 #include "periodic_task.h"
+#include "torque_sources.h"
 
 #if defined(HAS_OS_ACCESS)
 #error "Unexpected OS ACCESS HERE"
@@ -55,6 +56,7 @@ void AlternatorController::onFastCallback() {
 		pidReset();
 
 		// Shut off output if not needed
+		currentAltDuty = 0;
 		alternatorControl.setSimplePwmDutyCycle(0);
 
 		return;
@@ -66,6 +68,7 @@ void AlternatorController::onFastCallback() {
 	if (!vBatt) {
 		// Somehow battery voltage isn't valid, disable alternator control
 		alternatorPid.reset();
+		currentAltDuty = 0;
 		alternatorControl.setSimplePwmDutyCycle(0);
 	} else {
 		currentAltDuty = alternatorPid.getOutput(targetVoltage, vBatt.Value, FAST_CALLBACK_PERIOD_MS / 1000.0f);
@@ -78,6 +81,13 @@ void AlternatorController::onFastCallback() {
 	}
 }
 
+/**
+ * @return duty currently commanded to the alternator field, zero while it is not under our control
+ */
+percent_t getAlternatorDuty() {
+	return currentAltDuty;
+}
+
 void showAltInfo(void) {
 	efiPrintf("alt=%s @%s t=%dms", boolToString(engineConfiguration->isAlternatorControlEnabled),
 			hwPortname(engineConfiguration->alternatorControlPin),
@@ -11,9 +11,14 @@
 #include "boost_control.h"
 #include "pid_auto_tune.h"
 #include "electronic_throttle.h"
+#include "boost_model.h"
 
 #define NO_PIN_PERIOD 500
 
+// integrator limits, the boost model mode narrows them to hold the integrator for a step
+#define BOOST_I_TERM_MIN -50
+#define BOOST_I_TERM_MAX 50
+
 #if defined(HAS_OS_ACCESS)
 #error "Unexpected OS ACCESS HERE"
 #endif
@@ -22,6 +27,26 @@ static boostOpenLoop_Map3D_t boostMapOpen;
 static boostOpenLoop_Map3D_t boostMapClosed;
 static SimplePwm boostPwmControl("boost");
 
+static BoostModel boostModel;
+
+static float getBoostPressureRatio(float map) {
+	return map / Sensor::get(SensorType::BarometricPressure).value_or(101.325f);
+}
+
+static void showBoostModel() {
+	efiPrintf("Boost model %s: c0 %.3f c1 %.3f c2 %.3f c3 %.3f",
+			engineConfiguration->boostModel.enabled ? "enabled" : "disabled",
+			boostModel.coefficients[0], boostModel.coefficients[1],
+			boostModel.coefficients[2], boostModel.coefficients[3]);
+	efiPrintf("target %.1f reference %.1f kPa, last duty %.1f%%%s",
+			boostModel.rateLimitedTarget, boostModel.referenceMap, boostModel.lastDuty,
+			boostModel.isSteady ? ", steady" : "");
+}
+
+static bool isBoostModelActive() {
+	return engineConfiguration->boostModel.enabled && engineConfiguration->boostType == CLOSED_LOOP;
+}
+
 void BoostController::init(IPwm* pwm, const ValueProvider3D* openLoopMap, const ValueProvider3D* closedLoopTargetMap, pid_s* pidParams) {
 	m_pwm = pwm;
 	m_openLoopMap = openLoopMap;
@@ -62,10 +87,35 @@ expected<float> BoostController::getSetpoint() {
 		return unexpected;
 	}
 
-	return m_closedLoopTargetMap->getValue(rpm / RPM_1_BYTE_PACKING_MULT, tps.Value / TPS_1_BYTE_PACKING_MULT);
+	float target = m_closedLoopTargetMap->getValue(rpm / RPM_1_BYTE_PACKING_MULT, tps.Value / TPS_1_BYTE_PACKING_MULT);
+
+	if (isBoostModelActive()) {
+		auto map = Sensor::get(SensorType::Map);
+		if (!map) {
+			return unexpected;
+		}
+
+		return boostModel.limitTarget(target, map.Value, SLOW_CALLBACK_PERIOD_MS / 1000.0f,
+				engineConfiguration->boostModel.targetRampRate, engineConfiguration->boostModel.turboTimeConstant);
+	}
+
+	return target;
 }
 
 expected<percent_t> BoostController::getOpenLoop(float target) {
+	if (isBoostModelActive()) {
+		// model predicts duty for the target itself, PID only handles the residual
+		percent_t modelDuty = boostModel.predict(getBoostPressureRatio(target), engine->engineState.airflowEstimate);
+
+#if EFI_TUNER_STUDIO
+		if (engineConfiguration->debugMode == DBG_BOOST) {
+			engine->outputChannels.debugFloatField1 = modelDuty;
+		}
+#endif
+
+		return modelDuty;
+	}
+
 	// Boost control open loop doesn't care about target - only TPS/RPM
 	UNUSED(target);
 
@@ -109,6 +159,7 @@ percent_t BoostController::getClosedLoopImpl(float target, float manifoldPressur
 	// If the engine isn't running, don't correct.
 	if (GET_RPM() == 0) {
 		m_pid.reset();
+		boostModel.isActive = false;
 		return 0;
 	}
 
@@ -117,6 +168,33 @@ percent_t BoostController::getClosedLoopImpl(float target, float manifoldPressur
 		// We're below the CL threshold, inhibit CL for now
 		m_pid.reset();
 		closedLoopPart = 0;
+		boostModel.isActive = false;
+		return closedLoopPart;
+	}
+
+	if (isBoostModelActive()) {
+		constexpr float dt = SLOW_CALLBACK_PERIOD_MS / 1000.0f;
+
+		boostModel.isSteady = absF(manifoldPressure - boostModel.lastMap) / dt < engineConfiguration->boostModel.steadyStateRate;
+		boostModel.lastMap = manifoldPressure;
+
+		// Track where the turbo could be by now, not where we want it to end up
+		float reference = boostModel.referenceMap;
+		float error = reference - manifoldPressure;
+
+		// Pid has no way to skip integration, so the I term is clamped to its current value for this one step
+		bool holdIntegrator = boostModel.shouldHoldIntegrator(target, error);
+		if (holdIntegrator) {
+			m_pid.iTermMin = m_pid.iTermMax = m_pid.getIntegration();
+		}
+
+		closedLoopPart = m_pid.getOutput(reference, manifoldPressure, dt);
+
+		if (holdIntegrator) {
+			m_pid.iTermMin = BOOST_I_TERM_MIN;
+			m_pid.iTermMax = BOOST_I_TERM_MAX;
+		}
+
 		return closedLoopPart;
 	}
 
@@ -146,6 +224,15 @@ void BoostController::setOutput(expected<float> output) {
 	}
 #endif /* EFI_TUNER_STUDIO */
 
+	if (isBoostModelActive()) {
+		boostModel.lastDuty = percent;
+
+		// learn from what it actually took to hold boost, once the turbo has settled on target
+		if (output && engineConfiguration->boostModel.learnEnabled && boostModel.canLearn()) {
+			boostModel.learn(getBoostPressureRatio(boostModel.lastMap), engine->engineState.airflowEstimate, percent);
+		}
+	}
+
 	float duty = PERCENT_TO_DUTY(percent);
 
 	if (m_pwm) {
@@ -156,8 +243,8 @@ void BoostController::setOutput(expected<float> output) {
 }
 
 void BoostController::update() {
-	m_pid.iTermMin = -50;
-	m_pid.iTermMax = 50;
+	m_pid.iTermMin = BOOST_I_TERM_MIN;
+	m_pid.iTermMax = BOOST_I_TERM_MAX;
 
 	ClosedLoopController::update();
 }
@@ -190,6 +277,18 @@ void setDefaultBoostParameters() {
 		}
 	}
 
+	// Model based mode is opt-in, coefficients are a gentle starting point for a solenoid wastegate
+	engineConfiguration->boostModel.enabled = false;
+	engineConfiguration->boostModel.learnEnabled = true;
+	engineConfiguration->boostModel.coefficients[0] = 20;
+	engineConfiguration->boostModel.coefficients[1] = 60;
+	engineConfiguration->boostModel.coefficients[2] = -5;
+	engineConfiguration->boostModel.coefficients[3] = 0;
+	// kPa per second
+	engineConfiguration->boostModel.targetRampRate = 100;
+	engineConfiguration->boostModel.turboTimeConstant = 0.5f;
+	engineConfiguration->boostModel.steadyStateRate = 10;
+
 	// Defaults for ETB-style wastegate actuator
 	engineConfiguration->etbWastegatePid.pFactor = 1;
 	engineConfiguration->etbWastegatePid.minValue = -60;
@@ -243,6 +342,10 @@ void initBoostCtrl() {
 	// Set up boost controller instance
 	engine->boostController.init(&boostPwmControl, &boostMapOpen, &boostMapClosed, &engineConfiguration->boostPid);
 
+	// learned coefficients live until reboot, then start over from configuration
+	boostModel.reset(engineConfiguration->boostModel.coefficients);
+	addConsoleAction("boostmodelinfo", showBoostModel);
+
 #if !EFI_UNIT_TEST
 	startBoostPin();
 	hasInitBoost = true;
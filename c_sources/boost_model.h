@@ -0,0 +1,142 @@
+/**
+ * @file boost_model.h
+ *
+ * Feed-forward wastegate model for closed loop boost control and its recursive least squares
+ * refinement. Kept out of boost_control.cpp and free of configuration so that host tests can run it
+ * against a simulated turbo.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// reference pressure closer than this to the target means the turbo has caught up
+#define BOOST_MODEL_SETTLED_KPA 3
+// RLS forgetting factor, ~1000 steady state samples of memory
+#define BOOST_MODEL_FORGETTING 0.999f
+
+/**
+ * Duty needed to hold a pressure ratio at a given airflow:
+ *   duty = c0 + c1 * (PR - 1) + c2 * flow + c3 * (PR - 1) * flow, flow in 100 kg/h
+ * More boost takes more duty, more exhaust flow takes less. Coefficients start from configuration
+ * and are refined by recursive least squares while boost is steady.
+ */
+struct BoostModel {
+	static constexpr size_t N = 4;
+
+	float coefficients[N];
+	float covariance[N][N];
+
+	float rateLimitedTarget = 0;
+	float referenceMap = 0;
+	float lastMap = 0;
+	float lastDuty = 0;
+	bool isSteady = false;
+	bool isActive = false;
+
+	void reset(const float (&initialCoefficients)[N]) {
+		for (size_t i = 0; i < N; i++) {
+			coefficients[i] = initialCoefficients[i];
+			for (size_t j = 0; j < N; j++) {
+				covariance[i][j] = i == j ? 100 : 0;
+			}
+		}
+
+		isActive = false;
+	}
+
+	static void getRegressors(float pressureRatio, float flow, float (&phi)[N]) {
+		float boost = pressureRatio - 1;
+		flow *= 0.01f;
+
+		phi[0] = 1;
+		phi[1] = boost;
+		phi[2] = flow;
+		phi[3] = boost * flow;
+	}
+
+	// linear model output, not limited to the duty range
+	float predictUnclamped(float pressureRatio, float flow) const {
+		float phi[N];
+		getRegressors(pressureRatio, flow, phi);
+
+		float duty = 0;
+		for (size_t i = 0; i < N; i++) {
+			duty += coefficients[i] * phi[i];
+		}
+
+		return duty;
+	}
+
+	float predict(float pressureRatio, float flow) const {
+		return clampF(0, predictUnclamped(pressureRatio, flow), 100);
+	}
+
+	void learn(float pressureRatio, float flow, float duty) {
+		float phi[N];
+		getRegressors(pressureRatio, flow, phi);
+
+		// gain = P * phi / (lambda + phi' * P * phi)
+		float pPhi[N];
+		float denominator = BOOST_MODEL_FORGETTING;
+		for (size_t i = 0; i < N; i++) {
+			pPhi[i] = 0;
+			for (size_t j = 0; j < N; j++) {
+				pPhi[i] += covariance[i][j] * phi[j];
+			}
+			denominator += phi[i] * pPhi[i];
+		}
+
+		// residual of the linear model itself, clamping would hide how far off it is near 0% and 100%
+		float error = duty - predictUnclamped(pressureRatio, flow);
+
+		for (size_t i = 0; i < N; i++) {
+			coefficients[i] += pPhi[i] / denominator * error;
+		}
+
+		for (size_t i = 0; i < N; i++) {
+			for (size_t j = 0; j < N; j++) {
+				covariance[i][j] = (covariance[i][j] - pPhi[i] * pPhi[j] / denominator) / BOOST_MODEL_FORGETTING;
+			}
+		}
+	}
+
+	/**
+	 * Target may only rise at rampRate (kPa/s, zero for no limit), starting from where the manifold is now.
+	 * Drops apply immediately. Reference follows with turboTimeConstant.
+	 */
+	float limitTarget(float target, float map, float dt, float rampRate, float turboTimeConstant) {
+		if (!isActive) {
+			rateLimitedTarget = map;
+			referenceMap = map;
+			isActive = true;
+		}
+
+		if (rampRate > 0) {
+			rateLimitedTarget = minF(target, maxF(rateLimitedTarget, map) + rampRate * dt);
+		} else {
+			rateLimitedTarget = target;
+		}
+
+		// where a turbo with the configured response time would be by now
+		float tau = maxF(0, turboTimeConstant);
+		referenceMap += (rateLimitedTarget - referenceMap) * dt / (tau + dt);
+
+		return rateLimitedTarget;
+	}
+
+	/**
+	 * Anti-windup: no integration while the turbo is still expected to be spooling, or while
+	 * the output is pinned and integrating would only push it further
+	 */
+	bool shouldHoldIntegrator(float target, float error) const {
+		bool isSpooling = absF(target - referenceMap) > BOOST_MODEL_SETTLED_KPA;
+		bool isSaturated = (lastDuty >= 100 && error > 0) || (lastDuty <= 0 && error < 0);
+		return isSpooling || isSaturated;
+	}
+
+	// the turbo has caught up with the target and is holding it, the duty now is what this operating point needs
+	bool canLearn() const {
+		return isActive && isSteady && absF(rateLimitedTarget - referenceMap) < BOOST_MODEL_SETTLED_KPA;
+	}
+};
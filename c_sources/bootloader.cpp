@@ -121,6 +121,133 @@ void sendNak()
     // TODO: implement
 }
 
+// Several controllers may be updated at once, windowed acks carry a tag derived from chip UID in the top bits of the ID
+static uint8_t getControllerTag()
+{
+    const uint32_t* uid = reinterpret_cast<const uint32_t*>(UID_BASE);
+    uint32_t x = uid[0] ^ uid[1] ^ uid[2];
+    x ^= x >> 16;
+    x ^= x >> 8;
+    return (x ^ (x >> 6)) & 0x3F;
+}
+
+// 6 bit tag alone collides for 1 in 64 pairs, so every windowed ack also carries CRC of the whole 96 bit UID
+static uint32_t getControllerUidCrc()
+{
+    static uint32_t uidCrc = 0;
+    static bool isUidCrcValid = false;
+
+    if (!isUidCrcValid)
+    {
+        uidCrc = crc32(reinterpret_cast<const uint8_t*>(UID_BASE), 12);
+        isUidCrcValid = true;
+    }
+
+    return uidCrc;
+}
+
+// Cumulative ack of windowed transfer, or answer to a query
+void sendWindowedAck(uint32_t value)
+{
+    CANTxFrame frame;
+
+    frame.IDE = CAN_IDE_EXT;
+    frame.EID = 0x727573 | (getControllerTag() << 23);
+    frame.RTR = CAN_RTR_DATA;
+    frame.DLC = 8;
+    frame.data8[0] = value & 0xFF;
+    frame.data8[1] = (value >> 8) & 0xFF;
+    frame.data8[2] = (value >> 16) & 0xFF;
+    frame.data8[3] = (value >> 24) & 0xFF;
+
+    uint32_t uidCrc = getControllerUidCrc();
+    frame.data8[4] = uidCrc & 0xFF;
+    frame.data8[5] = (uidCrc >> 8) & 0xFF;
+    frame.data8[6] = (uidCrc >> 16) & 0xFF;
+    frame.data8[7] = (uidCrc >> 24) & 0xFF;
+
+    canTransmitTimeout(&CAND1, CAN_ANY_MAILBOX, &frame, TIME_INFINITE);
+}
+
+// accepted data frames between cumulative acks
+#define WINDOWED_ACK_INTERVAL 4
+// set in a cumulative ack when frames following the acked offset were dropped
+#define WINDOWED_ACK_GAP_FLAG 0x8000'0000
+#define WINDOWED_FRAME_SIZE 8
+
+// windowed transfer state: data is accepted strictly in order
+static uint32_t streamNextOffset = 0;
+static uint8_t framesSinceAck = 0;
+static bool isGapReported = false;
+
+static bool isWriteAllowed(uint32_t offset, uint8_t dlc)
+{
+    // Don't allow misaligned writes
+    if (offset % sizeof(flashdata_t) != 0 || dlc % sizeof(flashdata_t) != 0)
+    {
+        return false;
+    }
+
+    // Don't allow out of bounds writes
+    return offset < 26 * 1024;
+}
+
+static void handleWindowedWrite(const CANRxFrame& frame, uint16_t frameIndex)
+{
+    uint32_t offset = frameIndex * WINDOWED_FRAME_SIZE;
+
+    if (offset < streamNextOffset)
+    {
+        // retransmission of something we already have, possibly for another controller
+        return;
+    }
+
+    if (offset > streamNextOffset)
+    {
+        // we missed a frame, tell the sender once where to resume
+        if (!isGapReported)
+        {
+            isGapReported = true;
+            sendWindowedAck(streamNextOffset | WINDOWED_ACK_GAP_FLAG);
+        }
+
+        return;
+    }
+
+    if (!isWriteAllowed(offset, frame.DLC))
+    {
+        sendNak();
+        return;
+    }
+
+    Flash::Write(appFlashAddr + offset, &frame.data8[0], frame.DLC);
+    streamNextOffset += frame.DLC;
+    isGapReported = false;
+
+    framesSinceAck++;
+    if (framesSinceAck >= WINDOWED_ACK_INTERVAL)
+    {
+        framesSinceAck = 0;
+        sendWindowedAck(streamNextOffset);
+    }
+}
+
+static void handleWindowedQuery(uint16_t query)
+{
+    switch (query) {
+        case 0: // progress
+            framesSinceAck = 0;
+            sendWindowedAck(streamNextOffset);
+            break;
+        case 1: // CRC of everything written so far
+            sendWindowedAck(crc32(reinterpret_cast<const uint8_t*>(appFlashAddr), streamNextOffset));
+            break;
+        default:
+            sendNak();
+            break;
+    }
+}
+
 bool bootloaderBusy = false;
 
 void RunBootloaderLoop()
@@ -171,6 +298,9 @@ void RunBootloaderLoop()
                 if (embeddedData == 0x5A5A)
                 {
                     EraseAppPages();
+                    streamNextOffset = 0;
+                    framesSinceAck = 0;
+                    isGapReported = false;
                     sendAck();
                 }
                 else
@@ -182,13 +312,7 @@ void RunBootloaderLoop()
             case 0x02: // opcode 2 is "write flash data"
                 // Embedded data is the flash address
 
-                // Don't allow misaligned writes
-                if (embeddedData % sizeof(flashdata_t) != 0 || frame.DLC % sizeof(flashdata_t) != 0)
-                {
-                    sendNak();
-                }
-                // Don't allow out of bounds writes
-                else if (embeddedData >= 26 * 1024)
+                if (!isWriteAllowed(embeddedData, frame.DLC))
                 {
                     sendNak();
                 }
@@ -209,6 +333,13 @@ void RunBootloaderLoop()
                 bootloaderBusy = false;
                 // Kill this thread
                 return;
+            case 0x06: // opcode 6 is "write flash data, windowed"
+                // Embedded data is the frame index, acks are cumulative
+                handleWindowedWrite(frame, embeddedData);
+                break;
+            case 0x07: // opcode 7 is "windowed transfer query"
+                handleWindowedQuery(embeddedData);
+                break;
             default:
                 sendNak();
                 break;
@@ -0,0 +1,12 @@
+/**
+ * @file cam_listeners.h
+ *
+ * Controllers run on every cam position measurement once the engine phase is known, see trigger_central.cpp
+ */
+
+#pragma once
+
+// VVT closed loop, see vvt.cpp
+void onVvtCamMeasurement(int index, efitick_t nowNt);
+// HPFP lobe tracking, see high_pressure_fuel_pump.cpp
+void onHpfpCamUpdate(efitick_t nowNt);
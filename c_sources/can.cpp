@@ -98,10 +98,24 @@ void CanRxThread(void*)
             NVIC_SystemReset();
         }
         // Check if it's an "index set" message
-        else if (frame.DLC == 1 && frame.EID == WB_MSG_SET_INDEX)
+        else if ((frame.DLC == 1 || frame.DLC == 2) && frame.EID == WB_MSG_SET_INDEX)
         {
+            // Unknown sensor type, don't write it to flash and don't ack so the sender knows.
+            // That includes the LSU ADV until there is a measured pump characteristic for it
+            if (frame.DLC == 2 && frame.data8[1] > static_cast<uint8_t>(SensorType::Lsu42))
+            {
+                continue;
+            }
+
             auto newCfg = GetConfiguration();
             newCfg.CanIndexOffset = frame.data8[0];
+
+            // Optional second byte selects the sensor type
+            if (frame.DLC == 2)
+            {
+                newCfg.sensorType = static_cast<SensorType>(frame.data8[1]);
+            }
+
             SetConfiguration(newCfg);
             configuration = GetConfiguration();
             SendAck();
@@ -119,6 +133,11 @@ float GetRemoteBatteryVoltage()
     return remoteBatteryVoltage;
 }
 
+SensorType GetSensorType()
+{
+    return configuration.sensorType;
+}
+
 void InitCan()
 {
     configuration = GetConfiguration();
@@ -0,0 +1,284 @@
+/**
+ * @file	can_bus_load.cpp
+ *
+ * Per-bus CAN traffic accounting: received frames and bits per second, receive load,
+ * TX queue high-water mark, TX timeouts and controller error counters.
+ *
+ * Only what this tree can observe is reported. Every received frame passes processCanRxMessage() with its bus,
+ * so RX load is per bus. Transmitted frames go through CanTxMessage, which only counts them in canWriteOk and
+ * canWriteNotOk for all buses together, so TX shows up as frames per second and timeouts across buses and is
+ * not part of the load. Error counters and mailbox depth are read from the controller where the chip has them.
+ *
+ * Bit counts include the worst-case number of stuff bits, so reported load is an upper bound.
+ */
+
+#include "pch.h"
+
+#if EFI_CAN_SUPPORT || EFI_UNIT_TEST
+
+#include "can_bus_load.h"
+
+// most CAN controllers on any supported chip: STM32F7, STM32H7 and the SocketCAN simulator have three
+#define CAN_BUS_MAX_COUNT 3
+
+// update rates and load once per that many milliseconds
+#define CAN_BUS_LOAD_WINDOW_MS 1000
+
+struct CanBusCounters {
+	// accumulated over current window
+	uint32_t rxFrames;
+	uint32_t rxBits;
+
+	// totals since boot, frames the driver refused, e.g. a full SocketCAN queue
+	uint32_t txDrops;
+	uint8_t txQueueHighWater;
+
+	// results of last completed window
+	uint32_t rxFramesPerSecond;
+	uint32_t rxBitsPerSecond;
+	float rxLoadPercent;
+
+	// read from controller
+	uint8_t txErrorCounter;
+	uint8_t rxErrorCounter;
+	uint8_t lastErrorCode;
+	bool isBusOff;
+};
+
+static CanBusCounters canBusCounters[CAN_BUS_MAX_COUNT];
+// bus index to driver as detected from pins, only buses with a driver are reported
+static CANDriver* canBusDevices[CAN_BUS_MAX_COUNT];
+static Timer canBusLoadWindow;
+
+// canTransmitTimeout() results, CanTxMessage only counts them for all buses together
+static uint32_t canTxTimeouts;
+static uint32_t lastCanWriteNotOk;
+static uint32_t lastCanWriteOk;
+static uint32_t canTxFramesPerSecond;
+
+/**
+ * Frame length in bits on the wire including worst-case bit stuffing, interframe space excluded.
+ * SOF, arbitration, control, data and CRC are subject to stuffing, one stuff bit per four bits at worst.
+ */
+uint32_t getCanFrameBitCount(bool isExtended, uint8_t dlc) {
+	uint32_t stuffable = isExtended
+		// SOF + 11 bit ID + SRR + IDE + 18 bit ID + RTR + r1 + r0 + DLC + CRC
+		? 1 + 11 + 1 + 1 + 18 + 1 + 1 + 1 + 4 + 15
+		// SOF + 11 bit ID + RTR + IDE + r0 + DLC + CRC
+		: 1 + 11 + 1 + 1 + 1 + 4 + 15;
+	stuffable += 8 * dlc;
+
+	// CRC delimiter + ACK slot + ACK delimiter + EOF
+	uint32_t fixedTail = 1 + 1 + 1 + 7;
+
+	return stuffable + (stuffable - 1) / 4 + fixedTail;
+}
+
+static uint32_t getBitrate(size_t busIndex) {
+	// configuration has no bitrate of its own past the second bus
+	auto baudRate = busIndex == 0 ? engineConfiguration->canBaudRate : engineConfiguration->can2BaudRate;
+
+	switch (baudRate) {
+	case B100KBPS:
+		return 100'000;
+	case B250KBPS:
+		return 250'000;
+	case B1MBPS:
+		return 1'000'000;
+	case B500KBPS:
+	default:
+		return 500'000;
+	}
+}
+
+/**
+ * Invoked by initCanTx() with the pin detected devices CanTxMessage sends through, and by the simulator driver
+ */
+void canBusLoadSetDevice(size_t busIndex, CANDriver* device) {
+	if (busIndex >= CAN_BUS_MAX_COUNT) {
+		return;
+	}
+
+	canBusDevices[busIndex] = device;
+}
+
+void canBusLoadOnRx(size_t busIndex, const CANRxFrame& frame) {
+	if (busIndex >= CAN_BUS_MAX_COUNT) {
+		return;
+	}
+
+	chibios_rt::CriticalSectionLocker csl;
+
+	auto& counters = canBusCounters[busIndex];
+	counters.rxFrames++;
+	counters.rxBits += getCanFrameBitCount(frame.IDE == CAN_IDE_EXT, frame.DLC);
+}
+
+/**
+ * Invoked when the driver could not even queue the frame, that's not a bus timeout
+ */
+void canBusLoadOnTxDrop(size_t busIndex) {
+	if (busIndex >= CAN_BUS_MAX_COUNT) {
+		return;
+	}
+
+	chibios_rt::CriticalSectionLocker csl;
+	canBusCounters[busIndex].txDrops++;
+}
+
+/**
+ * CanTxMessage counts canTransmitTimeout() failures for all buses together
+ */
+static void countTransmitTimeouts() {
+	uint32_t writeNotOk = engine->outputChannels.canWriteNotOk;
+	canTxTimeouts += writeNotOk - lastCanWriteNotOk;
+	lastCanWriteNotOk = writeNotOk;
+}
+
+/**
+ * ...and the frames it sent, again for all buses together
+ */
+static void updateTxFramesPerSecond(float elapsedSeconds) {
+	uint32_t writeOk = engine->outputChannels.canWriteOk;
+	canTxFramesPerSecond = (writeOk - lastCanWriteOk) / elapsedSeconds;
+	lastCanWriteOk = writeOk;
+}
+
+// bxCAN has the counters in ESR, other controllers are not read yet
+#if EFI_PROD_CODE && (defined(STM32F4XX) || defined(STM32F7XX))
+#define CAN_BUS_LOAD_CONTROLLER_STATE 1
+#else
+#define CAN_BUS_LOAD_CONTROLLER_STATE 0
+#endif
+
+#if CAN_BUS_LOAD_CONTROLLER_STATE
+static void readControllerState(size_t busIndex, CanBusCounters& counters) {
+	CANDriver* driver = canBusDevices[busIndex];
+	if (!driver || driver->state != CAN_READY) {
+		return;
+	}
+
+	uint32_t esr = driver->can->ESR;
+	counters.txErrorCounter = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	counters.rxErrorCounter = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+	counters.lastErrorCode = (esr & CAN_ESR_LEC) >> CAN_ESR_LEC_Pos;
+	counters.isBusOff = esr & CAN_ESR_BOFF;
+
+	// three TX mailboxes, pending ones are the hardware queue depth
+	uint32_t emptyMailboxes = (driver->can->TSR & (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)) >> CAN_TSR_TME0_Pos;
+	uint8_t pending = 3 - __builtin_popcount(emptyMailboxes);
+	if (pending > counters.txQueueHighWater) {
+		counters.txQueueHighWater = pending;
+	}
+}
+#else
+static void readControllerState(size_t, CanBusCounters&) { }
+#endif // CAN_BUS_LOAD_CONTROLLER_STATE
+
+/**
+ * Invoked from CAN TX thread
+ */
+void updateCanBusLoad(efitick_t nowNt) {
+	countTransmitTimeouts();
+
+	for (size_t i = 0; i < CAN_BUS_MAX_COUNT; i++) {
+		readControllerState(i, canBusCounters[i]);
+	}
+
+	float elapsedSeconds = canBusLoadWindow.getElapsedSeconds(nowNt);
+	if (elapsedSeconds < CAN_BUS_LOAD_WINDOW_MS / 1000.0f) {
+		return;
+	}
+	canBusLoadWindow.reset(nowNt);
+
+	updateTxFramesPerSecond(elapsedSeconds);
+
+	for (size_t i = 0; i < CAN_BUS_MAX_COUNT; i++) {
+		auto& counters = canBusCounters[i];
+
+		uint32_t rxFrames;
+		uint32_t rxBits;
+
+		{
+			// updated from CAN RX thread
+			chibios_rt::CriticalSectionLocker csl;
+			rxFrames = counters.rxFrames;
+			rxBits = counters.rxBits;
+			counters.rxFrames = 0;
+			counters.rxBits = 0;
+		}
+
+		counters.rxFramesPerSecond = rxFrames / elapsedSeconds;
+		counters.rxBitsPerSecond = rxBits / elapsedSeconds;
+		counters.rxLoadPercent = 100.0f * counters.rxBitsPerSecond / getBitrate(i);
+	}
+
+#if EFI_TUNER_STUDIO
+	engine->outputChannels.canBus1RxLoadPercent = canBusCounters[0].rxLoadPercent;
+	engine->outputChannels.canBus2RxLoadPercent = canBusCounters[1].rxLoadPercent;
+	engine->outputChannels.canBus3RxLoadPercent = canBusCounters[2].rxLoadPercent;
+	engine->outputChannels.canTxTimeouts = canTxTimeouts;
+#if CAN_BUS_LOAD_CONTROLLER_STATE
+	// only where they are read, a zero would look like a healthy bus
+	engine->outputChannels.canBus1TxErrorCounter = canBusCounters[0].txErrorCounter;
+	engine->outputChannels.canBus1RxErrorCounter = canBusCounters[0].rxErrorCounter;
+	engine->outputChannels.canBus2TxErrorCounter = canBusCounters[1].txErrorCounter;
+	engine->outputChannels.canBus2RxErrorCounter = canBusCounters[1].rxErrorCounter;
+#endif // CAN_BUS_LOAD_CONTROLLER_STATE
+#endif // EFI_TUNER_STUDIO
+}
+
+/**
+ * Starts a fresh window, otherwise the first one would cover everything since boot
+ */
+void startCanBusLoad() {
+	chibios_rt::CriticalSectionLocker csl;
+
+	for (size_t i = 0; i < CAN_BUS_MAX_COUNT; i++) {
+		auto& counters = canBusCounters[i];
+		counters.rxFrames = 0;
+		counters.rxBits = 0;
+	}
+
+	lastCanWriteNotOk = engine->outputChannels.canWriteNotOk;
+	lastCanWriteOk = engine->outputChannels.canWriteOk;
+	canBusLoadWindow.reset();
+}
+
+void showCanBusLoad() {
+	efiPrintf("CAN load counts received frames per bus, sent frames are only known for all buses together");
+
+	for (size_t i = 0; i < CAN_BUS_MAX_COUNT; i++) {
+		if (!canBusDevices[i]) {
+			continue;
+		}
+
+		auto& counters = canBusCounters[i];
+		efiPrintf("CAN bus %d: RX %.1f%% load %d bit/s of %d, %d frames/s, TX drops %d",
+				(int)i, counters.rxLoadPercent, counters.rxBitsPerSecond, getBitrate(i),
+				counters.rxFramesPerSecond, counters.txDrops);
+#if CAN_BUS_LOAD_CONTROLLER_STATE
+		efiPrintf("CAN bus %d: TX queue high-water %d, TEC %d REC %d LEC %d%s",
+				(int)i, counters.txQueueHighWater,
+				counters.txErrorCounter, counters.rxErrorCounter, counters.lastErrorCode,
+				counters.isBusOff ? " BUS OFF" : "");
+#endif // CAN_BUS_LOAD_CONTROLLER_STATE
+	}
+
+#if !CAN_BUS_LOAD_CONTROLLER_STATE
+	efiPrintf("CAN controller error counters are not read on this platform");
+#endif // CAN_BUS_LOAD_CONTROLLER_STATE
+	efiPrintf("CAN TX all buses: %d frames/s, %d timeouts", canTxFramesPerSecond, canTxTimeouts);
+}
+
+#if EFI_UNIT_TEST
+float getCanBusRxLoadPercent(size_t busIndex) {
+	return canBusCounters[busIndex].rxLoadPercent;
+}
+
+uint32_t getCanTxFramesPerSecond() {
+	return canTxFramesPerSecond;
+}
+#endif // EFI_UNIT_TEST
+
+#endif // EFI_CAN_SUPPORT || EFI_UNIT_TEST
@@ -0,0 +1,20 @@
+/**
+ * @file can_bus_load.h
+ *
+ * Per-bus CAN traffic accounting, see can_bus_load.cpp
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+uint32_t getCanFrameBitCount(bool isExtended, uint8_t dlc);
+
+void canBusLoadSetDevice(size_t busIndex, CANDriver* device);
+void canBusLoadOnRx(size_t busIndex, const CANRxFrame& frame);
+void canBusLoadOnTxDrop(size_t busIndex);
+
+void startCanBusLoad();
+void updateCanBusLoad(efitick_t nowNt);
+void showCanBusLoad();
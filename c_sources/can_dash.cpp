@@ -9,6 +9,8 @@
 
 #include "pch.h"
 
+#include <array>
+
 #if EFI_CAN_SUPPORT
 #include "can_dash.h"
 #include "can_msg_tx.h"
@@ -113,1042 +115,624 @@ static bool cluster_time_set;
 
 constexpr uint8_t e90_temp_offset = 49;
 
-// todo: those forward declarations are out of overall code style
-void canDashboardBMW(CanCycle cycle);
-void canDashboardFiat(CanCycle cycle);
-void canMazdaRX8(CanCycle cycle);
-void canDashboardW202(CanCycle cycle);
-void canDashboardBMWE90(CanCycle cycle);
-void canDashboardVagMqb(CanCycle cycle);
-void canDashboardNissanVQ(CanCycle cycle);
-void canDashboardGenesisCoupe(CanCycle cycle);
-void canDashboardAim(CanCycle cycle);
-void canDashboardHaltech(CanCycle cycle);
-
-void updateDash(CanCycle cycle) {
-
-	// Transmit dash data, if enabled
-	switch (engineConfiguration->canNbcType) {
-	case CAN_BUS_NBC_NONE:
-		break;
-	case CAN_BUS_NBC_BMW:
-		canDashboardBMW(cycle);
-		break;
-	case CAN_BUS_Haltech:
-		canDashboardHaltech(cycle);
-		break;
-	case CAN_BUS_NBC_FIAT:
-		canDashboardFiat(cycle);
-		break;
-	case CAN_BUS_NBC_VAG:
-		canDashboardVAG(cycle);
-		break;
-	case CAN_BUS_MAZDA_RX8:
-		canMazdaRX8(cycle);
-		break;
-	case CAN_BUS_W202_C180:
-		canDashboardW202(cycle);
-		break;
-	case CAN_BUS_BMW_E90:
-		canDashboardBMWE90(cycle);
-		break;
-	case CAN_BUS_MQB:
-		canDashboardVagMqb(cycle);
-		break;
-	case CAN_BUS_NISSAN_VQ:
-		canDashboardNissanVQ(cycle);
-		break;
-	case CAN_BUS_GENESIS_COUPE:
-		canDashboardGenesisCoupe(cycle);
-		break;
-	case CAN_AIM_DASH:
-		canDashboardAim(cycle);
-		break;
-	default:
-		firmwareError(OBD_PCM_Processor_Fault, "Nothing for canNbcType %s", getCan_nbc_e(engineConfiguration->canNbcType));
-		break;
+// Frames that stay hand written: conditional lamp bits, rolling counters and the wall clock are not
+// described by the signal tables further down.
+
+static void sendMazdaStatus2() {
+	CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_STATUS_2);
+	auto clt = Sensor::get(SensorType::Clt);
+	msg[0] = (uint8_t)(clt.value_or(0) + 69); //temp gauge //~170 is red, ~165 last bar, 152 centre, 90 first bar, 92 second bar
+	// TODO: fixme!
+	//msg[1] = ((int16_t)(engine->engineState.vssEventCounter*(engineConfiguration->vehicleSpeedCoef*0.277*2.58))) & 0xff;
+	msg[2] = 0x00; // unknown
+	msg[3] = 0x00; //unknown
+	msg[4] = 0x01; //Oil Pressure (not really a gauge)
+	msg[5] = 0x00; //check engine light
+	msg[6] = 0x00; //Coolant, oil and battery
+	if ((Sensor::getOrZero(SensorType::Rpm)>0) && (Sensor::get(SensorType::BatteryVoltage).value_or(VBAT_FALLBACK_VALUE)<13)) {
+		msg.setBit(6, 6); // battery light
+	}
+	if (!clt.Valid || clt.Value > 105) {
+		// coolant light, 101 - red zone, light means its get too hot
+		// Also turn on the light in case of sensor failure
+		msg.setBit(6, 1);
 	}
+	//oil pressure warning lamp bit is 7
+	msg[7] = 0x00; //unused
 }
 
-//BMW Dashboard
-//todo: we use 50ms fixed cycle, trace is needed to check for correct period
-void canDashboardBMW(CanCycle cycle) {
-	
-	if (cycle.isInterval(CI::_50ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_BMW_E46_SPEED);
-			msg.setShortValue(10 * 8, 1);
-		}
+static int rollingId = 0;
 
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_BMW_E46_RPM);
-			msg.setShortValue((int) (Sensor::getOrZero(SensorType::Rpm) * 6.4), 2);
-		}
+static void sendNissanClt() {
+	CanTxMessage msg(CanCategory::OBD, NISSAN_CLT_551, 8);
 
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_BMW_E46_DME2);
-			msg.setShortValue((int) ((Sensor::getOrZero(SensorType::Clt) + 48.373) / 0.75), 1);
-		}
-	}
+	int clt = Sensor::getOrZero(SensorType::Clt);
+	msg[0] = clt + 45;
 }
 
-//todo: we use 50ms fixed cycle, trace is needed to check for correct period
-void canMazdaRX8(CanCycle cycle) {
-	if (cycle.isInterval(CI::_50ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_STEERING_WARNING);
-			// todo: something needs to be set here? see http://rusefi.com/wiki/index.php?title=Vehicle:Mazda_Rx8_2004
-		}
-
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_RPM_SPEED);
+static void sendNissanRpmClt() {
+	CanTxMessage msg(CanCategory::NBC, NISSAN_RPM_CLT, 8);
 
-			float kph = Sensor::getOrZero(SensorType::VehicleSpeed);
+	rollingId = (rollingId + 1) % 4;
+	const uint8_t magicByte[4] = {0x03, 0x23, 0x42, 0x63};
 
-			msg.setShortValue(SWAP_UINT16(Sensor::getOrZero(SensorType::Rpm) * 4), 0);
-			msg.setShortValue(0xFFFF, 2);
-			msg.setShortValue(SWAP_UINT16((int )(100 * kph + 10000)), 4);
-			msg.setShortValue(0, 6);
-		}
-
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_STATUS_1);
-			msg[0] = 0xFE; //Unknown
-			msg[1] = 0xFE; //Unknown
-			msg[2] = 0xFE; //Unknown
-			msg[3] = 0x34; //DSC OFF in combo with byte 5 Live data only seen 0x34
-			msg[4] = 0x00; // B01000000; // Brake warning B00001000;  //ABS warning
-			msg[5] = 0x40; // TCS in combo with byte 3
-			msg[6] = 0x00; // Unknown
-			msg[7] = 0x00; // Unused
-		}
+	msg[0] = magicByte[rollingId];
+	msg[1] = (int)(Sensor::getOrZero(SensorType::AcceleratorPedal) * 255 / 100);
 
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_STATUS_2);
-			auto clt = Sensor::get(SensorType::Clt);
-			msg[0] = (uint8_t)(clt.value_or(0) + 69); //temp gauge //~170 is red, ~165 last bar, 152 centre, 90 first bar, 92 second bar
-			// TODO: fixme!
-			//msg[1] = ((int16_t)(engine->engineState.vssEventCounter*(engineConfiguration->vehicleSpeedCoef*0.277*2.58))) & 0xff;
-			msg[2] = 0x00; // unknown
-			msg[3] = 0x00; //unknown
-			msg[4] = 0x01; //Oil Pressure (not really a gauge)
-			msg[5] = 0x00; //check engine light
-			msg[6] = 0x00; //Coolant, oil and battery
-			if ((Sensor::getOrZero(SensorType::Rpm)>0) && (Sensor::get(SensorType::BatteryVoltage).value_or(VBAT_FALLBACK_VALUE)<13)) {
-				msg.setBit(6, 6); // battery light
-			}
-			if (!clt.Valid || clt.Value > 105) {
-				// coolant light, 101 - red zone, light means its get too hot
-				// Also turn on the light in case of sensor failure
-				msg.setBit(6, 1);
-			}
-			//oil pressure warning lamp bit is 7
-			msg[7] = 0x00; //unused
-		}
-	}
+	// thank you "102 CAN Communication decoded"
+#define CAN_23D_RPM_MULT 3.15
+	int rpm315 = (int)(Sensor::getOrZero(SensorType::Rpm) / CAN_23D_RPM_MULT);
+	msg[3] = rpm315 & 0xFF;
+	msg[4] = rpm315 >> 8;
 
+	msg[7] = 0x70; // todo: CLT decoding?
 }
 
-void canDashboardFiat(CanCycle cycle) {
-	if (cycle.isInterval(CI::_50ms)) {
-		{
-			//Fiat Dashboard
-			CanTxMessage msg(CanCategory::NBC, CAN_FIAT_MOTOR_INFO);
-			msg.setShortValue((int) (Sensor::getOrZero(SensorType::Clt) - 40), 3); //Coolant Temp
-			msg.setShortValue(Sensor::getOrZero(SensorType::Rpm) / 32, 6); //RPM
-		}
-	}
+//Ebrake light
+static void sendE90Ebrake() {
+	CanTxMessage msg(CanCategory::OBD, E90_EBRAKE, 2);
+	msg[0] = 0xFD;
+	msg[1] = 0xFF;
 }
 
-void canDashboardVAG(CanCycle cycle) {
-	if (cycle.isInterval(CI::_10ms)) {
-		{
-			// https://github.com/commaai/opendbc/blob/57c8340a180dd8c75139b18050eb17c72c9cb6e4/vw_golf_mk4.dbc#L394
-			//VAG Dashboard
-			CanTxMessage msg(CanCategory::NBC, CAN_VAG_Motor_1);
-			msg.setShortValue(Sensor::getOrZero(SensorType::Rpm) * 4, 2); //RPM
-		}
-
-		float clt = Sensor::getOrZero(SensorType::Clt);
-
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_VAG_Motor_2);
-			msg.setShortValue((int) ((clt + 48.373) / 0.75), 1); //Coolant Temp
-		}
-
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_VAG_CLT_V2);
-			msg.setShortValue((int) ((clt + 48.373) / 0.75), 4); //Coolant Temp
-		}
-
-		{
-			CanTxMessage msg(CanCategory::NBC, CAN_VAG_IMMO);
-			msg.setShortValue(0x80, 1);
-		}
-	}
+static void sendE90Rpm() {
+	rpmcounter++;
+	if (rpmcounter > 0xFE)
+		rpmcounter = 0xF0;
+	CanTxMessage msg(CanCategory::OBD, E90_RPM, 3);
+	msg[0] = rpmcounter;
+	msg[1] = ((int)(Sensor::getOrZero(SensorType::Rpm)) * 4) & 0xFF;
+	msg[2] = ((int)(Sensor::getOrZero(SensorType::Rpm)) * 4) >> 8;
 }
 
-void canDashboardW202(CanCycle cycle) {
-	if (cycle.isInterval(CI::_20ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, W202_STAT_1);
-			uint16_t tmp = Sensor::getOrZero(SensorType::Rpm);
-			msg[0] = 0x08; // Unknown
-			msg[1] = (tmp >> 8); //RPM
-			msg[2] = (tmp & 0xff); //RPM
-			msg[3] = 0x00; // 0x01 - tank blink, 0x02 - EPC
-			msg[4] = 0x00; // Unknown
-			msg[5] = 0x00; // Unknown
-			msg[6] = 0x00; // Unknown - oil info
-			msg[7] = 0x00; // Unknown - oil info
-		}
-	}
-
-	if (cycle.isInterval(CI::_100ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, W202_STAT_2); //dlc 7
-			msg[0] = (int)(Sensor::getOrZero(SensorType::Clt) + 40); // CLT -40 offset
-			msg[1] = 0x3D; // TBD
-			msg[2] = 0x63; // Const
-			msg[3] = 0x41; // Const
-			msg[4] = 0x00; // Unknown
-			msg[5] = 0x05; // Const
-			msg[6] = 0x50; // TBD
-			msg[7] = 0x00; // Unknown
-		}
-	}
+//oil & coolant temp (all in C, despite gauge being F)
+static void sendE90Temp() {
+	tmp_cnt++;
+	if (tmp_cnt >= 0x0F)
+		tmp_cnt = 0x00;
+	CanTxMessage msg(CanCategory::OBD, E90_TEMP, 8);
+	msg[0] = (int)(Sensor::getOrZero(SensorType::Clt) + e90_temp_offset); //coolant
+	msg[1] = (int)(Sensor::getOrZero(SensorType::AuxTemp1) + e90_temp_offset); //oil (AuxTemp1)
+	msg[2] = tmp_cnt;
+	msg[3] = 0xC8;
+	msg[4] = 0xA7;
+	msg[5] = 0xD3;
+	msg[6] = 0x0D;
+	msg[7] = 0xA8;
+}
 
-	if (cycle.isInterval(CI::_200ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, W202_ALIVE);
-			msg[0] = 0x0A; // Const
-			msg[1] = 0x18; // Const
-			msg[2] = 0x00; // Const
-			msg[3] = 0x00; // Const
-			msg[4] = 0xC0; // Const
-			msg[5] = 0x00; // Const
-			msg[6] = 0x00; // Const
-			msg[7] = 0x00; // Const
-		}	
-
-		{
-			CanTxMessage msg(CanCategory::NBC, W202_STAT_3);
-			msg[0] = 0x00; // Const
-			msg[1] = 0x00; // Const
-			msg[2] = 0x6D; // TBD
-			msg[3] = 0x7B; // Const
-			msg[4] = 0x21; // TBD
-			msg[5] = 0x07; // Const
-			msg[6] = 0x33; // Const
-			msg[7] = 0x05; // Const
-		}
-	}
+static void sendE90SeatbeltCounter() {
+	seatbeltcnt++;
+	if (seatbeltcnt > 0xFE)
+		seatbeltcnt = 0x00;
+	CanTxMessage msg(CanCategory::NBC, E90_SEATBELT_COUNTER, 2);
+	msg[0] = seatbeltcnt;
+	msg[1] = 0xFF;
 }
 
-static int rollingId = 0;
+static void sendE90BrakeCounter() {
+	brakecnt_1 += 16;
+	brakecnt_2 += 16;
+	if (brakecnt_1 > 0xEF)
+		brakecnt_1 = 0x0F;
+	if (brakecnt_2 > 0xF0)
+		brakecnt_2 = 0xA0;
+	CanTxMessage msg(CanCategory::NBC, E90_BRAKE_COUNTER, 8);
+	msg[0] = 0x00;
+	msg[1] = 0xE0;
+	msg[2] = brakecnt_1;
+	msg[3] = 0xFC;
+	msg[4] = 0xFE;
+	msg[5] = 0x41;
+	msg[6] = 0x00;
+	msg[7] = brakecnt_2;
+}
 
-void canDashboardGenesisCoupe(CanCycle cycle) {
-	if (cycle.isInterval(CI::_50ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, GENESIS_COUPLE_RPM_316, 8);
-			int rpm8 = Sensor::getOrZero(SensorType::Rpm) * 4;
-			msg[3] = rpm8 >> 8;
-			msg[4] = rpm8 & 0xFF;
-		}
-		{
-			CanTxMessage msg(CanCategory::NBC, GENESIS_COUPLE_COOLANT_329, 8);
-			int clt = Sensor::getOrZero(SensorType::Clt) * 2;
-			msg[1] = clt;
-		}
-	}
+static void sendE90AbsCounter() {
+	abscounter++;
+	if (abscounter > 0xFE)
+		abscounter = 0xF0;
+	CanTxMessage msg(CanCategory::NBC, E90_ABS_COUNTER, 2);
+	msg[0] = abscounter;
+	msg[1] = 0xFF;
 }
 
-void canDashboardNissanVQ(CanCycle cycle) {
-	if (cycle.isInterval(CI::_50ms)) {
-		{
-			CanTxMessage msg(CanCategory::NBC, NISSAN_RPM_1F9, 8);
-			msg[0] = 0x20;
-			int rpm8 = (int)(Sensor::getOrZero(SensorType::Rpm) * 8);
-			msg[2] = rpm8 >> 8;
-			msg[3] = rpm8 & 0xFF;
-		}
+//Gear indicator/counter
+static void sendE90Gear() {
+	gear_cnt++;
+	if (gear_cnt >= 0x0F)
+		gear_cnt = 0x00;
+	CanTxMessage msg(CanCategory::NBC, E90_GEAR, 6);
+	msg[0] = 0x78;
+	msg[1] = 0x0F;
+	msg[2] = 0xFF;
+	msg[3] = (gear_cnt << 4) | 0xC;
+	msg[4] = 0xF1;
+	msg[5] = 0xFF;
+}
 
-		{
-			CanTxMessage msg(CanCategory::OBD, NISSAN_CLT_551, 8);
+static void sendE90Speed() {
+	auto vehicleSpeed = Sensor::getOrZero(SensorType::VehicleSpeed);
+	float mph = vehicleSpeed * 0.6213712;
+	mph_ctr = ((TIME_I2MS(chVTGetSystemTime()) - mph_timer) / 50);
+	mph_a = (mph_ctr * mph / 2);
+	mph_2a = mph_a + mph_last;
+	mph_last = mph_2a;
+	mph_counter += mph_ctr * 100;
+	if(mph_counter >= 0xFFF0)
+		mph_counter = 0xF000;
+	mph_timer = TIME_I2MS(chVTGetSystemTime());
+	CanTxMessage msg(CanCategory::NBC, E90_SPEED, 8);
+	msg[0] = mph_2a & 0xFF;
+	msg[1] = mph_2a >> 8;
+	msg[2] = mph_2a & 0xFF;
+	msg[3] = mph_2a >> 8;
+	msg[4] = mph_2a & 0xFF;
+	msg[5] = mph_2a >> 8;
+	msg[6] = mph_counter & 0xFF;
+	msg[7] = (mph_counter >> 8) | 0xF0;
+}
 
-			int clt = Sensor::getOrZero(SensorType::Clt);
-			msg[0] = clt + 45;
-		}
+// one shot, sets the cluster clock on the first slot after the dash is enabled
+static void sendE90Time() {
+	if (cluster_time_set) {
+		return;
+	}
 
+	struct tm timp;
+	date_get_tm(&timp);
+	CanTxMessage msg(CanCategory::NBC, E90_TIME, 8);
+	msg[0] = timp.tm_hour;
+	msg[1] = timp.tm_min;
+	msg[2] = timp.tm_sec;
+	msg[3] = timp.tm_mday;
+	msg[4] = (((timp.tm_mon + 1) << 4) | 0x0F);
+	msg[5] = (timp.tm_year + 1900) & 0xFF;
+	msg[6] = ((timp.tm_year + 1900) >> 8) | 0xF0;
+	msg[7] = 0xF2;
+	cluster_time_set = 1;
+}
 
-		{
-			CanTxMessage msg(CanCategory::NBC, NISSAN_RPM_CLT, 8);
+/**
+ * Declarative dash frame description: each signal is placed by DBC-style start bit, length and byte order,
+ * and scaled as physical = raw * scale + offset. Tables are constexpr and packers are instantiated per frame,
+ * so every signal compiles down to one getter call, one scaling and constant shifts.
+ */
+enum class CanByteOrder : uint8_t {
+	// little endian, start bit is the least significant bit
+	Intel,
+	// big endian, start bit is the most significant bit, DBC numbering
+	Motorola,
+};
 
-			rollingId = (rollingId + 1) % 4;
-			const uint8_t magicByte[4] = {0x03, 0x23, 0x42, 0x63};
+struct CanSignal {
+	uint8_t startBit;
+	uint8_t length;
+	CanByteOrder byteOrder;
+	bool isSigned;
+	float scale;
+	// precomputed 1 / scale, saves a division per signal
+	float invScale;
+	float offset;
+	float (*getValue)();
+};
 
-			msg[0] = magicByte[rollingId];
-			msg[1] = (int)(Sensor::getOrZero(SensorType::AcceleratorPedal) * 255 / 100);
+template <size_t TSignalCount>
+struct CanDashFrame {
+	uint32_t id;
+	uint8_t dlc;
+	CanSignal signals[TSignalCount];
+};
 
-			// thank you "102 CAN Communication decoded"
-#define CAN_23D_RPM_MULT 3.15
-			int rpm315 = (int)(Sensor::getOrZero(SensorType::Rpm) / CAN_23D_RPM_MULT);
-			msg[3] = rpm315 & 0xFF;
-			msg[4] = rpm315 >> 8;
+// DBC start bit of a Motorola signal whose most significant byte is 'byteIndex'
+static constexpr uint8_t motorolaStart(uint8_t byteIndex) {
+	return byteIndex * 8 + 7;
+}
 
-			msg[7] = 0x70; // todo: CLT decoding?
-		}
-	}
+static constexpr CanSignal be16(uint8_t byteIndex, float scale, float offset, float (*getValue)(), bool isSigned = false) {
+	return { motorolaStart(byteIndex), 16, CanByteOrder::Motorola, isSigned, scale, 1 / scale, offset, getValue };
 }
 
-/**
- * https://docs.google.com/spreadsheets/d/1XMfeGlhgl0lBL54lNtPdmmFd8gLr2T_YTriokb30kJg
- */
-void canDashboardVagMqb(CanCycle cycle) {
-	if (cycle.isInterval(CI::_50ms)) {
+static constexpr CanSignal le16(uint8_t byteIndex, float scale, float offset, float (*getValue)(), bool isSigned = false) {
+	return { (uint8_t)(byteIndex * 8), 16, CanByteOrder::Intel, isSigned, scale, 1 / scale, offset, getValue };
+}
 
-		{ // 'turn-on'
-			CanTxMessage msg(CanCategory::NBC, 0x3C0, 4);
-			// ignition ON
-			msg[2] = 3;
-		}
-	
-		{ //RPM
-			CanTxMessage msg(CanCategory::NBC, 0x107, 8);
-			msg[3] = ((int)(Sensor::getOrZero(SensorType::Rpm) / 3.5)) & 0xFF;
-			msg[4] = ((int)(Sensor::getOrZero(SensorType::Rpm) / 3.5)) >> 8;
-		}
-	}
+static constexpr CanSignal u8(uint8_t byteIndex, float scale, float offset, float (*getValue)()) {
+	return { (uint8_t)(byteIndex * 8), 8, CanByteOrder::Intel, false, scale, 1 / scale, offset, getValue };
 }
 
-void canDashboardBMWE90(CanCycle cycle)
-{
-
-	if (cycle.isInterval(CI::_50ms)) {
-		
-		{ //T15 'turn-on'
-			CanTxMessage msg(CanCategory::NBC, E90_T15, 5);
-			msg[0] = 0x45;
-			msg[1] = 0x41;
-			msg[2] = 0x61;
-			msg[3] = 0x8F;
-			msg[4] = 0xFC;			
-		}
+// byte the dash wants to see but which carries no data of ours
+static constexpr CanSignal constant8(uint8_t byteIndex, uint8_t value) {
+	return { (uint8_t)(byteIndex * 8), 8, CanByteOrder::Intel, false, 1, 1, -(float)value, nullptr };
+}
 
-		{ //Ebrake light
-			CanTxMessage msg(CanCategory::OBD, E90_EBRAKE, 2);
-			msg[0] = 0xFD;
-			msg[1] = 0xFF;
-		}
+static constexpr int32_t scaleSignal(const CanSignal& signal, float value) {
+	float raw = (value - signal.offset) * signal.invScale;
 
-		{ //RPM
-			rpmcounter++;
-			if (rpmcounter > 0xFE)
-				rpmcounter = 0xF0;
-			CanTxMessage msg(CanCategory::OBD, E90_RPM, 3);
-			msg[0] = rpmcounter;
-			msg[1] = ((int)(Sensor::getOrZero(SensorType::Rpm)) * 4) & 0xFF;
-			msg[2] = ((int)(Sensor::getOrZero(SensorType::Rpm)) * 4) >> 8;
-		}
+	// saturate rather than wrap, a pegged gauge is better than a gauge jumping back to zero
+	float maxRaw = signal.isSigned ? (1 << (signal.length - 1)) - 1 : (1 << signal.length) - 1;
+	float minRaw = signal.isSigned ? -(1 << (signal.length - 1)) : 0;
 
-		{ //oil & coolant temp (all in C, despite gauge being F)
-			tmp_cnt++;
-			if (tmp_cnt >= 0x0F)
-				tmp_cnt = 0x00;
-			CanTxMessage msg(CanCategory::OBD, E90_TEMP, 8);
-			msg[0] = (int)(Sensor::getOrZero(SensorType::Clt) + e90_temp_offset); //coolant
-			msg[1] = (int)(Sensor::getOrZero(SensorType::AuxTemp1) + e90_temp_offset); //oil (AuxTemp1)
-			msg[2] = tmp_cnt;
-			msg[3] = 0xC8;
-			msg[4] = 0xA7;
-			msg[5] = 0xD3;
-			msg[6] = 0x0D;
-			msg[7] = 0xA8;
-		}
+	// clamp while still float, NaN and out of range float to int conversion are undefined
+	if (!(raw > minRaw)) {
+		return minRaw;
+	} else if (raw > maxRaw) {
+		return maxRaw;
 	}
 
-	if (cycle.isInterval(CI::_100ms)) {
-		{
-			//Seatbelt counter
-			seatbeltcnt++;
-			if (seatbeltcnt > 0xFE)
-				seatbeltcnt = 0x00;
-			CanTxMessage msg(CanCategory::NBC, E90_SEATBELT_COUNTER, 2);
-			msg[0] = seatbeltcnt;
-			msg[1] = 0xFF;
-		}
-	
-		{
-			//Brake counter 100ms
-			brakecnt_1 += 16;
-			brakecnt_2 += 16;
-			if (brakecnt_1 > 0xEF)
-				brakecnt_1 = 0x0F;
-			if (brakecnt_2 > 0xF0)
-				brakecnt_2 = 0xA0;
-			CanTxMessage msg(CanCategory::NBC, E90_BRAKE_COUNTER, 8);
-			msg[0] = 0x00;
-			msg[1] = 0xE0;
-			msg[2] = brakecnt_1;
-			msg[3] = 0xFC;
-			msg[4] = 0xFE;
-			msg[5] = 0x41;
-			msg[6] = 0x00;
-			msg[7] = brakecnt_2;
-		}
-
-		{ //ABS counter
-			abscounter++;
-			if (abscounter > 0xFE)
-				abscounter = 0xF0;
-			CanTxMessage msg(CanCategory::NBC, E90_ABS_COUNTER, 2);
-			msg[0] = abscounter;
-			msg[1] = 0xFF;
-		}
+	// round to nearest: 1.000 at 0.001 scale must be 1000, not 999
+	return (int32_t)(raw >= 0 ? raw + 0.5f : raw - 0.5f);
+}
 
-		{ //Fuel gauge
-			CanTxMessage msg(CanCategory::NBC, E90_FUEL, 5); //fuel gauge
-			msg[0] = 0x76;
-			msg[1] = 0x0F;
-			msg[2] = 0xBE;
-			msg[3] = 0x1A;
-			msg[4] = 0x00;
+template <const auto& frame, size_t TIndex, typename TBuffer>
+static constexpr void packRaw(TBuffer& msg, uint32_t raw) {
+	constexpr const CanSignal& signal = frame.signals[TIndex];
+
+	if constexpr (signal.byteOrder == CanByteOrder::Motorola && signal.startBit % 8 == 7 && signal.length % 8 == 0) {
+		// byte aligned big endian: most significant byte first
+		constexpr size_t firstByte = signal.startBit / 8;
+		constexpr size_t byteCount = signal.length / 8;
+		for (size_t i = 0; i < byteCount; i++) {
+			msg[firstByte + i] = raw >> (8 * (byteCount - 1 - i));
+		}
+	} else if constexpr (signal.byteOrder == CanByteOrder::Intel && signal.startBit % 8 == 0 && signal.length % 8 == 0) {
+		// byte aligned little endian
+		constexpr size_t firstByte = signal.startBit / 8;
+		for (size_t i = 0; i < signal.length / 8; i++) {
+			msg[firstByte + i] = raw >> (8 * i);
+		}
+	} else {
+		// bit by bit from the least significant bit up
+		size_t bit = signal.startBit;
+		if (signal.byteOrder == CanByteOrder::Motorola) {
+			// Motorola start bit is the MSB, walk down to the LSB
+			for (size_t i = 1; i < signal.length; i++) {
+				bit = (bit % 8 == 0) ? bit + 15 : bit - 1;
+			}
 		}
 
-		{ //Gear indicator/counter
-			gear_cnt++;
-			if (gear_cnt >= 0x0F)
-				gear_cnt = 0x00;
-			CanTxMessage msg(CanCategory::NBC, E90_GEAR, 6);
-			msg[0] = 0x78;
-			msg[1] = 0x0F;
-			msg[2] = 0xFF;
-			msg[3] = (gear_cnt << 4) | 0xC;
-			msg[4] = 0xF1;
-			msg[5] = 0xFF;
-		}
+		for (size_t i = 0; i < signal.length; i++) {
+			uint8_t mask = 1 << (bit % 8);
+			if (raw & (1u << i)) {
+				msg[bit / 8] |= mask;
+			} else {
+				msg[bit / 8] &= ~mask;
+			}
 
-		{ //E90_SPEED
-			auto vehicleSpeed = Sensor::getOrZero(SensorType::VehicleSpeed); 
-			float mph = vehicleSpeed * 0.6213712;
-			mph_ctr = ((TIME_I2MS(chVTGetSystemTime()) - mph_timer) / 50);
-			mph_a = (mph_ctr * mph / 2);
-			mph_2a = mph_a + mph_last;
-			mph_last = mph_2a;
-			mph_counter += mph_ctr * 100;
-			if(mph_counter >= 0xFFF0)
-				mph_counter = 0xF000;
-			mph_timer = TIME_I2MS(chVTGetSystemTime());
-			CanTxMessage msg(CanCategory::NBC, E90_SPEED, 8);
-			msg[0] = mph_2a & 0xFF;
-			msg[1] = mph_2a >> 8;
-			msg[2] = mph_2a & 0xFF;
-			msg[3] = mph_2a >> 8;
-			msg[4] = mph_2a & 0xFF;
-			msg[5] = mph_2a >> 8;
-			msg[6] = mph_counter & 0xFF;
-			msg[7] = (mph_counter >> 8) | 0xF0;
+			if (signal.byteOrder == CanByteOrder::Intel) {
+				bit++;
+			} else {
+				bit = (bit % 8 == 7) ? bit - 15 : bit + 1;
+			}
 		}
 	}
+}
 
-	{
-		if (!cluster_time_set) {
-			struct tm timp;
-			date_get_tm(&timp);
-			CanTxMessage msg(CanCategory::NBC, E90_TIME, 8);
-			msg[0] = timp.tm_hour;
-			msg[1] = timp.tm_min;
-			msg[2] = timp.tm_sec;
-			msg[3] = timp.tm_mday;
-			msg[4] = (((timp.tm_mon + 1) << 4) | 0x0F);
-			msg[5] = (timp.tm_year + 1900) & 0xFF;
-			msg[6] = ((timp.tm_year + 1900) >> 8) | 0xF0;
-			msg[7] = 0xF2;
-			cluster_time_set = 1;
-		}
+template <const auto& frame, size_t TIndex>
+static void packSignal(CanTxMessage& msg) {
+	constexpr const CanSignal& signal = frame.signals[TIndex];
+	if constexpr (signal.getValue == nullptr) {
+		constexpr uint32_t raw = scaleSignal(signal, 0);
+		packRaw<frame, TIndex>(msg, raw);
+	} else {
+		packRaw<frame, TIndex>(msg, scaleSignal(signal, signal.getValue()));
 	}
 }
 
-void canDashboardHaltech(CanCycle cycle) {
-	
-	uint16_t tmp;
-
-	if (cycle.isInterval(CI::_20ms)) {
-		/* 0x360 - 50Hz rate */
-		{
-			CanTxMessage msg(CanCategory::NBC, 0x360, 8);
-			tmp = Sensor::getOrZero(SensorType::Rpm);
-			/* RPM */
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* MAP */
-			tmp = (((uint16_t)(Sensor::getOrZero(SensorType::Map))) * 10); 
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp & 0x00ff);
-			/* TPS  y = x/10 */
-			tmp = (uint16_t)((float)(Sensor::getOrZero(SensorType::Tps1)) * 10);
-			msg[4] = (tmp >> 8);
-			msg[5] = (tmp & 0x00ff);
-			/* Coolant pressure */
-			msg[6] = 0;
-			msg[7] = 0;
-		}
-
-		/* 0x361 - 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x361, 8);
-			/* Fuel pressure */
-			tmp =  (uint16_t)(Sensor::getOrZero(SensorType::FuelPressureLow));
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp&0x00ff);
-			/* Oil pressure */
-			tmp =  (uint16_t)(Sensor::getOrZero(SensorType::OilPressure));
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp & 0x00ff);
-			/* Engine Demand */
-			tmp =  (uint16_t)(Sensor::getOrZero(SensorType::Map));
-			msg[4] = (tmp >> 8);
-			msg[5] = (tmp & 0x00ff);
-			/* Wastegate Pressure */
-			msg[6] = 0;
-			msg[7] = 0;			
-		}
-
-		/* 0x362 - 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x362, 6);
-			/* Injection Stage 1 Duty Cycle - y = x/10 */
-			uint16_t rpm = Sensor::getOrZero(SensorType::Rpm);
-			tmp = (uint16_t)( getInjectorDutyCycle(rpm) * 10) ;
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* Injcetion Stage 2 Duty Cycle */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Ignition Angle (Leading) - y = x/10 */
-			float timing = engine->engineState.timingAdvance[0];
-			int16_t ignAngle = ((timing > 360 ? timing - 720 : timing) * 10);
-			msg[4] = (ignAngle >> 8);			
-			msg[5] = (ignAngle & 0x00ff);
-		}
-
-		/* todo: 0x3E5 = 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E5, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+// compile time packing of a single signal, for the golden byte checks below
+template <const auto& frame, size_t TIndex>
+static constexpr std::array<uint8_t, 8> packGolden(float value) {
+	std::array<uint8_t, 8> bytes{};
+	packRaw<frame, TIndex>(bytes, scaleSignal(frame.signals[TIndex], value));
+	return bytes;
+}
 
-		/* todo: 0x3EA = 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3EA, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
+template <size_t TCount>
+static constexpr bool isGolden(const std::array<uint8_t, 8>& bytes, const uint8_t (&expected)[TCount]) {
+	for (size_t i = 0; i < TCount; i++) {
+		if (bytes[i] != expected[i]) {
+			return false;
 		}
+	}
 
-		/* todo: 0x3EB = 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3EB, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+	return true;
+}
 
-		/* todo: 0x3EC = 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3EC, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+template <const auto& frame, size_t... TIndex>
+static void packFrame(CanTxMessage& msg, std::index_sequence<TIndex...>) {
+	(packSignal<frame, TIndex>(msg), ...);
+}
 
-		/* todo: 0x3ED = 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3ED, 2);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-		}
+template <const auto& frame>
+static void transmitDashFrame() {
+	CanTxMessage msg(CanCategory::NBC, frame.id, frame.dlc);
+	packFrame<frame>(msg, std::make_index_sequence<efi::size(frame.signals)>{});
+}
 
-		/* todo: 0x471 = 50Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x471, 2);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-		}
-	}
+// Frames we do not populate yet but the dash expects to see
+template <uint32_t TId, uint8_t TDlc>
+static void transmitZeroFrame() {
+	CanTxMessage msg(CanCategory::NBC, TId, TDlc);
+}
 
-	if (cycle.isInterval(CI::_50ms)) {
-	
-		/* 0x363 - 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x363, 4);
-			/* Wheel Slip */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Wheel Diff */
-			msg[2] = 0x00;
-			msg[3] = 0x00 ;
-		}
+/**
+ * Haltech, all values big endian
+ */
+static float haltechTimingAdvance() {
+	float timing = engine->engineState.timingAdvance[0];
+	return timing > 360 ? timing - 720 : timing;
+}
 
-		/* 0x368 - 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x368, 8);
-			/* Wideband Sensor 1 */
-			tmp =  (uint16_t)(Sensor::getOrZero(SensorType::Lambda1) * 1000);
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* Wideband Sensor 2 */
-			tmp =  (uint16_t)(Sensor::getOrZero(SensorType::Lambda2) * 1000);
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp & 0x00ff);
-			/* Wideband Sensor 3 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Wideband Sensor 4 */			
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+static constexpr CanDashFrame<3> haltech360 = { 0x360, 8, {
+	be16(0, 1, 0, []() { return Sensor::getOrZero(SensorType::Rpm); }),
+	be16(2, 0.1, 0, []() { return Sensor::getOrZero(SensorType::Map); }),
+	be16(4, 0.1, 0, []() { return Sensor::getOrZero(SensorType::Tps1); }),
+	// coolant pressure not sent
+}};
+
+static constexpr CanDashFrame<3> haltech361 = { 0x361, 8, {
+	be16(0, 1, 0, []() { return Sensor::getOrZero(SensorType::FuelPressureLow); }),
+	be16(2, 1, 0, []() { return Sensor::getOrZero(SensorType::OilPressure); }),
+	// engine demand
+	be16(4, 1, 0, []() { return Sensor::getOrZero(SensorType::Map); }),
+	// wastegate pressure not sent
+}};
+
+static constexpr CanDashFrame<2> haltech362 = { 0x362, 6, {
+	be16(0, 0.1, 0, []() { return getInjectorDutyCycle(Sensor::getOrZero(SensorType::Rpm)); }),
+	// injection stage 2 duty cycle not sent
+	// leading ignition angle
+	be16(4, 0.1, 0, haltechTimingAdvance, /*isSigned*/true),
+}};
+
+static constexpr CanDashFrame<2> haltech368 = { 0x368, 8, {
+	be16(0, 0.001, 0, []() { return Sensor::getOrZero(SensorType::Lambda1); }),
+	be16(2, 0.001, 0, []() { return Sensor::getOrZero(SensorType::Lambda2); }),
+	// wideband 3 and 4 not sent
+}};
 
 #if EFI_SHAFT_POSITION_INPUT
-		/* 0x369 - 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x369, 8);
-			/* Trigger System Error Count */
-			tmp = engine->triggerCentral.triggerState.totalTriggerErrorCounter;
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* Trigger Counter ?? */
-			tmp =  engine->triggerCentral.getHwEventCounter((int)SHAFT_PRIMARY_FALLING);
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp & 0x00ff);
-			/* unused */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Trigger Sync Level ?? */
-			msg[6] = 0x00;			
-			msg[7] = 0x00;
-		}
+static constexpr CanDashFrame<2> haltech369 = { 0x369, 8, {
+	// counters wrap at 16 bits, done here to not lose precision through float
+	be16(0, 1, 0, []() -> float { return engine->triggerCentral.triggerState.totalTriggerErrorCounter & 0xFFFF; }),
+	be16(2, 1, 0, []() -> float { return engine->triggerCentral.getHwEventCounter((int)SHAFT_PRIMARY_FALLING) & 0xFFFF; }),
+	// trigger sync level not sent
+}};
 #endif // EFI_SHAFT_POSITION_INPUT
 
-		/* 0x36A - 20Hz rate */
-		/* todo: one day we should split this */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x36A, 4);
-			/* Knock Level 1 */
-			tmp = (engine->outputChannels.knockLevel * 100);
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* Knock Level 2 */
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp * 0x00ff);
-		}
-
-		/* 0x36B - 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x36B, 8);
-			/* Break Pressure */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* NOS pressure Sensor 1 */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Turbo Speed Sensor 1 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Lateral G */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* 0x36C = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x36C, 8);
-			/* Wheel Speed Front Left */
-			auto vehicleSpeed = Sensor::getOrZero(SensorType::VehicleSpeed);
-			tmp = (vehicleSpeed * 10 );
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* Wheel Speed Front Right */
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp & 0x00ff);
-			/* Wheel Speed Read Left */
-			msg[4] = (tmp >> 8);
-			msg[5] = (tmp & 0x00ff);
-			/* Wheel Speed Read Right */
-			msg[6] = (tmp >> 8);
-			msg[7] = (tmp & 0x00ff);
-		}
-
-		/* 0x36D = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x36D, 8);
-			/* Unused */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Exhaust Cam Angle 1 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Exhaust Cam Angle 2 */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}	
-
-		/* 0x36E = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x36E, 8);
-			/* Engine Limiting Active 0 = off/1=on*/
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Launch Control Ignition Retard */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Launch Control Fuel Enrich */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Longitudinal G */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* 0x36F = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x36F, 4);
-			/* Generic Output 1 Duty Cycle */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Boost Control Output */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-		}
-
-		/* 0x370 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x370, 8);
-			/* Vehicle Speed */
-			auto vehicleSpeed = Sensor::getOrZero(SensorType::VehicleSpeed);
-			tmp = (vehicleSpeed * 10 );
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* unused */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Intake Cam Angle 1 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Intake Cam Angle 2 */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x3E6 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E6, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x3E7 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E7, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-	
-		/* todo: 0x3E8 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E8, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x3E9 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E9, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x3EE = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3EE, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x3EF = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3EF, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x470 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x470, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-
-		/* todo: 0x472 = 20Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x472, 8);
-			msg[0] = 0x00; 
-			msg[1] = 0x00;
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}		
-	}
+static float haltechKnockLevel() {
+	return engine->outputChannels.knockLevel;
+}
 
-	if (cycle.isInterval(CI::_100ms)) {
-		
-		/* 0x371 = 10Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x371, 4);
-			/* Fuel Flow */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Fuel Flow Return */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-		}
+// todo: one day we should split knock level per bank
+static constexpr CanDashFrame<2> haltech36A = { 0x36A, 4, {
+	be16(0, 0.01, 0, haltechKnockLevel),
+	be16(2, 0.01, 0, haltechKnockLevel),
+}};
 
-		/* 0x372 = 10Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x372, 8);
-			/* Battery Voltage */
-			tmp =  (uint16_t)(Sensor::getOrZero(SensorType::BatteryVoltage) * 10);
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* unused */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Target Boost Level todo */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Barometric pressure */
-			tmp = (uint16_t)(Sensor::getOrZero(SensorType::BarometricPressure) * 10);
-			msg[6] = (tmp >> 8);
-			msg[7] = (tmp & 0x00ff);
-		}
-	
-		/* 0x373 = 10Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x373, 8);
-			/* EGT1 */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* EGT2 */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* EGT3 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* EGT4 */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+static float haltechVehicleSpeed() {
+	return Sensor::getOrZero(SensorType::VehicleSpeed);
+}
 
-		/* 0x374 = 10Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x374, 8);
-			/* EGT5 */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* EGT6 */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* EGT7 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* EGT8 */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+// we only know vehicle speed, report it for all four wheels
+static constexpr CanDashFrame<4> haltech36C = { 0x36C, 8, {
+	be16(0, 0.1, 0, haltechVehicleSpeed),
+	be16(2, 0.1, 0, haltechVehicleSpeed),
+	be16(4, 0.1, 0, haltechVehicleSpeed),
+	be16(6, 0.1, 0, haltechVehicleSpeed),
+}};
+
+static constexpr CanDashFrame<1> haltech370 = { 0x370, 8, {
+	be16(0, 0.1, 0, haltechVehicleSpeed),
+	// intake cam angles not sent
+}};
+
+static constexpr CanDashFrame<2> haltech372 = { 0x372, 8, {
+	be16(0, 0.1, 0, []() { return Sensor::getOrZero(SensorType::BatteryVoltage); }),
+	// target boost level todo
+	be16(6, 0.1, 0, []() { return Sensor::getOrZero(SensorType::BarometricPressure); }),
+}};
+
+// temperatures are in Kelvin
+static constexpr CanDashFrame<2> haltech3E0 = { 0x3E0, 8, {
+	be16(0, 0.1, -273.15, []() { return Sensor::getOrZero(SensorType::Clt); }),
+	be16(2, 0.1, -273.15, []() { return Sensor::getOrZero(SensorType::Iat); }),
+	// fuel and oil temperature not sent
+}};
+
+// fuel level in liters
+static constexpr CanDashFrame<1> haltech3E2 = { 0x3E2, 2, {
+	be16(0, 0.1, 0, []() { return Sensor::getOrZero(SensorType::FuelLevel); }),
+}};
+
+// Golden bytes for the converted Haltech frames. These match the hand written packing for exact values,
+// otherwise the table rounds to nearest and saturates where the casts used to truncate and wrap.
+// MAP is now sent at its 0.1 kPa resolution, the hand written code sent whole kPa times ten.
+static_assert(isGolden(packGolden<haltech360, 0>(6500), { 0x19, 0x64 }));
+static_assert(isGolden(packGolden<haltech360, 0>(70000), { 0xFF, 0xFF }), "saturates instead of wrapping");
+static_assert(isGolden(packGolden<haltech360, 1>(1.3f), { 0, 0, 0x00, 0x0D }));
+static_assert(isGolden(packGolden<haltech360, 2>(99.9f), { 0, 0, 0, 0, 0x03, 0xE7 }));
+static_assert(isGolden(packGolden<haltech362, 1>(-10), { 0, 0, 0, 0, 0xFF, 0x9C }));
+static_assert(isGolden(packGolden<haltech362, 1>(35.5f), { 0, 0, 0, 0, 0x01, 0x63 }));
+static_assert(isGolden(packGolden<haltech368, 0>(1.0f), { 0x03, 0xE8 }));
+static_assert(isGolden(packGolden<haltech368, 1>(0.85f), { 0, 0, 0x03, 0x52 }));
+static_assert(isGolden(packGolden<haltech36A, 0>(0.29f), { 0x00, 0x1D }));
+static_assert(isGolden(packGolden<haltech372, 0>(13.8f), { 0x00, 0x8A }));
+static_assert(isGolden(packGolden<haltech3E0, 0>(86.85f), { 0x0E, 0x10 }));
+static_assert(isGolden(packGolden<haltech3E0, 1>(26.85f), { 0, 0, 0x0B, 0xB8 }));
+
+static float getDashRpm() {
+	return Sensor::getOrZero(SensorType::Rpm);
+}
 
-		/* 0x375 = 10Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x375, 8);
-			/* EGT9 */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* EGT10 */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* EGT11 */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* EGT12 */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+static float getDashClt() {
+	return Sensor::getOrZero(SensorType::Clt);
+}
 
-		/* 0x376 = 10Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x376, 8);
-			/* Ambient Air Temperature */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Relative Humidity */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Specific Humidity */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Absolute Humidity */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
-	}
+static float getDashVehicleSpeed() {
+	return Sensor::getOrZero(SensorType::VehicleSpeed);
+}
 
-	if (cycle.isInterval(CI::_200ms)) {
-		/* 0x3E0 = 5Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E0, 8);
-			/* Coolant temperature in K y = x/10 */
-			tmp = ((Sensor::getOrZero(SensorType::Clt) + 273.15) * 10);
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-			/* Air Temperature */
-			tmp = ((Sensor::getOrZero(SensorType::Iat) + 273.15) * 10);
-			msg[2] = (tmp >> 8);
-			msg[3] = (tmp & 0x00ff);
-			/* Fuel Temperature */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Oil Temperature */
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+/**
+ * BMW E46
+ * todo: we use 50ms fixed cycle, trace is needed to check for correct period
+ */
+static constexpr CanDashFrame<1> bmwSpeed = { CAN_BMW_E46_SPEED, 8, {
+	constant8(1, 10 * 8),
+}};
 
-		/* 0x3E1 = 5Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E1, 6);
-			/* Gearbox Oil Temperature */
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Diff oil Temperature */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Fuel Composition */
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-		}
+static constexpr CanDashFrame<1> bmwRpm = { CAN_BMW_E46_RPM, 8, {
+	le16(2, 1 / 6.4, 0, getDashRpm),
+}};
 
-		/* 0x3E2 = 5Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E2, 2);
-			/* Fuel Level in Liters */
-			tmp = (Sensor::getOrZero(SensorType::FuelLevel)* 10);
-			msg[0] = (tmp >> 8);
-			msg[1] = (tmp & 0x00ff);
-		}
+static constexpr CanDashFrame<1> bmwDme2 = { CAN_BMW_E46_DME2, 8, {
+	le16(1, 0.75, -48.373, getDashClt),
+}};
 
-		/* 0x3E3 = 5Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E3, 8);
-			/* Fuel Trim Short Term Bank 1*/
-			msg[0] = 0x00;
-			msg[1] = 0x00;
-			/* Fuel Trim Short Term Bank 2*/
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			/* Fuel Trim Long Term Bank 1*/
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			/* Fuel Trim Long Term Bank 2*/
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+/**
+ * Mazda RX8
+ * todo: we use 50ms fixed cycle, trace is needed to check for correct period
+ */
+static constexpr CanDashFrame<4> mazdaRpmSpeed = { CAN_MAZDA_RX_RPM_SPEED, 8, {
+	be16(0, 0.25, 0, getDashRpm),
+	constant8(2, 0xFF),
+	constant8(3, 0xFF),
+	be16(4, 0.01, -100, getDashVehicleSpeed),
+}};
+
+static constexpr CanDashFrame<5> mazdaStatus1 = { CAN_MAZDA_RX_STATUS_1, 8, {
+	// unknown
+	constant8(0, 0xFE),
+	constant8(1, 0xFE),
+	constant8(2, 0xFE),
+	// DSC OFF in combo with byte 5, live data only seen 0x34
+	constant8(3, 0x34),
+	// byte 4 brake warning 0x40, ABS warning 0x08
+	// TCS in combo with byte 3
+	constant8(5, 0x40),
+}};
+
+// Fiat
+static constexpr CanDashFrame<2> fiatMotorInfo = { CAN_FIAT_MOTOR_INFO, 8, {
+	le16(3, 1, 40, getDashClt),
+	le16(6, 32, 0, getDashRpm),
+}};
 
-		/* todo: 0x3E4 = 5Hz rate */
-		{ 
-			CanTxMessage msg(CanCategory::NBC, 0x3E4, 8);
-			msg[0] = 0x00; //unused
-			/* Switch status */
-			msg[1] = 0x00;
-			/* Switch status */
-			msg[2] = 0x00;
-			msg[3] = 0x00;
-			msg[4] = 0x00;
-			msg[5] = 0x00;
-			msg[6] = 0x00;
-			msg[7] = 0x00;
-		}
+/**
+ * VAG
+ * https://github.com/commaai/opendbc/blob/57c8340a180dd8c75139b18050eb17c72c9cb6e4/vw_golf_mk4.dbc#L394
+ */
+static constexpr CanDashFrame<1> vagMotor1 = { CAN_VAG_Motor_1, 8, {
+	le16(2, 0.25, 0, getDashRpm),
+}};
+
+static constexpr CanDashFrame<1> vagMotor2 = { CAN_VAG_Motor_2, 8, {
+	le16(1, 0.75, -48.373, getDashClt),
+}};
+
+static constexpr CanDashFrame<1> vagCltV2 = { CAN_VAG_CLT_V2, 8, {
+	le16(4, 0.75, -48.373, getDashClt),
+}};
+
+static constexpr CanDashFrame<1> vagImmo = { CAN_VAG_IMMO, 8, {
+	constant8(1, 0x80),
+}};
+
+// Mercedes W202
+static constexpr CanDashFrame<2> w202Stat1 = { W202_STAT_1, 8, {
+	// unknown
+	constant8(0, 0x08),
+	be16(1, 1, 0, getDashRpm),
+	// byte 3: 0x01 tank blink, 0x02 EPC, bytes 6 and 7 oil info
+}};
+
+static constexpr CanDashFrame<6> w202Stat2 = { W202_STAT_2, 8, {
+	u8(0, 1, -40, getDashClt),
+	// 1 and 6 TBD, the rest constant
+	constant8(1, 0x3D),
+	constant8(2, 0x63),
+	constant8(3, 0x41),
+	constant8(5, 0x05),
+	constant8(6, 0x50),
+}};
+
+static constexpr CanDashFrame<3> w202Alive = { W202_ALIVE, 8, {
+	constant8(0, 0x0A),
+	constant8(1, 0x18),
+	constant8(4, 0xC0),
+}};
+
+static constexpr CanDashFrame<6> w202Stat3 = { W202_STAT_3, 8, {
+	// 2 and 4 TBD, the rest constant
+	constant8(2, 0x6D),
+	constant8(3, 0x7B),
+	constant8(4, 0x21),
+	constant8(5, 0x07),
+	constant8(6, 0x33),
+	constant8(7, 0x05),
+}};
+
+// Hyundai Genesis coupe
+static constexpr CanDashFrame<1> genesisRpm = { GENESIS_COUPLE_RPM_316, 8, {
+	be16(3, 0.25, 0, getDashRpm),
+}};
+
+static constexpr CanDashFrame<1> genesisCoolant = { GENESIS_COUPLE_COOLANT_329, 8, {
+	u8(1, 0.5, 0, getDashClt),
+}};
+
+// Nissan
+static constexpr CanDashFrame<2> nissanRpm = { NISSAN_RPM_1F9, 8, {
+	constant8(0, 0x20),
+	be16(2, 0.125, 0, getDashRpm),
+}};
 
-	}
-}
+/**
+ * VAG MQB
+ * https://docs.google.com/spreadsheets/d/1XMfeGlhgl0lBL54lNtPdmmFd8gLr2T_YTriokb30kJg
+ */
+static constexpr CanDashFrame<1> mqbTurnOn = { 0x3C0, 4, {
+	// ignition ON
+	constant8(2, 3),
+}};
+
+static constexpr CanDashFrame<1> mqbRpm = { 0x107, 8, {
+	le16(3, 3.5, 0, getDashRpm),
+}};
+
+// BMW E90, T15 'turn-on'
+static constexpr CanDashFrame<5> e90T15 = { E90_T15, 5, {
+	constant8(0, 0x45),
+	constant8(1, 0x41),
+	constant8(2, 0x61),
+	constant8(3, 0x8F),
+	constant8(4, 0xFC),
+}};
+
+// fuel gauge
+static constexpr CanDashFrame<4> e90Fuel = { E90_FUEL, 5, {
+	constant8(0, 0x76),
+	constant8(1, 0x0F),
+	constant8(2, 0xBE),
+	constant8(3, 0x1A),
+}};
+
+// golden bytes for the other converted dashes, exact values pack as the hand written code did
+static_assert(isGolden(packGolden<bmwSpeed, 0>(0), { 0, 0x50, 0 }));
+static_assert(isGolden(packGolden<bmwRpm, 0>(2000), { 0, 0, 0x00, 0x32 }));
+static_assert(isGolden(packGolden<bmwDme2, 0>(90), { 0, 0xB8, 0x00 }));
+static_assert(isGolden(packGolden<mazdaRpmSpeed, 0>(3000), { 0x2E, 0xE0 }));
+static_assert(isGolden(packGolden<mazdaRpmSpeed, 3>(50), { 0, 0, 0, 0, 0x3A, 0x98 }));
+static_assert(isGolden(packGolden<fiatMotorInfo, 0>(90), { 0, 0, 0, 0x32, 0x00 }));
+static_assert(isGolden(packGolden<fiatMotorInfo, 1>(3200), { 0, 0, 0, 0, 0, 0, 0x64, 0x00 }));
+static_assert(isGolden(packGolden<vagMotor1, 0>(3000), { 0, 0, 0xE0, 0x2E }));
+static_assert(isGolden(packGolden<vagCltV2, 0>(90), { 0, 0, 0, 0, 0xB8, 0x00 }));
+static_assert(isGolden(packGolden<w202Stat1, 1>(800), { 0, 0x03, 0x20 }));
+static_assert(isGolden(packGolden<w202Stat2, 0>(90), { 0x82 }));
+static_assert(isGolden(packGolden<genesisRpm, 0>(1000), { 0, 0, 0, 0x0F, 0xA0 }));
+static_assert(isGolden(packGolden<genesisCoolant, 0>(90), { 0, 0xB4 }));
+static_assert(isGolden(packGolden<nissanRpm, 1>(1000), { 0, 0, 0x1F, 0x40 }));
+static_assert(isGolden(packGolden<mqbRpm, 0>(3500), { 0, 0, 0, 0xE8, 0x03 }));
 
 //Based on AIM can protocol
 //https://www.aimtechnologies.com/support/racingecu/AiM_CAN_101_eng.pdf
@@ -1277,27 +861,189 @@ static void populateFrame(Aim5f7& msg) {
 	msg.LambdaTarget2 = (float)engine->fuelComputer->targetLambda;
 }
 
-void canDashboardAim(CanCycle cycle) {
-	if (!cycle.isInterval(CI::_10ms)) {
+template <typename TData, uint32_t TId>
+static void transmitAimFrame() {
+	transmitStruct<TData>(CanCategory::NBC, TId, false);
+}
+
+/**
+ * Every dash message with its own period. Each one is a CAN TX slot, messages of the same dash
+ * and period are spread over that period rather than all going out in the same TX cycle.
+ */
+struct CanDashMessage {
+	can_nbc_e type;
+	uint16_t periodMs;
+	void (*send)();
+};
+
+static const CanDashMessage dashMessages[] = {
+	{ CAN_BUS_NBC_BMW, 50, transmitDashFrame<bmwSpeed> },
+	{ CAN_BUS_NBC_BMW, 50, transmitDashFrame<bmwRpm> },
+	{ CAN_BUS_NBC_BMW, 50, transmitDashFrame<bmwDme2> },
+
+	{ CAN_BUS_MAZDA_RX8, 50, transmitZeroFrame<CAN_MAZDA_RX_STEERING_WARNING, 8> },
+	{ CAN_BUS_MAZDA_RX8, 50, transmitDashFrame<mazdaRpmSpeed> },
+	{ CAN_BUS_MAZDA_RX8, 50, transmitDashFrame<mazdaStatus1> },
+	{ CAN_BUS_MAZDA_RX8, 50, sendMazdaStatus2 },
+
+	{ CAN_BUS_NBC_FIAT, 50, transmitDashFrame<fiatMotorInfo> },
+
+	{ CAN_BUS_NBC_VAG, 10, transmitDashFrame<vagMotor1> },
+	{ CAN_BUS_NBC_VAG, 10, transmitDashFrame<vagMotor2> },
+	{ CAN_BUS_NBC_VAG, 10, transmitDashFrame<vagCltV2> },
+	{ CAN_BUS_NBC_VAG, 10, transmitDashFrame<vagImmo> },
+
+	{ CAN_BUS_W202_C180, 20, transmitDashFrame<w202Stat1> },
+	{ CAN_BUS_W202_C180, 100, transmitDashFrame<w202Stat2> },
+	{ CAN_BUS_W202_C180, 200, transmitDashFrame<w202Alive> },
+	{ CAN_BUS_W202_C180, 200, transmitDashFrame<w202Stat3> },
+
+	{ CAN_BUS_GENESIS_COUPE, 50, transmitDashFrame<genesisRpm> },
+	{ CAN_BUS_GENESIS_COUPE, 50, transmitDashFrame<genesisCoolant> },
+
+	{ CAN_BUS_NISSAN_VQ, 50, transmitDashFrame<nissanRpm> },
+	{ CAN_BUS_NISSAN_VQ, 50, sendNissanClt },
+	{ CAN_BUS_NISSAN_VQ, 50, sendNissanRpmClt },
+
+	{ CAN_BUS_MQB, 50, transmitDashFrame<mqbTurnOn> },
+	{ CAN_BUS_MQB, 50, transmitDashFrame<mqbRpm> },
+
+	{ CAN_BUS_BMW_E90, 50, transmitDashFrame<e90T15> },
+	{ CAN_BUS_BMW_E90, 50, sendE90Ebrake },
+	{ CAN_BUS_BMW_E90, 50, sendE90Rpm },
+	{ CAN_BUS_BMW_E90, 50, sendE90Temp },
+	{ CAN_BUS_BMW_E90, 100, sendE90SeatbeltCounter },
+	{ CAN_BUS_BMW_E90, 100, sendE90BrakeCounter },
+	{ CAN_BUS_BMW_E90, 100, sendE90AbsCounter },
+	{ CAN_BUS_BMW_E90, 100, transmitDashFrame<e90Fuel> },
+	{ CAN_BUS_BMW_E90, 100, sendE90Gear },
+	{ CAN_BUS_BMW_E90, 100, sendE90Speed },
+	{ CAN_BUS_BMW_E90, 1000, sendE90Time },
+
+	// Haltech 50Hz
+	{ CAN_BUS_Haltech, 20, transmitDashFrame<haltech360> },
+	{ CAN_BUS_Haltech, 20, transmitDashFrame<haltech361> },
+	{ CAN_BUS_Haltech, 20, transmitDashFrame<haltech362> },
+	{ CAN_BUS_Haltech, 20, transmitZeroFrame<0x3E5, 8> },
+	{ CAN_BUS_Haltech, 20, transmitZeroFrame<0x3EA, 8> },
+	{ CAN_BUS_Haltech, 20, transmitZeroFrame<0x3EB, 8> },
+	{ CAN_BUS_Haltech, 20, transmitZeroFrame<0x3EC, 8> },
+	{ CAN_BUS_Haltech, 20, transmitZeroFrame<0x3ED, 2> },
+	{ CAN_BUS_Haltech, 20, transmitZeroFrame<0x471, 2> },
+	// Haltech 20Hz
+	{ CAN_BUS_Haltech, 50, transmitDashFrame<haltech368> },
+#if EFI_SHAFT_POSITION_INPUT
+	{ CAN_BUS_Haltech, 50, transmitDashFrame<haltech369> },
+#endif // EFI_SHAFT_POSITION_INPUT
+	{ CAN_BUS_Haltech, 50, transmitDashFrame<haltech36A> },
+	{ CAN_BUS_Haltech, 50, transmitDashFrame<haltech36C> },
+	{ CAN_BUS_Haltech, 50, transmitDashFrame<haltech370> },
+	// wheel slip, wheel diff
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x363, 4> },
+	// brake pressure, NOS pressure, turbo speed, lateral G
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x36B, 8> },
+	// exhaust cam angles
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x36D, 8> },
+	// limiter flags, launch control retard and enrichment, longitudinal G
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x36E, 8> },
+	// generic output duty, boost control output
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x36F, 4> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x3E6, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x3E7, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x3E8, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x3E9, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x3EE, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x3EF, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x470, 8> },
+	{ CAN_BUS_Haltech, 50, transmitZeroFrame<0x472, 8> },
+	// Haltech 10Hz
+	{ CAN_BUS_Haltech, 100, transmitDashFrame<haltech372> },
+	// fuel flow
+	{ CAN_BUS_Haltech, 100, transmitZeroFrame<0x371, 4> },
+	// EGT 1-12
+	{ CAN_BUS_Haltech, 100, transmitZeroFrame<0x373, 8> },
+	{ CAN_BUS_Haltech, 100, transmitZeroFrame<0x374, 8> },
+	{ CAN_BUS_Haltech, 100, transmitZeroFrame<0x375, 8> },
+	// ambient air temperature, humidity
+	{ CAN_BUS_Haltech, 100, transmitZeroFrame<0x376, 8> },
+	// Haltech 5Hz
+	{ CAN_BUS_Haltech, 200, transmitDashFrame<haltech3E0> },
+	{ CAN_BUS_Haltech, 200, transmitDashFrame<haltech3E2> },
+	// gearbox oil, diff oil temperature, fuel composition
+	{ CAN_BUS_Haltech, 200, transmitZeroFrame<0x3E1, 6> },
+	// fuel trims
+	{ CAN_BUS_Haltech, 200, transmitZeroFrame<0x3E3, 8> },
+	// switch status
+	{ CAN_BUS_Haltech, 200, transmitZeroFrame<0x3E4, 8> },
+
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f0, 0x5f0> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f1, 0x5f1> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f2, 0x5f2> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f3, 0x5f3> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f4, 0x5f4> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f5, 0x5f5> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f6, 0x5f6> },
+	{ CAN_AIM_DASH, 10, transmitAimFrame<Aim5f7, 0x5f7> },
+	// there are more, but less important for us
+	// Aim5f8 - Aim5fd
+};
+
+// keep in sync with getDashMessagePeriodMs/sendDashMessage, see initTxSlots
+extern const size_t canDashMessageCount = efi::size(dashMessages);
+
+// zero while the message does not belong to the configured dash
+int getDashMessagePeriodMs(size_t index) {
+	auto& message = dashMessages[index];
+	return engineConfiguration->canNbcType == message.type ? message.periodMs : 0;
+}
+
+void sendDashMessage(size_t index) {
+	dashMessages[index].send();
+}
+
+// position of the message among messages of the same dash and period
+void getDashMessagePhase(size_t index, uint8_t& phaseIndex, uint8_t& phaseCount) {
+	auto& message = dashMessages[index];
+
+	phaseIndex = 0;
+	phaseCount = 0;
+
+	for (size_t i = 0; i < efi::size(dashMessages); i++) {
+		auto& other = dashMessages[i];
+		if (other.type != message.type || other.periodMs != message.periodMs) {
+			continue;
+		}
+
+		if (i < index) {
+			phaseIndex++;
+		}
+		phaseCount++;
+	}
+}
+
+/**
+ * Messages only go out for a dash that has table entries, complain once per configuration change otherwise
+ */
+void checkDashType() {
+	static can_nbc_e checkedType = CAN_BUS_NBC_NONE;
+
+	auto type = engineConfiguration->canNbcType;
+	if (type == checkedType) {
 		return;
 	}
+	checkedType = type;
 
-	transmitStruct<Aim5f0>(CanCategory::NBC, 0x5f0, false);
-	transmitStruct<Aim5f1>(CanCategory::NBC, 0x5f1, false);
-	transmitStruct<Aim5f2>(CanCategory::NBC, 0x5f2, false);
-	transmitStruct<Aim5f3>(CanCategory::NBC, 0x5f3, false);
-	transmitStruct<Aim5f4>(CanCategory::NBC, 0x5f4, false);
-	transmitStruct<Aim5f5>(CanCategory::NBC, 0x5f5, false);
-	transmitStruct<Aim5f6>(CanCategory::NBC, 0x5f6, false);
-	transmitStruct<Aim5f7>(CanCategory::NBC, 0x5f7, false);
+	if (type == CAN_BUS_NBC_NONE) {
+		return;
+	}
 
-	// there are more, but less important for us
-	// transmitStruct<Aim5f8>(0x5f8, false);
-	// transmitStruct<Aim5f9>(0x5f9, false);
-	// transmitStruct<Aim5fa>(0x5fa, false);
-	// transmitStruct<Aim5fb>(0x5fb, false);
-	// transmitStruct<Aim5fc>(0x5fc, false);
-	// transmitStruct<Aim5fd>(0x5fd, false);
+	for (size_t i = 0; i < efi::size(dashMessages); i++) {
+		if (dashMessages[i].type == type) {
+			return;
+		}
+	}
+
+	firmwareError(OBD_PCM_Processor_Fault, "Nothing for canNbcType %s", getCan_nbc_e(type));
 }
 
 #endif // EFI_CAN_SUPPORT
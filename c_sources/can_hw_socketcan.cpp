@@ -0,0 +1,381 @@
+/**
+ * @file	can_hw_socketcan.cpp
+ *
+ * Simulator CAN low level driver on top of Linux SocketCAN.
+ *
+ * Each simulated CAN bus is bound to a host network interface, by default vcan0, vcan1...
+ * Create those with
+ *   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+ * after which candump, cangen, canplayer and friends can talk to the simulator.
+ *
+ * Interface names can be overridden with RUSEFI_CAN1_IFACE, RUSEFI_CAN2_IFACE... environment variables.
+ *
+ * Like the simulator serial driver, sockets are polled from _sim_check_for_interrupts()
+ * so that blocking host calls never stall the ChibiOS scheduler.
+ */
+
+#include "pch.h"
+
+#if EFI_SIMULATOR && HAL_USE_CAN
+
+#include "can_bus_load.h"
+#include "can_tasks.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#ifndef SIM_CAN_BUS_COUNT
+#define SIM_CAN_BUS_COUNT 2
+#endif
+
+#if SIM_CAN_BUS_COUNT < 1 || SIM_CAN_BUS_COUNT > 3
+#error SIM_CAN_BUS_COUNT has to be between 1 and 3
+#endif
+
+// frames received from the socket but not yet picked up by the CAN RX thread
+#define SOCKET_CAN_RX_QUEUE_SIZE 64
+
+CANDriver CAND1;
+#if SIM_CAN_BUS_COUNT > 1
+CANDriver CAND2;
+#endif
+#if SIM_CAN_BUS_COUNT > 2
+CANDriver CAND3;
+#endif
+
+struct SocketCanRxEntry {
+	CANRxFrame frame;
+	// host kernel receive time, becomes the frame arrival time for CAN RX listeners
+	uint64_t timestampUs;
+};
+
+struct SocketCanBus {
+	CANDriver* driver;
+	char interfaceName[IFNAMSIZ];
+	int sock = -1;
+
+	SocketCanRxEntry rxQueue[SOCKET_CAN_RX_QUEUE_SIZE];
+	size_t rxHead;
+	size_t rxTail;
+
+	uint64_t lastRxTimestampUs;
+	uint32_t maxRxGapUs;
+
+	uint32_t rxCounter;
+	uint32_t txCounter;
+	uint32_t rxOverflowCounter;
+	uint32_t txDropCounter;
+};
+
+static SocketCanBus socketCanBuses[SIM_CAN_BUS_COUNT];
+
+static SocketCanBus* getBus(CANDriver* canp) {
+	for (size_t i = 0; i < SIM_CAN_BUS_COUNT; i++) {
+		if (socketCanBuses[i].driver == canp) {
+			return &socketCanBuses[i];
+		}
+	}
+
+	return nullptr;
+}
+
+static bool isRxQueueEmpty(const SocketCanBus& bus) {
+	return bus.rxHead == bus.rxTail;
+}
+
+static uint64_t toMicroseconds(const struct timeval& tv) {
+	return (uint64_t)tv.tv_sec * 1'000'000 + tv.tv_usec;
+}
+
+static void closeSocket(SocketCanBus& bus) {
+	if (bus.sock >= 0) {
+		close(bus.sock);
+		bus.sock = -1;
+	}
+}
+
+static bool openSocket(SocketCanBus& bus) {
+	int sock = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (sock < 0) {
+		efiPrintf("SocketCAN: unable to create socket: %s", strerror(errno));
+		return false;
+	}
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, bus.interfaceName, IFNAMSIZ - 1);
+	if (ioctl(sock, SIOCGIFINDEX, &ifr) < 0) {
+		efiPrintf("SocketCAN: no interface %s: %s", bus.interfaceName, strerror(errno));
+		close(sock);
+		return false;
+	}
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		efiPrintf("SocketCAN: unable to bind %s: %s", bus.interfaceName, strerror(errno));
+		close(sock);
+		return false;
+	}
+
+	int enable = 1;
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable));
+
+	// never block the simulator
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+	bus.sock = sock;
+	return true;
+}
+
+/**
+ * Drain the socket into the RX queue.
+ * @return true if at least one frame was received
+ */
+static bool pollSocket(SocketCanBus& bus) {
+	if (bus.sock < 0) {
+		return false;
+	}
+
+	bool hasReceived = false;
+
+	while (true) {
+		struct can_frame raw;
+		struct iovec iov = { &raw, sizeof(raw) };
+		char control[CMSG_SPACE(sizeof(struct timeval))];
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t size = recvmsg(bus.sock, &msg, MSG_DONTWAIT);
+		if (size < (ssize_t)sizeof(raw)) {
+			// EAGAIN, or a truncated frame we can't make sense of
+			break;
+		}
+
+		if (raw.can_id & CAN_ERR_FLAG) {
+			continue;
+		}
+
+		struct timeval tv;
+		gettimeofday(&tv, nullptr);
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMP) {
+				memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			}
+		}
+
+		size_t nextHead = (bus.rxHead + 1) % SOCKET_CAN_RX_QUEUE_SIZE;
+		if (nextHead == bus.rxTail) {
+			// same as hardware FIFO overrun: newest frame is lost
+			bus.rxOverflowCounter++;
+			continue;
+		}
+
+		auto& entry = bus.rxQueue[bus.rxHead];
+		memset(&entry.frame, 0, sizeof(entry.frame));
+		if (raw.can_id & CAN_EFF_FLAG) {
+			entry.frame.IDE = CAN_IDE_EXT;
+			entry.frame.EID = raw.can_id & CAN_EFF_MASK;
+		} else {
+			entry.frame.IDE = CAN_IDE_STD;
+			entry.frame.SID = raw.can_id & CAN_SFF_MASK;
+		}
+		entry.frame.RTR = (raw.can_id & CAN_RTR_FLAG) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+		entry.frame.DLC = minI(raw.can_dlc, 8);
+		memcpy(entry.frame.data8, raw.data, entry.frame.DLC);
+		entry.timestampUs = toMicroseconds(tv);
+
+		bus.rxHead = nextHead;
+		bus.rxCounter++;
+		hasReceived = true;
+	}
+
+	return hasReceived;
+}
+
+static void showSocketCanInfo();
+
+extern "C" {
+
+void can_lld_init(void) {
+	static const char* const defaultNames[] = { "vcan0", "vcan1", "vcan2" };
+	static const char* const environmentNames[] = { "RUSEFI_CAN1_IFACE", "RUSEFI_CAN2_IFACE", "RUSEFI_CAN3_IFACE" };
+	CANDriver* const drivers[] = {
+		&CAND1,
+#if SIM_CAN_BUS_COUNT > 1
+		&CAND2,
+#endif
+#if SIM_CAN_BUS_COUNT > 2
+		&CAND3,
+#endif
+	};
+
+	for (size_t i = 0; i < SIM_CAN_BUS_COUNT; i++) {
+		auto& bus = socketCanBuses[i];
+		canObjectInit(drivers[i]);
+		bus.driver = drivers[i];
+
+		const char* name = getenv(environmentNames[i]);
+		strncpy(bus.interfaceName, name ? name : defaultNames[i], IFNAMSIZ - 1);
+
+		// CanTxMessage only sends on the first two, a third interface is still worth accounting RX for
+		canBusLoadSetDevice(i, drivers[i]);
+	}
+
+	// invoked once from halInit()
+	addConsoleAction("socketcaninfo", showSocketCanInfo);
+}
+
+void can_lld_start(CANDriver* canp) {
+	SocketCanBus* bus = getBus(canp);
+	if (!bus) {
+		return;
+	}
+
+	bus->rxHead = bus->rxTail = 0;
+	bus->lastRxTimestampUs = 0;
+
+	// A missing interface is not fatal: the bus behaves as if nothing is connected
+	if (openSocket(*bus)) {
+		efiPrintf("SocketCAN: %s ready", bus->interfaceName);
+	}
+}
+
+void can_lld_stop(CANDriver* canp) {
+	SocketCanBus* bus = getBus(canp);
+	if (bus) {
+		closeSocket(*bus);
+	}
+}
+
+bool can_lld_is_tx_empty(CANDriver*, canmbx_t) {
+	// kernel socket buffer is the TX queue
+	return true;
+}
+
+void can_lld_abort(CANDriver*, canmbx_t) {
+}
+
+void can_lld_transmit(CANDriver* canp, canmbx_t, const CANTxFrame* ctfp) {
+	SocketCanBus* bus = getBus(canp);
+	if (!bus || bus->sock < 0) {
+		return;
+	}
+
+	struct can_frame raw;
+	memset(&raw, 0, sizeof(raw));
+	if (ctfp->IDE == CAN_IDE_EXT) {
+		raw.can_id = (ctfp->EID & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	} else {
+		raw.can_id = ctfp->SID & CAN_SFF_MASK;
+	}
+	if (ctfp->RTR == CAN_RTR_REMOTE) {
+		raw.can_id |= CAN_RTR_FLAG;
+	}
+	raw.can_dlc = minI(ctfp->DLC, 8);
+	memcpy(raw.data, ctfp->data8, raw.can_dlc);
+
+	size_t busIndex = bus - socketCanBuses;
+
+	if (write(bus->sock, &raw, sizeof(raw)) != sizeof(raw)) {
+		// ENOBUFS when nobody drains a vcan interface fast enough
+		bus->txDropCounter++;
+		canBusLoadOnTxDrop(busIndex);
+		return;
+	}
+
+	// CanTxMessage counts the frame in canWriteOk, same as on hardware
+	bus->txCounter++;
+}
+
+bool can_lld_is_rx_nonempty(CANDriver* canp, canmbx_t) {
+	SocketCanBus* bus = getBus(canp);
+	return bus && !isRxQueueEmpty(*bus);
+}
+
+void can_lld_receive(CANDriver* canp, canmbx_t, CANRxFrame* crfp) {
+	SocketCanBus* bus = getBus(canp);
+	if (!bus || isRxQueueEmpty(*bus)) {
+		return;
+	}
+
+	auto& entry = bus->rxQueue[bus->rxTail];
+	*crfp = entry.frame;
+
+	if (bus->lastRxTimestampUs != 0) {
+		uint32_t gapUs = entry.timestampUs - bus->lastRxTimestampUs;
+		if (gapUs > bus->maxRxGapUs) {
+			bus->maxRxGapUs = gapUs;
+		}
+	}
+	bus->lastRxTimestampUs = entry.timestampUs;
+
+	// kernel time is wall clock: hand over how long ago the frame arrived, relative to the simulator clock
+	struct timeval tv;
+	gettimeofday(&tv, nullptr);
+	int64_t ageUs = (int64_t)(toMicroseconds(tv) - entry.timestampUs);
+	canRxSetArrivalNtI(bus - socketCanBuses, getTimeNowNt() - US2NT(ageUs > 0 ? ageUs : 0));
+
+	bus->rxTail = (bus->rxTail + 1) % SOCKET_CAN_RX_QUEUE_SIZE;
+}
+
+void can_lld_wakeup(CANDriver*) {
+}
+
+void can_lld_sleep(CANDriver*) {
+}
+
+/**
+ * Invoked from _sim_check_for_interrupts(), same as sd_lld_interrupt_pending()
+ * @return true if any driver got new frames
+ */
+bool can_lld_interrupt_pending(void) {
+	bool result = false;
+
+	for (size_t i = 0; i < SIM_CAN_BUS_COUNT; i++) {
+		auto& bus = socketCanBuses[i];
+		if (bus.driver->state != CAN_READY) {
+			continue;
+		}
+
+		if (pollSocket(bus)) {
+			CH_IRQ_PROLOGUE();
+			osalSysLockFromISR();
+			_can_rx_full_isr(bus.driver, CAN_MAILBOX_TO_MASK(1U));
+			osalSysUnlockFromISR();
+			CH_IRQ_EPILOGUE();
+			result = true;
+		}
+	}
+
+	return result;
+}
+
+} // extern "C"
+
+static void showSocketCanInfo() {
+	for (size_t i = 0; i < SIM_CAN_BUS_COUNT; i++) {
+		auto& bus = socketCanBuses[i];
+		efiPrintf("CAN%d on %s: %s", (int)(i + 1), bus.interfaceName, bus.sock >= 0 ? "open" : "not available");
+		efiPrintf("  RX %d TX %d, RX overflow %d, TX dropped %d, max RX gap %dus",
+				bus.rxCounter, bus.txCounter, bus.rxOverflowCounter, bus.txDropCounter, bus.maxRxGapUs);
+	}
+}
+
+#endif // EFI_SIMULATOR && HAL_USE_CAN
@@ -54,6 +54,8 @@ bool acceptCanRx(int /*sid*/) {
 #if EFI_CAN_SUPPORT
 
 #include "can.h"
+#include "can_bus_load.h"
+#include "can_tasks.h"
 #include "obd2.h"
 #include "can_sensor.h"
 #include "can_vss.h"
@@ -74,7 +76,7 @@ static void printPacket(const size_t busIndex, const CANRxFrame &rx) {
 
 	// internet people use both hex and decimal to discuss packed IDs, for usability it's better to print both right here
 	efiPrintf("CAN RX bus %d ID %x(%d) DLC %d: %02x %02x %02x %02x %02x %02x %02x %02x",
-			busIndex,
+			(int)busIndex,
 			id,	id, // once in hex, once in dec
 			rx.DLC,
 			rx.data8[0], rx.data8[1], rx.data8[2], rx.data8[3],
@@ -84,26 +86,332 @@ static void printPacket(const size_t busIndex, const CANRxFrame &rx) {
 
 volatile float canMap = 0;
 
+// full list of listeners, TX side walks it to call request()
 CanListener *canListeners_head = nullptr;
 
+// inter-arrival mean follows a new rate within about this many frames
+#define CAN_RX_INTERVAL_MEAN_WINDOW 8
+
+struct CanListenerSlot {
+	uint32_t id;
+	CanListener* listener;
+	uint32_t hits;
+
+	// inter-arrival statistics, timestamps as captured on frame reception
+	efitick_t lastRxNt;
+	efitick_t maxIntervalNt;
+	// exponential mean over the last few intervals, follows a sender which changes its rate
+	efitick_t meanIntervalNt;
+	uint32_t intervalCount;
+
+	// set where frames on this ID carry the value of a sensor registered through registerCanSensor()
+	CanSensorBase* sensor;
+
+	// timestamps are 64 bit and read from other threads, always called with canListenersMutex held
+	void onFrame(efitick_t rxNt) {
+		hits++;
+
+		if (lastRxNt != 0) {
+			efitick_t interval = rxNt - lastRxNt;
+			if (interval > maxIntervalNt) {
+				maxIntervalNt = interval;
+			}
+			if (intervalCount == 0) {
+				meanIntervalNt = interval;
+			} else {
+				meanIntervalNt += (interval - meanIntervalNt) / CAN_RX_INTERVAL_MEAN_WINDOW;
+			}
+			if (intervalCount < UINT32_MAX) {
+				intervalCount++;
+			}
+		}
+
+		lastRxNt = rxNt;
+	}
+};
+
+/**
+ * Guards both tables below and the statistics in them. Registration shifts the sorted table while RX threads
+ * search it, so dispatch holds the mutex for the whole frame, one lock per frame rather than one per slot.
+ * A mutex and not the system lock: listeners decode under it and interrupts stay enabled.
+ */
+static MUTEX_DECL(canListenersMutex);
+
+/**
+ * One slot per listener and ID, sorted by ID so that each received frame costs a binary search instead
+ * of a walk over every listener. Listeners spread over several IDs have a slot for each of them.
+ */
+static constexpr size_t maxExactListeners = 64;
+static CanListenerSlot exactListeners[maxExactListeners];
+static size_t exactListenerCount = 0;
+
+/**
+ * Listeners registered with ID zero override acceptFrame() with their own logic and get every frame.
+ */
+static constexpr size_t maxCatchAllListeners = 4;
+static CanListenerSlot catchAllListeners[maxCatchAllListeners];
+static size_t catchAllListenerCount = 0;
+
+// index of the first exact slot with ID not less than 'id'
+static size_t lowerBoundExact(uint32_t id) {
+	size_t lo = 0;
+	size_t hi = exactListenerCount;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (exactListeners[mid].id < id) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * @param nowNt reception timestamp of the frame, listeners see the same value
+ */
 void serviceCanSubscribers(const CANRxFrame &frame, efitick_t nowNt) {
-	CanListener *current = canListeners_head;
+	uint32_t id = CAN_ID(frame);
 
-	while (current) {
-		current = current->processFrame(frame, nowNt);
+	chMtxLock(&canListenersMutex);
+
+	for (size_t i = lowerBoundExact(id); i < exactListenerCount && exactListeners[i].id == id; i++) {
+		auto& slot = exactListeners[i];
+		slot.onFrame(nowNt);
+		// acceptFrame() still has the final word, some listeners also check DLC or payload
+		slot.listener->processFrame(frame, nowNt);
+	}
+
+	for (size_t i = 0; i < catchAllListenerCount; i++) {
+		auto& slot = catchAllListeners[i];
+		// interval between any two frames on the bus, still shows RX thread latency
+		slot.onFrame(nowNt);
+		slot.listener->processFrame(frame, nowNt);
 	}
+
+	chMtxUnlock(&canListenersMutex);
 }
 
-void registerCanListener(CanListener& listener) {
+static void addToListenerList(CanListener& listener) {
 	listener.setNext(canListeners_head);
 	canListeners_head = &listener;
 }
 
+// caller holds canListenersMutex and has checked the capacity
+static void insertExactSlot(CanListener& listener, uint32_t id, CanSensorBase* sensor) {
+	// insert after any listeners with the same ID, keeps registration order among them
+	size_t pos = lowerBoundExact(id + 1);
+	for (size_t i = exactListenerCount; i > pos; i--) {
+		exactListeners[i] = exactListeners[i - 1];
+	}
+	exactListeners[pos] = { id, &listener, 0, 0, 0, 0, 0, sensor };
+	exactListenerCount++;
+}
+
+/**
+ * @param ids every ID the listener decodes, each gets its own slot and statistics. acceptFrame() still has
+ * the final word on each frame
+ * @param sensor set if frames on these IDs carry the sensor value, for sample age and staleness
+ * @param isListed false to add IDs to a listener which is already on the list
+ */
+static void registerCanListenerIds(CanListener& listener, const uint32_t* ids, size_t idCount,
+		CanSensorBase* sensor, bool isListed = false) {
+	// count is checked under the same lock as the insert, listeners may register from several threads
+	chMtxLock(&canListenersMutex);
+
+	bool isRegistered = exactListenerCount + idCount <= maxExactListeners;
+	if (isRegistered) {
+		for (size_t i = 0; i < idCount; i++) {
+			insertExactSlot(listener, ids[i], sensor);
+		}
+		if (!isListed) {
+			addToListenerList(listener);
+		}
+	}
+
+	chMtxUnlock(&canListenersMutex);
+
+	if (!isRegistered) {
+		firmwareError(OBD_PCM_Processor_Fault, "Too many CAN listeners");
+	}
+}
+
+static void registerCatchAllListener(CanListener& listener) {
+	chMtxLock(&canListenersMutex);
+
+	bool isRegistered = catchAllListenerCount < maxCatchAllListeners;
+	if (isRegistered) {
+		catchAllListeners[catchAllListenerCount++] = { 0, &listener, 0, 0, 0, 0, 0, nullptr };
+		addToListenerList(listener);
+	}
+
+	chMtxUnlock(&canListenersMutex);
+
+	if (!isRegistered) {
+		firmwareError(OBD_PCM_Processor_Fault, "Too many catch-all CAN listeners");
+	}
+}
+
+void registerCanListener(CanListener& listener) {
+	uint32_t id = listener.getId();
+
+	if (id == 0) {
+		// custom acceptFrame(), has to see everything
+		registerCatchAllListener(listener);
+		return;
+	}
+
+	registerCanListenerIds(listener, &id, 1, nullptr);
+}
+
+// copies the slot out by index, false once the table got shorter than that
+static bool copyCanListenerSlot(bool isCatchAll, size_t index, CanListenerSlot& slot) {
+	chMtxLock(&canListenersMutex);
+	bool isPresent = index < (isCatchAll ? catchAllListenerCount : exactListenerCount);
+	if (isPresent) {
+		slot = isCatchAll ? catchAllListeners[index] : exactListeners[index];
+	}
+	chMtxUnlock(&canListenersMutex);
+
+	return isPresent;
+}
+
+static void printCanListenerSlot(const char* kind, const CanListenerSlot& slot) {
+	efiPrintf("CAN listener %s ID %x%s hits %d interval mean %.2fms max %.2fms",
+			kind, (unsigned int)slot.id, slot.sensor ? " sensor" : "", (int)slot.hits,
+			NT2US(slot.meanIntervalNt) / 1000.0f, NT2US(slot.maxIntervalNt) / 1000.0f);
+}
+
+/**
+ * Time since the last frame was delivered to this listener, for CAN-fed sensors that is the sample age:
+ * the most recent frame on any of the IDs which carry the sensor value.
+ * Catch-all listeners (ID zero) are offered every frame, age of the sample they actually decoded is not known.
+ * @return unexpected if listener is not registered, never got a frame or does not have an ID of its own
+ */
+expected<efitick_t> getCanListenerSampleAgeNt(const CanListener& listener, efitick_t nowNt) {
+	efitick_t lastRxNt = 0;
+
+	efitick_t lastSampleNt = 0;
+	bool isSensor = false;
+
+	chMtxLock(&canListenersMutex);
+	for (size_t i = 0; i < exactListenerCount; i++) {
+		const auto& slot = exactListeners[i];
+		if (slot.listener != &listener) {
+			continue;
+		}
+
+		lastRxNt = std::max(lastRxNt, slot.lastRxNt);
+		if (slot.sensor) {
+			isSensor = true;
+			lastSampleNt = std::max(lastSampleNt, slot.lastRxNt);
+		}
+	}
+	chMtxUnlock(&canListenersMutex);
+
+	// listeners which are not sensors only have their frames to go by
+	if (isSensor) {
+		lastRxNt = lastSampleNt;
+	}
+
+	if (lastRxNt == 0) {
+		return unexpected;
+	}
+
+	return nowNt - lastRxNt;
+}
+
+// a sensor is stale once its sample is older than that many of its own mean inter-arrival intervals
+#define CAN_SENSOR_STALE_INTERVALS 3
+// not before its rate is known
+#define CAN_SENSOR_STALE_MIN_INTERVALS 16
+
+// caller holds canListenersMutex
+static bool isSampleStale(const CanListenerSlot& slot, efitick_t nowNt) {
+	// RX thread may have stamped a frame after this cycle started, age is negative then
+	return slot.intervalCount >= CAN_SENSOR_STALE_MIN_INTERVALS
+		&& nowNt - slot.lastRxNt > CAN_SENSOR_STALE_INTERVALS * slot.meanIntervalNt;
+}
+
+// caller holds canListenersMutex. Sensors with several sample IDs stay valid while a newer one is on time
+static bool hasNewerSample(const CanListenerSlot& staleSlot, efitick_t nowNt) {
+	for (size_t i = 0; i < exactListenerCount; i++) {
+		const auto& slot = exactListeners[i];
+		if (slot.sensor == staleSlot.sensor && slot.lastRxNt > staleSlot.lastRxNt && !isSampleStale(slot, nowNt)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Invoked from CAN TX thread every cycle.
+ * CAN sensor timeouts are fixed at construction and sized for the slowest sender they may face. Once the actual
+ * rate of an ID is known, its sensor is also invalidated as soon as the sample is a few intervals old.
+ */
+void checkCanSensorSampleAge(efitick_t nowNt) {
+	chMtxLock(&canListenersMutex);
+
+	for (size_t i = 0; i < exactListenerCount; i++) {
+		auto& slot = exactListeners[i];
+		if (slot.sensor && isSampleStale(slot, nowNt) && !hasNewerSample(slot, nowNt)) {
+			slot.sensor->invalidate(UnexpectedCode::Timeout);
+		}
+	}
+
+	chMtxUnlock(&canListenersMutex);
+}
+
+static void showCanListeners() {
+	efiPrintf("CAN listeners: %d exact, %d catch-all", (int)exactListenerCount, (int)catchAllListenerCount);
+
+	// printing is slow, one slot copied out at a time so RX is not held up behind the console
+	CanListenerSlot slot;
+	for (size_t i = 0; copyCanListenerSlot(false, i, slot); i++) {
+		printCanListenerSlot("exact", slot);
+	}
+
+	for (size_t i = 0; copyCanListenerSlot(true, i, slot); i++) {
+		printCanListenerSlot("catch-all", slot);
+	}
+}
+
+void initCanRx() {
+	addConsoleAction("canlisteners", showCanListeners);
+}
+
 void registerCanSensor(CanSensorBase& sensor) {
-	registerCanListener(sensor);
+	uint32_t id = sensor.getId();
+
+	if (id == 0) {
+		// no sample age and no staleness check for a sensor which sees every frame
+		registerCatchAllListener(sensor);
+	} else {
+		registerCanListenerIds(sensor, &id, 1, &sensor);
+	}
+
 	sensor.Register();
 }
 
+/**
+ * Sensor whose value may come in on any of several IDs, see AemXSeriesWideband.
+ * Other IDs the sensor decodes go through registerCanListenerId().
+ */
+void registerCanSensor(CanSensorBase& sensor, const uint32_t* sampleIds, size_t sampleIdCount) {
+	registerCanListenerIds(sensor, sampleIds, sampleIdCount, &sensor);
+	sensor.Register();
+}
+
+/**
+ * One more ID for a listener which is already registered, its frames are not counted as sensor samples.
+ */
+void registerCanListenerId(CanListener& listener, uint32_t id) {
+	registerCanListenerIds(listener, &id, 1, nullptr, /*isListed*/true);
+}
+
 /*
  * TODO:
  *  - convert to CanListener
@@ -192,7 +500,55 @@ static void processCanRxImu(const CANRxFrame& frame) {
 	}
 }
 
+#define CAN_RX_ARRIVAL_BUS_COUNT 3
+
+// arrival time of the frame each bus RX thread is about to process, zero if the driver did not stamp it
+static efitick_t canRxArrivalNt[CAN_RX_ARRIVAL_BUS_COUNT];
+
+/**
+ * Drivers which know when a frame actually arrived report it here right before handing the frame to the
+ * RX thread: the simulator from the SocketCAN kernel timestamp, hardware from the RX interrupt or the
+ * controller timestamp. Invoked from can_lld_receive() or an interrupt, so with the system already locked.
+ */
+void canRxSetArrivalNtI(size_t busIndex, efitick_t arrivalNt) {
+	if (busIndex < CAN_RX_ARRIVAL_BUS_COUNT) {
+		canRxArrivalNt[busIndex] = arrivalNt;
+	}
+}
+
+/**
+ * Driver reported arrival of the frame being processed, or 'threadNt' if there is none.
+ * Each report is used once, the next frame falls back to the RX thread time unless stamped again.
+ */
+static efitick_t takeCanRxArrivalNt(size_t busIndex, efitick_t threadNt) {
+	if (busIndex >= CAN_RX_ARRIVAL_BUS_COUNT) {
+		return threadNt;
+	}
+
+	efitick_t arrivalNt;
+	{
+		chibios_rt::CriticalSectionLocker csl;
+		arrivalNt = canRxArrivalNt[busIndex];
+		canRxArrivalNt[busIndex] = 0;
+	}
+
+	// a frame cannot have arrived after the RX thread picked it up
+	if (arrivalNt == 0 || arrivalNt > threadNt) {
+		return threadNt;
+	}
+
+	return arrivalNt;
+}
+
+/**
+ * @param nowNt time the RX thread got the frame. Listeners see the arrival time reported by the driver
+ * instead when there is one, see canRxSetArrivalNtI()
+ */
 void processCanRxMessage(const size_t busIndex, const CANRxFrame &frame, efitick_t nowNt) {
+	nowNt = takeCanRxArrivalNt(busIndex, nowNt);
+
+	canBusLoadOnRx(busIndex, frame);
+
 	if (engineConfiguration->verboseCan && busIndex == 0) {
 		printPacket(busIndex, frame);
 	} else if (engineConfiguration->verboseCan2 && busIndex == 1) {
@@ -224,9 +580,8 @@ void processCanRxMessage(const size_t busIndex, const CANRxFrame &frame, efitick
 	}
 
 #if EFI_WIDEBAND_FIRMWARE_UPDATE
-	// Bootloader acks with address 0x727573 aka ascii "rus"
-	if (CAN_EID(frame) == 0x727573) {
-		handleWidebandBootloaderAck();
+	if (isWidebandBootloaderAck(frame)) {
+		handleWidebandBootloaderAck(frame);
 	}
 #endif
 #if EFI_USE_OPENBLT
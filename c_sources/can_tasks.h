@@ -0,0 +1,30 @@
+/**
+ * @file can_tasks.h
+ *
+ * What the CAN RX and TX threads call in the modules that talk CAN, see can_rx.cpp and can_tx.cpp
+ */
+
+#pragma once
+
+#include <cstddef>
+
+void initCanRx();
+void initCanTx();
+
+// RX: driver arrival time of the frame about to be handed to the RX thread
+void canRxSetArrivalNtI(size_t busIndex, efitick_t arrivalNt);
+void checkCanSensorSampleAge(efitick_t nowNt);
+
+// TX: work paced from the TX thread
+void obdSendPendingFrames(efitick_t nowNt);
+void doLuaCanPeriodicTx(efitick_t nowNt);
+void resetLuaCanTx();
+
+// periodic messages a Lua script can register, handles are 0 .. LUA_CAN_PERIODIC_TX_COUNT - 1
+#define LUA_CAN_PERIODIC_TX_COUNT 16
+int addLuaCanPeriodicTx(int bus, uint32_t id, bool isExt, int periodMs, const uint8_t* data, uint8_t dlc);
+bool setLuaCanPeriodicTxData(int handle, const uint8_t* data, uint8_t dlc);
+
+// wideband firmware update
+bool isWidebandBootloaderAck(const CANRxFrame& frame);
+void handleWidebandBootloaderAck(const CANRxFrame& frame);
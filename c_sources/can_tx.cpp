@@ -12,93 +12,221 @@
 #if EFI_CAN_SUPPORT
 #include "can.h"
 #include "can_hw.h"
+#include "can_bus_load.h"
+#include "can_tasks.h"
 #include "can_dash.h"
 #include "obd2.h"
 #include "can_sensor.h"
 #include "rusefi_wideband.h"
 
 extern CanListener* canListeners_head;
+extern const size_t canVerboseFrameCount;
+void sendCanVerboseFrame(size_t index);
 
+extern const size_t canDashMessageCount;
+int getDashMessagePeriodMs(size_t index);
+void sendDashMessage(size_t index);
+void getDashMessagePhase(size_t index, uint8_t& phaseIndex, uint8_t& phaseCount);
+void checkDashType();
 
-CanWrite::CanWrite()
-	: PeriodicController("CAN TX", PRIO_CAN_TX, CAN_CYCLE_FREQ)
-{
-}
+// at most that many scheduled broadcast messages go out in one TX cycle, the rest wait for the next one.
+// Haltech is the busiest dash at about 900 frames per second, that is 4.5 per 5ms cycle on average
+#define CAN_TX_MAX_SCHEDULED_PER_CYCLE 8
 
-void CanWrite::PeriodicTask(efitick_t nowNt) {
-	UNUSED(nowNt);
-	static uint16_t cycleCount = 0;
-	CanCycle cycle(cycleCount);
-
-	//in case we have Verbose Can enabled, we should keep user configured period
-	if (engineConfiguration->enableVerboseCanTx && !engine->pauseCANdueToSerial) {
-		uint16_t cycleCountsPeriodMs = cycleCount * CAN_CYCLE_PERIOD;
-		if (0 != engineConfiguration->canSleepPeriodMs) {
-			if (cycleCountsPeriodMs % engineConfiguration->canSleepPeriodMs) {
-				void sendCanVerbose();
-				sendCanVerbose();
-			}
-		}
+/**
+ * Broadcast message with its own period and phase offset, so that messages sharing
+ * a period are spread over TX cycles instead of bursting in the same one.
+ */
+struct CanTxSlot {
+	const char* name;
+	// returns zero while the message is disabled
+	int (*getPeriodMs)(size_t arg);
+	void (*send)(size_t arg);
+	size_t arg;
+	// offset as a fraction of period
+	uint8_t phaseIndex;
+	uint8_t phaseCount;
+
+	efitick_t deadlineNt;
+	bool isActive;
+
+	// how late this message went out compared to its deadline
+	efitick_t maxLatenessNt;
+	uint32_t sentCounter;
+};
+
+static int getVerbosePeriodMs(size_t) {
+	if (!engineConfiguration->enableVerboseCanTx || engine->pauseCANdueToSerial) {
+		return 0;
 	}
 
-	CanListener* current = canListeners_head;
+	return engineConfiguration->canSleepPeriodMs;
+}
 
-	while (current) {
-		current = current->request();
-	}
+#if EFI_WIDEBAND_FIRMWARE_UPDATE
+static int getWidebandInfoPeriodMs(size_t) {
+	return engineConfiguration->enableAemXSeries ? 50 : 0;
+}
+#endif
+
+// every dash protocol is registered, only the configured one is active
+static constexpr size_t maxTxSlots = 128;
+static CanTxSlot txSlots[maxTxSlots];
+static size_t txSlotCount = 0;
+
+// worst number of scheduled messages sent in a single TX cycle
+static size_t maxScheduledPerCycle = 0;
+
+static void addTxSlot(const char* name, int (*getPeriodMs)(size_t), void (*send)(size_t), size_t arg, uint8_t phaseIndex, uint8_t phaseCount) {
+	efiAssertVoid(OBD_PCM_Processor_Fault, txSlotCount < maxTxSlots, "too many CAN TX slots");
 
-	if (cycle.isInterval(CI::_MAX_Cycle)) {
-		//we now reset cycleCount since we reached max cycle count
-		cycleCount = 0;
+	auto& slot = txSlots[txSlotCount++];
+	slot.name = name;
+	slot.getPeriodMs = getPeriodMs;
+	slot.send = send;
+	slot.arg = arg;
+	slot.phaseIndex = phaseIndex;
+	slot.phaseCount = phaseCount;
+}
+
+static void initTxSlots() {
+	for (size_t i = 0; i < canVerboseFrameCount; i++) {
+		addTxSlot("verbose", getVerbosePeriodMs, sendCanVerboseFrame, i, i, canVerboseFrameCount);
 	}
 
-	updateDash(cycle);
+	for (size_t i = 0; i < canDashMessageCount; i++) {
+		uint8_t phaseIndex;
+		uint8_t phaseCount;
+		getDashMessagePhase(i, phaseIndex, phaseCount);
+		addTxSlot("dash", getDashMessagePeriodMs, sendDashMessage, i, phaseIndex, phaseCount);
+	}
 
 #if EFI_WIDEBAND_FIRMWARE_UPDATE
-	if (engineConfiguration->enableAemXSeries && cycle.isInterval(CI::_50ms)) {
-		sendWidebandInfo();
-	}
+	// half a period away from the verbose group start
+	addTxSlot("wideband", getWidebandInfoPeriodMs, [](size_t) { sendWidebandInfo(); }, 0, 1, 2);
 #endif
-
-	cycleCount++;
 }
 
-CanInterval CanCycle::computeFlags(uint32_t cycleCount) {
-	CanInterval cycleMask = CanInterval::_5ms;
+static void updateTxSlotDeadlines(efitick_t nowNt) {
+	for (size_t i = 0; i < txSlotCount; i++) {
+		auto& slot = txSlots[i];
+		int periodMs = slot.getPeriodMs(slot.arg);
 
-	if ((cycleCount % 2) == 0) {
-		cycleMask |= CI::_10ms;
-	}
+		if (periodMs <= 0) {
+			slot.isActive = false;
+			continue;
+		}
 
-	if ((cycleCount % 4) == 0) {
-		cycleMask |= CI::_20ms;
-	}
+		efitick_t periodNt = MS2NT(periodMs);
 
-	if ((cycleCount % 10) == 0) {
-		cycleMask |= CI::_50ms;
+		if (!slot.isActive) {
+			// just enabled: first transmission one phase offset from now
+			slot.deadlineNt = nowNt + periodNt * slot.phaseIndex / slot.phaseCount;
+			slot.isActive = true;
+		} else if (slot.deadlineNt + periodNt < nowNt) {
+			// more than one period behind, no point sending the backlog
+			slot.deadlineNt = nowNt;
+		}
 	}
+}
 
-	if ((cycleCount % 20) == 0) {
-		cycleMask |= CI::_100ms;
-	}
+static void runTxSlots(efitick_t nowNt) {
+	updateTxSlotDeadlines(nowNt);
+
+	size_t sentThisCycle = 0;
 
-	if ((cycleCount % 40) == 0) {
-		cycleMask |= CI::_200ms;
+	// earliest deadline first, anything above per-cycle budget stays due until next cycle
+	while (sentThisCycle < CAN_TX_MAX_SCHEDULED_PER_CYCLE) {
+		CanTxSlot* next = nullptr;
+
+		for (size_t i = 0; i < txSlotCount; i++) {
+			auto& slot = txSlots[i];
+			if (slot.isActive && slot.deadlineNt <= nowNt && (!next || slot.deadlineNt < next->deadlineNt)) {
+				next = &slot;
+			}
+		}
+
+		if (!next) {
+			break;
+		}
+
+		next->send(next->arg);
+		next->sentCounter++;
+		// jitter as seen on the wire, includes messages sent ahead of this one in the same cycle
+		efitick_t latenessNt = getTimeNowNt() - next->deadlineNt;
+		if (latenessNt > next->maxLatenessNt) {
+			next->maxLatenessNt = latenessNt;
+		}
+		// advance from deadline rather than from now to keep phase
+		next->deadlineNt += MS2NT(next->getPeriodMs(next->arg));
+		sentThisCycle++;
 	}
 
-	if ((cycleCount % 50) == 0) {
-		cycleMask |= CI::_250ms;
+	if (sentThisCycle > maxScheduledPerCycle) {
+		maxScheduledPerCycle = sentThisCycle;
 	}
+}
 
-	if ((cycleCount % 100) == 0) {
-		cycleMask |= CI::_500ms;
+static void showCanTxInfo() {
+	efiPrintf("CAN TX scheduled slots: %d, worst burst %d messages per %dms cycle",
+			(int)txSlotCount, (int)maxScheduledPerCycle, CAN_CYCLE_PERIOD);
+
+	for (size_t i = 0; i < txSlotCount; i++) {
+		auto& slot = txSlots[i];
+		if (!slot.isActive && slot.sentCounter == 0) {
+			// inactive dash protocols, nothing to report
+			continue;
+		}
+
+		efiPrintf("%s[%d] period %dms phase %d/%d sent %d worst jitter %dus",
+				slot.name, (int)slot.arg, slot.getPeriodMs(slot.arg),
+				slot.phaseIndex, slot.phaseCount,
+				slot.sentCounter, (int)NT2US(slot.maxLatenessNt));
 	}
+}
+
+void initCanTx() {
+	addConsoleAction("cantxinfo", showCanTxInfo);
+	addConsoleAction("canbusinfo", showCanBusLoad);
+
+#if EFI_PROD_CODE
+	// same pin detected devices CanTxMessage sends through, their controllers hold the error counters
+	canBusLoadSetDevice(0, detectCanDevice(engineConfiguration->canRxPin, engineConfiguration->canTxPin));
+	canBusLoadSetDevice(1, detectCanDevice(engineConfiguration->can2RxPin, engineConfiguration->can2TxPin));
+#endif // EFI_PROD_CODE
+
+	startCanBusLoad();
+}
 
-	if ((cycleCount % 200) == 0) {
-		cycleMask |= CI::_1000ms;
+CanWrite::CanWrite()
+	: PeriodicController("CAN TX", PRIO_CAN_TX, CAN_CYCLE_FREQ)
+{
+	initTxSlots();
+}
+
+void CanWrite::PeriodicTask(efitick_t nowNt) {
+	checkDashType();
+
+	runTxSlots(nowNt);
+
+	CanListener* current = canListeners_head;
+
+	while (current) {
+		current = current->request();
 	}
 
-	return cycleMask;
+	// ISO-TP consecutive frames of a multi-frame OBD response, paced by tester's flow control
+	obdSendPendingFrames(nowNt);
+
+#if EFI_LUA
+	// Lua-registered periodic messages, payload is maintained by the script
+	doLuaCanPeriodicTx(nowNt);
+#endif // EFI_LUA
+
+	// stale CAN-fed sensors, by their own observed rate
+	checkCanSensorSampleAge(nowNt);
+
+	updateCanBusLoad(nowNt);
 }
 
 #endif // EFI_CAN_SUPPORT
@@ -193,19 +193,24 @@ static void populateFrame(Cams& msg) {
 	msg.Bank2ExhaustTarget = engine->outputChannels.vvtTargets[3];
 }
 
-void sendCanVerbose() {
+// keep in sync with sendCanVerboseFrame
+extern const size_t canVerboseFrameCount = 9;
+
+void sendCanVerboseFrame(size_t index) {
 	auto base = engineConfiguration->verboseCanBaseAddress;
 	auto isExt = engineConfiguration->rusefiVerbose29b;
 
-	transmitStruct<Status>	    (CanCategory::VERBOSE, base + 0, isExt);
-	transmitStruct<Speeds>	    (CanCategory::VERBOSE, base + 1, isExt);
-	transmitStruct<PedalAndTps> (CanCategory::VERBOSE, base + CAN_PEDAL_TPS_OFFSET, isExt);
-	transmitStruct<Sensors1>	(CanCategory::VERBOSE, base + CAN_SENSOR_1_OFFSET, isExt);
-	transmitStruct<Sensors2>	(CanCategory::VERBOSE, base + 4, isExt);
-	transmitStruct<Fueling>	    (CanCategory::VERBOSE, base + 5, isExt);
-	transmitStruct<Fueling2>	(CanCategory::VERBOSE, base + 6, isExt);
-	transmitStruct<Fueling3>	(CanCategory::VERBOSE, base + 7, isExt);
-	transmitStruct<Cams>		(CanCategory::VERBOSE, base + 8, isExt);
+	switch (index) {
+		case 0: transmitStruct<Status>	    (CanCategory::VERBOSE, base + 0, isExt); break;
+		case 1: transmitStruct<Speeds>	    (CanCategory::VERBOSE, base + 1, isExt); break;
+		case 2: transmitStruct<PedalAndTps> (CanCategory::VERBOSE, base + CAN_PEDAL_TPS_OFFSET, isExt); break;
+		case 3: transmitStruct<Sensors1>	(CanCategory::VERBOSE, base + CAN_SENSOR_1_OFFSET, isExt); break;
+		case 4: transmitStruct<Sensors2>	(CanCategory::VERBOSE, base + 4, isExt); break;
+		case 5: transmitStruct<Fueling>	    (CanCategory::VERBOSE, base + 5, isExt); break;
+		case 6: transmitStruct<Fueling2>	(CanCategory::VERBOSE, base + 6, isExt); break;
+		case 7: transmitStruct<Fueling3>	(CanCategory::VERBOSE, base + 7, isExt); break;
+		case 8: transmitStruct<Cams>		(CanCategory::VERBOSE, base + 8, isExt); break;
+	}
 }
 
 #endif // EFI_CAN_SUPPORT
@@ -3,6 +3,7 @@
 #include "closed_loop_fuel.h"
 #include "closed_loop_fuel_cell.h"
 #include "deadband.h"
+#include "learn_table.h"
 
 struct FuelingBank {
 	ClosedLoopFuelCellImpl cells[STFT_CELL_COUNT];
@@ -96,6 +97,79 @@ bool shouldUpdateCorrection(SensorType sensor) {
 	return true;
 }
 
+// marks backup RAM contents as learned trims rather than garbage after power loss
+#define LTFT_COOKIE 0x4c544631
+
+// learned cells live in backup RAM next to knock learn
+static LearnStorage<LtftLearnData, LTFT_COOKIE> ltftStorage;
+
+static void showLongTermFuelTrim() {
+	auto data = ltftStorage.get();
+
+	efiPrintf("LTFT %s", engineConfiguration->ltft.enabled ? "enabled" : "disabled");
+
+	// only cells which learned something
+	for (size_t load = 0; load < efi::size(data->Table); load++) {
+		for (size_t rpm = 0; rpm < efi::size(data->Table[load]); rpm++) {
+			float cell = data->Table[load][rpm];
+			if (cell != 0) {
+				efiPrintf("load %d rpm %d: %.2f%%", (int)config->ltftLoadBins[load], (int)config->ltftRpmBins[rpm], cell);
+			}
+		}
+	}
+}
+
+void initLongTermFuelTrim() {
+	ltftStorage.init(BACKUP_LEARN_DATA(Ltft), [](const LtftLearnData& data) {
+		return isLearnRangeValid(data.Table, -25, 25);
+	});
+
+	addConsoleAction("ltftinfo", showLongTermFuelTrim);
+	addConsoleAction("resetltft", [](){
+		ltftStorage.reset();
+	});
+}
+
+/**
+ * Long term trim as fuel multiplier, one table lookup
+ */
+float getLongTermFuelTrim(float rpm, float load) {
+	if (!engineConfiguration->ltft.enabled) {
+		return 1;
+	}
+
+	float percent = interpolate3d(ltftStorage.get()->Table,
+		config->ltftLoadBins, load,
+		config->ltftRpmBins, rpm);
+
+	return 1 + 0.01f * percent;
+}
+
+/**
+ * Move part of what STFT currently corrects into long term cells around the operating point.
+ * Cells are only changed by their share of the bilinear weight, at a bounded rate.
+ */
+static void learnLongTermFuelTrim(float rpm, float load, float stft) {
+	const auto& cfg = engineConfiguration->ltft;
+
+	constexpr float dt = FAST_CALLBACK_PERIOD_MS * 0.001f;
+
+	// Clamp to reasonable limits, same as STFT - 100ms to 100s is too fast to be long term though
+	float timeConstant = maxF(10, cfg.timeConstant);
+	float step = 100 * (stft - 1) * dt / timeConstant;
+
+	float maxStep = maxF(0, cfg.maxRate) * dt;
+	step = clampF(-maxStep, step, maxStep);
+
+	float maxAdd = clampF(0, cfg.maxAdd, 25);
+	float maxRemove = clampF(-25, cfg.maxRemove, 0);
+
+	learnTableBilinear(ltftStorage.get()->Table,
+		config->ltftLoadBins, load,
+		config->ltftRpmBins, rpm,
+		step, maxRemove, maxAdd);
+}
+
 ClosedLoopFuelResult fuelClosedLoopCorrection() {
 	if (!shouldCorrect()) {
 		return {};
@@ -109,6 +183,9 @@ ClosedLoopFuelResult fuelClosedLoopCorrection() {
 
 	ClosedLoopFuelResult result;
 
+	float stftSum = 0;
+	size_t stftCount = 0;
+
 	for (int i = 0; i < STFT_BANK_COUNT; i++) {
 		auto& cell = banks[i].cells[binIdx];
 
@@ -119,10 +196,18 @@ ClosedLoopFuelResult fuelClosedLoopCorrection() {
 
 		if (shouldUpdateCorrection(sensor)) {
 			cell.update(engineConfiguration->stft.deadband * 0.01f, engineConfiguration->stftIgnoreErrorMagnitude);
+
+			stftSum += cell.getAdjustment();
+			stftCount++;
 		}
 
 		result.banks[i] = cell.getAdjustment();
 	}
 
+	// long term table is shared between banks
+	if (engineConfiguration->ltft.enabled && stftCount > 0) {
+		learnLongTermFuelTrim(Sensor::getOrZero(SensorType::Rpm), getFuelingLoad(), stftSum / stftCount);
+	}
+
 	return result;
 }
@@ -38,6 +38,7 @@ private:
 	SimplePwm m_pwm2;
 
 	bool isStarted = false;
+	bool m_useTwoWires = false;
 
 public:
 	DcHardware() : dcMotor(m_disablePin) {}
@@ -67,6 +68,7 @@ public:
 			return;
 		}
 		isStarted = true;
+		m_useTwoWires = useTwoWires;
 
 		dcMotor.setType(useTwoWires ? TwoPinDcMotor::ControlType::PwmDirectionPins : TwoPinDcMotor::ControlType::PwmEnablePin);
 
@@ -123,6 +125,14 @@ public:
 			dcMotor.configure(m_pwm1, wrappedDir1, wrappedDir2, isInverted);
 		}
 	}
+
+	/**
+	 * Hardware PWM duty is a compare register write and plain pins are ISR safe,
+	 * software PWM state is shared with the executor and is not.
+	 */
+	bool isIsrSafe() const {
+		return isStarted && m_pwm1.hardPwm && (!m_useTwoWires || m_pwm2.hardPwm);
+	}
 };
 
 static DcHardware dcHardware[ETB_COUNT + DC_PER_STEPPER];
@@ -171,6 +181,16 @@ void setDcMotorDuty(size_t index, float duty) {
 }
 
 
+bool isDcMotorIsrSafe(const DcMotor* motor) {
+	for (auto& hw : dcHardware) {
+		if (&hw.dcMotor == motor) {
+			return hw.isIsrSafe();
+		}
+	}
+
+	return false;
+}
+
 void showDcMotorInfo(int i) {
 	DcHardware *dc = &dcHardware[i];
 
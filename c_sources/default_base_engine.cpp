@@ -39,6 +39,14 @@ void setDefaultBaseEngine() {
 	engineConfiguration->cutFuelOnHardLimit = true;
 	engineConfiguration->cutSparkOnHardLimit = true;
 
+	// Soft limiter is off until a window is set
+	engineConfiguration->rpmSoftLimitWindowSize = 0;
+	engineConfiguration->rpmSoftLimitLookaheadMs = 30;
+	engineConfiguration->rpmSoftLimitTimingRetard = 10;
+	engineConfiguration->rpmSoftLimitRetardBand = 0.25;
+	// fuel cut starts taking over as soon as events are cut, spark cut with fuel already in goes out the exhaust
+	engineConfiguration->rpmSoftLimitFuelCutBand = 0;
+
 	engineConfiguration->failedMapFallback = 60;
 	engineConfiguration->enableMapEstimationTableFallback = false;
 
@@ -142,6 +142,23 @@ static void setDefaultStftSettings() {
 		cfg.cellCfgs[i].maxAdd = 5;
 		cfg.cellCfgs[i].maxRemove = -5;
 	}
+
+	auto& ltft = engineConfiguration->ltft;
+
+	// Default to disabled
+	ltft.enabled = false;
+
+	// STFT has to hold an error for minutes before it fully moves into the table
+	ltft.timeConstant = 300;
+	// at most 0.5% per second
+	ltft.maxRate = 0.5f;
+
+	// Allow +-15%
+	ltft.maxAdd = 15;
+	ltft.maxRemove = -15;
+
+	setRpmTableBin(config->ltftRpmBins, LTFT_RPM_COUNT);
+	setLinearCurve(config->ltftLoadBins, 20, 100, 1);
 }
 
 static const uint8_t tpsTpsTable[TPS_TPS_ACCEL_TABLE][TPS_TPS_ACCEL_TABLE] = {
@@ -215,6 +232,15 @@ void setDefaultWallWetting() {
 		0.21, 0.40, 0.60, 0.79, 0.85, 0.90, 0.95, 1.00
 	};
 	copyArray(engineConfiguration->wwBetaMapValues, betaMap);
+
+	// Tables start out as the product of the curves above, so switching modes changes nothing until tuned
+	engineConfiguration->wwUseTables = false;
+	for (size_t mapIndex = 0; mapIndex < efi::size(config->wwTauTable); mapIndex++) {
+		for (size_t cltIndex = 0; cltIndex < efi::size(config->wwTauTable[0]); cltIndex++) {
+			config->wwTauTable[mapIndex][cltIndex] = tauClt[cltIndex] * tauMap[mapIndex];
+			config->wwBetaTable[mapIndex][cltIndex] = betaClt[cltIndex] * betaMap[mapIndex];
+		}
+	}
 }
 
 void setDefaultFuel() {
@@ -117,4 +117,13 @@ void setDefaultIgnition() {
 
 	// IAT correction
 	setDefaultIatTimingCorrection();
+
+	// Knock learning, default to disabled
+	engineConfiguration->knockLearn.enabled = false;
+	// reactive retard held for ~5 seconds moves fully into the table
+	engineConfiguration->knockLearn.learnRate = 0.2f;
+	// give back a degree every 30 seconds without knock
+	engineConfiguration->knockLearn.recoveryRate = 1 / 30.0f;
+	engineConfiguration->knockLearn.maxRetard = 8;
+	engineConfiguration->knockLearn.cylinderStep = 0.25f;
 }
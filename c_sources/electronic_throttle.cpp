@@ -81,6 +81,7 @@
 #include "dc_motors.h"
 #include "pid_auto_tune.h"
 #include "defaults.h"
+#include "etb_plant_model.h"
 
 #if defined(HAS_OS_ACCESS)
 #error "Unexpected OS ACCESS HERE"
@@ -174,6 +175,282 @@ static percent_t directPwmValue = NAN;
 // this macro clamps both positive and negative percentages from about -100% to 100%
 #define ETB_PERCENT_TO_DUTY(x) (clampF(-ETB_DUTY_LIMIT, 0.01f * (x), ETB_DUTY_LIMIT))
 
+#ifndef EFI_ETB_FAST_LOOP
+#define EFI_ETB_FAST_LOOP FALSE
+#endif
+
+#if EFI_ETB_FAST_LOOP
+
+#include "etb_fast_loop.h"
+
+extern AdcDevice fastAdc;
+bool isDcMotorIsrSafe(const DcMotor* motor);
+
+// inner loop disarms itself if supervising ETB thread stops publishing for this long
+#define ETB_FAST_LOOP_STALE_MS 20
+// inner loop position is cross-checked against redundant TPS sensor every slow loop cycle
+#define ETB_FAST_LOOP_MAX_POSITION_MISMATCH 5
+
+/**
+ * Inner position loop running right from fast ADC conversion complete callback.
+ *
+ * ETB thread keeps doing everything slow: pedal map, idle, trim, rev limiter, feed-forward bias
+ * and redundant sensor checks. It then publishes target, feed-forward, PID gains and TPS calibration
+ * as fixed-point numbers. Each ADC sample costs a handful of integer operations and a motor duty update,
+ * no sensor registry or table lookups. I and D terms use the interval measured between samples.
+ *
+ * Primary TPS has to be sampled by fast ADC, otherwise publish() refuses and the ETB thread keeps the motor.
+ *
+ * Once armed the inner loop first runs in shadow, computing duty without writing it. ETB thread only hands
+ * the motor over after it has seen the inner loop iterate between two publishes, so if the ADC callback is
+ * not running the ETB thread simply keeps driving the motor itself.
+ */
+struct EtbFastLoop {
+	/**
+	 * Invoked from ETB thread
+	 * @return false if inner loop can not be used and caller has to drive motor itself
+	 */
+	bool publish(DcMotor* motor, percent_t target, percent_t feedForward, percent_t observation, bool isPidReset,
+			const pid_s& pid, adc_channel_e tpsChannel, uint16_t tpsMin, uint16_t tpsMax, efitick_t nowNt) {
+		// motor duty is written from ISR, only hardware PWM outputs can take that
+		if (tpsMax == tpsMin || !isDcMotorIsrSafe(motor) || !fastAdc.isHwUsed(tpsChannel)) {
+			disarm();
+			return false;
+		}
+
+		// inner loop has to have iterated since previous publish, and previous publish must be fresh
+		bool isRunning = isArmed
+			&& iterationCounter != publishedIterationCounter
+			&& nowNt - lastPublishNt <= MS2NT(ETB_FAST_LOOP_STALE_MS);
+
+		// inner loop has to agree with redundant TPS, otherwise its calibration is off
+		if (isRunning && absI(lastPositionQ8 - ETB_Q8(observation)) > ETB_Q8(ETB_FAST_LOOP_MAX_POSITION_MISMATCH)) {
+			disarm();
+			mismatchCounter++;
+			return false;
+		}
+
+		// position = (volts * TPS_TS_CONVERSION - tpsMin) * 100 / (tpsMax - tpsMin)
+		float percentPerVolt = 100.0f * TPS_TS_CONVERSION / (tpsMax - tpsMin);
+		float voltsPerCount = adcToVoltsDivided(1);
+
+		chibios_rt::CriticalSectionLocker csl;
+
+		this->motor = motor;
+		sampleIndex = fastAdc.internalAdcIndexByHardwareIndex[tpsChannel];
+		targetQ8 = ETB_Q8(target);
+		tpsSlopeQ16 = ETB_Q16(percentPerVolt * voltsPerCount);
+		tpsOffsetQ8 = ETB_Q8(100.0f * tpsMin / (tpsMax - tpsMin));
+
+		fastPid.feedForwardQ8 = ETB_Q8(feedForward + pid.offset);
+		fastPid.kpQ16 = ETB_Q16(pid.pFactor);
+		fastPid.kiQ16 = ETB_Q16(pid.iFactor);
+		fastPid.kdQ16 = ETB_Q16(pid.dFactor);
+		fastPid.iTermMinQ16 = ETB_Q16(engineConfiguration->etb_iTermMin);
+		fastPid.iTermMaxQ16 = ETB_Q16(engineConfiguration->etb_iTermMax);
+		fastPid.outputMinQ8 = ETB_Q8(maxF(pid.minValue, -100 * ETB_DUTY_LIMIT));
+		fastPid.outputMaxQ8 = ETB_Q8(minF(pid.maxValue, 100 * ETB_DUTY_LIMIT));
+
+		if (isPidReset || !isArmed) {
+			fastPid.reset();
+		}
+
+		lastPublishNt = nowNt;
+		publishedIterationCounter = iterationCounter;
+		isArmed = true;
+		ownsMotor = isRunning;
+
+		return isRunning;
+	}
+
+	void disarm() {
+		chibios_rt::CriticalSectionLocker csl;
+
+		isArmed = false;
+		ownsMotor = false;
+	}
+
+	/**
+	 * Invoked from ETB thread right before it would write duty itself
+	 */
+	bool isDriving(efitick_t nowNt) const {
+		return isArmed && ownsMotor && nowNt - lastPublishNt <= MS2NT(ETB_FAST_LOOP_STALE_MS);
+	}
+
+	/**
+	 * Invoked from fast ADC callback, ISR context
+	 */
+	void onFastAdc(const adcsample_t* samples, efitick_t nowNt) {
+		if (!isArmed) {
+			return;
+		}
+
+		if (nowNt - lastPublishNt > MS2NT(ETB_FAST_LOOP_STALE_MS)) {
+			// nobody is watching redundant sensors any more
+			isArmed = false;
+			if (ownsMotor) {
+				ownsMotor = false;
+				motor->disable();
+			}
+			return;
+		}
+
+		int32_t positionQ8 = ((samples[sampleIndex] * tpsSlopeQ16) >> 8) - tpsOffsetQ8;
+		lastPositionQ8 = positionQ8;
+
+		efitick_t sinceLastSampleNt = nowNt - lastSampleNt;
+		lastSampleNt = nowNt;
+		uint32_t intervalUs = sinceLastSampleNt <= US2NT(ETB_FAST_LOOP_MAX_INTERVAL_US) ? NT2US(sinceLastSampleNt) : 0;
+
+		int32_t outputQ8 = fastPid.update(targetQ8, positionQ8, intervalUs);
+
+		if (ownsMotor) {
+			// Q8 percent to duty fraction, already clamped so SimplePwm range warnings are unreachable
+			motor->set(outputQ8 * (1.0f / ETB_Q8_ONE));
+		}
+		iterationCounter++;
+	}
+
+	volatile bool isArmed = false;
+	volatile bool ownsMotor = false;
+	volatile uint32_t iterationCounter = 0;
+	uint32_t mismatchCounter = 0;
+
+private:
+	DcMotor* motor = nullptr;
+	efitick_t lastPublishNt = 0;
+	efitick_t lastSampleNt = 0;
+	uint32_t publishedIterationCounter = 0;
+	int sampleIndex = 0;
+
+	int32_t targetQ8 = 0;
+	int32_t tpsSlopeQ16 = 0;
+	int32_t tpsOffsetQ8 = 0;
+	int32_t lastPositionQ8 = 0;
+
+	EtbFastPid fastPid;
+};
+
+static EtbFastLoop etbFastLoops[ETB_COUNT];
+
+static EtbFastLoop* getFastLoop(etb_function_e function) {
+	size_t index;
+	switch (function) {
+		case ETB_Throttle1: index = 0; break;
+		case ETB_Throttle2: index = 1; break;
+		// idle valve and wastegate are slow enough for ETB thread
+		default: return nullptr;
+	}
+
+	return index < efi::size(etbFastLoops) ? &etbFastLoops[index] : nullptr;
+}
+
+static void disarmFastLoop(etb_function_e function) {
+	if (EtbFastLoop* fastLoop = getFastLoop(function)) {
+		fastLoop->disarm();
+	}
+}
+
+/**
+ * Invoked from fast ADC conversion complete callback, see mapAveragingAdcCallback()
+ */
+void etbFastLoopOnAdc() {
+	efitick_t nowNt = getTimeNowNt();
+	for (auto& fastLoop : etbFastLoops) {
+		fastLoop.onFastAdc(fastAdc.samples, nowNt);
+	}
+}
+
+#endif // EFI_ETB_FAST_LOOP
+
+expected<EtbPlantModel> identifyEtbPlant(const float* duty, const float* position, size_t count, float periodSeconds, percent_t neutral) {
+	EtbPlantIdentifier identifier;
+	identifier.reset(neutral, periodSeconds);
+
+	for (size_t i = 0; i < count; i++) {
+		identifier.addSample(duty[i], position[i]);
+	}
+
+	return identifier.fit();
+}
+
+// Identification run: slow triangle position sweep held by P-only loop with PRBS duty added on top
+#define ETB_IDENT_DURATION_SECONDS 6
+#define ETB_IDENT_SWEEP_MIN 10
+#define ETB_IDENT_SWEEP_MAX 90
+#define ETB_IDENT_PRBS_AMPLITUDE 15
+// PRBS bit is held for that many loop periods to put energy near plant bandwidth
+#define ETB_IDENT_PRBS_HOLD 4
+
+static EtbPlantIdentifier etbIdentifier;
+// dynamic terms have no home in the tune yet, so they only live until reboot and 'etbident' has to be rerun
+static EtbPlantModel etbPlantModel;
+static bool isEtbPlantModelValid = false;
+
+static bool isEtbIdentificationActive = false;
+static size_t etbIdentificationStep = 0;
+static uint16_t etbIdentificationLfsr = 0x1FF;
+static float etbIdentificationLastDuty = 0;
+
+// target smoothing ahead of differentiation for dynamic feed-forward, seconds
+#define ETB_FEED_FORWARD_TIME_CONSTANT 0.02f
+// per throttle, seeded from the first target once the model is valid
+static EtbTargetDerivative etbTargetDerivatives[2];
+
+static void startEtbIdentification() {
+	if (Sensor::getOrZero(SensorType::Rpm) > 0) {
+		efiPrintf("ETB identification only with engine stopped");
+		return;
+	}
+
+	etbIdentifier.reset(engineConfiguration->etbNeutralPosition, etbPeriodSeconds);
+	etbIdentificationStep = 0;
+	etbIdentificationLfsr = 0x1FF;
+	etbIdentificationLastDuty = 0;
+	isEtbIdentificationActive = true;
+
+	efiPrintf("ETB identification started");
+}
+
+// 9 bit maximal length LFSR, x^9 + x^5 + 1
+static bool nextPrbsBit() {
+	bool bit = ((etbIdentificationLfsr >> 8) ^ (etbIdentificationLfsr >> 4)) & 1;
+	etbIdentificationLfsr = ((etbIdentificationLfsr << 1) | bit) & 0x1FF;
+	return bit;
+}
+
+static void finishEtbIdentification() {
+	isEtbIdentificationActive = false;
+
+	auto model = etbIdentifier.fit();
+	if (!model) {
+		if (!etbIdentifier.hasCrossedNeutral()) {
+			efiPrintf("ETB identification failed: sweep did not cross neutral position %.1f, preload unknown",
+					engineConfiguration->etbNeutralPosition);
+		} else {
+			efiPrintf("ETB identification failed: not enough excitation in %d samples", (int)etbIdentifier.getSampleCount());
+		}
+		return;
+	}
+
+	etbPlantModel = model.Value;
+	isEtbPlantModelValid = true;
+
+	// static part of the model goes to the bias curve, that one is persisted with the tune.
+	// Bins outside of the swept range keep their values, the model was never checked there
+	for (size_t i = 0; i < efi::size(config->etbBiasBins); i++) {
+		float bin = config->etbBiasBins[i];
+		if (bin >= etbIdentifier.getMinPosition() && bin <= etbIdentifier.getMaxPosition()) {
+			config->etbBiasValues[i] = etbPlantModel.getStaticDuty(bin);
+		}
+	}
+
+	efiPrintf("ETB model: preload %.2f spring %.3f friction %.2f damping %.4f inertia %.6f",
+			etbPlantModel.preload, etbPlantModel.spring, etbPlantModel.friction,
+			etbPlantModel.damping, etbPlantModel.inertia);
+	efiPrintf("ETB model: bias curve updated, friction/damping/inertia are not saved and are lost on reboot");
+}
+
 bool EtbController::init(etb_function_e function, DcMotor *motor, pid_s *pidParameters, const ValueProvider3D* pedalMap, bool initializeThrottles) {
 	if (function == ETB_None) {
 		// if not configured, don't init.
@@ -390,10 +667,25 @@ percent_t EtbController2::getThrottleTrim(float rpm, percent_t targetPosition) c
 }
 
 expected<percent_t> EtbController::getOpenLoop(percent_t target) {
-	// Don't apply open loop for wastegate/idle valve, only real ETB
-	if (m_function != ETB_Wastegate
+	bool isThrottle = m_function == ETB_Throttle1 || m_function == ETB_Throttle2;
+
+	if (m_function == ETB_Throttle1 && isEtbIdentificationActive) {
+		// excitation is the whole output of the throttle being identified
+		etbFeedForward = 0;
+		// targets from before are stale once a model comes out of this
+		etbTargetDerivatives[0].clear();
+	} else if (m_function != ETB_Wastegate
 		&& m_function != ETB_IdleValve) {
+		// Don't apply open loop for wastegate/idle valve, only real ETB
 		etbFeedForward = interpolate2d(target, config->etbBiasBins, config->etbBiasValues);
+
+		if (isThrottle && isEtbPlantModelValid) {
+			// identified friction, damping and inertia, so PID is only left with residual error
+			auto& derivative = etbTargetDerivatives[m_function == ETB_Throttle1 ? 0 : 1];
+			derivative.update(target, etbPeriodSeconds, ETB_FEED_FORWARD_TIME_CONSTANT);
+
+			etbFeedForward += etbPlantModel.getFeedForwardDuty(derivative.getVelocity(), derivative.getAcceleration());
+		}
 	} else {
 	    etbFeedForward = 0;
 	}
@@ -505,7 +797,47 @@ expected<percent_t> EtbController::getClosedLoopAutotune(percent_t target, perce
 	return autotuneAmplitude * (isPositive ? -1 : 1);
 }
 
+/**
+ * Identification replaces closed loop, output is P-only sweep plus PRBS excitation
+ */
+static percent_t getClosedLoopIdentification(percent_t observation) {
+	if (Sensor::getOrZero(SensorType::Rpm) > 0) {
+		efiPrintf("ETB identification aborted, engine is running");
+		isEtbIdentificationActive = false;
+		return 0;
+	}
+
+	etbIdentifier.addSample(etbIdentificationLastDuty, observation);
+
+	size_t totalSteps = ETB_IDENT_DURATION_SECONDS * ETB_LOOP_FREQUENCY;
+	if (etbIdentificationStep >= totalSteps) {
+		finishEtbIdentification();
+		return 0;
+	}
+
+	// triangle: up during first half, down during second half
+	float phase = (float)etbIdentificationStep / totalSteps;
+	float sweep = phase < 0.5f ? 2 * phase : 2 * (1 - phase);
+	// start below neutral even on throttles with a low limp home position, preload needs both sides
+	float sweepMin = clampF(0, engineConfiguration->etbNeutralPosition - 5, ETB_IDENT_SWEEP_MIN);
+	float setpoint = sweepMin + sweep * (ETB_IDENT_SWEEP_MAX - sweepMin);
+
+	static bool prbsBit;
+	if (etbIdentificationStep % ETB_IDENT_PRBS_HOLD == 0) {
+		prbsBit = nextPrbsBit();
+	}
+	etbIdentificationStep++;
+
+	float duty = engineConfiguration->etb.pFactor * (setpoint - observation)
+		+ (prbsBit ? ETB_IDENT_PRBS_AMPLITUDE : -ETB_IDENT_PRBS_AMPLITUDE);
+	duty = clampF(-100 * ETB_DUTY_LIMIT, duty, 100 * ETB_DUTY_LIMIT);
+
+	etbIdentificationLastDuty = duty;
+	return duty;
+}
+
 expected<percent_t> EtbController::getClosedLoop(percent_t target, percent_t observation) {
+	bool isPidReset = m_shouldResetPid;
 	if (m_shouldResetPid) {
 		m_pid.reset();
 		m_shouldResetPid = false;
@@ -521,7 +853,15 @@ expected<percent_t> EtbController::getClosedLoop(percent_t target, percent_t obs
 
 	// Only allow autotune with stopped engine, and on the first throttle
 	if (m_isAutotune) {
+#if EFI_ETB_FAST_LOOP
+		disarmFastLoop(m_function);
+#endif // EFI_ETB_FAST_LOOP
 		return getClosedLoopAutotune(target, observation);
+	} else if (isEtbIdentificationActive && m_function == ETB_Throttle1) {
+#if EFI_ETB_FAST_LOOP
+		disarmFastLoop(m_function);
+#endif // EFI_ETB_FAST_LOOP
+		return getClosedLoopIdentification(observation);
 	} else {
 		// Check that we're not over the error limit
 		etbIntegralError = m_errorAccumulator.accumulate(target - observation);
@@ -532,6 +872,22 @@ expected<percent_t> EtbController::getClosedLoop(percent_t target, percent_t obs
 			//getLimpManager()->etbProblem();
 		}
 
+#if EFI_ETB_FAST_LOOP
+		if (EtbFastLoop* fastLoop = getFastLoop(m_function)) {
+			bool isThrottle1 = m_function == ETB_Throttle1;
+			if (fastLoop->publish(m_motor, target, etbFeedForward, observation, isPidReset, engineConfiguration->etb,
+					isThrottle1 ? engineConfiguration->tps1_1AdcChannel : engineConfiguration->tps2_1AdcChannel,
+					isThrottle1 ? engineConfiguration->tpsMin : engineConfiguration->tps2Min,
+					isThrottle1 ? engineConfiguration->tpsMax : engineConfiguration->tps2Max,
+					getTimeNowNt())) {
+				// inner loop owns motor duty, see setOutput()
+				return 0;
+			}
+		}
+#else
+		UNUSED(isPidReset);
+#endif // EFI_ETB_FAST_LOOP
+
 		// Normal case - use PID to compute closed loop part
 		return m_pid.getOutput(target, observation, etbPeriodSeconds);
 	}
@@ -547,13 +903,31 @@ void EtbController::setOutput(expected<percent_t> outputValue) {
 
 	if (!m_motor) return;
 
+#if EFI_ETB_FAST_LOOP
+	EtbFastLoop* fastLoop = getFastLoop(m_function);
+#endif // EFI_ETB_FAST_LOOP
+
 	// If ETB is allowed, output is valid, and we aren't paused, output to motor.
 	if (getLimpManager()->allowElectronicThrottle()
 		&& outputValue
 		&& !engineConfiguration->pauseEtbControl) {
 		m_motor->enable();
+
+#if EFI_ETB_FAST_LOOP
+		if (fastLoop && fastLoop->isDriving(getTimeNowNt())) {
+			// duty is written by inner loop on every TPS sample
+			return;
+		}
+#endif // EFI_ETB_FAST_LOOP
+
 		m_motor->set(ETB_PERCENT_TO_DUTY(outputValue.Value));
 	} else {
+#if EFI_ETB_FAST_LOOP
+		if (fastLoop) {
+			fastLoop->disarm();
+		}
+#endif // EFI_ETB_FAST_LOOP
+
 		// Otherwise disable the motor.
 		m_motor->disable();
 	}
@@ -574,6 +948,9 @@ void EtbController::update() {
 #endif /* EFI_TUNER_STUDIO */
 
 	if (!cisnan(directPwmValue)) {
+#if EFI_ETB_FAST_LOOP
+		disarmFastLoop(m_function);
+#endif // EFI_ETB_FAST_LOOP
 		m_motor->set(directPwmValue);
 		return;
 	}
@@ -583,6 +960,9 @@ void EtbController::update() {
 			engine->engineState.lua.luaDisableEtb) {
 		// If engine is stopped and so configured, skip the ETB update entirely
 		// This is quieter and pulls less power than leaving it on all the time
+#if EFI_ETB_FAST_LOOP
+		disarmFastLoop(m_function);
+#endif // EFI_ETB_FAST_LOOP
 		m_motor->disable();
 		return;
 	}
@@ -732,6 +1112,11 @@ static void showEtbInfo() {
 		efiPrintf(" control=%s", hwPortname(engineConfiguration->etbIo[i].controlPin));
 		efiPrintf(" disable=%s", hwPortname(engineConfiguration->etbIo[i].disablePin));
 		showDcMotorInfo(i);
+#if EFI_ETB_FAST_LOOP
+		efiPrintf(" fast loop armed=%d owns motor=%d iterations=%d mismatches=%d",
+				etbFastLoops[i].isArmed, etbFastLoops[i].ownsMotor,
+				etbFastLoops[i].iterationCounter, etbFastLoops[i].mismatchCounter);
+#endif // EFI_ETB_FAST_LOOP
 	}
 
 #endif /* EFI_PROD_CODE */
@@ -1021,6 +1406,7 @@ void initElectronicThrottle() {
 	addConsoleAction("etbinfo", showEtbInfo);
 	addConsoleAction("etbreset", etbReset);
 	addConsoleActionI("etb_freq", setEtbFrequency);
+	addConsoleAction("etbident", startEtbIdentification);
 
 	// this command is useful for real hardware test with known cheap hardware
 	addConsoleAction("etb_test_hw", [](){
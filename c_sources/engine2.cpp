@@ -15,6 +15,7 @@
 #include "advance_map.h"
 #include "aux_valves.h"
 #include "closed_loop_fuel.h"
+#include "learn_table.h"
 #include "launch_control.h"
 #include "injector_model.h"
 #include "tunerstudio.h"
@@ -172,14 +173,16 @@ void EngineState::periodicFastCallback() {
 		engine->stftCorrection[i] = corr;
 	}
 
+	float longTermTrim = getLongTermFuelTrim(rpm, fuelLoad);
+
 	// Now apply that to per-cylinder fueling and timing
 	for (size_t i = 0; i < engineConfiguration->specs.cylindersCount; i++) {
 		uint8_t bankIndex = engineConfiguration->cylinderBankSelect[i];
 		auto bankTrim =engine->stftCorrection[bankIndex];
 		auto cylinderTrim = getCylinderFuelTrim(i, rpm, fuelLoad);
 
-		// Apply both per-bank and per-cylinder trims
-		engine->engineState.injectionMass[i] = injectionMass * bankTrim * cylinderTrim;
+		// Apply long term, per-bank and per-cylinder trims
+		engine->engineState.injectionMass[i] = injectionMass * longTermTrim * bankTrim * cylinderTrim;
 
 		timingAdvance[i] = advance + getCylinderIgnitionTrim(i, rpm, ignitionLoad);
 	}
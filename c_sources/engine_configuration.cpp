@@ -577,6 +577,18 @@ static void setDefaultEngineConfiguration() {
 
 	engineConfiguration->useStepperIdle = false;
 
+	// Air mass idle model, ballpark for a 2 liter four: ~1.3mg of air per cylinder buys one Nm at idle efficiency
+	engineConfiguration->idleAirMassMode = false;
+	engineConfiguration->idleAirModel.airmassPerTorque = 1.3;
+	// belt driven compressors take roughly 5 to 10 Nm at idle with the clutch in, middle of that
+	engineConfiguration->idleAirModel.acTorque = 8;
+	engineConfiguration->idleAirModel.fan1Torque = 2;
+	engineConfiguration->idleAirModel.fan2Torque = 2;
+	engineConfiguration->idleAirModel.alternatorTorque = 10;
+	engineConfiguration->idleAirModel.gearTorque = 6;
+	setLinearCurve(config->idleAirFlowPositionBins, 0, 100, 1);
+	setLinearCurve(config->idleAirFlowRate, 0, 40, 0.1);
+
 	setLinearCurve(config->iacCoastingRpmBins, 0, 8000, 1);
 
 	setDefaultGppwmParameters();
@@ -46,6 +46,7 @@
 #include "vvt.h"
 #include "boost_control.h"
 #include "launch_control.h"
+#include "knock_logic.h"
 #include "tachometer.h"
 #include "gppwm.h"
 #include "date_stamp.h"
@@ -54,6 +55,7 @@
 #include "dynoview.h"
 #include "vr_pwm.h"
 #include "adc_subscription.h"
+#include "learn_table.h"
 
 #if EFI_SENSOR_CHART
 #include "sensor_chart.h"
@@ -67,6 +69,10 @@
 #include "logic_analyzer.h"
 #endif /* EFI_LOGIC_ANALYZER */
 
+#if EFI_CAN_SUPPORT
+#include "can_tasks.h"
+#endif /* EFI_CAN_SUPPORT */
+
 #if HAL_USE_ADC
 #include "AdcConfiguration.h"
 #endif /* HAL_USE_ADC */
@@ -469,9 +475,11 @@ void commonInitEngineController() {
 	initBoostCtrl();
 #endif /* EFI_BOOST_CONTROL */
 
-#if EFI_LAUNCH_CONTROL
-	initLaunchControl();
-#endif
+	initSoftSparkLimiter();
+
+	initKnockLearn();
+
+	initLongTermFuelTrim();
 
 #if EFI_UNIT_TEST
 	engine->rpmCalculator.Register();
@@ -599,6 +607,12 @@ bool validateConfig() {
 void initEngineController() {
 	addConsoleAction("sensorinfo", printSensorInfo);
 
+#if EFI_CAN_SUPPORT
+	// CAN hardware is started separately, these only register diagnostics and reset bus load window
+	initCanRx();
+	initCanTx();
+#endif /* EFI_CAN_SUPPORT */
+
 #if EFI_PROD_CODE && EFI_ENGINE_CONTROL
 	initBenchTest();
 #endif /* EFI_PROD_CODE && EFI_ENGINE_CONTROL */
@@ -0,0 +1,110 @@
+/**
+ * @file etb_fast_loop.h
+ *
+ * Fixed-point position PID of the ETB inner loop, see EtbFastLoop in electronic_throttle.cpp.
+ * Kept free of configuration and HAL so that the closed loop can be simulated from unit tests.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// percent values are Q8: 1% == 256
+#define ETB_Q8_ONE 256
+// gains and integrator are Q16
+#define ETB_Q16_ONE 65536
+
+// longer gaps between samples (ADC stalled, loop just armed) restart integration and derivative
+#define ETB_FAST_LOOP_MAX_INTERVAL_US 5000
+
+inline int32_t etbSaturate(int64_t x) {
+	if (x > INT32_MAX) {
+		return INT32_MAX;
+	} else if (x < INT32_MIN) {
+		return INT32_MIN;
+	} else {
+		return (int32_t)x;
+	}
+}
+
+inline int64_t etbClamp(int64_t low, int64_t x, int64_t high) {
+	return x < low ? low : (x > high ? high : x);
+}
+
+/**
+ * Float to fixed point. Saturates instead of wrapping, a large gain must not turn into a negative one.
+ */
+inline int32_t etbToFixed(float x, float one) {
+	float scaled = x * one;
+	// largest float below 2^31
+	if (scaled >= 2147483520.0f) {
+		return INT32_MAX;
+	} else if (scaled <= -2147483648.0f) {
+		return INT32_MIN;
+	} else {
+		return (int32_t)scaled;
+	}
+}
+
+#define ETB_Q8(x) etbToFixed((x), ETB_Q8_ONE)
+#define ETB_Q16(x) etbToFixed((x), ETB_Q16_ONE)
+
+/**
+ * Gains are per second, each sample is integrated and differentiated over the interval the caller measured
+ * since the previous one, so ADC jitter or a different conversion rate does not change the loop tuning.
+ */
+struct EtbFastPid {
+	void reset() {
+		integratorQ16 = 0;
+		hasLastError = false;
+	}
+
+	/**
+	 * @param intervalUs time since previous sample, zero or anything above ETB_FAST_LOOP_MAX_INTERVAL_US
+	 * skips I and D for this sample
+	 * @return output in Q8 percent
+	 */
+	int32_t update(int32_t targetQ8, int32_t positionQ8, uint32_t intervalUs) {
+		int32_t errorQ8 = targetQ8 - positionQ8;
+		bool isIntervalValid = intervalUs > 0 && intervalUs <= ETB_FAST_LOOP_MAX_INTERVAL_US;
+
+		// Q16 gain * Q8 error >> 16 == Q8 result
+		int64_t outputQ8 = feedForwardQ8 + (((int64_t)kpQ16 * errorQ8) >> 16);
+
+		if (isIntervalValid) {
+			// Q16 gain * Q8 error * seconds >> 8 == Q16 integrator
+			int64_t stepQ16 = (((int64_t)kiQ16 * errorQ8 * intervalUs) / 1000000) >> 8;
+			integratorQ16 = etbClamp(iTermMinQ16, integratorQ16 + stepQ16, iTermMaxQ16);
+		}
+		outputQ8 += integratorQ16 >> 8;
+
+		if (isIntervalValid && hasLastError) {
+			// error rate in Q8 percent per second, saturated so that the product below fits 64 bits
+			int32_t rateQ8 = etbSaturate((int64_t)(errorQ8 - lastErrorQ8) * 1000000 / intervalUs);
+			outputQ8 += ((int64_t)kdQ16 * rateQ8) >> 16;
+		}
+		lastErrorQ8 = errorQ8;
+		hasLastError = true;
+
+		return etbClamp(outputMinQ8, outputQ8, outputMaxQ8);
+	}
+
+	int32_t feedForwardQ8 = 0;
+	int32_t kpQ16 = 0;
+	int32_t kiQ16 = 0;
+	int32_t kdQ16 = 0;
+	int32_t iTermMinQ16 = 0;
+	int32_t iTermMaxQ16 = 0;
+	int32_t outputMinQ8 = 0;
+	int32_t outputMaxQ8 = 0;
+
+private:
+	int32_t integratorQ16 = 0;
+	int32_t lastErrorQ8 = 0;
+	bool hasLastError = false;
+};
+
+/**
+ * Runs the inner loop on a fresh TPS sample, called from the fast ADC callback, see electronic_throttle.cpp
+ */
+void etbFastLoopOnAdc();
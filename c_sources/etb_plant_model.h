@@ -0,0 +1,311 @@
+/**
+ * @file etb_plant_model.h
+ *
+ * Throttle plant model and its least squares identification. Kept out of
+ * electronic_throttle.cpp so that recorded logs can be fitted from unit tests.
+ */
+
+#pragma once
+
+#include <cstring>
+
+inline float etbSign(float x, float deadband = 0) {
+	if (x > deadband) {
+		return 1;
+	} else if (x < -deadband) {
+		return -1;
+	} else {
+		return 0;
+	}
+}
+
+// below that speed (percent per second) friction direction is unknown
+#define ETB_MODEL_VELOCITY_DEADBAND 1.0f
+
+// feed-forward blends friction in linearly over that target speed, percent per second
+#define ETB_FEED_FORWARD_FRICTION_BAND 20.0f
+// dynamic feed-forward never asks for more than that, percent duty
+#define ETB_FEED_FORWARD_DYNAMIC_LIMIT 30.0f
+// identification needs at least that many samples on each side of neutral to fit preload
+#define ETB_MODEL_MIN_SIDE_SAMPLES 20
+
+/**
+ * Throttle plant as seen from the motor, every term in percent duty:
+ *   duty = preload * sgn(x) + spring * x + friction * sgn(v) + damping * v + inertia * a
+ * x is plate position relative to limp home (neutral) position, v and a are its derivatives.
+ * Preload and spring hold the plate off neutral, friction and damping oppose motion.
+ */
+struct EtbPlantModel {
+	float neutral = 0;
+	float preload = 0;
+	float spring = 0;
+	float friction = 0;
+	float damping = 0;
+	float inertia = 0;
+
+	// duty which holds the plate still at given position
+	float getStaticDuty(percent_t position) const {
+		float x = position - neutral;
+		return preload * etbSign(x) + spring * x;
+	}
+
+	// extra duty to keep the plate moving at given speed and to accelerate it
+	float getDynamicDuty(float velocity, float acceleration) const {
+		return friction * etbSign(velocity, ETB_MODEL_VELOCITY_DEADBAND) + damping * velocity + inertia * acceleration;
+	}
+
+	/**
+	 * Dynamic duty for feed-forward from a target trajectory: friction ramps in with speed instead of
+	 * switching sign, which would chatter around a still target, and the total is limited
+	 */
+	float getFeedForwardDuty(float velocity, float acceleration) const {
+		float frictionScale = velocity / ETB_FEED_FORWARD_FRICTION_BAND;
+		if (frictionScale > 1) {
+			frictionScale = 1;
+		} else if (frictionScale < -1) {
+			frictionScale = -1;
+		}
+
+		float duty = friction * frictionScale + damping * velocity + inertia * acceleration;
+
+		if (duty > ETB_FEED_FORWARD_DYNAMIC_LIMIT) {
+			return ETB_FEED_FORWARD_DYNAMIC_LIMIT;
+		} else if (duty < -ETB_FEED_FORWARD_DYNAMIC_LIMIT) {
+			return -ETB_FEED_FORWARD_DYNAMIC_LIMIT;
+		}
+		return duty;
+	}
+};
+
+/**
+ * Velocity and acceleration of the ETB target for the dynamic feed-forward. The target goes through two
+ * first order filters before being differentiated, so a pedal step becomes a bounded velocity ramp
+ * instead of a one period spike. State is seeded from the first target seen.
+ */
+class EtbTargetDerivative {
+public:
+	// forget history, next update seeds from its target
+	void clear() {
+		m_isSeeded = false;
+		m_velocity = 0;
+		m_acceleration = 0;
+	}
+
+	void update(percent_t target, float periodSeconds, float timeConstant) {
+		if (!m_isSeeded) {
+			m_stage1 = target;
+			m_stage2 = target;
+			m_isSeeded = true;
+			return;
+		}
+
+		float alpha = periodSeconds / (timeConstant + periodSeconds);
+		m_stage1 += alpha * (target - m_stage1);
+		float stage2 = m_stage2 + alpha * (m_stage1 - m_stage2);
+
+		float velocity = (stage2 - m_stage2) / periodSeconds;
+		m_acceleration = (velocity - m_velocity) / periodSeconds;
+		m_velocity = velocity;
+		m_stage2 = stage2;
+	}
+
+	float getVelocity() const {
+		return m_velocity;
+	}
+
+	float getAcceleration() const {
+		return m_acceleration;
+	}
+
+private:
+	bool m_isSeeded = false;
+	float m_stage1 = 0;
+	float m_stage2 = 0;
+	float m_velocity = 0;
+	float m_acceleration = 0;
+};
+
+static constexpr size_t etbModelTerms = 5;
+
+/**
+ * Least squares fit of EtbPlantModel from duty/position samples taken at a fixed period.
+ * Only normal equations are kept, so samples can be streamed from the ETB thread or from a recorded log.
+ */
+class EtbPlantIdentifier {
+public:
+	void reset(percent_t neutral, float periodSeconds) {
+		m_neutral = neutral;
+		m_period = periodSeconds;
+		m_sampleCount = 0;
+		m_fitCount = 0;
+		m_aboveNeutral = 0;
+		m_belowNeutral = 0;
+		m_minPosition = 100;
+		m_maxPosition = 0;
+		memset(m_ata, 0, sizeof(m_ata));
+		memset(m_atb, 0, sizeof(m_atb));
+	}
+
+	/**
+	 * @param duty percent duty applied during the period which ended with this position sample
+	 */
+	void addSample(float duty, percent_t position) {
+		m_positions[0] = m_positions[1];
+		m_positions[1] = m_positions[2];
+		m_positions[2] = position;
+		m_duties[0] = m_duties[1];
+		m_duties[1] = duty;
+
+		m_sampleCount++;
+		if (m_sampleCount < 3) {
+			return;
+		}
+
+		// central differences around the middle sample
+		float velocity = (m_positions[2] - m_positions[0]) / (2 * m_period);
+		float acceleration = (m_positions[2] - 2 * m_positions[1] + m_positions[0]) / (m_period * m_period);
+		float x = m_positions[1] - m_neutral;
+
+		if (x > 0) {
+			m_aboveNeutral++;
+		} else if (x < 0) {
+			m_belowNeutral++;
+		}
+
+		if (m_positions[1] < m_minPosition) {
+			m_minPosition = m_positions[1];
+		}
+		if (m_positions[1] > m_maxPosition) {
+			m_maxPosition = m_positions[1];
+		}
+
+		float terms[etbModelTerms] = {
+			etbSign(x),
+			x,
+			etbSign(velocity, ETB_MODEL_VELOCITY_DEADBAND),
+			velocity,
+			acceleration,
+		};
+
+		// duty driving the middle sample: applied between samples 0 and 1 and between 1 and 2
+		float y = 0.5f * (m_duties[0] + m_duties[1]);
+
+		for (size_t i = 0; i < etbModelTerms; i++) {
+			for (size_t j = 0; j < etbModelTerms; j++) {
+				m_ata[i][j] += terms[i] * terms[j];
+			}
+			m_atb[i] += terms[i] * y;
+		}
+
+		m_fitCount++;
+	}
+
+	expected<EtbPlantModel> fit() const {
+		// too few samples to say anything about five parameters
+		if (m_fitCount < 100) {
+			return unexpected;
+		}
+
+		// Preload is the step in static duty across neutral. From one side only it can't be told apart from
+		// the spring, and the fitted curve on the unseen side would be pure extrapolation
+		if (!hasCrossedNeutral()) {
+			return unexpected;
+		}
+
+		// Gaussian elimination with partial pivoting on a copy of normal equations
+		float a[etbModelTerms][etbModelTerms + 1];
+		for (size_t i = 0; i < etbModelTerms; i++) {
+			for (size_t j = 0; j < etbModelTerms; j++) {
+				a[i][j] = m_ata[i][j];
+			}
+			a[i][etbModelTerms] = m_atb[i];
+		}
+
+		for (size_t col = 0; col < etbModelTerms; col++) {
+			size_t pivot = col;
+			for (size_t row = col + 1; row < etbModelTerms; row++) {
+				if (absF(a[row][col]) > absF(a[pivot][col])) {
+					pivot = row;
+				}
+			}
+
+			// excitation did not reach some of the terms, e.g. never crossed neutral
+			if (absF(a[pivot][col]) < 1e-6f) {
+				return unexpected;
+			}
+
+			if (pivot != col) {
+				for (size_t j = 0; j <= etbModelTerms; j++) {
+					float tmp = a[col][j];
+					a[col][j] = a[pivot][j];
+					a[pivot][j] = tmp;
+				}
+			}
+
+			for (size_t row = col + 1; row < etbModelTerms; row++) {
+				float factor = a[row][col] / a[col][col];
+				for (size_t j = col; j <= etbModelTerms; j++) {
+					a[row][j] -= factor * a[col][j];
+				}
+			}
+		}
+
+		float solution[etbModelTerms];
+		for (int row = etbModelTerms - 1; row >= 0; row--) {
+			float sum = a[row][etbModelTerms];
+			for (size_t j = row + 1; j < etbModelTerms; j++) {
+				sum -= a[row][j] * solution[j];
+			}
+			solution[row] = sum / a[row][row];
+		}
+
+		EtbPlantModel model;
+		model.neutral = m_neutral;
+		model.preload = solution[0];
+		model.spring = solution[1];
+		model.friction = solution[2];
+		model.damping = solution[3];
+		model.inertia = solution[4];
+
+		return model;
+	}
+
+	size_t getSampleCount() const {
+		return m_sampleCount;
+	}
+
+	bool hasCrossedNeutral() const {
+		return m_aboveNeutral >= ETB_MODEL_MIN_SIDE_SAMPLES && m_belowNeutral >= ETB_MODEL_MIN_SIDE_SAMPLES;
+	}
+
+	// positions the fit has seen, static duty is only known in between
+	percent_t getMinPosition() const {
+		return m_minPosition;
+	}
+
+	percent_t getMaxPosition() const {
+		return m_maxPosition;
+	}
+
+private:
+	percent_t m_neutral = 0;
+	float m_period = 0;
+	size_t m_sampleCount = 0;
+	size_t m_fitCount = 0;
+	size_t m_aboveNeutral = 0;
+	size_t m_belowNeutral = 0;
+	percent_t m_minPosition = 100;
+	percent_t m_maxPosition = 0;
+
+	float m_positions[3] = {};
+	float m_duties[2] = {};
+
+	float m_ata[etbModelTerms][etbModelTerms];
+	float m_atb[etbModelTerms];
+};
+
+/**
+ * Offline identification from a recorded log, for example in unit tests
+ * @param duty percent duty applied during each period, ending with matching position sample
+ */
+expected<EtbPlantModel> identifyEtbPlant(const float* duty, const float* position, size_t count, float periodSeconds, percent_t neutral);
@@ -40,11 +40,55 @@ void GearDetector::onConfigurationChange(engine_configuration_s const * /*previo
 	}
 }
 
+// Below this the ratio is too close to a gear threshold, or still moving too much, to call the gear
+#define GEAR_CONFIDENCE_THRESHOLD 0.5f
+
 void GearDetector::onSlowCallback() {
 	float ratio = computeGearboxRatio();
 	m_gearboxRatio = ratio;
 
-	m_currentGear = determineGearFromRatio(ratio);
+	if (ratio == 0) {
+		// too slow to tell, start over once moving
+		m_filteredRatio = 0;
+		m_gearConfidence = 0;
+		m_currentGear = 0;
+		return;
+	}
+
+	// ~150ms time constant at the slow callback rate: rides through driveline shunt and VSS quantization
+	// while still following a shift within a few callbacks
+	m_filteredRatio = m_filteredRatio == 0 ? ratio : m_filteredRatio + 0.25f * (ratio - m_filteredRatio);
+
+	size_t gear = determineGearFromRatio(m_filteredRatio);
+	m_gearConfidence = getGearConfidence(gear, m_filteredRatio, ratio);
+
+	// Hold the last gear through a shift or clutch slip rather than flicking through whatever lies in between
+	if (m_gearConfidence >= GEAR_CONFIDENCE_THRESHOLD) {
+		m_currentGear = gear;
+	}
+}
+
+/**
+ * @return 0..1, how sure we are that the gearbox is in the gear the filtered ratio points at.
+ * Low when the ratio sits between two gears, or when the raw ratio disagrees with the filtered one (shift in progress, slip).
+ */
+float GearDetector::getGearConfidence(size_t gear, float filteredRatio, float rawRatio) const {
+	if (gear == 0) {
+		// out of range of any gear, confidently neutral
+		return 1;
+	}
+
+	// 1 right on the gear ratio, 0 at the threshold to the neighbouring gear
+	float gearRatio = engineConfiguration->gearRatio[gear - 1];
+	float thresholdRatio = filteredRatio > gearRatio
+		? (gear > 1 ? m_gearThresholds[gear - 2] : gearRatio * 1.5f)
+		: (gear < engineConfiguration->totalGearsCount ? m_gearThresholds[gear - 1] : gearRatio * 0.66f);
+	float closeness = 1 - absF(filteredRatio - gearRatio) / absF(thresholdRatio - gearRatio);
+
+	// a settled ratio agrees with the raw value to within a few percent
+	float stability = 1 - absF(rawRatio - filteredRatio) / (0.1f * filteredRatio);
+
+	return clampF(0, minF(closeness, stability), 1);
 }
 
 size_t GearDetector::determineGearFromRatio(float ratio) const {
@@ -128,3 +172,7 @@ float GearDetector::getGearboxRatio() const {
 size_t GearDetector::getCurrentGear() const {
 	return m_currentGear;
 }
+
+float GearDetector::getGearConfidence() const {
+	return m_gearConfidence;
+}
@@ -153,7 +153,7 @@ static void HeaterThread(void*)
     while (true)
     {
         // Read sensor state
-        float heaterEsr = GetSensorInternalResistance();
+        float heaterEsr = GetSensorNormalizedEsr();
 
         auto heaterAllowState = GetHeaterAllowed();
 
@@ -27,6 +27,7 @@
 #include "pch.h"
 
 #include "high_pressure_fuel_pump.h"
+#include "cam_listeners.h"
 #include "spark_logic.h"
 #include "fuel_computer.h"
 
@@ -35,36 +36,84 @@
 // A constant we use; doesn't seem important to hoist into engineConfiguration.
 static constexpr int rpm_spinning_cutoff = 60; // Below this RPM, we don't run the logic
 
-angle_t HpfpLobe::findNextLobe() {
-	// TODO: Ideally we figure out where we are in the engine cycle and pick the next lobe
-	// based on that.  At least we should do that when cranking, so we can start that much
-	// sooner.
+// Queued events are only moved by cam updates while they are at least this far ahead of the crank,
+// otherwise the event could move behind the current tooth and be missed for a whole cycle
+static constexpr angle_t camCorrectionMargin = 20;
+
+static angle_t wrapEngineCycle(angle_t angle) {
+	while (angle < 0) {
+		angle += 720;
+	}
+	while (angle >= 720) {
+		angle -= 720;
+	}
+	return angle;
+}
 
-	auto lobes = engineConfiguration->hpfpCamLobes;
-	if (!lobes) {
+/**
+ * Lobe peak positions only depend on configuration, recompute them when it changes
+ */
+void HpfpLobe::updateLobeAngles() {
+	int lobes = minI(engineConfiguration->hpfpCamLobes, HPFP_MAX_LOBES);
+	angle_t peakPos = engineConfiguration->hpfpPeakPos;
+
+	if (lobes == m_lobeCount && peakPos == m_peakPos) {
+		return;
+	}
+
+	for (int i = 0; i < lobes; i++) {
+		m_lobeAngles[i] = peakPos + i * 720.f / lobes;
+	}
+
+	m_lobeCount = lobes;
+	m_peakPos = peakPos;
+}
+
+angle_t HpfpLobe::getVvtOffset() const {
+	if (engineConfiguration->hpfpCam == HPFP_CAM_NONE) {
 		return 0;
 	}
 
-	// Which lobe are we on?
-	int next_index = m_lobe_index + 1;
-	// Note, this will be insufficient if the # of cam lobes is
-	// dynamically changed rapidly by more than 2x, but it will
-	// correct itself rather quickly.
-	if (next_index >= lobes) {
-		next_index -= lobes;
+	// TODO: Is the sign correct here?  + means ATDC?
+	return engine->triggerCentral.getVVTPosition(
+		(engineConfiguration->hpfpCam - 1) / 2 & 1, // Bank
+		(engineConfiguration->hpfpCam - 1) & 1);    // Cam
+}
+
+/**
+ * Point the lobe index so that the next findNextLobe() returns the first lobe ahead of the crank
+ */
+void HpfpLobe::syncToEnginePhase(efitick_t nowNt) {
+	auto phase = engine->triggerCentral.getCurrentEnginePhase(nowNt);
+	if (!phase || !m_lobeCount) {
+		return;
+	}
+
+	angle_t enginePhase = phase.Value - tdcPosition();
+	angle_t vvt = getVvtOffset();
+
+	int next = 0;
+	angle_t closest = 720;
+	for (int i = 0; i < m_lobeCount; i++) {
+		angle_t ahead = wrapEngineCycle(m_lobeAngles[i] + vvt - enginePhase);
+		if (ahead < closest) {
+			closest = ahead;
+			next = i;
+		}
 	}
-	m_lobe_index = next_index;
 
-	// Calculate impact of VVT
-	angle_t vvt = 0;
-	if (engineConfiguration->hpfpCam != HPFP_CAM_NONE) {
-		// TODO: Is the sign correct here?  + means ATDC?
-		vvt = engine->triggerCentral.getVVTPosition(
-			(engineConfiguration->hpfpCam - 1) / 2 & 1, // Bank
-			(engineConfiguration->hpfpCam - 1) & 1);    // Cam
+	m_lobe_index = (next + m_lobeCount - 1) % m_lobeCount;
+}
+
+angle_t HpfpLobe::findNextLobe() {
+	if (!m_lobeCount) {
+		return 0;
 	}
 
-	return engineConfiguration->hpfpPeakPos + vvt + next_index * 720 / lobes;
+	// modulo also takes care of lobe count having been reduced since last call
+	m_lobe_index = (m_lobe_index + 1) % m_lobeCount;
+
+	return m_lobeAngles[m_lobe_index] + getVvtOffset();
 }
 
 // As a percent of the full pump stroke
@@ -79,10 +128,15 @@ float HpfpQuantity::calcFuelPercent(int rpm) {
 			      engineConfiguration->hpfpCompensationRpmBins, rpm);
 }
 
+/**
+ * Invoked once per lobe, so the I term is applied per pump stroke as configured
+ */
 float HpfpQuantity::calcPI(int rpm, float calc_fuel_percent) {
+	// two revolutions per cycle
+	float lobePeriodSeconds = 120.f / (rpm * engineConfiguration->hpfpCamLobes);
+
 	m_pressureTarget_kPa = std::max<float>(
-		m_pressureTarget_kPa - (engineConfiguration->hpfpTargetDecay *
-					(FAST_CALLBACK_PERIOD_MS / 1000.)),
+		m_pressureTarget_kPa - engineConfiguration->hpfpTargetDecay * lobePeriodSeconds,
 		interpolate3d(engineConfiguration->hpfpTarget,
 			      engineConfiguration->hpfpTargetLoadBins, Sensor::get(SensorType::Map).value_or(0), // TODO: allow other load axis, like we claim to
 			      engineConfiguration->hpfpTargetRpmBins, rpm));
@@ -96,17 +150,8 @@ float HpfpQuantity::calcPI(int rpm, float calc_fuel_percent) {
 		m_pressureTarget_kPa - fuelPressure.Value;
 
 	float p_control_percent = pressureError_kPa * engineConfiguration->hpfpPidP;
-	float i_factor_divisor =
-		1000. * // ms/sec
-		60. *   // sec/min -> ms/min
-		2.;     // rev/cycle -> (rev * ms) / (min * cycle)
-	float i_factor =
-		engineConfiguration->hpfpPidI * // % / (kPa * lobe)
-		rpm * // (% * revs) / (kPa * lobe * min)
-		engineConfiguration->hpfpCamLobes * // lobes/cycle -> (% * revs) / (kPa * min * cycles)
-		(FAST_CALLBACK_PERIOD_MS / // (% * revs * ms) / (kPa * min * cycles)
-		 i_factor_divisor); // % / kPa
-	float i_control_percent = m_I_sum_percent + pressureError_kPa * i_factor;
+	// % / (kPa * lobe), one lobe per invocation
+	float i_control_percent = m_I_sum_percent + pressureError_kPa * engineConfiguration->hpfpPidI;
 	// Clamp the output so that calc_fuel_percent+i_control_percent is within 0% to 100%
 	// That way the I term can override any fuel calculations over the long term.
 	// The P term is still allowed to drive the total output over 100% or under 0% to react to
@@ -121,8 +166,7 @@ angle_t HpfpQuantity::pumpAngleFuel(int rpm, HpfpController *model) {
 	// Math based on fuel requested
 	model->fuel_requested_percent = calcFuelPercent(rpm);
 
-	model->fuel_requested_percent_pi = calcPI(rpm, model->fuel_requested_percent);
-	// Apply PI control
+	// Apply PI control, as of the last lobe
 	float fuel_requested_percentTotal = model->fuel_requested_percent + model->fuel_requested_percent_pi;
 
 
@@ -142,7 +186,11 @@ void HpfpController::onFastCallback() {
 		    !enginePins.hpfpValve.isInitialized();
 	// What conditions can we not handle?
 	if (isHpfpInactive) {
+		// PI state is also updated by onLobeSample() from the trigger scheduler, which can interrupt us
+		chibios_rt::CriticalSectionLocker csl;
+
 		m_quantity.reset();
+		fuel_requested_percent_pi = 0;
 		m_requested_pump = 0;
 		m_deadtime = 0;
 	} else {
@@ -158,15 +206,84 @@ void HpfpController::onFastCallback() {
 
 		// We set deadtime first, then pump, in case pump used to be 0.  Pump is what
 		// determines whether we do anything or not.
-		m_requested_pump = m_quantity.pumpAngleFuel(rpm, this);
+		{
+			// same request as onLobeSample() computes, don't let it interleave with ours
+			chibios_rt::CriticalSectionLocker csl;
+			m_requested_pump = m_quantity.pumpAngleFuel(rpm, this);
+		}
+
+		m_lobe.updateLobeAngles();
+		m_sampleLobe.updateLobeAngles();
 
 		if (!m_running) {
 			m_running = true;
+			efitick_t nowNt = getTimeNowNt();
+			m_lobe.syncToEnginePhase(nowNt);
+			m_sampleLobe.syncToEnginePhase(nowNt);
 			scheduleNextCycle();
+			scheduleNextSample();
 		}
 	}
 }
 
+/**
+ * Invoked at lobe peak: pressure is sampled at the same pump phase every stroke, which keeps
+ * pumping ripple out of the PI loop
+ */
+void HpfpController::onLobeSample(HpfpController *self) {
+	// the sample event is only ever queued from here, so the valve chain can't push it away from its lobe
+	self->scheduleNextSample();
+
+	int rpm = Sensor::getOrZero(SensorType::Rpm);
+	if (self->isHpfpInactive || rpm < rpm_spinning_cutoff) {
+		return;
+	}
+
+	self->fuel_requested_percent_pi = self->m_quantity.calcPI(rpm, self->fuel_requested_percent);
+	self->m_requested_pump = self->m_quantity.pumpAngleFuel(rpm, self);
+}
+
+/**
+ * Invoked on every cam position update. Events which are still waiting for their trigger tooth are
+ * moved by the change of VVT position since they were queued.
+ */
+void HpfpController::onCamUpdate(efitick_t nowNt) {
+	if (!m_running || engineConfiguration->hpfpCam == HPFP_CAM_NONE) {
+		return;
+	}
+
+	auto phase = engine->triggerCentral.getCurrentEnginePhase(nowNt);
+	if (!phase) {
+		return;
+	}
+	angle_t enginePhase = phase.Value - tdcPosition();
+	angle_t vvt = m_lobe.getVvtOffset();
+
+	// Each event remembers the VVT position it was last placed for, that only follows if the event really moved
+	auto moveEvent = [&](AngleBasedEventOld& event, angle_t& angle, angle_t& scheduledVvt) {
+		angle_t delta = vvt - scheduledVvt;
+		if (absF(delta) < 0.1f) {
+			return;
+		}
+
+		if (wrapEngineCycle(angle - enginePhase) <= camCorrectionMargin
+			|| wrapEngineCycle(angle + delta - enginePhase) <= camCorrectionMargin) {
+			return;
+		}
+
+		// Only events still in the angle based queue, once with the executor the timing is fixed
+		if (engine->module<TriggerScheduler>()->moveQueuedEvent(&event, angle + delta)) {
+			angle += delta;
+			scheduledVvt += delta;
+		}
+	};
+
+	chibios_rt::CriticalSectionLocker csl;
+
+	moveEvent(m_event, m_eventAngle, m_eventVvt);
+	moveEvent(m_sampleEvent, m_sampleAngle, m_sampleVvt);
+}
+
 void HpfpController::pinTurnOn(HpfpController *self) {
 	enginePins.hpfpValve.setHigh();
 
@@ -194,9 +311,12 @@ void HpfpController::scheduleNextCycle() {
 	angle_t lobe = m_lobe.findNextLobe();
 	angle_t angle_requested = m_requested_pump;
 
+	m_eventVvt = m_lobe.getVvtOffset();
+
 	angleAboveMin = angle_requested > engineConfiguration->hpfpMinAngle;
 	if (angleAboveMin) {
 		di_nextStart = lobe - angle_requested - m_deadtime;
+		m_eventAngle = di_nextStart;
 
 		/**
 		 * We are good to use just one m_event instance because new events are scheduled when we turn off valve.
@@ -208,6 +328,8 @@ void HpfpController::scheduleNextCycle() {
 
 		// Off will be scheduled after turning the valve on
 	} else {
+		m_eventAngle = lobe;
+
 		// Schedule this, even if we aren't opening the valve this time, since this
 		// will schedule the next lobe.
 		// todo: would it have been cleaner to schedule 'scheduleNextCycle' directly?
@@ -217,4 +339,25 @@ void HpfpController::scheduleNextCycle() {
 	}
 }
 
+/**
+ * Pressure control runs once per lobe regardless of whether the valve opens. Sampling walks
+ * the lobes with its own index, independent of when the valve events fire.
+ */
+void HpfpController::scheduleNextSample() {
+	if (!m_running) {
+		return;
+	}
+
+	m_sampleAngle = m_sampleLobe.findNextLobe();
+	m_sampleVvt = m_sampleLobe.getVvtOffset();
+
+	engine->module<TriggerScheduler>()->scheduleOrQueue(
+		&m_sampleEvent, TRIGGER_EVENT_UNDEFINED, 0, m_sampleAngle,
+		{ onLobeSample, this });
+}
+
+void onHpfpCamUpdate(efitick_t nowNt) {
+	engine->module<HpfpController>()->onCamUpdate(nowNt);
+}
+
 #endif // EFI_HPFP
@@ -15,6 +15,7 @@
 #if EFI_IDLE_CONTROL
 #include "idle_thread.h"
 #include "idle_hardware.h"
+#include "torque_sources.h"
 
 #include "periodic_task.h"
 #include "dc_motors.h"
@@ -89,15 +90,72 @@ float IdleController::getCrankingOpenLoop(float clt) const {
 	return engineConfiguration->crankingIACposition * mult;
 }
 
+/**
+ * @return brake torque, in Nm, the currently active accessory and drivetrain loads take away from idle
+ */
+float IdleController::getIdleLoadTorque() const {
+	auto& model = engineConfiguration->idleAirModel;
+
+	float torque = 0;
+
+	// Use the actual compressor clutch state, not the button: AC may be held off by rpm/clt/tps limits
+	torque += engine->module<AcController>().unmock().isAcEnabled() ? model.acTorque : 0;
+	torque += enginePins.fanRelay.getLogicValue() ? model.fan1Torque : 0;
+	torque += enginePins.fanRelay2.getLogicValue() ? model.fan2Torque : 0;
+
+#if EFI_ALTERNATOR_CONTROL
+	// field duty is a good proxy for the electrical load the alternator is putting on the crank
+	torque += model.alternatorTorque * getAlternatorDuty() / 100;
+#endif // EFI_ALTERNATOR_CONTROL
+
+#if EFI_TCU
+	// automatic in drive/reverse: torque converter drags on the engine
+	if (engine->gearController != nullptr && engine->gearController->getDesiredGear() != NEUTRAL) {
+		torque += model.gearTorque;
+	}
+#endif // EFI_TCU
+
+	return torque;
+}
+
+/**
+ * Air mass targeting: instead of bumping valve position by a fixed amount per load and waiting for rpm
+ * to sag before PID reacts, convert the predicted load torque into the extra air the engine has to
+ * breathe to hold target rpm, then look up the valve position which flows base + extra air.
+ * PID is left to trim whatever the model got wrong.
+ */
+percent_t IdleController::getAirModelPosition(percent_t basePosition, float targetRpm) {
+	idleLoadTorque = getIdleLoadTorque();
+
+	// Extra air each cylinder needs per cycle to make that torque
+	float extraCylinderAirmass = idleLoadTorque * engineConfiguration->idleAirModel.airmassPerTorque / 1000;	// mg -> g
+
+	// ...and the same as engine airflow at the speed we want to hold it at
+	constexpr float gramsPerMsToKgPerHour = (3600.0f * 1000.0f) / 1000.0f;
+	float extraAirflow = targetRpm == 0 ? 0
+		: extraCylinderAirmass * engineConfiguration->specs.cylindersCount * gramsPerMsToKgPerHour / getEngineCycleDuration(targetRpm);
+
+	// The flow curve is monotonic, so it can be walked either direction: position -> flow and flow -> position
+	float baseAirflow = interpolate2d(basePosition, config->idleAirFlowPositionBins, config->idleAirFlowRate);
+	idleAirflowTarget = baseAirflow + extraAirflow;
+
+	return interpolate2d(idleAirflowTarget, config->idleAirFlowRate, config->idleAirFlowPositionBins);
+}
+
 percent_t IdleController::getRunningOpenLoop(float rpm, float clt, SensorResult tps) {
 	float running =
 		engineConfiguration->manIdlePosition		// Base idle position (slider)
 		* interpolate2d(clt, config->cltIdleCorrBins, config->cltIdleCorr);
 
-	// Now we bump it by the AC/fan amount if necessary
-	running += engine->module<AcController>().unmock().acButtonState ? engineConfiguration->acIdleExtraOffset : 0;
-	running += enginePins.fanRelay.getLogicValue() ? engineConfiguration->fan1ExtraIdle : 0;
-	running += enginePins.fanRelay2.getLogicValue() ? engineConfiguration->fan2ExtraIdle : 0;
+	if (engineConfiguration->idleAirMassMode) {
+		// Loads are handled in the air domain, this replaces the fixed AC/fan adders
+		running = getAirModelPosition(running, m_lastTargetRpm);
+	} else {
+		// Now we bump it by the AC/fan amount if necessary
+		running += engine->module<AcController>().unmock().acButtonState ? engineConfiguration->acIdleExtraOffset : 0;
+		running += enginePins.fanRelay.getLogicValue() ? engineConfiguration->fan1ExtraIdle : 0;
+		running += enginePins.fanRelay2.getLogicValue() ? engineConfiguration->fan2ExtraIdle : 0;
+	}
 
 	running += luaAdd;
 
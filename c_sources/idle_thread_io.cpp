@@ -71,6 +71,12 @@ static void showIdleInfo() {
 		}
 	}
 
+	if (engineConfiguration->idleAirMassMode) {
+		auto& controller = engine->module<IdleController>().unmock();
+		efiPrintf("air mass idle: load=%.1fNm airflow target=%.2fkg/h",
+				controller.idleLoadTorque, controller.idleAirflowTarget);
+	}
+
 	if (engineConfiguration->idleMode == IM_AUTO) {
 		engine->module<IdleController>().unmock().getIdlePid()->showPidStatus("idle");
 	}
@@ -35,3 +35,40 @@ float interpolate_1d_float(const struct inter_point *p, int size, float x)
 	/* no exterpolation */
 	return p[size - 1].y;
 }
+
+/*
+ * Uniformly spaced fixed point table, built once from a float reference. On parts without an FPU a lookup
+ * is one multiply to find the bin and one integer lerp, instead of a search and a soft float division.
+ * x is Q16, y is stored in whatever fixed point format the caller chose for the reference.
+ */
+void fixed_table_build(struct fixed_table *t, float (*reference)(float), float xMin, float xMax, float yScale)
+{
+	float step = (xMax - xMin) / (FIXED_TABLE_SIZE - 1);
+
+	t->x0 = (int32_t)(xMin * 65536);
+	t->invStep = (int32_t)(65536 / step);
+
+	for (int i = 0; i < FIXED_TABLE_SIZE; i++) {
+		t->y[i] = (int16_t)(reference(xMin + i * step) * yScale + 0.5f);
+	}
+}
+
+int32_t fixed_table_lookup(const struct fixed_table *t, int32_t x)
+{
+	/* no exterpolation */
+	if (x <= t->x0)
+		return t->y[0];
+
+	/* position in bins, Q16 */
+	int64_t pos = ((int64_t)(x - t->x0) * t->invStep) >> 16;
+	int32_t idx = (int32_t)(pos >> 16);
+
+	if (idx >= FIXED_TABLE_SIZE - 1)
+		return t->y[FIXED_TABLE_SIZE - 1];
+
+	int32_t frac = (int32_t)(pos & 0xFFFF);
+	int32_t y1 = t->y[idx];
+	int32_t y2 = t->y[idx + 1];
+
+	return y1 + (((y2 - y1) * frac) >> 16);
+}
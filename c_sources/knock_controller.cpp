@@ -7,10 +7,50 @@
 
 #include "pch.h"
 #include "knock_logic.h"
+#include "learn_table.h"
 
 
 #include "hip9011.h"
 
+// marks backup RAM contents as learned knock data rather than garbage after power loss
+#define KNOCK_LEARN_COOKIE 0x4b4e4c31
+
+// learned knock retard survives ignition off, it is not part of the tune
+static LearnStorage<KnockLearnData, KNOCK_LEARN_COOKIE> knockLearnStorage;
+
+static void showKnockLearn() {
+	auto data = knockLearnStorage.get();
+
+	efiPrintf("Knock learn %s, max %.1f deg", engineConfiguration->knockLearn.enabled ? "enabled" : "disabled",
+			engineConfiguration->knockLearn.maxRetard);
+
+	// only cells which actually hold retard
+	for (size_t load = 0; load < efi::size(data->Table); load++) {
+		for (size_t rpm = 0; rpm < efi::size(data->Table[load]); rpm++) {
+			float cell = data->Table[load][rpm];
+			if (cell > 0) {
+				efiPrintf("load %d rpm %d: %.2f deg", (int)config->maxKnockRetardLoadBins[load],
+						(int)config->maxKnockRetardRpmBins[rpm], cell);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < engineConfiguration->specs.cylindersCount; i++) {
+		efiPrintf("cylinder %d offset %.2f deg", (int)i + 1, data->CylinderOffset[i]);
+	}
+}
+
+void initKnockLearn() {
+	knockLearnStorage.init(BACKUP_LEARN_DATA(KnockLearn), [](const KnockLearnData& data) {
+		return isLearnRangeValid(data.Table, 0, 30) && isLearnRangeValid(data.CylinderOffset, 0, 30);
+	});
+
+	addConsoleAction("knocklearninfo", showKnockLearn);
+	addConsoleAction("resetknocklearn", [](){
+		knockLearnStorage.reset();
+	});
+}
+
 void KnockController::onConfigurationChange(engine_configuration_s const * previousConfig) {
 	KnockControllerBase::onConfigurationChange(previousConfig);
 
@@ -85,6 +125,12 @@ bool KnockControllerBase::onKnockSenseCompleted(uint8_t cylinderNumber, float db
 			auto newRetard = m_knockRetard + retardAmount;
 			m_knockRetard = clampF(0, newRetard, m_maximumRetard);
 		}
+
+		if (engineConfiguration->knockLearn.enabled && cylinderNumber < efi::size(knockLearnStorage.get()->CylinderOffset)) {
+			// the global table learns what all cylinders need, offset takes what is specific to this one
+			float& offset = knockLearnStorage.get()->CylinderOffset[cylinderNumber];
+			offset = minF(offset + engineConfiguration->knockLearn.cylinderStep, engineConfiguration->knockLearn.maxRetard);
+		}
 	}
 
 	return isKnock;
@@ -94,6 +140,58 @@ float KnockControllerBase::getKnockRetard() const {
 	return m_knockRetard;
 }
 
+/**
+ * Learned retard is applied ahead of knock, total with reactive retard still obeys maximum retard
+ */
+float KnockControllerBase::getLearnedKnockRetard(uint8_t cylinderNumber) const {
+	if (!engineConfiguration->knockLearn.enabled || cylinderNumber >= efi::size(knockLearnStorage.get()->CylinderOffset)) {
+		return 0;
+	}
+
+	float learned = m_learnedRetard + knockLearnStorage.get()->CylinderOffset[cylinderNumber];
+	return clampF(0, learned, maxF(0, m_maximumRetard - m_knockRetard));
+}
+
+/**
+ * Reactive retard is integrated into the cells around the operating point, cells slowly give
+ * timing back while there is no knock.
+ */
+void KnockControllerBase::updateKnockLearn(float rpm, float load) {
+	const auto& cfg = engineConfiguration->knockLearn;
+	auto data = knockLearnStorage.get();
+
+	constexpr float dt = FAST_CALLBACK_PERIOD_MS / 1000.0f;
+
+	float maxRetard = clampF(0, cfg.maxRetard, 30);
+	float recovery = maxF(0, cfg.recoveryRate) * dt;
+
+#if EFI_SHAFT_POSITION_INPUT
+	bool isRunning = engine->rpmCalculator.isRunning();
+#else
+	bool isRunning = false;
+#endif // EFI_SHAFT_POSITION_INPUT
+
+	if (isRunning) {
+		// while knock controller is pulling timing, learn a fraction of it per second
+		float step = m_knockRetard > 0
+			? maxF(0, cfg.learnRate) * m_knockRetard * dt
+			: -recovery;
+
+		learnTableBilinear(data->Table,
+			config->maxKnockRetardLoadBins, load,
+			config->maxKnockRetardRpmBins, rpm,
+			step, 0, maxRetard);
+
+		for (size_t i = 0; i < engineConfiguration->specs.cylindersCount && i < efi::size(data->CylinderOffset); i++) {
+			data->CylinderOffset[i] = clampF(0, data->CylinderOffset[i] - recovery, maxRetard);
+		}
+	}
+
+	m_learnedRetard = interpolate3d(data->Table,
+		config->maxKnockRetardLoadBins, load,
+		config->maxKnockRetardRpmBins, rpm);
+}
+
 uint32_t KnockControllerBase::getKnockCount() const {
 	return m_knockCount;
 }
@@ -115,6 +213,12 @@ void KnockControllerBase::onFastCallback() {
 		// don't allow retard to go negative
 		m_knockRetard = maxF(0, newRetard);
 	}
+
+	if (engineConfiguration->knockLearn.enabled) {
+		updateKnockLearn(Sensor::getOrZero(SensorType::Rpm), getIgnitionLoad());
+	} else {
+		m_learnedRetard = 0;
+	}
 }
 
 float KnockController::getKnockThreshold() const {
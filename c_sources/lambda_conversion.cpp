@@ -1,31 +1,138 @@
 #include "lambda_conversion.h"
 #include "sampling.h"
+#include "interpolation.h"
+#include "port.h"
 
-static float GetPhi(float pumpCurrent)
+#include "ch.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+// Pump current (mA) to lambda, from the Bosch datasheet characteristic
+static const struct inter_point lsu49_ip_to_lambda[] =
+{
+    // linear extension of the rich side, the datasheet stops at 0.65
+    { -3.500f, 0.503f },
+    { -2.000f, 0.650f },
+    { -1.602f, 0.700f },
+    { -1.243f, 0.750f },
+    { -0.927f, 0.800f },
+    { -0.800f, 0.822f },
+    { -0.652f, 0.850f },
+    { -0.405f, 0.900f },
+    { -0.183f, 0.950f },
+    { -0.106f, 0.970f },
+    { -0.040f, 0.990f },
+    {  0.000f, 1.003f },
+    {  0.015f, 1.010f },
+    {  0.097f, 1.050f },
+    {  0.193f, 1.100f },
+    {  0.250f, 1.132f },
+    {  0.329f, 1.179f },
+    {  0.671f, 1.429f },
+    {  0.938f, 1.701f },
+    {  1.150f, 1.990f },
+    {  1.385f, 2.434f },
+    {  1.700f, 3.413f },
+    {  2.000f, 5.391f },
+};
+
+static const struct inter_point lsu42_ip_to_lambda[] =
+{
+    { -3.500f, 0.520f },
+    { -1.850f, 0.700f },
+    { -1.080f, 0.800f },
+    { -0.760f, 0.850f },
+    { -0.470f, 0.900f },
+    {  0.000f, 1.009f },
+    {  0.340f, 1.180f },
+    {  0.680f, 1.430f },
+    {  0.950f, 1.700f },
+    {  1.400f, 2.420f },
+    {  2.000f, 4.000f },
+};
+
+struct LsuPumpCharacteristic
+{
+    const struct inter_point* ipToLambda;
+    int size;
+};
+
+// Pump current is used as measured, without exhaust pressure or cell temperature correction.
+// LSU ADV has no pump characteristic here, CAN refuses to select it.
+static const LsuPumpCharacteristic pumpCharacteristics[] =
 {
-    // Maximum lambda ~2
-    if (pumpCurrent > 1.11f)
+    /* Lsu49 */  { lsu49_ip_to_lambda, ARRAY_SIZE(lsu49_ip_to_lambda) },
+    /* Lsu42 */  { lsu42_ip_to_lambda, ARRAY_SIZE(lsu42_ip_to_lambda) },
+};
+
+static const LsuPumpCharacteristic& GetPumpCharacteristic(SensorType type)
+{
+    size_t index = static_cast<size_t>(type);
+
+    if (index >= ARRAY_SIZE(pumpCharacteristics))
     {
-        return 0.5f;
+        index = 0;
     }
 
-    // Minimum lambda ~0.5
-    if (pumpCurrent < -3.5f)
+    return pumpCharacteristics[index];
+}
+
+// Float reference, also what the fixed point table is built from
+static const LsuPumpCharacteristic* referenceCharacteristic = &pumpCharacteristics[0];
+
+static float GetLambdaReference(float pumpCurrent)
+{
+    return interpolate_1d_float(referenceCharacteristic->ipToLambda, referenceCharacteristic->size, pumpCurrent);
+}
+
+// Lambda stored in Q12, 0..7.99
+#define LAMBDA_Q 4096.0f
+
+// GetLambda is called from both the CAN and the UART thread. A rebuild goes into the table nobody
+// reads and is then swapped in, lookups happen under the system lock so they never see a half built table.
+static struct fixed_table lambdaTables[2];
+static struct fixed_table* lambdaTable = &lambdaTables[0];
+static SensorType lambdaTableType;
+static bool lambdaTableValid = false;
+static MUTEX_DECL(lambdaRebuildMutex);
+
+static void RebuildLambdaTable(SensorType type)
+{
+    chMtxLock(&lambdaRebuildMutex);
+
+    // Another thread may have got here first
+    if (!lambdaTableValid || type != lambdaTableType)
     {
-        return 1 / 0.5f;
-    }
+        const LsuPumpCharacteristic& c = GetPumpCharacteristic(type);
+        struct fixed_table* spare = lambdaTable == &lambdaTables[0] ? &lambdaTables[1] : &lambdaTables[0];
 
-    // This estimation is accurate within 0.5% from 0.8 to 1.0, and 0.01% from 1 to 1.2 lambda when compared to the lookup table in the Bosch datasheet
-    // This error is less than half of the claimed accuracy of the sensor itself
-    float gain = pumpCurrent < 0 ? -0.28299f : -0.44817f;
+        referenceCharacteristic = &c;
+        fixed_table_build(spare, GetLambdaReference, -3.5f, 2.0f, LAMBDA_Q);
 
-    return gain * pumpCurrent + 0.99559f;
+        chSysLock();
+        lambdaTable = spare;
+        lambdaTableType = type;
+        lambdaTableValid = true;
+        chSysUnlock();
+    }
+
+    chMtxUnlock(&lambdaRebuildMutex);
 }
 
 float GetLambda()
 {
-    float pumpCurrent = GetPumpNominalCurrent();
+    SensorType type = GetSensorType();
+
+    if (!lambdaTableValid || type != lambdaTableType)
+    {
+        RebuildLambdaTable(type);
+    }
+
+    int32_t pumpCurrent = (int32_t)(GetPumpNominalCurrent() * 65536);
+
+    chSysLock();
+    int32_t lambda = fixed_table_lookup(lambdaTable, pumpCurrent);
+    chSysUnlock();
 
-    // Lambda is reciprocal of phi
-    return 1 / GetPhi(pumpCurrent);
+    return lambda * (1 / LAMBDA_Q);
 }
@@ -7,14 +7,13 @@
 
 #include "pch.h"
 
+#include "launch_control.h"
+
 #if EFI_LAUNCH_CONTROL
 #include "boost_control.h"
-#include "launch_control.h"
 #include "periodic_task.h"
 #include "advance_map.h"
 #include "engine_state.h"
-#include "advance_map.h"
-#include "tinymt32.h"
 
 /**
  * We can have active condition from switch or from clutch.
@@ -130,32 +129,76 @@ bool LaunchControlBase::isLaunchRpmRetardCondition() const {
 }
 
 bool LaunchControlBase::isLaunchSparkRpmRetardCondition() const {
-	return isLaunchRpmRetardCondition() && engineConfiguration->launchSparkCutEnable;
+	// soft cut does its own spark cutting per event, see getSparkSkipRatio
+	return isLaunchRpmRetardCondition() && engineConfiguration->launchSparkCutEnable && !engineConfiguration->launchSoftSparkCut;
 }
 
 bool LaunchControlBase::isLaunchFuelRpmRetardCondition() const {
 	return isLaunchRpmRetardCondition() && engineConfiguration->launchFuelCutEnable;
 }
 
+/**
+ * Fraction of sparks to cut, ramping from none at launch rpm to all of them at the hard cut threshold.
+ * Evaluated per spark event with instant rpm, so the limiter reacts within a cylinder rather than a callback period.
+ */
+float LaunchControlBase::getSparkSkipRatio(int rpm) const {
+	if (!isLaunchCondition || !engineConfiguration->launchSparkCutEnable || !engineConfiguration->launchSoftSparkCut) {
+		return 0;
+	}
+
+	return interpolateClamped(engineConfiguration->launchRpm, 0, retardThresholdRpm, 1, rpm);
+}
+
+#endif /* EFI_LAUNCH_CONTROL */
+
+/**
+ * Spark cut pattern shared by Lua, launch control and the soft rev limiter
+ */
 void SoftSparkLimiter::setTargetSkipRatio(float targetSkipRatio) {
-	this->targetSkipRatio = targetSkipRatio;
+	this->targetSkipRatio = clampF(0, targetSkipRatio, 1);
 }
 
-static tinymt32_t tinymt;
+float SoftSparkLimiter::getTargetSkipRatio() const {
+	return targetSkipRatio;
+}
+
+void SoftSparkLimiter::reset() {
+	m_engineError = 0;
+
+	// Stagger cylinders by the golden ratio so low ratios don't start with the whole engine cutting on one cycle
+	for (size_t i = 0; i < efi::size(m_cylinderError); i++) {
+		float phase = i * 0.618034f;
+		m_cylinderError[i] = phase - (int)phase;
+	}
+}
+
+/**
+ * Deterministic sigma-delta cut pattern. Each event accumulates the requested ratio into an engine-wide error
+ * and into the error of its own cylinder, and is skipped once their average reaches a whole spark.
+ * The engine term keeps the number of cuts per cycle within about one of the target, the cylinder term
+ * stops the pattern from locking onto the same cylinders when the ratio divides the cylinder count
+ * (plain engine-wide sigma-delta at 50% on a four cylinder would only ever cut #1 and #3).
+ */
+bool SoftSparkLimiter::shouldSkip(size_t cylinderIndex, float skipRatio) {
+	if (skipRatio <= 0) {
+		return false;
+	}
+
+	skipRatio = minF(skipRatio, 1);
 
-bool SoftSparkLimiter::shouldSkip()  {
-	if (targetSkipRatio == 0 || wasJustSkipped) {
-		wasJustSkipped = false;
+	float& cylinderError = m_cylinderError[cylinderIndex];
+	m_engineError += skipRatio;
+	cylinderError += skipRatio;
+
+	if ((m_engineError + cylinderError) / 2 < 1) {
 		return false;
 	}
 
-	float r = tinymt32_generate_float(&tinymt);
-	wasJustSkipped = r < 2 * targetSkipRatio;
-	return wasJustSkipped;
+	m_engineError -= 1;
+	cylinderError -= 1;
+	return true;
 }
 
-void initLaunchControl() {
-    tinymt32_init(&tinymt, 1345135);
+void initSoftSparkLimiter() {
+	engine->softSparkLimiter.reset();
 }
-
-#endif /* EFI_LAUNCH_CONTROL */
@@ -0,0 +1,129 @@
+/**
+ * @file learn_table.h
+ *
+ * Learning into an rpm/load table: a correction goes into the four cells around the operating point,
+ * each by its bilinear weight, so that interpolate3d() reads back what was learned at that point.
+ */
+
+#pragma once
+
+#if EFI_PROD_CODE
+#include "backup_ram.h"
+#endif // EFI_PROD_CODE
+
+/**
+ * Bin below 'value' and how far 'value' is towards the next one, held at the first and last cell
+ * outside of the axis same as interpolate3d()
+ */
+template <typename TBin, size_t TSize>
+static void findLearnBin(float value, const TBin (&bins)[TSize], size_t& index, float& fraction) {
+	if (value <= bins[0]) {
+		index = 0;
+		fraction = 0;
+		return;
+	}
+
+	for (size_t i = 0; i < TSize - 1; i++) {
+		if (value < bins[i + 1]) {
+			index = i;
+			fraction = (value - bins[i]) / (bins[i + 1] - bins[i]);
+			return;
+		}
+	}
+
+	index = TSize - 2;
+	fraction = 1;
+}
+
+/**
+ * Adds 'step' to the cells around (rowValue, columnValue), arguments in the same order as interpolate3d()
+ */
+template <typename TValue, size_t TRowNum, size_t TColNum, typename TRowBin, typename TColBin>
+static void learnTableBilinear(TValue (&table)[TRowNum][TColNum],
+		const TRowBin (&rowBins)[TRowNum], float rowValue,
+		const TColBin (&columnBins)[TColNum], float columnValue,
+		float step, float minValue, float maxValue) {
+	size_t row;
+	size_t column;
+	float rowFraction;
+	float columnFraction;
+	findLearnBin(rowValue, rowBins, row, rowFraction);
+	findLearnBin(columnValue, columnBins, column, columnFraction);
+
+	for (size_t dRow = 0; dRow < 2; dRow++) {
+		for (size_t dColumn = 0; dColumn < 2; dColumn++) {
+			float weight = (dRow ? rowFraction : 1 - rowFraction) * (dColumn ? columnFraction : 1 - columnFraction);
+			TValue& cell = table[row + dRow][column + dColumn];
+			cell = clampF(minValue, cell + weight * step, maxValue);
+		}
+	}
+}
+
+/**
+ * True when every learned value is within [minValue, maxValue], false on NaN too
+ */
+template <size_t TSize>
+static bool isLearnRangeValid(const float (&values)[TSize], float minValue, float maxValue) {
+	bool isValid = true;
+	for (float value : values) {
+		// catches NaN too
+		isValid &= value >= minValue && value <= maxValue;
+	}
+	return isValid;
+}
+
+template <size_t TRowNum, size_t TColNum>
+static bool isLearnRangeValid(const float (&table)[TRowNum][TColNum], float minValue, float maxValue) {
+	bool isValid = true;
+	for (auto& row : table) {
+		isValid &= isLearnRangeValid(row, minValue, maxValue);
+	}
+	return isValid;
+}
+
+/**
+ * Where backup RAM keeps the learned 'field', nullptr on boards without backup RAM
+ */
+#if EFI_PROD_CODE
+#define BACKUP_LEARN_DATA(field) (getBackupSram() != nullptr ? &getBackupSram()->field : nullptr)
+#else
+#define BACKUP_LEARN_DATA(field) nullptr
+#endif // EFI_PROD_CODE
+
+/**
+ * Learned values change every drive, writing them into the tune would erase and burn config flash on every
+ * engine stop. They live in backup RAM instead, or in plain RAM where there is none and are then lost on power down.
+ * 'TData' starts with a uint32_t Cookie which tells learned contents from garbage after power loss.
+ */
+template <typename TData, uint32_t TCookie>
+class LearnStorage {
+public:
+	TData* get() {
+		return m_data;
+	}
+
+	/**
+	 * @param backup where backup RAM keeps the data, nullptr without backup RAM
+	 * @param isInRange contents without the cookie or out of range are reset
+	 */
+	void init(TData* backup, bool (*isInRange)(const TData&)) {
+		m_data = backup != nullptr ? backup : &m_ram;
+
+		if (m_data->Cookie != TCookie || !isInRange(*m_data)) {
+			reset();
+		}
+	}
+
+	void reset() {
+		memset(m_data, 0, sizeof(*m_data));
+		m_data->Cookie = TCookie;
+	}
+
+private:
+	TData m_ram;
+	TData* m_data = &m_ram;
+};
+
+// long term fuel trim, see closed_loop_fuel.cpp
+void initLongTermFuelTrim();
+float getLongTermFuelTrim(float rpm, float load);
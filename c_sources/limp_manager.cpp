@@ -56,6 +56,8 @@ void LimpManager::updateState(int rpm, efitick_t nowNt) {
 			? interpolate2d(Sensor::get(SensorType::Clt).value_or(0), engineConfiguration->cltRevLimitRpmBins, engineConfiguration->cltRevLimitRpm)
 			: (float)engineConfiguration->rpmHardLimit;
 
+		m_revLimit = revLimit;
+
 		// Require 50 rpm drop before resuming
 		if (m_revLimitHysteresis.test(rpm, revLimit, revLimit - 50)) {
 			if (engineConfiguration->cutFuelOnHardLimit) {
@@ -212,6 +214,78 @@ LimpState LimpManager::allowInjection() const {
 	return {true, ClearReason::None};
 }
 
+/**
+ * Soft rev limiter, updated per spark event with instant rpm.
+ * Predicts where rpm will be a short time ahead from its rate of change, and ramps a torque reduction ratio
+ * from 0 at the start of the window below the limit to 1 at the limit itself.
+ * The hard limit above stays in place as a backstop.
+ */
+void LimpManager::updateSoftRevLimit(float rpm, efitick_t nowNt) {
+	float window = engineConfiguration->rpmSoftLimitWindowSize;
+	if (window <= 0) {
+		m_softLimitTorqueRatio = 0;
+		return;
+	}
+
+	float dt = m_softLimitTimer.getElapsedSecondsAndReset(nowNt);
+	if (dt >= 0.1f) {
+		// first event after a pause, nothing to differentiate against
+		m_softLimitRpmRate = 0;
+	} else if (dt > 0) {
+		// light filter, events are only a few ms apart near the limit and instant rpm is noisy
+		float rate = (rpm - m_softLimitLastRpm) / dt;
+		m_softLimitRpmRate += 0.3f * (rate - m_softLimitRpmRate);
+	}
+	// further events scheduled from the same trigger edge see dt == 0 and keep the rate as it is
+	m_softLimitLastRpm = rpm;
+
+	float predictedRpm = rpm + m_softLimitRpmRate * engineConfiguration->rpmSoftLimitLookaheadMs / 1000;
+	m_softLimitTorqueRatio = clampF(0, (predictedRpm - (m_revLimit - window)) / window, 1);
+}
+
+/**
+ * Torque reduction is realized from least to most intrusive: the first rpmSoftLimitRetardBand of the ratio
+ * is spark retard only...
+ */
+angle_t LimpManager::getSoftLimitTimingRetard() const {
+	float retardBand = engineConfiguration->rpmSoftLimitRetardBand;
+	if (retardBand <= 0) {
+		return 0;
+	}
+
+	return minF(m_softLimitTorqueRatio / retardBand, 1) * engineConfiguration->rpmSoftLimitTimingRetard;
+}
+
+/**
+ * ...the rest is taken out by cutting events. Above rpmSoftLimitFuelCutBand fuel cut progressively takes
+ * over from spark cut, so a limiter held for long doesn't keep pumping unburnt fuel into the exhaust.
+ */
+float LimpManager::getSoftLimitCutRatio() const {
+	float retardBand = engineConfiguration->rpmSoftLimitRetardBand;
+	if (retardBand >= 1) {
+		return 0;
+	}
+
+	return clampF(0, (m_softLimitTorqueRatio - retardBand) / (1 - retardBand), 1);
+}
+
+float LimpManager::getSoftLimitFuelShare() const {
+	float fuelBand = engineConfiguration->rpmSoftLimitFuelCutBand;
+	if (fuelBand >= 1) {
+		return 0;
+	}
+
+	return clampF(0, (m_softLimitTorqueRatio - fuelBand) / (1 - fuelBand), 1);
+}
+
+float LimpManager::getSoftLimitSparkSkipRatio() const {
+	return getSoftLimitCutRatio() * (1 - getSoftLimitFuelShare());
+}
+
+bool LimpManager::shouldSkipInjection(size_t cylinderIndex) {
+	return m_softLimitFuelCut.shouldSkip(cylinderIndex, getSoftLimitCutRatio() * getSoftLimitFuelShare());
+}
+
 LimpState LimpManager::allowIgnition() const {
 	if (!m_allowIgnition) {
 		return {false, m_allowIgnition.clearReason};
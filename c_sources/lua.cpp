@@ -8,6 +8,7 @@
 #include "lua.hpp"
 #include "lua_hooks.h"
 #include "can_filter.h"
+#include "can_tasks.h"
 
 #define TAG "LUA "
 
@@ -260,6 +261,7 @@ static void resetLua() {
 	engine->module<AcController>().unmock().isDisabledByLua = false;
 #if EFI_CAN_SUPPORT
 	resetLuaCanRx();
+	resetLuaCanTx();
 #endif // EFI_CAN_SUPPORT
 
 	// De-init pins, they will reinit next start of the script.
@@ -466,46 +468,3 @@ void testLuaExecString(const char* script) {
 
 #endif // EFI_UNIT_TEST
 #endif // EFI_LUA
-
-// This is technically non-compliant, but it's only used for lua float parsing.
-// It doesn't properly handle very small and very large numbers, and doesn't
-// parse numbers in the format 1.3e5 at all.
-extern "C" float strtof_rusefi(const char* str, char** endPtr) {
-	bool afterDecimalPoint = false;
-	float div = 1; // Divider to place digits after the decimal point
-
-	if (endPtr) {
-		*endPtr = const_cast<char*>(str);
-	}
-
-	float integerPart = 0;
-	float fractionalPart = 0;
-
-	while (*str != '\0') {
-		char c = *str;
-		int digitVal = c - '0';
-
-		if (c >= '0' && c <= '9') {
-			if (!afterDecimalPoint) {
-				// Integer part
-				integerPart = 10 * integerPart + digitVal;
-			} else {
-				// Fractional part
-				fractionalPart = 10 * fractionalPart + digitVal;
-				div *= 10;
-			}
-		} else if (c == '.') {
-			afterDecimalPoint = true;
-		} else {
-			break;
-		}
-
-		str++;
-
-		if (endPtr) {
-			*endPtr = const_cast<char*>(str);
-		}
-	}
-
-	return integerPart + fractionalPart / div;
-}
@@ -0,0 +1,112 @@
+/**
+ * @file	lua_can_tx.cpp
+ *
+ * Periodic CAN messages registered from Lua. The script only provides the payload,
+ * transmission itself happens on schedule from the CAN TX thread without invoking Lua.
+ */
+
+#include "pch.h"
+
+#if EFI_CAN_SUPPORT
+
+#include "can_msg_tx.h"
+#include "can_tasks.h"
+
+struct LuaCanPeriodicTx {
+	uint32_t Id;
+	int Bus;
+	bool IsExt;
+	uint8_t Dlc;
+	uint8_t Data[8];
+	efitick_t PeriodNt;
+	efitick_t NextTxNt;
+};
+
+static size_t periodicTxCount = 0;
+static LuaCanPeriodicTx periodicTx[LUA_CAN_PERIODIC_TX_COUNT];
+
+void resetLuaCanTx() {
+	chibios_rt::CriticalSectionLocker csl;
+	// Drop all periodic messages - reloading the script will re-register them
+	periodicTxCount = 0;
+}
+
+/**
+ * @return handle of the new periodic message, or -1 if there is no free slot
+ */
+int addLuaCanPeriodicTx(int bus, uint32_t id, bool isExt, int periodMs, const uint8_t* data, uint8_t dlc) {
+	chibios_rt::CriticalSectionLocker csl;
+
+	if (periodicTxCount >= LUA_CAN_PERIODIC_TX_COUNT) {
+		return -1;
+	}
+
+	auto& tx = periodicTx[periodicTxCount];
+	tx.Id = id;
+	tx.Bus = bus;
+	tx.IsExt = isExt;
+	tx.Dlc = dlc;
+	memset(tx.Data, 0, sizeof(tx.Data));
+	memcpy(tx.Data, data, dlc);
+	tx.PeriodNt = MS2NT(periodMs);
+	// first transmission on the next TX cycle
+	tx.NextTxNt = getTimeNowNt();
+
+	return periodicTxCount++;
+}
+
+/**
+ * Replace the payload of a periodic message, takes effect on its next transmission.
+ * @return false if handle is not valid
+ */
+bool setLuaCanPeriodicTxData(int handle, const uint8_t* data, uint8_t dlc) {
+	chibios_rt::CriticalSectionLocker csl;
+
+	if (handle < 0 || (size_t)handle >= periodicTxCount) {
+		return false;
+	}
+
+	auto& tx = periodicTx[handle];
+	tx.Dlc = dlc;
+	memcpy(tx.Data, data, dlc);
+
+	return true;
+}
+
+/**
+ * Invoked from CAN TX thread
+ */
+void doLuaCanPeriodicTx(efitick_t nowNt) {
+	for (size_t i = 0; i < LUA_CAN_PERIODIC_TX_COUNT; i++) {
+		LuaCanPeriodicTx copy;
+
+		{
+			// Lua thread may be updating the payload or resetting the list
+			chibios_rt::CriticalSectionLocker csl;
+
+			if (i >= periodicTxCount) {
+				return;
+			}
+
+			auto& tx = periodicTx[i];
+			if (nowNt < tx.NextTxNt) {
+				continue;
+			}
+
+			// keep the phase stable: advance by whole periods rather than from 'now'
+			do {
+				tx.NextTxNt += tx.PeriodNt;
+			} while (tx.NextTxNt <= nowNt);
+
+			copy = tx;
+		}
+
+		CanTxMessage msg(CanCategory::LUA, copy.Id, copy.Dlc, copy.IsExt);
+		msg.busIndex = copy.Bus;
+		for (size_t j = 0; j < copy.Dlc; j++) {
+			msg[j] = copy.Data[j];
+		}
+	}
+}
+
+#endif // EFI_CAN_SUPPORT
@@ -10,6 +10,7 @@
 #include "can_filter.h"
 #if EFI_CAN_SUPPORT || EFI_UNIT_TEST
 #include "can_msg_tx.h"
+#include "can_tasks.h"
 #endif // EFI_CAN_SUPPORT
 #include "settings.h"
 #include <new>
@@ -591,6 +592,49 @@ int lua_canRxAddMask(lua_State* l) {
 
 	return 0;
 }
+
+// handle = txCanPeriodic(bus, id, ext, periodMs, data)
+static int lua_txCanPeriodic(lua_State* l) {
+	auto bus = validateCanChannelAndConvertFromHumanIntoZeroIndex(l);
+	auto id = luaL_checkinteger(l, 2);
+	auto ext = luaL_checkinteger(l, 3);
+	auto periodMs = luaL_checkinteger(l, 4);
+
+	luaL_argcheck(l, id >= 0, 2, "ID specified is negative");
+	if (ext == 0) {
+		luaL_argcheck(l, id <= 0x7FF, 2, "ID specified is greater than max std ID");
+	} else {
+		luaL_argcheck(l, id <= 0x1FFF'FFFF, 2, "ID specified is greater than max ext ID");
+	}
+	// CAN TX thread runs every CAN_CYCLE_PERIOD, anything faster would not be honored
+	luaL_argcheck(l, periodMs >= CAN_CYCLE_PERIOD && periodMs <= 10000, 4, "period out of range");
+
+	uint8_t data[8];
+	uint32_t dlc = getArray(l, 5, data, sizeof(data));
+
+	int handle = addLuaCanPeriodicTx(bus, id, ext != 0, periodMs, data, dlc);
+	if (handle < 0) {
+		return luaL_error(l, "Too many Lua periodic CAN TX messages");
+	}
+
+	lua_pushinteger(l, handle);
+	return 1;
+}
+
+// setCanPeriodicData(handle, data)
+static int lua_setCanPeriodicData(lua_State* l) {
+	auto handle = luaL_checkinteger(l, 1);
+	luaL_argcheck(l, handle >= 0 && handle < LUA_CAN_PERIODIC_TX_COUNT, 1, "periodic CAN TX handle out of range");
+
+	uint8_t data[8];
+	uint32_t dlc = getArray(l, 2, data, sizeof(data));
+
+	if (!setLuaCanPeriodicTxData(handle, data, dlc)) {
+		luaL_error(l, "Invalid periodic CAN TX handle %d", (int)handle);
+	}
+
+	return 0;
+}
 #endif // EFI_CAN_SUPPORT
 
 void configureRusefiLuaHooks(lua_State* l) {
@@ -668,13 +712,11 @@ void configureRusefiLuaHooks(lua_State* l) {
 	});
 #endif // EFI_SENT_SUPPORT
 
-#if EFI_LAUNCH_CONTROL
 	lua_register(l, "setSparkSkipRatio", [](lua_State* l) {
 		auto targetSkipRatio = luaL_checknumber(l, 1);
 		engine->softSparkLimiter.setTargetSkipRatio(targetSkipRatio);
 		return 1;
 	});
-#endif // EFI_LAUNCH_CONTROL
 
 #if !EFI_UNIT_TEST
 	lua_register(l, "selfStimulateRPM", [](lua_State* l) {
@@ -879,6 +921,8 @@ void configureRusefiLuaHooks(lua_State* l) {
 #if EFI_CAN_SUPPORT
 	lua_register(l, "canRxAdd", lua_canRxAdd);
 	lua_register(l, "canRxAddMask", lua_canRxAddMask);
+	lua_register(l, "txCanPeriodic", lua_txCanPeriodic);
+	lua_register(l, "setCanPeriodicData", lua_setCanPeriodicData);
 #endif // EFI_CAN_SUPPORT
 #endif // not EFI_UNIT_TEST
 
@@ -80,12 +80,17 @@ void InjectionEvent::onTriggerTooth(int rpm, efitick_t nowNt, float currentPhase
 		return;
 	}
 
+	// Soft rev limiter fuel cut, spread over cylinders the same way as its spark cut
+	if (getLimpManager()->shouldSkipInjection(ownIndex)) {
+		return;
+	}
+
 	// Select fuel mass from the correct cylinder
 	auto injectionMassGrams = getEngineState()->injectionMass[this->cylinderNumber];
 
 	// Perform wall wetting adjustment on fuel mass, not duration, so that
 	// it's correct during fuel pressure (injector flow) or battery voltage (deadtime) transients
-	injectionMassGrams = wallFuel.adjust(injectionMassGrams);
+	injectionMassGrams = wallFuel.adjust(injectionMassGrams, nowNt);
 	const floatms_t injectionDuration = engine->module<InjectorModel>()->getInjectionDuration(injectionMassGrams);
 
 #if EFI_PRINTF_FUEL_DETAILS
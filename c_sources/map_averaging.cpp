@@ -29,6 +29,7 @@
 
 #include "map_averaging.h"
 #include "trigger_central.h"
+#include "etb_fast_loop.h"
 
 #if EFI_SENSOR_CHART
 #include "sensor_chart.h"
@@ -141,6 +142,11 @@ void mapAveragingAdcCallback(adcsample_t adcValue) {
 #if EFI_TUNER_STUDIO
 	engine->outputChannels.instantMAPValue = instantMap;
 #endif // EFI_TUNER_STUDIO
+
+#if EFI_ETB_FAST_LOOP
+	// same conversion also carries TPS when it is configured as a fast channel
+	etbFastLoopOnAdc();
+#endif // EFI_ETB_FAST_LOOP
 }
 #endif
 
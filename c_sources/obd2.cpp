@@ -28,6 +28,7 @@
 #include "obd2.h"
 #include "can.h"
 #include "can_msg_tx.h"
+#include "can_tasks.h"
 #include "fuel_math.h"
 
 static const int16_t supportedPids0120[] = { 
@@ -56,37 +57,31 @@ static const int16_t supportedPids4160[] = {
 	-1
 };
 
-static void obdSendPacket(int mode, int PID, int numBytes, uint32_t iValue, size_t busIndex) {
-	CanTxMessage resp(CanCategory::OBD, OBD_TEST_RESPONSE);
+// a single mode 01 request carries at most that many PIDs
+#define OBD_MAX_PIDS_PER_REQUEST 6
+// mode byte + (PID + up to 4 data bytes) per requested PID
+#define OBD_MAX_RESPONSE_SIZE (1 + OBD_MAX_PIDS_PER_REQUEST * 5)
 
-	// Respond on the same bus we got the request from
-	resp.busIndex = busIndex;
+// physical address of this ECU, as opposed to functional OBD_TEST_REQUEST
+#define OBD_PHYSICAL_REQUEST (OBD_TEST_RESPONSE - 8)
 
-	// write number of bytes
-	resp[0] = (uint8_t)(2 + numBytes);
-	// write 2 bytes of header
-	resp[1] = (uint8_t)(0x40 + mode);
-	resp[2] = (uint8_t)PID;
-	// write N data bytes
-	for (int i = 8 * (numBytes - 1), j = 3; i >= 0; i -= 8, j++) {
-		resp[j] = (uint8_t)((iValue >> i) & 0xff);
-	}
-}
+// scan tools polling several PIDs get the same value within that window
+#define OBD_RESPONSE_CACHE_MS 20
+
+// N_Bs, ISO 15765-2: how long a first frame or a finished block waits for the next flow control
+#define OBD_FLOW_CONTROL_TIMEOUT_MS 1000
 
 #define _1_MODE 1
 
-static void obdSendValue(int mode, int PID, int numBytes, float value, size_t busIndex) {
-	efiAssertVoid(CUSTOM_ERR_6662, numBytes <= 2, "invalid numBytes");
+static int obdScaleValue(int numBytes, float value) {
 	int iValue = (int)efiRound(value, 1.0f);
 	// clamp to uint8_t (0..255) or uint16_t (0..65535)
-	iValue = maxI(minI(iValue, (numBytes == 1) ? 255 : 65535), 0);
-	obdSendPacket(mode, PID, numBytes, iValue, busIndex);
+	return maxI(minI(iValue, (numBytes == 1) ? 255 : 65535), 0);
 }
 
-
 //#define MOCK_SUPPORTED_PIDS 0xffffffff
 
-static void obdWriteSupportedPids(int PID, int bitOffset, const int16_t *supportedPids, size_t busIndex) {
+static uint32_t obdGetSupportedPids(int bitOffset, const int16_t *supportedPids) {
 	uint32_t value = 0;
 	// gather all 32 bit fields
 	for (int i = 0; i < 32 && supportedPids[i] > 0; i++)
@@ -97,64 +92,66 @@ static void obdWriteSupportedPids(int PID, int bitOffset, const int16_t *support
 	value = MOCK_SUPPORTED_PIDS;
 #endif
 
-	obdSendPacket(1, PID, 4, value, busIndex);
+	return value;
 }
 
-static void handleGetDataRequest(const CANRxFrame& rx, size_t busIndex) {
-	int pid = rx.data8[2];
+/**
+ * @return number of data bytes for this PID, zero if PID is not supported
+ */
+static int obdGetPidValue(int pid, uint32_t& value) {
 	switch (pid) {
 	case PID_SUPPORTED_PIDS_REQUEST_01_20:
-		obdWriteSupportedPids(pid, 1, supportedPids0120, busIndex);
-		break;
+		value = obdGetSupportedPids(1, supportedPids0120);
+		return 4;
 	case PID_SUPPORTED_PIDS_REQUEST_21_40:
-		obdWriteSupportedPids(pid, 21, supportedPids2140, busIndex);
-		break;
+		value = obdGetSupportedPids(21, supportedPids2140);
+		return 4;
 	case PID_SUPPORTED_PIDS_REQUEST_41_60:
-		obdWriteSupportedPids(pid, 41, supportedPids4160, busIndex);
-		break;
+		value = obdGetSupportedPids(41, supportedPids4160);
+		return 4;
 	case PID_MONITOR_STATUS:
-		obdSendPacket(1, pid, 4, 0, busIndex);	// todo: add statuses
-		break;
+		value = 0;	// todo: add statuses
+		return 4;
 	case PID_FUEL_SYSTEM_STATUS:
 		// todo: add statuses
-		obdSendValue(_1_MODE, pid, 2, (2<<8)|(0), busIndex);	// 2 = "Closed loop, using oxygen sensor feedback to determine fuel mix"
-		break;
+		value = obdScaleValue(2, (2<<8)|(0));	// 2 = "Closed loop, using oxygen sensor feedback to determine fuel mix"
+		return 2;
 	case PID_ENGINE_LOAD:
-		obdSendValue(_1_MODE, pid, 1, getFuelingLoad() * ODB_TPS_BYTE_PERCENT, busIndex);
-		break;
+		value = obdScaleValue(1, getFuelingLoad() * ODB_TPS_BYTE_PERCENT);
+		return 1;
 	case PID_COOLANT_TEMP:
-		obdSendValue(_1_MODE, pid, 1, Sensor::getOrZero(SensorType::Clt) + ODB_TEMP_EXTRA, busIndex);
-		break;
+		value = obdScaleValue(1, Sensor::getOrZero(SensorType::Clt) + ODB_TEMP_EXTRA);
+		return 1;
 	case PID_STFT_BANK1:
-		obdSendValue(_1_MODE, pid, 1, 128 * engine->stftCorrection[0], busIndex);
-		break;
+		value = obdScaleValue(1, 128 * engine->stftCorrection[0]);
+		return 1;
 	case PID_STFT_BANK2:
-		obdSendValue(_1_MODE, pid, 1, 128 * engine->stftCorrection[1], busIndex);
-		break;
+		value = obdScaleValue(1, 128 * engine->stftCorrection[1]);
+		return 1;
 	case PID_INTAKE_MAP:
-		obdSendValue(_1_MODE, pid, 1, Sensor::getOrZero(SensorType::Map), busIndex);
-		break;
+		value = obdScaleValue(1, Sensor::getOrZero(SensorType::Map));
+		return 1;
 	case PID_RPM:
-		obdSendValue(_1_MODE, pid, 2, Sensor::getOrZero(SensorType::Rpm) * ODB_RPM_MULT, busIndex);	//	rotation/min.	(A*256+B)/4
-		break;
+		value = obdScaleValue(2, Sensor::getOrZero(SensorType::Rpm) * ODB_RPM_MULT);	//	rotation/min.	(A*256+B)/4
+		return 2;
 	case PID_SPEED:
-		obdSendValue(_1_MODE, pid, 1, Sensor::getOrZero(SensorType::VehicleSpeed), busIndex);
-		break;
+		value = obdScaleValue(1, Sensor::getOrZero(SensorType::VehicleSpeed));
+		return 1;
 	case PID_TIMING_ADVANCE: {
 		float timing = engine->engineState.timingAdvance[0];
 		timing = (timing > 360.0f) ? (timing - 720.0f) : timing;
-		obdSendValue(_1_MODE, pid, 1, (timing + 64.0f) * 2.0f, busIndex);		// angle before TDC.	(A/2)-64
-		break;
+		value = obdScaleValue(1, (timing + 64.0f) * 2.0f);		// angle before TDC.	(A/2)-64
+		return 1;
 		}
 	case PID_INTAKE_TEMP:
-		obdSendValue(_1_MODE, pid, 1, Sensor::getOrZero(SensorType::Iat) + ODB_TEMP_EXTRA, busIndex);
-		break;
+		value = obdScaleValue(1, Sensor::getOrZero(SensorType::Iat) + ODB_TEMP_EXTRA);
+		return 1;
 	case PID_INTAKE_MAF:
-		obdSendValue(_1_MODE, pid, 2, Sensor::getOrZero(SensorType::Maf) * 100.0f, busIndex);	// grams/sec	(A*256+B)/100
-		break;
+		value = obdScaleValue(2, Sensor::getOrZero(SensorType::Maf) * 100.0f);	// grams/sec	(A*256+B)/100
+		return 2;
 	case PID_THROTTLE:
-		obdSendValue(_1_MODE, pid, 1, Sensor::getOrZero(SensorType::Tps1) * ODB_TPS_BYTE_PERCENT, busIndex);	// (A*100/255)
-		break;
+		value = obdScaleValue(1, Sensor::getOrZero(SensorType::Tps1) * ODB_TPS_BYTE_PERCENT);	// (A*100/255)
+		return 1;
 	case PID_FUEL_AIR_RATIO_1: {
 		float lambda = Sensor::getOrZero(SensorType::Lambda1);
 		// phi = 1 / lambda
@@ -162,20 +159,255 @@ static void handleGetDataRequest(const CANRxFrame& rx, size_t busIndex) {
 
 		uint16_t scaled = phi * 32768;
 
-		obdSendPacket(1, pid, 4, scaled << 16, busIndex);
-		break;
+		value = scaled << 16;
+		return 4;
 	} case PID_FUEL_RATE: {
 		float gPerSecond = engine->engineState.fuelConsumption.getConsumptionGramPerSecond();
 		float gPerHour = gPerSecond * 3600;
 		float literPerHour = gPerHour * 0.00139f;
-		obdSendValue(_1_MODE, pid, 2, literPerHour * 20.0f, busIndex);	//	L/h.	(A*256+B)/20
-		break;
+		value = obdScaleValue(2, literPerHour * 20.0f);	//	L/h.	(A*256+B)/20
+		return 2;
 	} default:
 		// ignore unhandled PIDs
-		break;
+		return 0;
 	}
 }
 
+struct ObdCachedPid {
+	efitick_t timeNt;
+	int revolution;
+	uint32_t value;
+	uint8_t numBytes;
+	bool isValid;
+};
+
+static ObdCachedPid pidCache[256];
+
+/**
+ * Loggers poll the same PIDs back to back, there is no point in recomputing values
+ * which cannot have changed since the previous request within the same engine revolution.
+ */
+static int obdGetCachedPidValue(int pid, uint32_t& value) {
+	efitick_t nowNt = getTimeNowNt();
+	int revolution = getTriggerCentral()->triggerState.getCrankSynchronizationCounter();
+
+	auto& cached = pidCache[pid];
+	if (cached.isValid
+			&& cached.revolution == revolution
+			&& nowNt - cached.timeNt < MS2NT(OBD_RESPONSE_CACHE_MS)) {
+		value = cached.value;
+		return cached.numBytes;
+	}
+
+	int numBytes = obdGetPidValue(pid, value);
+
+	cached.timeNt = nowNt;
+	cached.revolution = revolution;
+	cached.value = value;
+	cached.numBytes = numBytes;
+	cached.isValid = true;
+
+	return numBytes;
+}
+
+/**
+ * State of an ISO-TP multi-frame response. RX thread starts it and applies flow control,
+ * consecutive frames are paced out from CAN TX thread, see obdSendPendingFrames()
+ */
+struct ObdMultiFrameResponse {
+	uint8_t data[OBD_MAX_RESPONSE_SIZE];
+	size_t size;
+	size_t offset;
+	uint8_t sequenceNumber;
+	size_t busIndex;
+	bool isActive;
+
+	// released by flow control, cleared again once block size frames went out
+	bool isClearToSend;
+	int blockSize;
+	int framesInBlock;
+	efitick_t separationNt;
+	efitick_t nextFrameNt;
+	// N_Bs deadline while not clear to send, the transfer is abandoned after that
+	efitick_t flowControlTimeoutNt;
+};
+
+static ObdMultiFrameResponse multiFrame;
+
+static void obdSendFrame(const uint8_t* data, size_t size, size_t busIndex) {
+	CanTxMessage resp(CanCategory::OBD, OBD_TEST_RESPONSE);
+
+	// Respond on the same bus we got the request from
+	resp.busIndex = busIndex;
+
+	for (size_t i = 0; i < size; i++) {
+		resp[i] = data[i];
+	}
+}
+
+static void obdSendResponse(const uint8_t* payload, size_t size, size_t busIndex) {
+	uint8_t frame[8];
+
+	if (size <= 7) {
+		// ISO-TP single frame
+		frame[0] = size;
+		memcpy(frame + 1, payload, size);
+
+		{
+			chibios_rt::CriticalSectionLocker csl;
+			multiFrame.isActive = false;
+		}
+
+		obdSendFrame(frame, size + 1, busIndex);
+		return;
+	}
+
+	{
+		chibios_rt::CriticalSectionLocker csl;
+
+		memcpy(multiFrame.data, payload, size);
+		multiFrame.size = size;
+		multiFrame.offset = 6;
+		multiFrame.sequenceNumber = 1;
+		multiFrame.busIndex = busIndex;
+		multiFrame.isClearToSend = false;
+		multiFrame.flowControlTimeoutNt = getTimeNowNt() + MS2NT(OBD_FLOW_CONTROL_TIMEOUT_MS);
+		multiFrame.isActive = true;
+	}
+
+	// ISO-TP first frame, rest goes once tester sends flow control
+	frame[0] = 0x10 | ((size >> 8) & 0xF);
+	frame[1] = size & 0xFF;
+	memcpy(frame + 2, payload, 6);
+	obdSendFrame(frame, 8, busIndex);
+}
+
+static int getSeparationTimeUs(uint8_t stMin) {
+	if (stMin <= 0x7F) {
+		return stMin * 1000;
+	} else if (stMin >= 0xF1 && stMin <= 0xF9) {
+		return (stMin - 0xF0) * 100;
+	}
+
+	// reserved values mean the longest separation
+	return 0x7F * 1000;
+}
+
+static void handleFlowControl(const CANRxFrame& rx, size_t busIndex) {
+	chibios_rt::CriticalSectionLocker csl;
+
+	if (!multiFrame.isActive || busIndex != multiFrame.busIndex) {
+		return;
+	}
+
+	uint8_t flowStatus = rx.data8[0] & 0xF;
+	if (flowStatus == 1) {
+		// wait, tester will send another flow control frame: N_Bs starts over
+		multiFrame.isClearToSend = false;
+		multiFrame.flowControlTimeoutNt = getTimeNowNt() + MS2NT(OBD_FLOW_CONTROL_TIMEOUT_MS);
+		return;
+	} else if (flowStatus != 0) {
+		// overflow or garbage: abort
+		multiFrame.isActive = false;
+		return;
+	}
+
+	// never sleep here, this is RX thread: frames go out from CAN TX thread
+	multiFrame.blockSize = rx.data8[1];
+	multiFrame.separationNt = US2NT(getSeparationTimeUs(rx.data8[2]));
+	multiFrame.framesInBlock = 0;
+	multiFrame.nextFrameNt = getTimeNowNt();
+	multiFrame.isClearToSend = true;
+}
+
+/**
+ * Invoked from CAN TX thread every cycle. With zero separation the whole released block goes out at once,
+ * otherwise at most one consecutive frame per cycle once separation time since previous one has passed.
+ * A transfer the tester stopped answering is dropped here once N_Bs runs out.
+ */
+void obdSendPendingFrames(efitick_t nowNt) {
+	while (true) {
+		uint8_t frame[8];
+		size_t frameSize;
+		size_t busIndex;
+		bool isSeparated;
+
+		{
+			chibios_rt::CriticalSectionLocker csl;
+
+			if (multiFrame.isActive && !multiFrame.isClearToSend && nowNt >= multiFrame.flowControlTimeoutNt) {
+				multiFrame.isActive = false;
+			}
+
+			if (!multiFrame.isActive || !multiFrame.isClearToSend || nowNt < multiFrame.nextFrameNt) {
+				return;
+			}
+
+			size_t chunk = minI(multiFrame.size - multiFrame.offset, 7);
+			frame[0] = 0x20 | multiFrame.sequenceNumber;
+			memcpy(frame + 1, multiFrame.data + multiFrame.offset, chunk);
+			frameSize = chunk + 1;
+			busIndex = multiFrame.busIndex;
+			isSeparated = multiFrame.separationNt != 0;
+
+			multiFrame.offset += chunk;
+			multiFrame.sequenceNumber = (multiFrame.sequenceNumber + 1) & 0xF;
+			multiFrame.nextFrameNt = nowNt + multiFrame.separationNt;
+			multiFrame.framesInBlock++;
+
+			if (multiFrame.offset >= multiFrame.size) {
+				multiFrame.isActive = false;
+			} else if (multiFrame.blockSize != 0 && multiFrame.framesInBlock == multiFrame.blockSize) {
+				// next flow control frame releases the next block
+				multiFrame.isClearToSend = false;
+				multiFrame.flowControlTimeoutNt = nowNt + MS2NT(OBD_FLOW_CONTROL_TIMEOUT_MS);
+			}
+		}
+
+		obdSendFrame(frame, frameSize, busIndex);
+
+		if (isSeparated) {
+			return;
+		}
+	}
+}
+
+/**
+ * Mode 01 request may ask for up to six PIDs at once, answer is a single
+ * response with PID and value pairs in the same order
+ */
+static void handleGetDataRequest(const CANRxFrame& rx, size_t busIndex) {
+	// first byte is ISO-TP single frame length, including mode byte, PIDs past the frame's DLC are not there
+	int pidCount = minI(minI(rx.data8[0] - 1, rx.DLC - 2), OBD_MAX_PIDS_PER_REQUEST);
+
+	uint8_t payload[OBD_MAX_RESPONSE_SIZE];
+	size_t size = 0;
+	payload[size++] = 0x40 + _1_MODE;
+
+	for (int i = 0; i < pidCount; i++) {
+		int pid = rx.data8[2 + i];
+
+		uint32_t value = 0;
+		int numBytes = obdGetCachedPidValue(pid, value);
+		if (numBytes == 0) {
+			continue;
+		}
+
+		payload[size++] = pid;
+		// write N data bytes, most significant first
+		for (int shift = 8 * (numBytes - 1); shift >= 0; shift -= 8) {
+			payload[size++] = (uint8_t)((value >> shift) & 0xff);
+		}
+	}
+
+	if (size == 1) {
+		// none of requested PIDs are supported, stay silent like any other ECU would
+		return;
+	}
+
+	obdSendResponse(payload, size, busIndex);
+}
+
 static void handleDtcRequest(int numCodes, int *dtcCode) {
 	// TODO: this appears to be unfinished?
 	UNUSED(numCodes);
@@ -192,11 +424,16 @@ static void handleDtcRequest(int numCodes, int *dtcCode) {
 
 #if HAL_USE_CAN
 void obdOnCanPacketRx(const CANRxFrame& rx, size_t busIndex) {
-	if (CAN_SID(rx) != OBD_TEST_REQUEST) {
+	if (CAN_ISX(rx) || (CAN_SID(rx) != OBD_TEST_REQUEST && CAN_SID(rx) != OBD_PHYSICAL_REQUEST)) {
 		return;
 	}
 
-	if (rx.data8[0] == _OBD_2 && rx.data8[1] == OBD_CURRENT_DATA) {
+	if ((rx.data8[0] & 0xF0) == 0x30) {
+		// flow control is point to point: only the physical address, never the functional broadcast one
+		if (CAN_SID(rx) == OBD_PHYSICAL_REQUEST) {
+			handleFlowControl(rx, busIndex);
+		}
+	} else if (rx.data8[0] >= _OBD_2 && rx.data8[0] <= 7 && rx.data8[1] == OBD_CURRENT_DATA) {
 		handleGetDataRequest(rx, busIndex);
 	} else if (rx.data8[0] == 1 && rx.data8[1] == OBD_STORED_DIAGNOSTIC_TROUBLE_CODES) {
 		// todo: implement stored/pending difference?
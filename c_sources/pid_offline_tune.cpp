@@ -0,0 +1,822 @@
+/*
+ * pid_offline_tune.cpp
+ *
+ * Host tool: PID tuning from a recorded MLG log instead of an on-car relay experiment.
+ *
+ * The log provides setpoint, measurement and controller output channels. A first or second
+ * order plus dead time model is fitted by least squares and refined on the simulated output error,
+ * PID gains are computed with SIMC rules with the closed loop time constant picked to meet a maximum
+ * sensitivity target, and the result is verified by running the firmware Pid class against the identified model on the logged
+ * setpoint trace.
+ *
+ * Build on host: make -C c_sources/test tools, then c_sources/test/build/pid_offline_tune
+ *
+ * Usage:
+ *   pid_offline_tune log.mlg --setpoint "Idle: Target RPM" --measurement "RPM" --output "Idle: Position"
+ *       [--order 1|2] [--ms 1.6] [--tauc seconds] [--from seconds] [--to seconds]
+ *
+ * SIMC: S. Skogestad, "Simple analytic rules for model reduction and PID controller tuning",
+ * Journal of Process Control 13 (2003) 291-309
+ */
+
+#include "pch.h"
+
+#if EFI_PID_OFFLINE_TUNE
+
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// longest dead time considered during identification
+#define MAX_DEAD_TIME_SAMPLES 100
+
+/**
+ * Minimal reader for the MLVLG format version 1 as produced by binary_logging.cpp
+ * See also mlq_file_format.txt
+ */
+struct MlgField {
+	uint8_t type;
+	std::string name;
+	float scale;
+	float shift;
+	size_t offset;
+};
+
+struct MlgLog {
+	std::vector<MlgField> fields;
+	std::vector<std::vector<float>> records;
+
+	int indexOf(const char* name) const {
+		for (size_t i = 0; i < fields.size(); i++) {
+			if (fields[i].name == name) {
+				return i;
+			}
+		}
+		return -1;
+	}
+};
+
+static uint32_t readBigEndian(const uint8_t* p, size_t size) {
+	uint32_t result = 0;
+	for (size_t i = 0; i < size; i++) {
+		result = (result << 8) | p[i];
+	}
+	return result;
+}
+
+static float readBigEndianFloat(const uint8_t* p) {
+	uint32_t raw = readBigEndian(p, 4);
+	float result;
+	memcpy(&result, &raw, sizeof(result));
+	return result;
+}
+
+static size_t getMlgFieldSize(uint8_t type) {
+	switch (type) {
+	case 0: // U08
+	case 1: // S08
+		return 1;
+	case 2: // U16
+	case 3: // S16
+		return 2;
+	case 6: // S64
+		return 8;
+	default: // U32, S32, F32
+		return 4;
+	}
+}
+
+static float decodeMlgValue(const MlgField& field, const uint8_t* p) {
+	double raw;
+	switch (field.type) {
+	case 0: raw = p[0]; break;
+	case 1: raw = (int8_t)p[0]; break;
+	case 2: raw = readBigEndian(p, 2); break;
+	case 3: raw = (int16_t)readBigEndian(p, 2); break;
+	case 4: raw = readBigEndian(p, 4); break;
+	case 5: raw = (int32_t)readBigEndian(p, 4); break;
+	case 6: raw = (int64_t)(((uint64_t)readBigEndian(p, 4) << 32) | readBigEndian(p + 4, 4)); break;
+	default: raw = readBigEndianFloat(p); break;
+	}
+	return (raw + field.shift) * field.scale;
+}
+
+static bool readMlg(const char* fileName, MlgLog& log) {
+	FILE* f = fopen(fileName, "rb");
+	if (!f) {
+		printf("Unable to open %s\n", fileName);
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	uint8_t chunk[4096];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		data.insert(data.end(), chunk, chunk + read);
+	}
+	fclose(f);
+
+	if (data.size() < MLQ_HEADER_SIZE || memcmp(data.data(), "MLVLG", 6) != 0) {
+		printf("%s is not an MLG log\n", fileName);
+		return false;
+	}
+
+	if (readBigEndian(&data[6], 2) != 1) {
+		printf("Only MLG format version 1 is supported\n");
+		return false;
+	}
+
+	size_t dataBegin = readBigEndian(&data[14], 4);
+	size_t recordLength = readBigEndian(&data[18], 2);
+	size_t fieldCount = readBigEndian(&data[20], 2);
+
+	if (MLQ_HEADER_SIZE + fieldCount * MLQ_FIELD_HEADER_SIZE > data.size() || dataBegin > data.size()) {
+		printf("Truncated MLG header\n");
+		return false;
+	}
+
+	size_t offset = 0;
+	for (size_t i = 0; i < fieldCount; i++) {
+		const uint8_t* p = &data[MLQ_HEADER_SIZE + i * MLQ_FIELD_HEADER_SIZE];
+
+		MlgField field;
+		field.type = p[0];
+		field.name = std::string(reinterpret_cast<const char*>(p + 1), strnlen(reinterpret_cast<const char*>(p + 1), 34));
+		field.scale = readBigEndianFloat(p + 46);
+		field.shift = readBigEndianFloat(p + 50);
+		field.offset = offset;
+		offset += getMlgFieldSize(field.type);
+
+		log.fields.push_back(field);
+	}
+
+	if (offset != recordLength) {
+		printf("Record length mismatch: header says %d, fields add up to %d\n", (int)recordLength, (int)offset);
+		return false;
+	}
+
+	size_t position = dataBegin;
+	while (position < data.size()) {
+		uint8_t blockType = data[position];
+
+		if (blockType == 1) {
+			// marker block: type, counter, timestamp, 50 byte message
+			position += 4 + 50;
+			continue;
+		}
+
+		// data block: type, counter, timestamp, record, checksum
+		if (blockType != 0 || position + 4 + recordLength + 1 > data.size()) {
+			break;
+		}
+
+		const uint8_t* record = &data[position + 4];
+
+		uint8_t sum = 0;
+		for (size_t i = 0; i < recordLength; i++) {
+			sum += record[i];
+		}
+
+		if (sum == record[recordLength]) {
+			std::vector<float> values;
+			for (auto& field : log.fields) {
+				values.push_back(decodeMlgValue(field, record + field.offset));
+			}
+			log.records.push_back(values);
+		}
+
+		position += 4 + recordLength + 1;
+	}
+
+	return true;
+}
+
+/**
+ * Solve A * x = b in place, Gaussian elimination with partial pivoting
+ */
+static bool solveLinear(std::vector<std::vector<double>>& a, std::vector<double>& b, std::vector<double>& x) {
+	size_t n = b.size();
+
+	for (size_t col = 0; col < n; col++) {
+		size_t pivot = col;
+		for (size_t row = col + 1; row < n; row++) {
+			if (fabs(a[row][col]) > fabs(a[pivot][col])) {
+				pivot = row;
+			}
+		}
+
+		if (fabs(a[pivot][col]) < 1e-12) {
+			return false;
+		}
+
+		std::swap(a[col], a[pivot]);
+		std::swap(b[col], b[pivot]);
+
+		for (size_t row = col + 1; row < n; row++) {
+			double factor = a[row][col] / a[col][col];
+			for (size_t k = col; k < n; k++) {
+				a[row][k] -= factor * a[col][k];
+			}
+			b[row] -= factor * b[col];
+		}
+	}
+
+	x.assign(n, 0);
+	for (size_t row = n; row-- > 0;) {
+		double sum = b[row];
+		for (size_t k = row + 1; k < n; k++) {
+			sum -= a[row][k] * x[k];
+		}
+		x[row] = sum / a[row][row];
+	}
+
+	return true;
+}
+
+/**
+ * K * exp(-theta * s) / ((tau1 * s + 1) * (tau2 * s + 1)), tau2 is zero for a first order model
+ */
+struct PlantModel {
+	int order;
+	float gain;
+	float tau1;
+	float tau2;
+	float deadTime;
+	float bias;
+	// root mean square error: one step ahead for the least squares estimate, simulated once refined
+	float residual;
+};
+
+/**
+ * Fit y[k+1] = a1 * y[k] (+ a2 * y[k-1]) + b * u[k-d] + c for each dead time d and keep the best one
+ */
+static bool identifyPlant(const std::vector<float>& u, const std::vector<float>& y, float dt, int order, PlantModel& model) {
+	size_t paramCount = order == 1 ? 3 : 4;
+	size_t n = y.size();
+
+	bool found = false;
+
+	for (int d = 0; d <= MAX_DEAD_TIME_SAMPLES; d++) {
+		size_t first = maxI(d, order - 1);
+		if (first + 1 + paramCount >= n) {
+			break;
+		}
+
+		std::vector<std::vector<double>> a(paramCount, std::vector<double>(paramCount, 0));
+		std::vector<double> b(paramCount, 0);
+		std::vector<double> phi(paramCount);
+
+		for (size_t k = first; k + 1 < n; k++) {
+			size_t i = 0;
+			phi[i++] = y[k];
+			if (order == 2) {
+				phi[i++] = y[k - 1];
+			}
+			phi[i++] = u[k - d];
+			phi[i++] = 1;
+
+			for (size_t r = 0; r < paramCount; r++) {
+				for (size_t c = 0; c < paramCount; c++) {
+					a[r][c] += phi[r] * phi[c];
+				}
+				b[r] += phi[r] * y[k + 1];
+			}
+		}
+
+		std::vector<double> theta;
+		if (!solveLinear(a, b, theta)) {
+			continue;
+		}
+
+		double a1 = theta[0];
+		double a2 = order == 2 ? theta[1] : 0;
+		double gainCoef = theta[order];
+		double bias = theta[order + 1];
+
+		double errorSum = 0;
+		for (size_t k = first; k + 1 < n; k++) {
+			double predicted = a1 * y[k] + a2 * (order == 2 ? y[k - 1] : 0) + gainCoef * u[k - d] + bias;
+			errorSum += (y[k + 1] - predicted) * (y[k + 1] - predicted);
+		}
+		float residual = sqrt(errorSum / (n - 1 - first));
+
+		if (found && residual >= model.residual) {
+			continue;
+		}
+
+		PlantModel candidate;
+		candidate.order = order;
+		candidate.deadTime = d * dt;
+		candidate.residual = residual;
+
+		double staticDenominator = 1 - a1 - a2;
+		if (fabs(staticDenominator) < 1e-9) {
+			continue;
+		}
+		candidate.gain = gainCoef / staticDenominator;
+		candidate.bias = bias / staticDenominator;
+
+		if (order == 1) {
+			if (a1 <= 0 || a1 >= 1) {
+				continue;
+			}
+			candidate.tau1 = -dt / log(a1);
+			candidate.tau2 = 0;
+		} else {
+			// poles of z^2 - a1 * z - a2, both have to be real and stable
+			double discriminant = a1 * a1 + 4 * a2;
+			if (discriminant < 0) {
+				continue;
+			}
+			double p1 = (a1 + sqrt(discriminant)) / 2;
+			double p2 = (a1 - sqrt(discriminant)) / 2;
+			if (p1 <= 0 || p1 >= 1 || p2 <= 0 || p2 >= 1) {
+				continue;
+			}
+			candidate.tau1 = -dt / log(p1);
+			candidate.tau2 = -dt / log(p2);
+		}
+
+		model = candidate;
+		found = true;
+	}
+
+	return found;
+}
+
+/**
+ * Output error of the model driven with the logged output, for given time constants and dead time.
+ * Gain and bias are linear in the simulated output, those come from least squares.
+ */
+static float fitGainAndBias(const std::vector<float>& u, const std::vector<float>& y, float dt,
+		float tau1, float tau2, int deadSamples, std::vector<double>& filtered, PlantModel& model) {
+	size_t n = y.size();
+	double alpha1 = exp(-dt / tau1);
+	double alpha2 = tau2 > 0 ? exp(-dt / tau2) : 0;
+	// steady state at the first sample, same as SimulatedPlant
+	double x1 = u[0];
+	double x2 = u[0];
+
+	filtered.resize(n);
+	for (size_t k = 0; k < n; k++) {
+		filtered[k] = x2;
+		double delayed = u[k >= (size_t)deadSamples ? k - deadSamples : 0];
+		x1 = alpha1 * x1 + (1 - alpha1) * delayed;
+		x2 = alpha2 * x2 + (1 - alpha2) * x1;
+	}
+
+	double sumF = 0, sumY = 0, sumFF = 0, sumFY = 0;
+	for (size_t k = 0; k < n; k++) {
+		sumF += filtered[k];
+		sumY += y[k];
+		sumFF += filtered[k] * filtered[k];
+		sumFY += filtered[k] * y[k];
+	}
+
+	double determinant = n * sumFF - sumF * sumF;
+	if (fabs(determinant) < 1e-9) {
+		return INFINITY;
+	}
+
+	double gain = (n * sumFY - sumF * sumY) / determinant;
+	double bias = (sumY - gain * sumF) / n;
+
+	double errorSum = 0;
+	for (size_t k = 0; k < n; k++) {
+		double error = y[k] - (gain * filtered[k] + bias);
+		errorSum += error * error;
+	}
+
+	model.gain = gain;
+	model.bias = bias;
+	model.tau1 = tau1;
+	model.tau2 = tau2;
+	model.deadTime = deadSamples * dt;
+	model.residual = sqrt(errorSum / n);
+	return model.residual;
+}
+
+/**
+ * The one step ahead fit is biased by measurement noise and at short log periods mostly sees that noise,
+ * second order fits often come out with complex or negative poles. Refine by minimizing the simulated
+ * output error instead: pattern search on log time constants for every dead time.
+ */
+static bool refinePlant(const std::vector<float>& u, const std::vector<float>& y, float dt, int order,
+		const PlantModel& initial, PlantModel& model) {
+	std::vector<double> filtered;
+	bool found = false;
+	float minTau = 0.1f * dt;
+
+	for (int d = 0; d <= MAX_DEAD_TIME_SAMPLES && (size_t)d < y.size() / 2; d++) {
+		double logTau[2] = { log(initial.tau1), log(initial.tau2 > 0 ? initial.tau2 : initial.tau1 / 4) };
+		PlantModel candidate = initial;
+		candidate.order = order;
+
+		auto evaluate = [&](const double* point, PlantModel& result) {
+			float tau1 = exp(point[0]);
+			float tau2 = order == 2 ? exp(point[1]) : 0;
+			// slow lag first, and neither faster than the sampling can tell apart
+			if (tau1 < minTau || (order == 2 && (tau2 < minTau || tau2 > tau1))) {
+				return (float)INFINITY;
+			}
+			result.order = order;
+			return fitGainAndBias(u, y, dt, tau1, tau2, d, filtered, result);
+		};
+
+		float best = evaluate(logTau, candidate);
+		for (double step = 0.5; step > 0.005;) {
+			bool improved = false;
+			for (int axis = 0; axis < order; axis++) {
+				for (int direction = -1; direction <= 1; direction += 2) {
+					double point[2] = { logTau[0], logTau[1] };
+					point[axis] += direction * step;
+					PlantModel result;
+					float error = evaluate(point, result);
+					if (error < best) {
+						best = error;
+						candidate = result;
+						logTau[0] = point[0];
+						logTau[1] = point[1];
+						improved = true;
+					}
+				}
+			}
+			if (!improved) {
+				step /= 2;
+			}
+		}
+
+		if (std::isfinite(best) && (!found || best < model.residual)) {
+			model = candidate;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+static bool identifyAndRefinePlant(const std::vector<float>& u, const std::vector<float>& y, float dt, int order, PlantModel& model) {
+	// first order least squares is the starting point for both orders, it is the one noise does not break
+	PlantModel initial;
+	if (!identifyPlant(u, y, dt, 1, initial)) {
+		return false;
+	}
+
+	// second order least squares only replaces it when it finds stable real poles
+	if (order == 2) {
+		identifyPlant(u, y, dt, 2, initial);
+	}
+
+	return refinePlant(u, y, dt, order, initial, model);
+}
+
+struct PidGains {
+	float kp;
+	float ki;
+	float kd;
+};
+
+/**
+ * SIMC rules for closed loop time constant tauC, converted from series to the parallel form used by Pid
+ */
+static PidGains getSimcGains(const PlantModel& model, float tauC) {
+	float kc = model.tau1 / (model.gain * (tauC + model.deadTime));
+	float ti = minF(model.tau1, 4 * (tauC + model.deadTime));
+	float td = model.tau2;
+
+	PidGains gains;
+	gains.kp = kc * (1 + td / ti);
+	gains.ki = kc / ti;
+	gains.kd = kc * td;
+	return gains;
+}
+
+/**
+ * Maximum sensitivity |1 / (1 + C * G)| over frequency, up to Nyquist of the controller period
+ */
+static float getMaxSensitivity(const PlantModel& model, const PidGains& gains, float dt) {
+	using complex = std::complex<double>;
+
+	double fastest = maxF(maxF(model.deadTime, model.tau2), dt);
+	double wMin = 0.01 / (model.tau1 + model.deadTime);
+	double wMax = minF(100 / fastest, M_PI / dt);
+
+	double result = 0;
+
+	const int points = 500;
+	for (int i = 0; i < points; i++) {
+		double w = wMin * pow(wMax / wMin, (double)i / (points - 1));
+		complex s(0, w);
+
+		// sampling and hold adds half a period of delay
+		double delay = model.deadTime + 0.5 * dt;
+		complex plant = (double)model.gain * exp(-delay * s) / (((double)model.tau1 * s + 1.0) * ((double)model.tau2 * s + 1.0));
+		complex controller = (double)gains.kp + (double)gains.ki / s + (double)gains.kd * s;
+
+		result = maxF(result, std::abs(1.0 / (1.0 + controller * plant)));
+	}
+
+	return result;
+}
+
+/**
+ * Sensitivity drops as the closed loop is made slower, bisect on tauC to hit the target
+ */
+static float findTauCForMaxSensitivity(const PlantModel& model, float dt, float targetMs) {
+	float lo = 0.1f * maxF(model.deadTime, dt);
+	float hi = 20 * (model.tau1 + model.deadTime);
+
+	if (getMaxSensitivity(model, getSimcGains(model, lo), dt) <= targetMs) {
+		return lo;
+	}
+
+	for (int i = 0; i < 60; i++) {
+		float mid = sqrtf(lo * hi);
+		if (getMaxSensitivity(model, getSimcGains(model, mid), dt) > targetMs) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return hi;
+}
+
+/**
+ * Discrete time plant with zero order hold, states of two cascaded first order lags
+ */
+class SimulatedPlant {
+public:
+	SimulatedPlant(const PlantModel& model, float dt, float initialOutput, float initialInput)
+		: m_model(model)
+		, m_alpha1(exp(-dt / model.tau1))
+		, m_alpha2(model.tau2 > 0 ? exp(-dt / model.tau2) : 0)
+		// oldest entry is read back right after the newest is written: one extra slot for the full dead time
+		, m_delay((int)(model.deadTime / dt + 0.5f) + 1, initialInput)
+	{
+		m_x1 = m_x2 = initialOutput;
+	}
+
+	float step(float input) {
+		m_delay[m_delayIndex] = input;
+		m_delayIndex = (m_delayIndex + 1) % m_delay.size();
+		float delayed = m_delay[m_delayIndex];
+
+		float target = m_model.gain * delayed + m_model.bias;
+		m_x1 = m_alpha1 * m_x1 + (1 - m_alpha1) * target;
+		m_x2 = m_alpha2 * m_x2 + (1 - m_alpha2) * m_x1;
+
+		return m_x2;
+	}
+
+private:
+	const PlantModel& m_model;
+	const float m_alpha1;
+	const float m_alpha2;
+	std::vector<float> m_delay;
+	size_t m_delayIndex = 0;
+	float m_x1;
+	float m_x2;
+};
+
+struct LoopStats {
+	float iae;
+	float overshoot;
+};
+
+static LoopStats getLoopStats(const std::vector<float>& setpoint, const std::vector<float>& measurement, float dt) {
+	LoopStats stats = { 0, 0 };
+
+	for (size_t k = 0; k < setpoint.size(); k++) {
+		float error = setpoint[k] - measurement[k];
+		stats.iae += fabsf(error) * dt;
+
+		// only count excursions past the target in the direction of the last setpoint change
+		if (k > 0) {
+			float direction = setpoint[k] - setpoint[0];
+			if (direction * -error > 0) {
+				stats.overshoot = maxF(stats.overshoot, fabsf(error));
+			}
+		}
+	}
+
+	return stats;
+}
+
+/**
+ * Run the firmware Pid against the model on the logged setpoint trace
+ */
+static LoopStats verifyClosedLoop(const PlantModel& model, const PidGains& gains, float dt,
+		const std::vector<float>& setpoint, const std::vector<float>& measurement, const std::vector<float>& output) {
+	float outputMin = output[0];
+	float outputMax = output[0];
+	for (float value : output) {
+		outputMin = minF(outputMin, value);
+		outputMax = maxF(outputMax, value);
+	}
+
+	pid_s parameters;
+	memset(&parameters, 0, sizeof(parameters));
+	parameters.pFactor = gains.kp;
+	parameters.iFactor = gains.ki;
+	parameters.dFactor = gains.kd;
+	parameters.periodMs = dt * 1000;
+	// start from where the recorded loop was, Pid output is relative to that. Limits are whole
+	// units in pid_s so round them outwards, the exact range is applied to 'u' below
+	parameters.minValue = floorf(outputMin - output[0]);
+	parameters.maxValue = ceilf(outputMax - output[0]);
+
+	Pid pid(&parameters);
+	pid.reset();
+	pid.iTermMin = parameters.minValue;
+	pid.iTermMax = parameters.maxValue;
+
+	SimulatedPlant plant(model, dt, measurement[0], output[0]);
+
+	std::vector<float> simulated;
+	float y = measurement[0];
+	for (size_t k = 0; k < setpoint.size(); k++) {
+		simulated.push_back(y);
+		float u = output[0] + pid.getOutput(setpoint[k], y, dt);
+		u = clampF(outputMin, u, outputMax);
+		y = plant.step(u);
+	}
+
+	return getLoopStats(setpoint, simulated, dt);
+}
+
+/**
+ * How much of the measurement variance is explained by the model driven with the logged output
+ */
+static float getModelFitPercent(const PlantModel& model, float dt, const std::vector<float>& measurement, const std::vector<float>& output) {
+	SimulatedPlant plant(model, dt, measurement[0], output[0]);
+
+	double mean = 0;
+	for (float value : measurement) {
+		mean += value;
+	}
+	mean /= measurement.size();
+
+	double errorSum = 0;
+	double varianceSum = 0;
+	float y = measurement[0];
+	for (size_t k = 0; k < measurement.size(); k++) {
+		errorSum += (measurement[k] - y) * (measurement[k] - y);
+		varianceSum += (measurement[k] - mean) * (measurement[k] - mean);
+		y = plant.step(output[k]);
+	}
+
+	if (varianceSum == 0) {
+		return 0;
+	}
+
+	return 100 * (1 - sqrt(errorSum / varianceSum));
+}
+
+static void printUsage() {
+	printf("pid_offline_tune <log.mlg> --setpoint <field> --measurement <field> --output <field>\n");
+	printf("    [--order 1|2] [--ms <max sensitivity, default 1.6>] [--tauc <seconds>] [--from <s>] [--to <s>]\n");
+}
+
+int main(int argc, char** argv) {
+	const char* fileName = nullptr;
+	const char* setpointName = nullptr;
+	const char* measurementName = nullptr;
+	const char* outputName = nullptr;
+	// zero means try both and keep the better one
+	int order = 0;
+	float targetMs = 1.6f;
+	float tauC = 0;
+	float from = 0;
+	float to = 1e9;
+
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--setpoint") && hasValue) {
+			setpointName = argv[++i];
+		} else if (!strcmp(argv[i], "--measurement") && hasValue) {
+			measurementName = argv[++i];
+		} else if (!strcmp(argv[i], "--output") && hasValue) {
+			outputName = argv[++i];
+		} else if (!strcmp(argv[i], "--order") && hasValue) {
+			order = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--ms") && hasValue) {
+			targetMs = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--tauc") && hasValue) {
+			tauC = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--from") && hasValue) {
+			from = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--to") && hasValue) {
+			to = atof(argv[++i]);
+		} else if (!fileName) {
+			fileName = argv[i];
+		} else {
+			printUsage();
+			return -1;
+		}
+	}
+
+	if (!fileName || !setpointName || !measurementName || !outputName || order < 0 || order > 2 || targetMs <= 1) {
+		printUsage();
+		return -1;
+	}
+
+	MlgLog log;
+	if (!readMlg(fileName, log)) {
+		return -1;
+	}
+
+	int timeIndex = log.indexOf("Time");
+	int setpointIndex = log.indexOf(setpointName);
+	int measurementIndex = log.indexOf(measurementName);
+	int outputIndex = log.indexOf(outputName);
+
+	if (timeIndex < 0 || setpointIndex < 0 || measurementIndex < 0 || outputIndex < 0) {
+		printf("Log does not have all of 'Time', '%s', '%s', '%s'\n", setpointName, measurementName, outputName);
+		return -1;
+	}
+
+	std::vector<float> setpoint;
+	std::vector<float> measurement;
+	std::vector<float> output;
+	float firstTime = 0;
+	float lastTime = 0;
+
+	for (auto& record : log.records) {
+		float time = record[timeIndex];
+		if (time < from || time > to) {
+			continue;
+		}
+
+		if (setpoint.empty()) {
+			firstTime = time;
+		}
+		lastTime = time;
+
+		setpoint.push_back(record[setpointIndex]);
+		measurement.push_back(record[measurementIndex]);
+		output.push_back(record[outputIndex]);
+	}
+
+	if (setpoint.size() < 50 || lastTime <= firstTime) {
+		printf("Not enough samples: %d\n", (int)setpoint.size());
+		return -1;
+	}
+
+	// the log is written at a steady rate, the model and the simulated controller use the average period
+	float dt = (lastTime - firstTime) / (setpoint.size() - 1);
+	printf("%d samples over %.1f s, period %.1f ms\n", (int)setpoint.size(), lastTime - firstTime, dt * 1000);
+
+	PlantModel model;
+	bool hasModel = false;
+
+	for (int candidateOrder = 1; candidateOrder <= 2; candidateOrder++) {
+		if (order != 0 && candidateOrder != order) {
+			continue;
+		}
+
+		PlantModel candidate;
+		if (!identifyAndRefinePlant(output, measurement, dt, candidateOrder, candidate)) {
+			printf("No stable order %d model found\n", candidateOrder);
+			continue;
+		}
+
+		printf("Order %d: gain %.4f tau1 %.3f s tau2 %.3f s dead time %.3f s, residual %.4f, fit %.1f%%\n",
+				candidateOrder, candidate.gain, candidate.tau1, candidate.tau2, candidate.deadTime,
+				candidate.residual, getModelFitPercent(candidate, dt, measurement, output));
+
+		// second order has to earn its extra parameter
+		if (!hasModel || candidate.residual < 0.9f * model.residual) {
+			model = candidate;
+			hasModel = true;
+		}
+	}
+
+	if (!hasModel) {
+		printf("Identification failed: is there enough excitation in '%s'?\n", outputName);
+		return -1;
+	}
+
+	if (tauC <= 0) {
+		tauC = findTauCForMaxSensitivity(model, dt, targetMs);
+	}
+
+	PidGains gains = getSimcGains(model, tauC);
+	float ms = getMaxSensitivity(model, gains, dt);
+
+	printf("Using order %d model, tauC %.3f s, max sensitivity %.2f\n", model.order, tauC, ms);
+	printf("pFactor %.5f iFactor %.5f dFactor %.5f\n", gains.kp, gains.ki, gains.kd);
+
+	LoopStats recorded = getLoopStats(setpoint, measurement, dt);
+	LoopStats simulated = verifyClosedLoop(model, gains, dt, setpoint, measurement, output);
+	printf("Recorded  IAE %.3f overshoot %.3f\n", recorded.iae, recorded.overshoot);
+	printf("Simulated IAE %.3f overshoot %.3f\n", simulated.iae, simulated.overshoot);
+
+	return 0;
+}
+
+#endif // EFI_PID_OFFLINE_TUNE
@@ -7,46 +7,56 @@
 
 #define ADC_CHANNEL_COUNT 3
 
-static adcsample_t adcBuffer[ADC_CHANNEL_COUNT * ADC_OVERSAMPLE];
+// Continuous sampling for the sampling thread: DMA runs circular over two halves, and each half is one phase
+// of the ESR excitation. The excitation pin is toggled from the half/full transfer interrupt, so the square wave
+// is locked to the sample clock instead of to however long the thread took to get around its loop.
+static adcsample_t burstBuffer[2 * ADC_CHANNEL_COUNT * ADC_OVERSAMPLE];
 
-ADCConversionGroup convGroup =
-{
-    false,
-    ADC_CHANNEL_COUNT,
-    nullptr,
-    nullptr,
-    ADC_CFGR1_CONT | ADC_CFGR1_RES_12BIT,                  // CFGR1
-    ADC_TR(0, 0),       // TR
-    ADC_SMPR_SMP_7P5,      // SMPR
-    ADC_CHSELR_CHSEL0 | ADC_CHSELR_CHSEL2 | ADC_CHSELR_CHSEL3
-};
+// Frames at the start of each half that are thrown away while the nernst input settles from the excitation step
+#define ESR_SETTLE_FRAMES 4
+static AnalogBurstCallback burstCallback = nullptr;
 
-static float AverageSamples(adcsample_t* buffer, size_t idx)
+static void BurstConversionCallback(ADCDriver* adcp)
 {
-    uint32_t sum = 0;
+    // Toggle first, the next half is already converting and should see the new phase as early as possible
+    palTogglePad(NERNST_ESR_DRIVER_PORT, NERNST_ESR_DRIVER_PIN);
+
+    const adcsample_t* half = adcIsBufferComplete(adcp) ? &burstBuffer[ADC_CHANNEL_COUNT * ADC_OVERSAMPLE] : burstBuffer;
+
+    AnalogBurst burst = {};
+    burst.Frames = ADC_OVERSAMPLE - ESR_SETTLE_FRAMES;
 
-    for (size_t i = 0; i < ADC_OVERSAMPLE; i++)
+    // Skip the first frames of the half, the nernst input is still settling from the excitation step
+    for (size_t i = ESR_SETTLE_FRAMES; i < ADC_OVERSAMPLE; i++)
     {
-        sum += buffer[idx];
-        idx += ADC_CHANNEL_COUNT;
+        const adcsample_t* frame = &half[i * ADC_CHANNEL_COUNT];
+
+        burst.NernstSum += frame[0];
+        burst.PumpCurrentSum += frame[1];
+        burst.VirtualGroundSum += frame[2];
     }
 
-    constexpr float scale = VCC_VOLTS / (ADC_MAX_COUNT * ADC_OVERSAMPLE);
+    // No battery channel on this board, BatteryVoltageSum stays zero
 
-    return (float)sum * scale;
+    burstCallback(burst);
 }
 
-AnalogResult AnalogSample()
+static const ADCConversionGroup burstGroup =
 {
-    adcConvert(&ADCD1, &convGroup, adcBuffer, ADC_OVERSAMPLE);
+    true,
+    ADC_CHANNEL_COUNT,
+    BurstConversionCallback,
+    nullptr,
+    ADC_CFGR1_CONT | ADC_CFGR1_RES_12BIT,                  // CFGR1
+    ADC_TR(0, 0),       // TR
+    ADC_SMPR_SMP_7P5,      // SMPR
+    ADC_CHSELR_CHSEL0 | ADC_CHSELR_CHSEL2 | ADC_CHSELR_CHSEL3
+};
 
-    return
-    {
-        .NernstVoltage = AverageSamples(adcBuffer, 0) * NERNST_INPUT_GAIN,
-        .PumpCurrentVoltage = AverageSamples(adcBuffer, 1),
-        .VirtualGroundVoltageInt = AverageSamples(adcBuffer, 2),
-        .BatteryVoltage = 0,
-    };
+void StartAnalogBursts(AnalogBurstCallback callback)
+{
+    burstCallback = callback;
+    adcStartConversion(&ADCD1, &burstGroup, burstBuffer, 2 * ADC_OVERSAMPLE);
 }
 
 // Returns:
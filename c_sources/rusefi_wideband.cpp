@@ -4,6 +4,7 @@
 
 #include "ch.h"
 #include "can_msg_tx.h"
+#include "can_tasks.h"
 #include "rusefi_wideband.h"
 
 // This file contains an array called build_wideband_noboot_bin
@@ -12,17 +13,256 @@
 
 #define EVT_BOOTLOADER_ACK EVENT_MASK(0)
 
+// Bootloader acks with address 0x727573 aka ascii "rus", windowed acks carry controller tag in top bits
+#define WB_ACK_ID 0x727573
+#define WB_ACK_ID_MASK 0x7F'FFFF
+
+// All controllers on the bus receive the same broadcast data frames and get flashed at once
+#define WB_MAX_PARALLEL_UPDATE 8
+#define WB_DATA_FRAME_SIZE 8
+// data frames in flight ahead of the slowest controller's cumulative ack
+#define WB_WINDOW_FRAMES 8
+#define WB_WINDOW_ACK_TIMEOUT_MS 50
+// consecutive timeouts without any progress before we give up
+#define WB_WINDOW_MAX_RETRIES 10
+// set by bootloader in a cumulative ack when it dropped frames following the acked offset
+#define WB_ACK_GAP_FLAG 0x8000'0000
+
+// opcode 7 queries, answered by each controller with a tagged ack
+#define WB_QUERY_PROGRESS 0
+#define WB_QUERY_CRC 1
+
+struct WidebandUpdateTarget {
+	uint8_t tag;
+	// CRC of the full chip UID, tells apart two controllers whose 6 bit tags collide
+	uint32_t uidCrc;
+	// next expected byte offset (possibly with WB_ACK_GAP_FLAG), or image CRC in response to WB_QUERY_CRC
+	uint32_t value;
+	uint32_t ackCount;
+	uint32_t handledAckCount;
+};
+
 static thread_t* waitingBootloaderThread = nullptr;
 
-void handleWidebandBootloaderAck() {
+static WidebandUpdateTarget updateTargets[WB_MAX_PARALLEL_UPDATE];
+static size_t updateTargetCount = 0;
+// two controllers answered with the same tag, their acks can not be told apart
+static bool isTagCollision = false;
+
+static void recordWindowedAck(uint8_t tag, uint32_t uidCrc, uint32_t value) {
+	chibios_rt::CriticalSectionLocker csl;
+
+	for (size_t i = 0; i < updateTargetCount; i++) {
+		auto& target = updateTargets[i];
+		if (target.tag == tag) {
+			if (target.uidCrc != uidCrc) {
+				isTagCollision = true;
+				return;
+			}
+
+			target.value = value;
+			target.ackCount++;
+			return;
+		}
+	}
+
+	if (updateTargetCount < WB_MAX_PARALLEL_UPDATE) {
+		updateTargets[updateTargetCount++] = { tag, uidCrc, value, 1, 0 };
+	}
+}
+
+bool isWidebandBootloaderAck(const CANRxFrame& frame) {
+	return CAN_ISX(frame) && (CAN_EID(frame) & WB_ACK_ID_MASK) == WB_ACK_ID;
+}
+
+void handleWidebandBootloaderAck(const CANRxFrame& frame) {
+	if (frame.DLC == 8) {
+		uint32_t value = frame.data8[0]
+			| frame.data8[1] << 8
+			| frame.data8[2] << 16
+			| frame.data8[3] << 24;
+		uint32_t uidCrc = frame.data8[4]
+			| frame.data8[5] << 8
+			| frame.data8[6] << 16
+			| frame.data8[7] << 24;
+		recordWindowedAck(CAN_EID(frame) >> 23, uidCrc, value);
+	}
+
 	auto t = waitingBootloaderThread;
 	if (t) {
 		chEvtSignal(t, EVT_BOOTLOADER_ACK);
 	}
 }
 
+static bool waitAck(int timeoutMs) {
+	return chEvtWaitAnyTimeout(EVT_BOOTLOADER_ACK, TIME_MS2I(timeoutMs)) != 0;
+}
+
 bool waitAck() {
-	return chEvtWaitAnyTimeout(EVT_BOOTLOADER_ACK, TIME_MS2I(1000)) != 0;
+	return waitAck(1000);
+}
+
+static void sendWindowedQuery(uint16_t query) {
+	CanTxMessage m(CanCategory::WBO_SERVICE, 0xEF7'0000 + query, 0, true);
+}
+
+/**
+ * @param gapOffset lowest offset reported as a gap since last call, unchanged if none
+ * @return offset acknowledged by the slowest controller
+ */
+static uint32_t collectAcks(uint32_t& gapOffset) {
+	chibios_rt::CriticalSectionLocker csl;
+
+	uint32_t slowest = UINT32_MAX;
+
+	for (size_t i = 0; i < updateTargetCount; i++) {
+		auto& target = updateTargets[i];
+		uint32_t offset = target.value & ~WB_ACK_GAP_FLAG;
+
+		bool isNewAck = target.ackCount != target.handledAckCount;
+		if (isNewAck && (target.value & WB_ACK_GAP_FLAG) && offset < gapOffset) {
+			gapOffset = offset;
+		}
+		target.handledAckCount = target.ackCount;
+
+		if (offset < slowest) {
+			slowest = offset;
+		}
+	}
+
+	return slowest;
+}
+
+static void sendDataFrame(size_t offset, size_t totalSize) {
+	uint8_t dlc = minI(totalSize - offset, WB_DATA_FRAME_SIZE);
+
+	// Embedded data is the frame index, which lets 16 bits address the whole image
+	CanTxMessage m(CanCategory::WBO_SERVICE, 0xEF6'0000 + offset / WB_DATA_FRAME_SIZE, dlc, true);
+	memcpy(&m[0], build_wideband_image_bin + offset, dlc);
+}
+
+/**
+ * Bootloaders which support windowed transfer answer progress query, older ones ignore it
+ * @return number of controllers which answered
+ */
+static size_t discoverWindowedTargets() {
+	{
+		chibios_rt::CriticalSectionLocker csl;
+		updateTargetCount = 0;
+		isTagCollision = false;
+	}
+
+	sendWindowedQuery(WB_QUERY_PROGRESS);
+
+	// give every controller a chance to answer
+	chThdSleepMilliseconds(100);
+	chEvtGetAndClearEvents(EVT_BOOTLOADER_ACK);
+
+	return updateTargetCount;
+}
+
+/**
+ * Keeps up to WB_WINDOW_FRAMES data frames in flight. Bootloaders ack cumulatively and report the first
+ * missing offset right away, in which case we rewind and resend from there. Frames a controller already
+ * has are ignored by it, so the slowest controller paces the transfer for everyone.
+ */
+static bool streamImage(size_t totalSize) {
+	size_t sentOffset = 0;
+	uint32_t lastAckedOffset = 0;
+	int retries = 0;
+
+	while (true) {
+		if (isTagCollision) {
+			// some acks went to the wrong controller's state, progress can not be trusted
+			efiPrintf("Wideband Update ERROR: two controllers answer with the same ack tag.");
+			return false;
+		}
+
+		uint32_t gapOffset = UINT32_MAX;
+		uint32_t ackedOffset = collectAcks(gapOffset);
+
+		if (ackedOffset >= totalSize) {
+			return true;
+		}
+
+		if (ackedOffset != lastAckedOffset) {
+			lastAckedOffset = ackedOffset;
+			retries = 0;
+		}
+
+		if (gapOffset < sentOffset) {
+			// bootloader dropped everything after the gap
+			sentOffset = gapOffset;
+		}
+
+		while (sentOffset < totalSize && sentOffset < ackedOffset + WB_WINDOW_FRAMES * WB_DATA_FRAME_SIZE) {
+			sendDataFrame(sentOffset, totalSize);
+			sentOffset += WB_DATA_FRAME_SIZE;
+		}
+
+		if (waitAck(WB_WINDOW_ACK_TIMEOUT_MS)) {
+			continue;
+		}
+
+		// Lost acks, or image tail shorter than bootloader ack interval: ask where everyone is
+		if (++retries > WB_WINDOW_MAX_RETRIES) {
+			return false;
+		}
+
+		sendWindowedQuery(WB_QUERY_PROGRESS);
+		chThdSleepMilliseconds(WB_WINDOW_ACK_TIMEOUT_MS);
+
+		uint32_t ignored = UINT32_MAX;
+		sentOffset = collectAcks(ignored);
+	}
+}
+
+static bool verifyImage(size_t totalSize) {
+	uint32_t expectedCrc = crc32(build_wideband_image_bin, totalSize);
+
+	uint32_t ackCountBefore[WB_MAX_PARALLEL_UPDATE];
+	for (size_t i = 0; i < updateTargetCount; i++) {
+		ackCountBefore[i] = updateTargets[i].ackCount;
+	}
+
+	sendWindowedQuery(WB_QUERY_CRC);
+	chThdSleepMilliseconds(100);
+
+	bool isOk = !isTagCollision;
+	if (!isOk) {
+		efiPrintf("Wideband Update ERROR: two controllers answer with the same ack tag.");
+	}
+
+	for (size_t i = 0; i < updateTargetCount; i++) {
+		auto& target = updateTargets[i];
+
+		if (target.ackCount == ackCountBefore[i]) {
+			efiPrintf("Wideband Update ERROR: controller %d did not report CRC", target.tag);
+			isOk = false;
+		} else if (target.value != expectedCrc) {
+			efiPrintf("Wideband Update ERROR: controller %d CRC %x expected %x", target.tag, target.value, expectedCrc);
+			isOk = false;
+		}
+	}
+
+	return isOk;
+}
+
+static bool sendImageLegacy(size_t totalSize) {
+	// Send flash data 8 bytes at a time
+	for (size_t i = 0; i < totalSize; i += 8) {
+		{
+			CanTxMessage m(CanCategory::WBO_SERVICE, 0xEF2'0000 + i, 8, true);
+			memcpy(&m[0], build_wideband_image_bin + i, 8);
+		}
+
+		if (!waitAck()) {
+			efiPrintf("Wideband Update ERROR: Expected ACK from data write, didn't get one.");
+			return false;
+		}
+	}
+
+	return true;
 }
 
 void updateWidebandFirmware() {
@@ -41,6 +281,9 @@ void updateWidebandFirmware() {
 	// If the chip was already in bootloader (aka manual mode), then that's ok - the second request will
 	// just be safely ignored (but acked)
 	for (int i = 0; i < 2; i++) {
+		// every controller on the bus acks, the slower ones must not count as the answer to the next command
+		chEvtGetAndClearEvents(EVT_BOOTLOADER_ACK);
+
 		{
 			// Send bootloader entry command
 			CanTxMessage m(CanCategory::WBO_SERVICE, 0xEF0'0000, 0, true);
@@ -48,6 +291,7 @@ void updateWidebandFirmware() {
 
 		if (!waitAck()) {
 			efiPrintf("Wideband Update ERROR: Expected ACK from entry to bootloader, didn't get one.");
+			waitingBootloaderThread = nullptr;
 			return;
 		}
 
@@ -57,6 +301,8 @@ void updateWidebandFirmware() {
 
 	efiPrintf("Wideband Update: in update mode, erasing flash...");
 
+	chEvtGetAndClearEvents(EVT_BOOTLOADER_ACK);
+
 	{
 		// Erase flash - opcode 1, magic value 0x5A5A
 		CanTxMessage m(CanCategory::WBO_SERVICE, 0xEF1'5A5A, 0, true);
@@ -64,26 +310,45 @@ void updateWidebandFirmware() {
 
 	if (!waitAck()) {
 		efiPrintf("Wideband Update ERROR: Expected ACK from flash erase command, didn't get one.");
+		waitingBootloaderThread = nullptr;
 		return;
 	}
 
+	// each controller acks the erase, wait for the slowest one
+	chThdSleepMilliseconds(200);
+
 	size_t totalSize = sizeof(build_wideband_image_bin);
+	size_t targetCount = discoverWindowedTargets();
 
-	efiPrintf("Wideband Update: Flash erased! Sending %d bytes...", totalSize);
+	Timer transferTimer;
+	transferTimer.reset();
 
-	// Send flash data 8 bytes at a time
-	for (size_t i = 0; i < totalSize; i += 8) {
-		{
-			CanTxMessage m(CanCategory::WBO_SERVICE, 0xEF2'0000 + i, 8, true);
-			memcpy(&m[0], build_wideband_image_bin + i, 8);
-		}
+	if (isTagCollision) {
+		// windowed acks and CRC answers would merge, fall back to the old ack per frame transfer
+		efiPrintf("Wideband Update: two controllers share an ack tag, not using windowed transfer.");
+		targetCount = 0;
+	}
 
-		if (!waitAck()) {
-			efiPrintf("Wideband Update ERROR: Expected ACK from data write, didn't get one.");
-			return;
+	bool isOk;
+	if (targetCount == 0) {
+		efiPrintf("Wideband Update: Flash erased! Sending %d bytes...", (int)totalSize);
+		isOk = sendImageLegacy(totalSize);
+	} else {
+		efiPrintf("Wideband Update: Flash erased! Streaming %d bytes to %d controller(s)...", (int)totalSize, (int)targetCount);
+		isOk = streamImage(totalSize);
+		if (!isOk) {
+			efiPrintf("Wideband Update ERROR: transfer stalled, no progress from controllers.");
+		} else {
+			isOk = verifyImage(totalSize);
 		}
 	}
 
+	if (!isOk) {
+		waitingBootloaderThread = nullptr;
+		return;
+	}
+
+	efiPrintf("Wideband Update: image sent in %.1f seconds", transferTimer.getElapsedSeconds());
 	efiPrintf("Wideband Update: Update complete! Rebooting controller.");
 
 	{
@@ -1,4 +1,5 @@
 #include "sampling.h"
+#include "sampling_demod.h"
 #include "interpolation.h"
 
 #include "ch.h"
@@ -37,61 +38,77 @@ static const struct inter_point lsu49_r_to_temp[] =
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
-constexpr float f_abs(float x)
+static EsrDemodulator demodulator;
+static DemodResult demodReady;
+static binary_semaphore_t demodSem;
+
+// Runs in the ADC interrupt once per excitation half period
+static void OnAnalogBurst(const AnalogBurst& burst)
 {
-    return x > 0 ? x : -x;
+    DemodResult result;
+
+    if (demodulator.OnHalfPeriod(burst.NernstSum, burst.PumpCurrentSum, burst.VirtualGroundSum, burst.BatteryVoltageSum, burst.Frames, result))
+    {
+        // If the thread hasn't picked up the last result it simply gets the newer one
+        demodReady = result;
+
+        chSysLockFromISR();
+        chBSemSignalI(&demodSem);
+        chSysUnlockFromISR();
+    }
 }
 
-static THD_WORKING_AREA(waSamplingThread, 256);
+// Same time constants as when the filters ran once per half period
+static constexpr float esrSenseAlpha = AlphaPerUpdate(ESR_SENSE_ALPHA);
+static constexpr float pumpFilterAlpha = AlphaPerUpdate(PUMP_FILTER_ALPHA);
 
-static void SamplingThread(void*)
+// Volts and filters from one demodulated update
+static void ProcessDemodResult(const DemodResult& result)
 {
-    float r_2 = 0;
-    float r_3 = 0;
+    // Summed ADC counts to average volts at the ADC pin, the only float division per update
+    float countsToVolts = VCC_VOLTS / (ADC_MAX_COUNT * result.Frames);
 
-    while(true)
-    {
-        auto result = AnalogSample();
-
-        // Toggle the pin after sampling so that any switching noise occurs while we're doing our math instead of when sampling
-        palTogglePad(NERNST_ESR_DRIVER_PORT, NERNST_ESR_DRIVER_PIN);
+    float nernstAcLocal = result.NernstAc2 * (countsToVolts * NERNST_INPUT_GAIN / 2);
+    nernstDc = result.NernstDc4 * (countsToVolts * NERNST_INPUT_GAIN / 4);
 
-        float r_1 = result.NernstVoltage;
+    nernstAc =
+        (1 - esrSenseAlpha) * nernstAc +
+        esrSenseAlpha * nernstAcLocal;
 
-        // r2_opposite_phase estimates where the previous sample would be had we not been toggling
-        // AKA the absolute value of the difference between r2_opposite_phase and r2 is the amplitude
-        // of the AC component on the nernst voltage.  We have to pull this trick so as to use the past 3
-        // samples to cancel out any slope in the DC (aka actual nernst cell output) from the AC measurement
-        // See firmware/sampling.png for a drawing of what's going on here
-        float r2_opposite_phase = (r_1 + r_3) / 2;
+    // Exponential moving average (aka first order lpf)
+    pumpCurrentSenseVoltage =
+        (1 - pumpFilterAlpha) * pumpCurrentSenseVoltage +
+        pumpFilterAlpha * result.PumpCurrent * countsToVolts;
 
-        // Compute AC (difference) and DC (average) components
-        float nernstAcLocal = f_abs(r2_opposite_phase - r_2);
-        nernstDc = (r2_opposite_phase + r_2) / 2;
+    #ifdef BATTERY_INPUT_DIVIDER
+        internalBatteryVoltage = result.BatteryVoltage * countsToVolts * BATTERY_INPUT_DIVIDER;
+    #endif
+}
 
-        nernstAc =
-            (1 - ESR_SENSE_ALPHA) * nernstAc +
-            ESR_SENSE_ALPHA * nernstAcLocal;
+static THD_WORKING_AREA(waSamplingThread, 256);
 
-        // Exponential moving average (aka first order lpf)
-        pumpCurrentSenseVoltage =
-            (1 - PUMP_FILTER_ALPHA) * pumpCurrentSenseVoltage +
-            PUMP_FILTER_ALPHA * (result.PumpCurrentVoltage - result.VirtualGroundVoltageInt);
+static void SamplingThread(void*)
+{
+    while(true)
+    {
+        chBSemWait(&demodSem);
 
-        #ifdef BATTERY_INPUT_DIVIDER
-            internalBatteryVoltage = result.BatteryVoltage;
-        #endif
+        chSysLock();
+        DemodResult result = demodReady;
+        chSysUnlock();
 
-        // Shift history over by one
-        r_3 = r_2;
-        r_2 = r_1;
+        ProcessDemodResult(result);
     }
 }
 
 void StartSampling()
 {
+    chBSemObjectInit(&demodSem, true);
+
     adcStart(&ADCD1, nullptr);
     chThdCreateStatic(waSamplingThread, sizeof(waSamplingThread), NORMALPRIO + 5, SamplingThread, nullptr);
+
+    StartAnalogBursts(OnAnalogBurst);
 }
 
 float GetNernstAc()
@@ -109,16 +126,89 @@ float GetSensorInternalResistance()
     return totalEsr - VM_RESISTOR_VALUE;
 }
 
+// Nominal ESR at operating temperature, the LSU 4.9 curve above is scaled by this for the other sensors
+static const float sensorNominalEsr[] =
+{
+    /* Lsu49 */  300,
+    /* Lsu42 */  80,
+};
+
+static float GetEsrScale(SensorType type)
+{
+    size_t index = static_cast<size_t>(type);
+
+    if (index >= ARRAY_SIZE(sensorNominalEsr))
+    {
+        index = 0;
+    }
+
+    return sensorNominalEsr[index] / sensorNominalEsr[0];
+}
+
+float GetSensorNormalizedEsr()
+{
+    // Heater thresholds are written for an LSU 4.9, scale so they hold for every sensor type
+    return GetSensorInternalResistance() / GetEsrScale(GetSensorType());
+}
+
+// Float reference, also what the fixed point table is built from
+static float esrScale = 1;
+
+static float GetTemperatureReference(float esr)
+{
+    return interpolate_1d_float(lsu49_r_to_temp, ARRAY_SIZE(lsu49_r_to_temp), esr / esrScale);
+}
+
+// Temperature stored in Q4
+#define TEMPERATURE_Q 16.0f
+
+// Read from several threads, built the same way as the lambda table: into the spare, then swapped in
+static struct fixed_table temperatureTables[2];
+static struct fixed_table* temperatureTable = &temperatureTables[0];
+static float temperatureTableScale = 1;
+static SensorType temperatureTableType;
+static bool temperatureTableValid = false;
+static MUTEX_DECL(temperatureRebuildMutex);
+
+static void RebuildTemperatureTable(SensorType type)
+{
+    chMtxLock(&temperatureRebuildMutex);
+
+    if (!temperatureTableValid || type != temperatureTableType)
+    {
+        struct fixed_table* spare = temperatureTable == &temperatureTables[0] ? &temperatureTables[1] : &temperatureTables[0];
+
+        esrScale = GetEsrScale(type);
+        fixed_table_build(spare, GetTemperatureReference, 80 * esrScale, 5000 * esrScale, TEMPERATURE_Q);
+
+        chSysLock();
+        temperatureTable = spare;
+        temperatureTableScale = esrScale;
+        temperatureTableType = type;
+        temperatureTableValid = true;
+        chSysUnlock();
+    }
+
+    chMtxUnlock(&temperatureRebuildMutex);
+}
+
 float GetSensorTemperature()
 {
-    float esr = GetSensorInternalResistance();
+    SensorType type = GetSensorType();
 
-    if (esr > 5000)
+    if (!temperatureTableValid || type != temperatureTableType)
     {
-        return 0;
+        RebuildTemperatureTable(type);
     }
 
-    return interpolate_1d_float(lsu49_r_to_temp, ARRAY_SIZE(lsu49_r_to_temp), esr);
+    float esr = GetSensorInternalResistance();
+
+    chSysLock();
+    bool inRange = esr <= 5000 * temperatureTableScale;
+    int32_t temperature = inRange ? fixed_table_lookup(temperatureTable, (int32_t)(esr * 65536)) : 0;
+    chSysUnlock();
+
+    return temperature * (1 / TEMPERATURE_Q);
 }
 
 float GetNernstDc()
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of excitation half periods demodulated before the thread is woken up
+#define ESR_BURSTS_PER_UPDATE 8
+
+// Demodulated integer results handed over from the ADC interrupt to the thread
+struct DemodResult
+{
+    // sum of 2 * |AC|, in ADC counts
+    uint32_t NernstAc2;
+    // sum of 4 * DC
+    int32_t NernstDc4;
+    // sum of pump sense minus virtual ground
+    int32_t PumpCurrent;
+    uint32_t BatteryVoltage;
+    // samples per channel that went into the sums above
+    uint32_t Frames;
+};
+
+/**
+ * Slope-cancelling AC/DC split of the nernst signal, fed once per excitation half period with the sums of that
+ * half. Integer only so that it can run from the ADC interrupt, and kept free of any HAL so it runs on the host too.
+ * See firmware/sampling.png for a drawing of what's going on here
+ */
+class EsrDemodulator
+{
+public:
+    // Returns true and fills in result once every ESR_BURSTS_PER_UPDATE half periods
+    bool OnHalfPeriod(int32_t nernstSum, int32_t pumpCurrentSum, int32_t virtualGroundSum, uint32_t batteryVoltageSum, uint32_t frames, DemodResult& result)
+    {
+        int32_t h_1 = nernstSum;
+
+        if (m_history >= 2)
+        {
+            // h_1 + h_3 is twice where the previous half would be had we not been toggling,
+            // so its difference to 2 * h_2 is twice the amplitude of the AC component
+            int32_t opposite2 = h_1 + m_h3;
+            int32_t ac2 = opposite2 - 2 * m_h2;
+            m_accumulator.NernstAc2 += ac2 > 0 ? ac2 : -ac2;
+            m_accumulator.NernstDc4 += opposite2 + 2 * m_h2;
+        }
+        else
+        {
+            m_history++;
+        }
+
+        m_accumulator.PumpCurrent += pumpCurrentSum - virtualGroundSum;
+        m_accumulator.BatteryVoltage += batteryVoltageSum;
+        m_accumulator.Frames += frames;
+
+        // Shift history over by one
+        m_h3 = m_h2;
+        m_h2 = h_1;
+
+        m_burstCount++;
+        if (m_burstCount < ESR_BURSTS_PER_UPDATE)
+        {
+            return false;
+        }
+
+        m_burstCount = 0;
+        result = m_accumulator;
+        m_accumulator = {};
+
+        return true;
+    }
+
+private:
+    DemodResult m_accumulator = {};
+    int32_t m_h2 = 0;
+    int32_t m_h3 = 0;
+    uint8_t m_history = 0;
+    uint8_t m_burstCount = 0;
+};
+
+/**
+ * Filter constants in wideband_config.h are per excitation half period, which is how often the old sampling loop
+ * ran. Returns the alpha giving the same time constant for an EMA updated once per ESR_BURSTS_PER_UPDATE halves.
+ */
+constexpr float AlphaPerUpdate(float alphaPerHalfPeriod)
+{
+    float keep = 1;
+
+    for (int i = 0; i < ESR_BURSTS_PER_UPDATE; i++)
+    {
+        keep *= 1 - alphaPerHalfPeriod;
+    }
+
+    return 1 - keep;
+}
@@ -29,9 +29,19 @@ void FunctionalSensor::showInfo(const char* sensorName) const {
 #if EFI_CAN_SUPPORT || EFI_UNIT_TEST
 #include "can_sensor.h"
 
+#if EFI_CAN_SUPPORT
+expected<efitick_t> getCanListenerSampleAgeNt(const CanListener& listener, efitick_t nowNt);
+#endif // EFI_CAN_SUPPORT
+
 void CanSensorBase::showInfo(const char* sensorName) const {
 	const auto value = get();
 	efiPrintf("CAN Sensor \"%s\": valid: %s value: %.2f", sensorName, boolToString(value.Valid), value.Value);
+
+#if EFI_CAN_SUPPORT
+	if (auto age = getCanListenerSampleAgeNt(*this, getTimeNowNt())) {
+		efiPrintf("CAN Sensor \"%s\": sample age %.1fms", sensorName, NT2US(age.Value) / 1000.0f);
+	}
+#endif // EFI_CAN_SUPPORT
 }
 #endif // EFI_CAN_SUPPORT
 
@@ -19,6 +19,7 @@
 #include "tooth_logger.h"
 
 #include "knock_logic.h"
+#include "torque_sources.h"
 
 #if EFI_ENGINE_CONTROL
 
@@ -104,7 +105,16 @@ static void prepareCylinderIgnitionSchedule(angle_t dwellAngleDuration, floatms_
 		// Offset by this cylinder's position in the cycle
 		+ getCylinderAngle(event->cylinderIndex, event->cylinderNumber)
 		// Pull any extra timing for knock retard
-		+ engine->module<KnockController>()->getKnockRetard();
+		+ engine->module<KnockController>()->getKnockRetard()
+		// and what was learned for this cylinder and operating point
+		+ engine->module<KnockController>()->getLearnedKnockRetard(event->cylinderNumber)
+		// Soft rev limiter takes the first slice of its torque reduction out of timing
+		+ getLimpManager()->getSoftLimitTimingRetard();
+
+#if EFI_TCU
+	// Take torque away through the inertia phase of an upshift
+	sparkAngle += getTransmissionTimingRetard();
+#endif // EFI_TCU
 
 	efiAssertVoid(CUSTOM_SPARK_ANGLE_1, !cisnan(sparkAngle), "sparkAngle#1");
 
@@ -492,11 +502,18 @@ void onTriggerEventSparkLogic(uint32_t trgEventIndex, int rpm, efitick_t edgeTim
 				warning(CUSTOM_ARTIFICIAL_MISFIRE, "artificial misfire on cylinder #1 for testing purposes %d", engine->engineState.sparkCounter);
 				continue;
 			}
+			// Soft rev limiter and launch soft cut are resolved per event with the freshest rpm we have
+			float instantRpm = engine->triggerCentral.instantRpm.getInstantRpm();
+			getLimpManager()->updateSoftRevLimit(instantRpm, edgeTimestamp);
+
+			// Lua, launch and the soft rev limiter share one pattern generator so that their cuts don't stack up on the same cylinders
+			float sparkSkipRatio = maxF(engine->softSparkLimiter.getTargetSkipRatio(), getLimpManager()->getSoftLimitSparkSkipRatio());
 #if EFI_LAUNCH_CONTROL
-			if (engine->softSparkLimiter.shouldSkip()) {
+			sparkSkipRatio = maxF(sparkSkipRatio, engine->launchController.getSparkSkipRatio(instantRpm));
+#endif // EFI_LAUNCH_CONTROL
+			if (engine->softSparkLimiter.shouldSkip(i, sparkSkipRatio)) {
 				continue;
 			}
-#endif // EFI_LAUNCH_CONTROL
 
 			scheduleSparkEvent(limitedSpark, trgEventIndex, event, rpm, edgeTimestamp, currentPhase, nextPhase);
 		}
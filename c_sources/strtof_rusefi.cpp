@@ -0,0 +1,612 @@
+/**
+ * @file	strtof_rusefi.cpp
+ *
+ * Exact string to float conversion for Lua number parsing, lua_str2number() in luaconf.h. Console input
+ * still goes through atoff() from efilib.cpp.
+ *
+ * Short decimals, the bulk of script literals, are scanned once and converted by Clinger's fast path.
+ * Longer decimal input goes through the same fast path when both mantissa and power of ten are exact floats,
+ * then through an Eisel-Lemire style multiplication by a 64-bit truncated power of five. The rare inputs
+ * where truncation error leaves rounding undecided are resolved by an exact big integer comparison
+ * against the halfway point between neighbouring floats. Hex floats (0x1.8p3) are converted exactly.
+ *
+ * Rounding is always round-half-to-even, matching host strtof.
+ */
+
+#include "pch.h"
+
+#define FLOAT_INF_BITS 0x7F800000u
+#define FLOAT_SIGN_BIT 0x80000000u
+
+// that many decimal digits always fit into uint64_t
+#define MAX_FAST_DIGITS 19
+// no halfway point between two floats has more significant digits than this
+#define MAX_EXACT_DIGITS 120
+
+#define MIN_POW5 -65
+#define MAX_POW5 38
+
+/**
+ * 5^q for q in [MIN_POW5, MAX_POW5], normalized to 64 bits (top bit set) and truncated
+ */
+static const uint64_t pow5Mantissa[MAX_POW5 - MIN_POW5 + 1] = {
+	0x86ccbb52ea94baea, 0xa87fea27a539e9a5, 0xd29fe4b18e88640e,
+	0x83a3eeeef9153e89, 0xa48ceaaab75a8e2b, 0xcdb02555653131b6,
+	0x808e17555f3ebf11, 0xa0b19d2ab70e6ed6, 0xc8de047564d20a8b,
+	0xfb158592be068d2e, 0x9ced737bb6c4183d, 0xc428d05aa4751e4c,
+	0xf53304714d9265df, 0x993fe2c6d07b7fab, 0xbf8fdb78849a5f96,
+	0xef73d256a5c0f77c, 0x95a8637627989aad, 0xbb127c53b17ec159,
+	0xe9d71b689dde71af, 0x9226712162ab070d, 0xb6b00d69bb55c8d1,
+	0xe45c10c42a2b3b05, 0x8eb98a7a9a5b04e3, 0xb267ed1940f1c61c,
+	0xdf01e85f912e37a3, 0x8b61313bbabce2c6, 0xae397d8aa96c1b77,
+	0xd9c7dced53c72255, 0x881cea14545c7575, 0xaa242499697392d2,
+	0xd4ad2dbfc3d07787, 0x84ec3c97da624ab4, 0xa6274bbdd0fadd61,
+	0xcfb11ead453994ba, 0x81ceb32c4b43fcf4, 0xa2425ff75e14fc31,
+	0xcad2f7f5359a3b3e, 0xfd87b5f28300ca0d, 0x9e74d1b791e07e48,
+	0xc612062576589dda, 0xf79687aed3eec551, 0x9abe14cd44753b52,
+	0xc16d9a0095928a27, 0xf1c90080baf72cb1, 0x971da05074da7bee,
+	0xbce5086492111aea, 0xec1e4a7db69561a5, 0x9392ee8e921d5d07,
+	0xb877aa3236a4b449, 0xe69594bec44de15b, 0x901d7cf73ab0acd9,
+	0xb424dc35095cd80f, 0xe12e13424bb40e13, 0x8cbccc096f5088cb,
+	0xafebff0bcb24aafe, 0xdbe6fecebdedd5be, 0x89705f4136b4a597,
+	0xabcc77118461cefc, 0xd6bf94d5e57a42bc, 0x8637bd05af6c69b5,
+	0xa7c5ac471b478423, 0xd1b71758e219652b, 0x83126e978d4fdf3b,
+	0xa3d70a3d70a3d70a, 0xcccccccccccccccc, 0x8000000000000000,
+	0xa000000000000000, 0xc800000000000000, 0xfa00000000000000,
+	0x9c40000000000000, 0xc350000000000000, 0xf424000000000000,
+	0x9896800000000000, 0xbebc200000000000, 0xee6b280000000000,
+	0x9502f90000000000, 0xba43b74000000000, 0xe8d4a51000000000,
+	0x9184e72a00000000, 0xb5e620f480000000, 0xe35fa931a0000000,
+	0x8e1bc9bf04000000, 0xb1a2bc2ec5000000, 0xde0b6b3a76400000,
+	0x8ac7230489e80000, 0xad78ebc5ac620000, 0xd8d726b7177a8000,
+	0x878678326eac9000, 0xa968163f0a57b400, 0xd3c21bcecceda100,
+	0x84595161401484a0, 0xa56fa5b99019a5c8, 0xcecb8f27f4200f3a,
+	0x813f3978f8940984, 0xa18f07d736b90be5, 0xc9f2c9cd04674ede,
+	0xfc6f7c4045812296, 0x9dc5ada82b70b59d, 0xc5371912364ce305,
+	0xf684df56c3e01bc6, 0x9a130b963a6c115c, 0xc097ce7bc90715b3,
+	0xf0bdc21abb48db20, 0x96769950b50d88f4,
+};
+
+static const float exactPow10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+static float fromBits(uint32_t bits) {
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+// floor(log2(5^q)), valid for |q| < 500
+static int floorLog2Pow5(int q) {
+	return (152170 * q) >> 16;
+}
+
+static uint64_t mulHigh64(uint64_t a, uint64_t b, uint64_t& lo) {
+	uint64_t aLo = (uint32_t)a;
+	uint64_t aHi = a >> 32;
+	uint64_t bLo = (uint32_t)b;
+	uint64_t bHi = b >> 32;
+
+	uint64_t ll = aLo * bLo;
+	uint64_t lh = aLo * bHi;
+	uint64_t hl = aHi * bLo;
+	uint64_t hh = aHi * bHi;
+
+	uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+	lo = (mid << 32) | (uint32_t)ll;
+	return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+}
+
+// number of mantissa bits available at given binary exponent, fewer for subnormals
+static int floatPrecision(int binExp) {
+	return binExp >= -126 ? 24 : binExp + 150;
+}
+
+/**
+ * @param m64 normalized mantissa, top bit set
+ * @param binExp floor(log2(value)), value = m64 * 2^(binExp - 63)
+ * @param sticky true if there are non-zero bits below m64
+ * @param truncate round towards zero instead of half-to-even
+ */
+static uint32_t roundToFloatBits(uint64_t m64, int binExp, bool sticky, bool truncate = false) {
+	if (binExp > 127) {
+		return FLOAT_INF_BITS;
+	}
+
+	int precision = floatPrecision(binExp);
+	if (precision < 0) {
+		// below half of the smallest subnormal
+		return 0;
+	}
+
+	int shift = 64 - precision;
+	uint64_t m = shift >= 64 ? 0 : m64 >> shift;
+
+	if (!truncate) {
+		uint64_t roundBit = 1ULL << (shift - 1);
+		uint64_t rest = m64 & (roundBit - 1);
+		if ((m64 & roundBit) && (rest || sticky || (m & 1))) {
+			m++;
+		}
+	}
+
+	// the implicit bit of a normal mantissa lands in the exponent field, so does a rounding carry
+	uint32_t bits = binExp >= -126 ? ((uint32_t)(binExp + 126) << 23) + (uint32_t)m : (uint32_t)m;
+	return bits >= FLOAT_INF_BITS ? FLOAT_INF_BITS : bits;
+}
+
+/**
+ * true if the bits below rounding position are (nearly) all ones, so that a carry from
+ * the truncated power of five could still change the rounded result. Truncation error
+ * is below one unit of the upper product word, two after normalization shift.
+ */
+static bool isRoundingUndecided(uint64_t m64, int binExp) {
+	int precision = floatPrecision(binExp);
+	if (binExp > 127 || precision < 0) {
+		return false;
+	}
+
+	uint64_t mask = (1ULL << (63 - precision)) - 1;
+	return (m64 & mask) >= mask - 1;
+}
+
+/**
+ * Computes w * 10^q rounded to float.
+ * @return false if the result could not be decided, 'bits' then holds a lower bound at most one ulp below the answer
+ */
+static bool eiselLemire(uint64_t w, int q, uint32_t& bits) {
+	if (w == 0 || q < MIN_POW5) {
+		bits = 0;
+		return true;
+	}
+
+	if (q > MAX_POW5) {
+		bits = FLOAT_INF_BITS;
+		return true;
+	}
+
+	int lz = __builtin_clzll(w);
+	w <<= lz;
+
+	uint64_t lo;
+	uint64_t hi = mulHigh64(w, pow5Mantissa[q - MIN_POW5], lo);
+
+	int upperBit = hi >> 63;
+	if (!upperBit) {
+		hi = (hi << 1) | (lo >> 63);
+		lo <<= 1;
+	}
+
+	int binExp = 63 + upperBit + floorLog2Pow5(q) + q - lz;
+
+	// 5^27 is the largest power of five that fits 64 bits, the product is exact
+	if (q >= 0 && q <= 27) {
+		bits = roundToFloatBits(hi, binExp, lo != 0);
+		return true;
+	}
+
+	if (isRoundingUndecided(hi, binExp)) {
+		bits = roundToFloatBits(hi, binExp, false, /*truncate*/true);
+		return false;
+	}
+
+	// true value is strictly above the truncated product
+	bits = roundToFloatBits(hi, binExp, true);
+	return true;
+}
+
+/**
+ * Just enough of an arbitrary precision unsigned integer to compare a decimal against a float halfway point
+ */
+class BigUnsigned {
+public:
+	void mulAdd(uint32_t mul, uint32_t add) {
+		uint64_t carry = add;
+		for (size_t i = 0; i < m_len; i++) {
+			uint64_t v = (uint64_t)m_words[i] * mul + carry;
+			m_words[i] = (uint32_t)v;
+			carry = v >> 32;
+		}
+		push(carry);
+	}
+
+	void mulPow5(int n) {
+		// 5^13 is the largest power of five below 2^32
+		for (; n >= 13; n -= 13) {
+			mulAdd(1220703125, 0);
+		}
+		for (; n > 0; n--) {
+			mulAdd(5, 0);
+		}
+	}
+
+	void shiftLeft(int n) {
+		int wordShift = n / 32;
+		int bitShift = n % 32;
+
+		if (bitShift) {
+			uint32_t carry = 0;
+			for (size_t i = 0; i < m_len; i++) {
+				uint32_t v = m_words[i];
+				m_words[i] = (v << bitShift) | carry;
+				carry = v >> (32 - bitShift);
+			}
+			push(carry);
+		}
+
+		if (wordShift && m_len) {
+			size_t newLen = m_len + wordShift < words ? m_len + wordShift : words;
+			for (size_t i = newLen; i-- > 0;) {
+				m_words[i] = i >= (size_t)wordShift ? m_words[i - wordShift] : 0;
+			}
+			m_len = newLen;
+		}
+	}
+
+	int compare(const BigUnsigned& other) const {
+		if (m_len != other.m_len) {
+			return m_len > other.m_len ? 1 : -1;
+		}
+
+		for (size_t i = m_len; i-- > 0;) {
+			if (m_words[i] != other.m_words[i]) {
+				return m_words[i] > other.m_words[i] ? 1 : -1;
+			}
+		}
+
+		return 0;
+	}
+
+private:
+	void push(uint64_t carry) {
+		if (carry && m_len < words) {
+			m_words[m_len++] = (uint32_t)carry;
+		}
+	}
+
+	// enough for MAX_EXACT_DIGITS scaled by the whole float exponent range
+	static constexpr size_t words = 32;
+	uint32_t m_words[words] = {};
+	size_t m_len = 0;
+};
+
+/**
+ * Slow path: exactly decides between 'bits' and the following floats by comparing the full
+ * decimal mantissa in [start, end) times 10^exp10 against each halfway point.
+ */
+static uint32_t decimalToFloatExact(const char* start, const char* end, int exp10, uint32_t bits) {
+	BigUnsigned digits;
+	int kept = 0;
+	bool started = false;
+	bool afterDecimalPoint = false;
+	bool sticky = false;
+
+	for (const char* p = start; p < end; p++) {
+		if (*p == '.') {
+			afterDecimalPoint = true;
+			continue;
+		}
+
+		int digitVal = *p - '0';
+
+		if (!started && digitVal == 0) {
+			if (afterDecimalPoint) {
+				exp10--;
+			}
+			continue;
+		}
+		started = true;
+
+		if (kept < MAX_EXACT_DIGITS) {
+			digits.mulAdd(10, digitVal);
+			kept++;
+			if (afterDecimalPoint) {
+				exp10--;
+			}
+		} else {
+			sticky |= digitVal != 0;
+			if (!afterDecimalPoint) {
+				exp10++;
+			}
+		}
+	}
+
+	if (sticky) {
+		// any digit strictly between the kept prefix and the next value of it
+		digits.mulAdd(10, 1);
+		exp10--;
+	}
+
+	// lower bound is at most one ulp off, two steps are always enough
+	for (int i = 0; i < 3 && bits < FLOAT_INF_BITS; i++) {
+		uint32_t exponentField = bits >> 23;
+		uint32_t mantissa = bits & 0x7FFFFF;
+		int lsbExp = -149;
+		if (exponentField) {
+			mantissa |= 0x800000;
+			lsbExp = exponentField - 150;
+		}
+
+		// halfway point to the next float is (2 * mantissa + 1) * 2^(lsbExp - 1)
+		BigUnsigned lhs = digits;
+		BigUnsigned rhs;
+		rhs.mulAdd(1, 2 * mantissa + 1);
+
+		if (exp10 >= 0) {
+			lhs.mulPow5(exp10);
+		} else {
+			rhs.mulPow5(-exp10);
+		}
+
+		int binShift = exp10 - (lsbExp - 1);
+		if (binShift >= 0) {
+			lhs.shiftLeft(binShift);
+		} else {
+			rhs.shiftLeft(-binShift);
+		}
+
+		int cmp = lhs.compare(rhs);
+		if (cmp < 0 || (cmp == 0 && (bits & 1) == 0)) {
+			break;
+		}
+
+		bits++;
+	}
+
+	return bits;
+}
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static int hexDigitValue(char c) {
+	if (isDigit(c)) {
+		return c - '0';
+	}
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+/**
+ * Parses optional [eEpP][+-]digits, leaves 'str' untouched if there is no valid exponent
+ */
+static int parseExponent(const char*& str, char marker) {
+	const char* p = str;
+	if ((*p | 0x20) != marker) {
+		return 0;
+	}
+	p++;
+
+	bool negative = false;
+	if (*p == '+' || *p == '-') {
+		negative = *p == '-';
+		p++;
+	}
+
+	if (!isDigit(*p)) {
+		return 0;
+	}
+
+	int exponent = 0;
+	for (; isDigit(*p); p++) {
+		// way past anything representable, just keep the sign
+		if (exponent < 100000) {
+			exponent = 10 * exponent + (*p - '0');
+		}
+	}
+
+	str = p;
+	return negative ? -exponent : exponent;
+}
+
+static uint32_t parseHexFloat(const char*& str) {
+	// 'str' points right after 0x
+	const char* p = str;
+	uint64_t mantissa = 0;
+	int exp2 = 0;
+	bool sticky = false;
+	bool anyDigits = false;
+
+	for (int digitVal; (digitVal = hexDigitValue(*p)) >= 0; p++) {
+		anyDigits = true;
+		if ((mantissa >> 60) == 0) {
+			mantissa = (mantissa << 4) | digitVal;
+		} else {
+			sticky |= digitVal != 0;
+			exp2 += 4;
+		}
+	}
+
+	if (*p == '.') {
+		p++;
+		for (int digitVal; (digitVal = hexDigitValue(*p)) >= 0; p++) {
+			anyDigits = true;
+			if ((mantissa >> 60) == 0) {
+				mantissa = (mantissa << 4) | digitVal;
+				exp2 -= 4;
+			} else {
+				sticky |= digitVal != 0;
+			}
+		}
+	}
+
+	if (!anyDigits) {
+		// just the leading "0" of "0x" is a number
+		str--;
+		return 0;
+	}
+
+	exp2 += parseExponent(p, 'p');
+	str = p;
+
+	if (mantissa == 0) {
+		return 0;
+	}
+
+	int lz = __builtin_clzll(mantissa);
+	return roundToFloatBits(mantissa << lz, 63 - lz + exp2, sticky);
+}
+
+static uint32_t parseDecimalFloat(const char*& str, bool& anyDigits) {
+	const char* mantissaStart = str;
+	const char* p = str;
+	uint64_t w = 0;
+	int digitCount = 0;
+	int exp10 = 0;
+	bool truncated = false;
+
+	for (; isDigit(*p); p++) {
+		anyDigits = true;
+		int digitVal = *p - '0';
+		if (digitCount < MAX_FAST_DIGITS) {
+			w = 10 * w + digitVal;
+			// leading zeros are not significant
+			digitCount += w != 0;
+		} else {
+			truncated |= digitVal != 0;
+			exp10++;
+		}
+	}
+
+	if (*p == '.') {
+		p++;
+		for (; isDigit(*p); p++) {
+			anyDigits = true;
+			int digitVal = *p - '0';
+			if (digitCount < MAX_FAST_DIGITS) {
+				w = 10 * w + digitVal;
+				digitCount += w != 0;
+				exp10--;
+			} else {
+				truncated |= digitVal != 0;
+			}
+		}
+	}
+
+	if (!anyDigits) {
+		return 0;
+	}
+
+	const char* mantissaEnd = p;
+	int explicitExp = parseExponent(p, 'e');
+	str = p;
+	exp10 += explicitExp;
+
+	// Clinger's fast path: both operands are exact floats, so is the single rounding
+	if (!truncated && w <= (1 << 24) && exp10 >= -10 && exp10 <= 10) {
+		float value = w;
+		value = exp10 >= 0 ? value * exactPow10[exp10] : value / exactPow10[-exp10];
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	uint32_t bits;
+	bool decided = eiselLemire(w, exp10, bits);
+
+	if (decided && truncated) {
+		// true value is between w and w + 1, fine as long as both round the same way
+		uint32_t upperBits;
+		// rounding is monotonic, so 'bits' stays a valid lower bound for the slow path
+		decided = eiselLemire(w + 1, exp10, upperBits) && upperBits == bits;
+	}
+
+	if (decided) {
+		return bits;
+	}
+
+	return decimalToFloatExact(mantissaStart, mantissaEnd, explicitExp, bits);
+}
+
+// kept out of line so that strtof_rusefi() stays a leaf without a stack frame for short numerals
+__attribute__((noinline)) static float parseFloat(const char* str, char** endPtr) {
+	const char* p = str;
+
+	while (*p == ' ' || (*p >= '\t' && *p <= '\r')) {
+		p++;
+	}
+
+	bool negative = false;
+	if (*p == '+' || *p == '-') {
+		negative = *p == '-';
+		p++;
+	}
+
+	uint32_t bits;
+	bool anyDigits = false;
+
+	if (p[0] == '0' && (p[1] | 0x20) == 'x') {
+		p += 2;
+		bits = parseHexFloat(p);
+		anyDigits = true;
+	} else {
+		bits = parseDecimalFloat(p, anyDigits);
+	}
+
+	if (!anyDigits) {
+		p = str;
+		negative = false;
+	}
+
+	if (endPtr) {
+		*endPtr = const_cast<char*>(p);
+	}
+
+	return fromBits(negative ? bits | FLOAT_SIGN_BIT : bits);
+}
+
+// digits of a short decimal, below 2^24 so the integer mantissa is an exact float
+#define MAX_SHORT_DIGITS 7
+
+/**
+ * strtof replacement: accepts leading whitespace, sign, decimal with optional exponent and hex floats.
+ * On failure *endPtr is set to 'str' and zero is returned.
+ */
+extern "C" float strtof_rusefi(const char* str, char** endPtr) {
+	// "14.7", "6500", "2.5e-4": one scan and Clinger's fast path, the integer mantissa and the power of
+	// ten are both exact floats so the single multiplication or division rounds correctly
+	const char* p = str;
+	// wraps around on long inputs, those are rejected by their digit count
+	uint32_t w = 0;
+
+	for (; isDigit(*p); p++) {
+		w = 10 * w + (*p - '0');
+	}
+	int integerDigits = p - str;
+
+	int fractionDigits = 0;
+	if (*p == '.') {
+		const char* fractionStart = ++p;
+		for (; isDigit(*p); p++) {
+			w = 10 * w + (*p - '0');
+		}
+		fractionDigits = p - fractionStart;
+	}
+
+	int digitCount = integerDigits + fractionDigits;
+	char next = *p | 0x20;
+	if (digitCount == 0 || digitCount > MAX_SHORT_DIGITS || next == 'x') {
+		// whitespace, sign, hex or a long mantissa
+		return parseFloat(str, endPtr);
+	}
+
+	float value = w;
+	if (next == 'e') {
+		int exp10 = parseExponent(p, 'e') - fractionDigits;
+		if (exp10 < -10 || exp10 > 10) {
+			return parseFloat(str, endPtr);
+		}
+		value = exp10 >= 0 ? value * exactPow10[exp10] : value / exactPow10[-exp10];
+	} else {
+		value = value / exactPow10[fractionDigits];
+	}
+
+	if (endPtr) {
+		*endPtr = const_cast<char*>(p);
+	}
+
+	return value;
+}
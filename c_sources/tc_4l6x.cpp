@@ -65,7 +65,11 @@ gear_e Gm4l6xTransmissionController::setCurrentGear(gear_e gear) {
 	if (gear == getCurrentGear()) {
 		return getCurrentGear();
 	}
+	gear_e previousGear = getCurrentGear();
 	currentGear = gear;
+	// remembered before the shift sequencer asks for pressure, that already has to come from the shift tables
+	shiftingFrom = previousGear;
+	isShifting = true;
 	enginePins.tcuTccOnoffSolenoid.setValue(0);
 	for (size_t i = 0; i < efi::size(engineConfiguration->tcu_solenoid); i++) {
 #if ! EFI_UNIT_TEST
@@ -73,9 +77,19 @@ gear_e Gm4l6xTransmissionController::setCurrentGear(gear_e gear) {
 #endif
 	}
 	measureShiftTime(gear);
+	beginShift(previousGear, gear, getTimeNowNt());
 	return getCurrentGear();
 }
 
+void Gm4l6xTransmissionController::applyShiftPressure(ShiftPhase phase) {
+	if (phase == ShiftPhase::None) {
+		// sequenced shift is over once the ratio is there, back to the table of the new gear
+		isShifting = false;
+	}
+
+	setPcState(getCurrentGear());
+}
+
 void Gm4l6xTransmissionController::setTccState() {
 	auto tps = Sensor::get(SensorType::DriverThrottleIntent);
 	auto vss = Sensor::get(SensorType::VehicleSpeed);
@@ -96,12 +110,14 @@ void Gm4l6xTransmissionController::setTccState() {
 }
 
 void Gm4l6xTransmissionController::setPcState(gear_e gear) {
-	uint8_t (*pcts)[sizeof(config->tcu_pcAirmassBins)/sizeof(config->tcu_pcAirmassBins[0])];
-	if (gear != getCurrentGear()) {
-		shiftingFrom = getCurrentGear();
-		isShifting = true;
+	if (m_shiftPhase == ShiftPhase::Fill) {
+		// fast fill of the oncoming clutch, no torque on it yet so the load tables don't apply
+		pcPwm.setSimplePwmDutyCycle(0.01f * engineConfiguration->tcu_shiftFillDuty);
+		return;
 	}
 
+	uint8_t (*pcts)[sizeof(config->tcu_pcAirmassBins)/sizeof(config->tcu_pcAirmassBins[0])];
+
 	switch (getCurrentGear()) {
 	case REVERSE:
 		pcts = &config->tcu_pcValsR;
@@ -143,8 +159,17 @@ void Gm4l6xTransmissionController::setPcState(gear_e gear) {
 		return;
 	}
 
-	float duty = 0.01f * interpolate2d(engine->fuelComputer->sdAirMassInOneCylinder, config->tcu_pcAirmassBins, *pcts);
-	pcPwm.setSimplePwmDutyCycle(duty);
+	float pct = interpolate2d(engine->fuelComputer->sdAirMassInOneCylinder, config->tcu_pcAirmassBins, *pcts);
+
+	// sequenced shifts trim the shift table per phase: the oncoming clutch takes the load over in the torque phase,
+	// and pulls the engine down to the new gear, with torque reduced on upshifts, in the inertia phase
+	if (m_shiftPhase == ShiftPhase::Torque) {
+		pct += engineConfiguration->tcu_shiftTorquePhaseDutyAdder;
+	} else if (m_shiftPhase == ShiftPhase::Inertia) {
+		pct += engineConfiguration->tcu_shiftInertiaPhaseDutyAdder;
+	}
+
+	pcPwm.setSimplePwmDutyCycle(0.01f * clampF(0, pct, 100));
 }
 
 void Gm4l6xTransmissionController::set32State(gear_e gear) {
@@ -153,7 +178,6 @@ void Gm4l6xTransmissionController::set32State(gear_e gear) {
 		if (!vss.Valid) {
 			return;
 		}
-		uint8_t (*pcts)[sizeof(config->tcu_32SpeedBins)/sizeof(config->tcu_32SpeedBins[0])];
 		int pct = interpolate2d(vss.Value, config->tcu_32SpeedBins, config->tcu_32Vals);
 		shift32Pwm.setSimplePwmDutyCycle(pct*0.01);
 	} else {
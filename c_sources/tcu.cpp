@@ -10,6 +10,7 @@
 
 #include "tcu.h"
 #include "engine.h"
+#include "torque_sources.h"
 
 #if EFI_TCU
 void TransmissionControllerBase::init() {
@@ -40,8 +41,94 @@ void TransmissionControllerBase::measureShiftTime(gear_e gear) {
 	m_shiftTimeGear = gear;
 }
 
+/**
+ * Shift sequencing. The slow callback only decides that we shift, the clutch pressure phases and the matching
+ * engine torque reduction are timed from the scheduler so that they line up to the tick rather than to the callback period.
+ *
+ *   fill:    oncoming clutch is filled quickly, no torque transferred yet
+ *   torque:  oncoming clutch takes the load over from the offgoing one, ratio doesn't move yet
+ *   inertia: engine speed is pulled down to the new gear, on upshifts spark retard takes torque away
+ *            so that the clutch isn't fighting the engine, which is what shows up as flare and a long shift
+ */
+
+// how often to look at the gearbox ratio while waiting for the inertia phase to finish
+#define SHIFT_INERTIA_POLL_MS 5
+// raw ratio this close to the new gear's counts as synchronized
+#define SHIFT_SYNC_RATIO_TOLERANCE 0.03f
+
+// only one transmission per ECU, shared with spark logic
+static angle_t shiftTimingRetard = 0;
+
+static void onShiftPhaseEndAdapter(TransmissionControllerBase* controller) {
+	controller->onShiftPhaseEnd(getTimeNowNt());
+}
+
+void TransmissionControllerBase::beginShift(gear_e from, gear_e to, efitick_t nowNt) {
+	engine->executor.cancel(&m_shiftPhaseEvent);
+	shiftTimingRetard = 0;
+
+	// Only clutch-to-clutch shifts between forward gears get sequenced, zero fill time disables it
+	if (from < GEAR_1 || to < GEAR_1 || engineConfiguration->tcu_shiftFillMs == 0) {
+		m_shiftPhase = ShiftPhase::None;
+		return;
+	}
+
+	m_shiftFrom = from;
+	m_shiftTo = to;
+	setShiftPhase(ShiftPhase::Fill, nowNt + MS2NT(engineConfiguration->tcu_shiftFillMs));
+}
+
+void TransmissionControllerBase::setShiftPhase(ShiftPhase phase, efitick_t endNt) {
+	m_shiftPhase = phase;
+	applyShiftPressure(phase);
+	engine->executor.scheduleByTimestampNt("shift", &m_shiftPhaseEvent, endNt, { onShiftPhaseEndAdapter, this });
+}
+
+void TransmissionControllerBase::onShiftPhaseEnd(efitick_t nowNt) {
+	switch (m_shiftPhase) {
+	case ShiftPhase::Fill:
+		setShiftPhase(ShiftPhase::Torque, nowNt + MS2NT(engineConfiguration->tcu_shiftTorquePhaseMs));
+		break;
+	case ShiftPhase::Torque:
+		// Torque reduction starts on the same tick as the inertia phase. Power-on downshifts need the
+		// engine to speed up, so those are left alone
+		if (m_shiftTo > m_shiftFrom) {
+			shiftTimingRetard = engineConfiguration->tcu_shiftTorqueRetard;
+		}
+		m_inertiaDeadline = nowNt + MS2NT(engineConfiguration->tcu_shiftInertiaTimeoutMs);
+		setShiftPhase(ShiftPhase::Inertia, nowNt + MS2NT(SHIFT_INERTIA_POLL_MS));
+		break;
+	case ShiftPhase::Inertia: {
+		// Raw ratio, not the filtered gear: we want to know the moment the engine arrives at the new gear.
+		// Gear from ratio would already say the new gear halfway there, at the threshold between the two
+		float ratio = engine->module<GearDetector>()->computeGearboxRatio();
+		float targetRatio = engineConfiguration->gearRatio[m_shiftTo - 1];
+		bool isSynchronized = absF(ratio - targetRatio) < SHIFT_SYNC_RATIO_TOLERANCE * targetRatio;
+
+		if (isSynchronized || nowNt >= m_inertiaDeadline) {
+			shiftTimingRetard = 0;
+			m_shiftPhase = ShiftPhase::None;
+			applyShiftPressure(ShiftPhase::None);
+		} else {
+			engine->executor.scheduleByTimestampNt("shift", &m_shiftPhaseEvent, nowNt + MS2NT(SHIFT_INERTIA_POLL_MS), { onShiftPhaseEndAdapter, this });
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void TransmissionControllerBase::applyShiftPressure(ShiftPhase /*phase*/) {
+	// plain on/off solenoid transmissions have no pressure control
+}
+
+angle_t getTransmissionTimingRetard() {
+	return shiftTimingRetard;
+}
+
 float TransmissionControllerBase::isShiftCompleted() {
-	if (m_shiftTime &&  m_shiftTimeGear == engine->module<GearDetector>()->getCurrentGear()) {
+	if (m_shiftTime &&  static_cast<size_t>(m_shiftTimeGear) == engine->module<GearDetector>()->getCurrentGear()) {
 		m_shiftTime = false;
 		return m_shiftTimer.getElapsedSeconds();
 	} else {
@@ -0,0 +1,173 @@
+// First order turbo regression harness for boost_model.h: the spool time constant and the boost per duty both
+// depend on exhaust flow, which itself rises with boost. Compares a tuned open loop table plus PID against the
+// model feed-forward with rate limited target, reference tracking and frozen integrator, after the model has
+// learned over a few pulls.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+
+HOST_TEST_GLOBALS
+
+#include "boost_model.h"
+
+static constexpr float dt = 0.05f;
+static constexpr float baro = 101.325f;
+
+// same defaults as setDefaultBoostParameters()
+static constexpr float pFactor = 0.5f;
+static constexpr float iFactor = 0.3f;
+static constexpr float iTermLimit = 50;
+static constexpr float pidLimit = 20;
+static constexpr float initialCoefficients[BoostModel::N] = { 20, 60, -5, 0 };
+
+/**
+ * Turbo whose boost per duty and spool time both scale with exhaust flow
+ */
+struct Turbo {
+	float map = 100;
+	float flow = 300;
+
+	// duty holding this pressure at this flow once spooled
+	static float steadyDuty(float map, float flow) {
+		return (map - 100) * 100 / (flow / 3 * 2.2f);
+	}
+
+	void step(float duty) {
+		float tau = 0.8f * 300 / flow;
+		float steadyMap = 100 + duty / 100 * flow / 3 * 2.2f;
+		map += (steadyMap - map) * dt / (tau + dt);
+		flow = std::min(600.f, 300 + (map - 100) * 2);
+	}
+};
+
+/**
+ * I term is integrated and clamped first, then the sum is clamped to the PID output limits, like Pid::getOutput
+ */
+struct HostPid {
+	float iTerm = 0;
+	float iTermMin = -iTermLimit;
+	float iTermMax = iTermLimit;
+
+	float getOutput(float target, float input) {
+		float error = target - input;
+		iTerm = clampF(iTermMin, iTerm + iFactor * error * dt, iTermMax);
+		return clampF(-pidLimit, pFactor * error + iTerm, pidLimit);
+	}
+};
+
+struct StepResult {
+	float overshoot;
+	float t90;
+	float final;
+};
+
+static StepResult runStep(float target, BoostModel* model, float seconds = 8) {
+	Turbo turbo;
+	HostPid pid;
+	float peak = 0;
+	float t90 = NAN;
+
+	if (model) {
+		model->isActive = false;
+		model->lastMap = turbo.map;
+	}
+
+	for (int k = 0; k < seconds / dt; k++) {
+		float duty;
+
+		if (model) {
+			model->limitTarget(target, turbo.map, dt, 300, 0.25f);
+
+			model->isSteady = absF(turbo.map - model->lastMap) / dt < 10;
+			model->lastMap = turbo.map;
+
+			float reference = model->referenceMap;
+			float error = reference - turbo.map;
+
+			// same hold and restore as BoostController::getClosedLoopImpl
+			bool hold = model->shouldHoldIntegrator(target, error);
+			if (hold) {
+				pid.iTermMin = pid.iTermMax = pid.iTerm;
+			}
+			float closedLoop = pid.getOutput(reference, turbo.map);
+			if (hold) {
+				pid.iTermMin = -iTermLimit;
+				pid.iTermMax = iTermLimit;
+			}
+
+			duty = clampF(0, model->predict(model->rateLimitedTarget / baro, turbo.flow) + closedLoop, 100);
+			model->lastDuty = duty;
+
+			if (model->canLearn()) {
+				model->learn(turbo.map / baro, turbo.flow, duty);
+			}
+		} else {
+			// open loop table tuned for 200 kPa at full flow
+			duty = clampF(0, 27 + pid.getOutput(target, turbo.map), 100);
+		}
+
+		turbo.step(duty);
+
+		peak = std::max(peak, turbo.map);
+		if (std::isnan(t90) && turbo.map >= 100 + 0.9f * (target - 100)) {
+			t90 = (k + 1) * dt;
+		}
+	}
+
+	return { peak - target, t90, turbo.map };
+}
+
+int main() {
+	StepResult table160 = runStep(160, nullptr);
+	StepResult table200 = runStep(200, nullptr);
+	printf("table + PID: overshoot %.1f / %.1f kPa, t90 %.2f / %.2f s\n",
+			table160.overshoot, table200.overshoot, table160.t90, table200.t90);
+
+	BoostModel model;
+	model.reset(initialCoefficients);
+
+	// a few pulls to learn from
+	for (int pull = 0; pull < 8; pull++) {
+		for (float target : { 150.f, 180.f, 200.f, 220.f }) {
+			runStep(target, &model);
+		}
+	}
+
+	printf("learned c0 %.2f c1 %.2f c2 %.2f c3 %.2f\n",
+			model.coefficients[0], model.coefficients[1], model.coefficients[2], model.coefficients[3]);
+
+	for (float target : { 160.f, 200.f }) {
+		StepResult result = runStep(target, &model);
+		printf("model + PID %.0f kPa: overshoot %.1f kPa, t90 %.2f s, final %.1f kPa\n",
+				target, result.overshoot, result.t90, result.final);
+
+		check(result.overshoot < 2, "model step overshoot below 2 kPa", result.overshoot);
+		check(result.t90 < 1.2f, "model step reaches 90% within 1.2 s", result.t90);
+		check(std::fabs(result.final - target) < 1, "model step settles on target", result.final);
+	}
+
+	check(table200.overshoot > 10, "table + PID baseline overshoots", table200.overshoot);
+
+	// feed-forward matches what the turbo needs at steady state operating points it has seen
+	for (float map : { 150.f, 200.f }) {
+		float flow = std::min(600.f, 300 + (map - 100) * 2);
+		float error = model.predict(map / baro, flow) - Turbo::steadyDuty(map, flow);
+		check(std::fabs(error) < 3, "learned duty matches steady state", error);
+	}
+
+	// learning is on the linear model: an out of range prediction is pulled back even while its clamped value agrees
+	BoostModel clamped;
+	clamped.reset(initialCoefficients);
+	clamped.coefficients[0] = 150;
+	float before = clamped.predictUnclamped(2, 500);
+	for (int i = 0; i < 20; i++) {
+		clamped.learn(2, 500, 100);
+	}
+	float after = clamped.predictUnclamped(2, 500);
+	printf("over range prediction %.1f -> %.1f\n", before, after);
+	check(std::fabs(after - 100) < 1, "over range prediction learns down to observed duty", after);
+
+	return hostFailures == 0 ? 0 : 1;
+}
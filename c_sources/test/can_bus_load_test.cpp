@@ -0,0 +1,121 @@
+// Simulated bus traffic through can_bus_load.cpp: frame lengths against the published worst case,
+// RX load and rates over a window on two buses. TX is booked the way CanTxMessage does it, in canWriteOk and
+// canWriteNotOk for all buses together, and must not show up in the per bus load.
+
+#include "host_rusefi.h"
+
+#include <cmath>
+
+#define EFI_CAN_SUPPORT 1
+#define EFI_UNIT_TEST 1
+#define EFI_PROD_CODE 0
+#define EFI_SIMULATOR 1
+#define EFI_TUNER_STUDIO 1
+
+HOST_TEST_GLOBALS
+
+struct Timer {
+	void reset() { m_last = hostNowNt; }
+	void reset(efitick_t nowNt) { m_last = nowNt; }
+	float getElapsedSeconds(efitick_t nowNt) const { return (nowNt - m_last) * 1e-6f; }
+	efitick_t m_last = 0;
+};
+
+enum can_baudrate_e { B100KBPS, B250KBPS, B500KBPS, B1MBPS };
+
+struct {
+	can_baudrate_e canBaudRate = B500KBPS;
+	can_baudrate_e can2BaudRate = B250KBPS;
+} config, *engineConfiguration = &config;
+
+struct {
+	struct {
+		uint32_t canWriteOk;
+		uint32_t canWriteNotOk;
+		float canBus1RxLoadPercent;
+		float canBus2RxLoadPercent;
+		float canBus3RxLoadPercent;
+		uint32_t canTxTimeouts;
+	} outputChannels;
+} engineInstance, *engine = &engineInstance;
+
+struct CANDriver { };
+
+#include "can_bus_load.cpp"
+
+static void rx(size_t bus, bool isExtended, uint8_t dlc) {
+	CANRxFrame frame = {};
+	frame.IDE = isExtended ? CAN_IDE_EXT : CAN_IDE_STD;
+	frame.DLC = dlc;
+	canBusLoadOnRx(bus, frame);
+}
+
+// what CanTxMessage does with the canTransmitTimeout() result, neither bus nor length is recorded
+static void tx(bool isTimeout = false) {
+	if (isTimeout) {
+		engine->outputChannels.canWriteNotOk++;
+	} else {
+		engine->outputChannels.canWriteOk++;
+	}
+}
+
+int main() {
+	// worst case frame lengths without the 3 bit interframe space: 135, 160 and 55 bits with it
+	check(getCanFrameBitCount(false, 8) == 132, "standard 8 byte frame bits", getCanFrameBitCount(false, 8));
+	check(getCanFrameBitCount(true, 8) == 157, "extended 8 byte frame bits", getCanFrameBitCount(true, 8));
+	check(getCanFrameBitCount(false, 0) == 52, "standard empty frame bits", getCanFrameBitCount(false, 0));
+
+	CANDriver can1;
+	CANDriver can2;
+	canBusLoadSetDevice(0, &can1);
+	canBusLoadSetDevice(1, &can2);
+
+	startCanBusLoad();
+
+	// one second of traffic in 10ms ticks, the CAN TX thread updates every tick
+	for (int tick = 1; tick <= 100; tick++) {
+		// bus 1, 500k: 10 standard 8 byte frames received and 5 extended 4 byte frames sent per tick
+		for (int i = 0; i < 10; i++) {
+			rx(0, false, 8);
+		}
+		for (int i = 0; i < 5; i++) {
+			tx();
+		}
+		// bus 2, 250k: 2 standard 2 byte frames per tick, one of them refused by the driver
+		rx(1, false, 2);
+		tx();
+		canBusLoadOnTxDrop(1);
+
+		// every 10th tick one more frame on bus 2 times out in canTransmitTimeout()
+		if (tick % 10 == 0) {
+			tx(true);
+		}
+
+		hostNowNt = US2NT(tick * 10'000);
+		updateCanBusLoad(hostNowNt);
+	}
+
+	float bus1Bits = 1000 * 132;
+	check(fabsf(getCanBusRxLoadPercent(0) - 100 * bus1Bits / 500'000) < 0.01f, "bus 1 RX load percent", getCanBusRxLoadPercent(0));
+
+	float bus2Bits = 100 * getCanFrameBitCount(false, 2);
+	check(fabsf(getCanBusRxLoadPercent(1) - 100 * bus2Bits / 250'000) < 0.01f, "bus 2 RX load percent", getCanBusRxLoadPercent(1));
+	check(getCanTxFramesPerSecond() == 600, "TX frames/s all buses, timeouts excluded", getCanTxFramesPerSecond());
+	check(canBusCounters[1].txDrops == 100, "bus 2 TX drops", canBusCounters[1].txDrops);
+	check(canTxTimeouts == 10, "TX timeouts", canTxTimeouts);
+
+	// same numbers in the TunerStudio output channels
+	check(engine->outputChannels.canBus1RxLoadPercent == getCanBusRxLoadPercent(0), "bus 1 RX load output channel", engine->outputChannels.canBus1RxLoadPercent);
+	check(engine->outputChannels.canBus2RxLoadPercent == getCanBusRxLoadPercent(1), "bus 2 RX load output channel", engine->outputChannels.canBus2RxLoadPercent);
+	check(engine->outputChannels.canTxTimeouts == 10, "TX timeouts output channel", engine->outputChannels.canTxTimeouts);
+
+	showCanBusLoad();
+
+	// idle window reads zero
+	hostNowNt += US2NT(1'000'000);
+	updateCanBusLoad(hostNowNt);
+	check(getCanBusRxLoadPercent(0) == 0, "idle bus 1 RX load percent", getCanBusRxLoadPercent(0));
+	check(getCanTxFramesPerSecond() == 0, "idle TX frames/s", getCanTxFramesPerSecond());
+
+	return hostFailures == 0 ? 0 : 1;
+}
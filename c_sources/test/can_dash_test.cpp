@@ -0,0 +1,550 @@
+// Dash frames from the can_dash.cpp signal tables against copies of the hand written packers they replaced:
+// byte identical for exact values, one count apart where rounding to nearest replaced truncation.
+// Also prints time per frame and host code size of both, the firmware build is not available here.
+
+#include "host_rusefi.h"
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <string>
+
+#define EFI_CAN_SUPPORT 1
+#define EFI_SHAFT_POSITION_INPUT 0
+
+HOST_TEST_GLOBALS
+
+enum class SensorType {
+	Rpm, Map, Tps1, FuelPressureLow, FuelPressureInjector, OilPressure, Lambda1, Lambda2, VehicleSpeed,
+	BatteryVoltage, BarometricPressure, Clt, Iat, FuelLevel, AcceleratorPedal, AuxTemp1, AuxTemp2, Count,
+};
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static expected<float> get(SensorType type) {
+		return sensorValues[(int)type];
+	}
+};
+
+#define VBAT_FALLBACK_VALUE 12
+
+enum can_nbc_e {
+	CAN_BUS_NBC_NONE, CAN_BUS_NBC_FIAT, CAN_BUS_NBC_VAG, CAN_BUS_MAZDA_RX8, CAN_BUS_NBC_BMW, CAN_BUS_W202_C180,
+	CAN_BUS_BMW_E90, CAN_BUS_Haltech, CAN_BUS_MQB, CAN_BUS_NISSAN_VQ, CAN_BUS_GENESIS_COUPE, CAN_BUS_HONDA_K, CAN_AIM_DASH,
+};
+
+static const char* getCan_nbc_e(can_nbc_e) {
+	return "dash";
+}
+
+struct {
+	can_nbc_e canNbcType = CAN_BUS_NBC_NONE;
+} config, *engineConfiguration = &config;
+
+struct {
+	struct {
+		float timingAdvance[1];
+	} engineState;
+	struct {
+		float knockLevel;
+	} outputChannels;
+	struct {
+		float targetLambda;
+	} fuelComputerInstance, *fuelComputer = &fuelComputerInstance;
+} engineInstance, *engine = &engineInstance;
+
+static float getInjectorDutyCycle(float rpm) {
+	return rpm / 100;
+}
+
+typedef uint32_t time_msecs_t;
+#define TIME_I2MS(t) (t)
+static uint32_t chVTGetSystemTime() { return 0; }
+static void date_get_tm(struct tm* timp) { memset(timp, 0, sizeof(*timp)); }
+
+#define CAN_BMW_E46_SPEED 0x153
+#define CAN_BMW_E46_RPM 0x316
+#define CAN_BMW_E46_DME2 0x329
+#define CAN_VAG_Motor_1 0x280
+#define CAN_VAG_Motor_2 0x288
+#define CAN_VAG_CLT_V2 0x420
+#define CAN_VAG_IMMO 0x3D0
+
+constexpr inline uint16_t SWAP_UINT16(uint16_t x) {
+	return ((x << 8) | (x >> 8));
+}
+
+// every frame lands here, cheap enough to not hide the packing cost in the timing
+struct SentFrame {
+	uint32_t id;
+	uint8_t dlc;
+	uint8_t data[8];
+};
+
+static SentFrame lastFrame;
+static volatile uint32_t sentCount;
+
+enum class CanCategory { NBC, OBD };
+
+class CanTxMessage {
+public:
+	CanTxMessage(CanCategory, uint32_t eid, uint8_t dlc = 8, bool = false) : m_id(eid), m_dlc(dlc) { }
+
+	~CanTxMessage() {
+		lastFrame.id = m_id;
+		lastFrame.dlc = m_dlc;
+		memcpy(lastFrame.data, m_data, sizeof(m_data));
+		sentCount = sentCount + 1;
+	}
+
+	uint8_t& operator[](size_t index) {
+		return m_data[index];
+	}
+
+	void setShortValue(uint16_t value, size_t offset) {
+		m_data[offset] = value & 0xFF;
+		m_data[offset + 1] = value >> 8;
+	}
+
+	void setBit(size_t byteIdx, size_t bitIdx) {
+		m_data[byteIdx] |= 1 << bitIdx;
+	}
+
+private:
+	uint32_t m_id;
+	uint8_t m_dlc;
+	uint8_t m_data[8] = {};
+};
+
+template <typename TStorage, int TMult>
+struct scaled_channel {
+	scaled_channel& operator=(float value) {
+		m_value = value * TMult;
+		return *this;
+	}
+
+	TStorage m_value;
+};
+
+template <typename TData>
+static void transmitStruct(CanCategory category, uint32_t id, bool isExtended) {
+	CanTxMessage msg(category, id, sizeof(TData), isExtended);
+	TData data;
+	populateFrame(data);
+	memcpy(&msg[0], &data, sizeof(TData));
+}
+
+#include "can_dash.cpp"
+
+// hand written packers as they were before the conversion
+namespace legacy {
+
+static void sendBmwSpeed() {
+	CanTxMessage msg(CanCategory::NBC, CAN_BMW_E46_SPEED);
+	msg.setShortValue(10 * 8, 1);
+}
+
+static void sendBmwRpm() {
+	CanTxMessage msg(CanCategory::NBC, CAN_BMW_E46_RPM);
+	msg.setShortValue((int) (Sensor::getOrZero(SensorType::Rpm) * 6.4), 2);
+}
+
+static void sendBmwDme2() {
+	CanTxMessage msg(CanCategory::NBC, CAN_BMW_E46_DME2);
+	msg.setShortValue((int) ((Sensor::getOrZero(SensorType::Clt) + 48.373) / 0.75), 1);
+}
+
+static void sendMazdaRpmSpeed() {
+	CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_RPM_SPEED);
+
+	float kph = Sensor::getOrZero(SensorType::VehicleSpeed);
+
+	msg.setShortValue(SWAP_UINT16(Sensor::getOrZero(SensorType::Rpm) * 4), 0);
+	msg.setShortValue(0xFFFF, 2);
+	msg.setShortValue(SWAP_UINT16((int )(100 * kph + 10000)), 4);
+	msg.setShortValue(0, 6);
+}
+
+static void sendMazdaStatus1() {
+	CanTxMessage msg(CanCategory::NBC, CAN_MAZDA_RX_STATUS_1);
+	msg[0] = 0xFE;
+	msg[1] = 0xFE;
+	msg[2] = 0xFE;
+	msg[3] = 0x34;
+	msg[4] = 0x00;
+	msg[5] = 0x40;
+	msg[6] = 0x00;
+	msg[7] = 0x00;
+}
+
+static void sendFiatMotorInfo() {
+	CanTxMessage msg(CanCategory::NBC, CAN_FIAT_MOTOR_INFO);
+	msg.setShortValue((int) (Sensor::getOrZero(SensorType::Clt) - 40), 3);
+	msg.setShortValue(Sensor::getOrZero(SensorType::Rpm) / 32, 6);
+}
+
+static void sendVagMotor1() {
+	CanTxMessage msg(CanCategory::NBC, CAN_VAG_Motor_1);
+	msg.setShortValue(Sensor::getOrZero(SensorType::Rpm) * 4, 2);
+}
+
+static void sendVagMotor2() {
+	CanTxMessage msg(CanCategory::NBC, CAN_VAG_Motor_2);
+	msg.setShortValue((int) ((Sensor::getOrZero(SensorType::Clt) + 48.373) / 0.75), 1);
+}
+
+static void sendVagCltV2() {
+	CanTxMessage msg(CanCategory::NBC, CAN_VAG_CLT_V2);
+	msg.setShortValue((int) ((Sensor::getOrZero(SensorType::Clt) + 48.373) / 0.75), 4);
+}
+
+static void sendVagImmo() {
+	CanTxMessage msg(CanCategory::NBC, CAN_VAG_IMMO);
+	msg.setShortValue(0x80, 1);
+}
+
+static void sendW202Stat1() {
+	CanTxMessage msg(CanCategory::NBC, W202_STAT_1);
+	uint16_t tmp = Sensor::getOrZero(SensorType::Rpm);
+	msg[0] = 0x08;
+	msg[1] = (tmp >> 8);
+	msg[2] = (tmp & 0xff);
+	msg[3] = 0x00;
+	msg[4] = 0x00;
+	msg[5] = 0x00;
+	msg[6] = 0x00;
+	msg[7] = 0x00;
+}
+
+static void sendW202Stat2() {
+	CanTxMessage msg(CanCategory::NBC, W202_STAT_2);
+	msg[0] = (int)(Sensor::getOrZero(SensorType::Clt) + 40);
+	msg[1] = 0x3D;
+	msg[2] = 0x63;
+	msg[3] = 0x41;
+	msg[4] = 0x00;
+	msg[5] = 0x05;
+	msg[6] = 0x50;
+	msg[7] = 0x00;
+}
+
+static void sendW202Alive() {
+	CanTxMessage msg(CanCategory::NBC, W202_ALIVE);
+	msg[0] = 0x0A;
+	msg[1] = 0x18;
+	msg[2] = 0x00;
+	msg[3] = 0x00;
+	msg[4] = 0xC0;
+	msg[5] = 0x00;
+	msg[6] = 0x00;
+	msg[7] = 0x00;
+}
+
+static void sendW202Stat3() {
+	CanTxMessage msg(CanCategory::NBC, W202_STAT_3);
+	msg[0] = 0x00;
+	msg[1] = 0x00;
+	msg[2] = 0x6D;
+	msg[3] = 0x7B;
+	msg[4] = 0x21;
+	msg[5] = 0x07;
+	msg[6] = 0x33;
+	msg[7] = 0x05;
+}
+
+static void sendGenesisRpm() {
+	CanTxMessage msg(CanCategory::NBC, GENESIS_COUPLE_RPM_316, 8);
+	int rpm8 = Sensor::getOrZero(SensorType::Rpm) * 4;
+	msg[3] = rpm8 >> 8;
+	msg[4] = rpm8 & 0xFF;
+}
+
+static void sendGenesisCoolant() {
+	CanTxMessage msg(CanCategory::NBC, GENESIS_COUPLE_COOLANT_329, 8);
+	int clt = Sensor::getOrZero(SensorType::Clt) * 2;
+	msg[1] = clt;
+}
+
+static void sendNissanRpm() {
+	CanTxMessage msg(CanCategory::NBC, NISSAN_RPM_1F9, 8);
+	msg[0] = 0x20;
+	int rpm8 = (int)(Sensor::getOrZero(SensorType::Rpm) * 8);
+	msg[2] = rpm8 >> 8;
+	msg[3] = rpm8 & 0xFF;
+}
+
+static void sendMqbTurnOn() {
+	CanTxMessage msg(CanCategory::NBC, 0x3C0, 4);
+	msg[2] = 3;
+}
+
+static void sendMqbRpm() {
+	CanTxMessage msg(CanCategory::NBC, 0x107, 8);
+	msg[3] = ((int)(Sensor::getOrZero(SensorType::Rpm) / 3.5)) & 0xFF;
+	msg[4] = ((int)(Sensor::getOrZero(SensorType::Rpm) / 3.5)) >> 8;
+}
+
+static void sendE90T15() {
+	CanTxMessage msg(CanCategory::NBC, E90_T15, 5);
+	msg[0] = 0x45;
+	msg[1] = 0x41;
+	msg[2] = 0x61;
+	msg[3] = 0x8F;
+	msg[4] = 0xFC;
+}
+
+static void sendE90Fuel() {
+	CanTxMessage msg(CanCategory::NBC, E90_FUEL, 5);
+	msg[0] = 0x76;
+	msg[1] = 0x0F;
+	msg[2] = 0xBE;
+	msg[3] = 0x1A;
+	msg[4] = 0x00;
+}
+
+static void sendHaltech360() {
+	uint16_t tmp;
+	CanTxMessage msg(CanCategory::NBC, 0x360, 8);
+	tmp = Sensor::getOrZero(SensorType::Rpm);
+	msg[0] = (tmp >> 8);
+	msg[1] = (tmp & 0x00ff);
+	tmp = (((uint16_t)(Sensor::getOrZero(SensorType::Map))) * 10);
+	msg[2] = (tmp >> 8);
+	msg[3] = (tmp & 0x00ff);
+	tmp = (uint16_t)((float)(Sensor::getOrZero(SensorType::Tps1)) * 10);
+	msg[4] = (tmp >> 8);
+	msg[5] = (tmp & 0x00ff);
+	msg[6] = 0;
+	msg[7] = 0;
+}
+
+static void sendHaltech368() {
+	uint16_t tmp;
+	CanTxMessage msg(CanCategory::NBC, 0x368, 8);
+	tmp = (uint16_t)(Sensor::getOrZero(SensorType::Lambda1) * 1000);
+	msg[0] = (tmp >> 8);
+	msg[1] = (tmp & 0x00ff);
+	tmp = (uint16_t)(Sensor::getOrZero(SensorType::Lambda2) * 1000);
+	msg[2] = (tmp >> 8);
+	msg[3] = (tmp & 0x00ff);
+	msg[4] = 0x00;
+	msg[5] = 0x00;
+	msg[6] = 0x00;
+	msg[7] = 0x00;
+}
+
+} // namespace legacy
+
+// where a data field sits in the frame, everything else must match byte for byte
+struct Field {
+	uint8_t byteIndex;
+	uint8_t length;
+	bool isBigEndian;
+	// whole kPa times ten in the hand written code
+	int maxDifference = 1;
+};
+
+struct Comparison {
+	const char* name;
+	// symbol names for the code size sum
+	const char* tableSymbol;
+	const char* legacySymbol;
+	void (*table)();
+	void (*legacy)();
+	Field fields[3];
+};
+
+#define COMPARE(name, frame, send, ...) { name, "transmitDashFrame<" #frame ">(", "legacy::" #send "(", \
+		transmitDashFrame<frame>, legacy::send, { __VA_ARGS__ } }
+
+static const Comparison comparisons[] = {
+	COMPARE("BMW speed", bmwSpeed, sendBmwSpeed),
+	COMPARE("BMW rpm", bmwRpm, sendBmwRpm, { 2, 2, false }),
+	COMPARE("BMW DME2", bmwDme2, sendBmwDme2, { 1, 2, false }),
+	COMPARE("Mazda rpm speed", mazdaRpmSpeed, sendMazdaRpmSpeed, { 0, 2, true }, { 4, 2, true }),
+	COMPARE("Mazda status 1", mazdaStatus1, sendMazdaStatus1),
+	COMPARE("Fiat motor info", fiatMotorInfo, sendFiatMotorInfo, { 3, 2, false }, { 6, 2, false }),
+	COMPARE("VAG motor 1", vagMotor1, sendVagMotor1, { 2, 2, false }),
+	COMPARE("VAG motor 2", vagMotor2, sendVagMotor2, { 1, 2, false }),
+	COMPARE("VAG CLT v2", vagCltV2, sendVagCltV2, { 4, 2, false }),
+	COMPARE("VAG immo", vagImmo, sendVagImmo),
+	COMPARE("W202 stat 1", w202Stat1, sendW202Stat1, { 1, 2, true }),
+	COMPARE("W202 stat 2", w202Stat2, sendW202Stat2, { 0, 1, false }),
+	COMPARE("W202 alive", w202Alive, sendW202Alive),
+	COMPARE("W202 stat 3", w202Stat3, sendW202Stat3),
+	COMPARE("Genesis rpm", genesisRpm, sendGenesisRpm, { 3, 2, true }),
+	COMPARE("Genesis coolant", genesisCoolant, sendGenesisCoolant, { 1, 1, false }),
+	COMPARE("Nissan rpm", nissanRpm, sendNissanRpm, { 2, 2, true }),
+	COMPARE("MQB turn on", mqbTurnOn, sendMqbTurnOn),
+	COMPARE("MQB rpm", mqbRpm, sendMqbRpm, { 3, 2, false }),
+	COMPARE("E90 T15", e90T15, sendE90T15),
+	COMPARE("E90 fuel", e90Fuel, sendE90Fuel),
+	COMPARE("Haltech 0x360", haltech360, sendHaltech360, { 0, 2, true }, { 2, 2, true, 10 }, { 4, 2, true }),
+	COMPARE("Haltech 0x368", haltech368, sendHaltech368, { 0, 2, true }, { 2, 2, true }),
+};
+
+static SentFrame capture(void (*send)()) {
+	lastFrame = {};
+	send();
+	return lastFrame;
+}
+
+static int readField(const SentFrame& frame, const Field& field) {
+	int value = 0;
+	for (size_t i = 0; i < field.length; i++) {
+		size_t shift = field.isBigEndian ? 8 * (field.length - 1 - i) : 8 * i;
+		value |= frame.data[field.byteIndex + i] << shift;
+	}
+	return value;
+}
+
+static void setSensors(float rpm, float clt, float vss, float map) {
+	sensorValues[(int)SensorType::Rpm] = rpm;
+	sensorValues[(int)SensorType::Clt] = clt;
+	sensorValues[(int)SensorType::VehicleSpeed] = vss;
+	sensorValues[(int)SensorType::Map] = map;
+	sensorValues[(int)SensorType::Tps1] = map / 3;
+	sensorValues[(int)SensorType::Lambda1] = 0.7f + map / 500;
+	sensorValues[(int)SensorType::Lambda2] = 0.7f + clt / 500;
+}
+
+// table frames either match the hand written bytes or sit a count above where truncation became rounding
+static bool compareFrames(const Comparison& comparison, bool isExactOnly) {
+	SentFrame table = capture(comparison.table);
+	SentFrame legacy = capture(comparison.legacy);
+
+	if (table.id != legacy.id || table.dlc != legacy.dlc) {
+		return false;
+	}
+
+	bool isFieldByte[8] = {};
+	for (auto& field : comparison.fields) {
+		if (field.length == 0) {
+			continue;
+		}
+		int difference = readField(table, field) - readField(legacy, field);
+		if (difference < 0 || difference > (isExactOnly ? 0 : field.maxDifference)) {
+			return false;
+		}
+		for (size_t i = 0; i < field.length; i++) {
+			isFieldByte[field.byteIndex + i] = true;
+		}
+	}
+
+	for (size_t i = 0; i < table.dlc; i++) {
+		if (!isFieldByte[i] && table.data[i] != legacy.data[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static double nanosecondsPerFrame(void (*send)()) {
+	constexpr int count = 200'000;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < count; i++) {
+		sensorValues[(int)SensorType::Rpm] = i & 0x1FFF;
+		send();
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / count;
+}
+
+// host code size of both, sums symbol sizes of this binary, not a substitute for the firmware map file
+static void printCodeSize(const char* binary) {
+	std::string command = std::string("nm -S -C --defined-only ") + binary + " 2>/dev/null";
+	FILE* nm = popen(command.c_str(), "r");
+	if (!nm) {
+		printf("code size: n/a\n");
+		return;
+	}
+
+	size_t tableBytes = 0;
+	size_t legacyBytes = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), nm)) {
+		unsigned long long address;
+		unsigned long long size;
+		char type;
+		int nameOffset;
+		if (sscanf(line, "%llx %llx %c %n", &address, &size, &type, &nameOffset) != 3 || (type != 't' && type != 'T')) {
+			continue;
+		}
+		const char* name = line + nameOffset;
+		for (auto& comparison : comparisons) {
+			if (strstr(name, comparison.tableSymbol)) {
+				tableBytes += size;
+			} else if (strstr(name, comparison.legacySymbol)) {
+				legacyBytes += size;
+			}
+		}
+	}
+
+	if (pclose(nm) != 0 || legacyBytes == 0) {
+		printf("code size: n/a\n");
+		return;
+	}
+	printf("code size on host: tables %d bytes, hand written %d bytes\n", (int)tableBytes, (int)legacyBytes);
+}
+
+int main(int, char** argv) {
+	// exact values: byte identical, MAP in whole kPa so the old x10 packing matches too
+	setSensors(3360, 90, 50, 100);
+	engineConfiguration->canNbcType = CAN_BUS_NBC_BMW;
+	for (auto& comparison : comparisons) {
+		std::string what = std::string(comparison.name) + " bytes at exact values";
+		check(compareFrames(comparison, /*isExactOnly*/true), what.c_str(), 0);
+	}
+
+	// sweep: rounding to nearest is at most one count above truncation, MAP now keeps its 0.1 kPa
+	for (auto& comparison : comparisons) {
+		int failures = 0;
+		for (int i = 0; i < 500; i++) {
+			// coolant from 40C up, below that the hand written Fiat code wrapped
+			setSensors(i * 13.7f, 40 + i * 0.16f, i * 0.49f, 20 + i * 0.43f);
+			if (!compareFrames(comparison, /*isExactOnly*/false)) {
+				failures++;
+			}
+		}
+		std::string what = std::string(comparison.name) + " within one count over the sweep";
+		check(failures == 0, what.c_str(), failures);
+	}
+
+	// MAP 100.5 kPa: 1005 now, 1000 before
+	setSensors(3000, 90, 50, 100.5f);
+	SentFrame haltech = capture(transmitDashFrame<haltech360>);
+	check(haltech.data[2] == 0x03 && haltech.data[3] == 0xED, "Haltech MAP at 0.1 kPa", readField(haltech, { 2, 2, true }));
+
+	// below zero the table saturates, the hand written Fiat code wrapped to 0xFFxx
+	setSensors(3000, 20, 50, 100);
+	SentFrame fiat = capture(transmitDashFrame<fiatMotorInfo>);
+	check(fiat.data[3] == 0 && fiat.data[4] == 0, "Fiat coolant below offset saturates", readField(fiat, { 3, 2, false }));
+
+	// every converted dash still has its frames in the table
+	can_nbc_e dashes[] = { CAN_BUS_NBC_BMW, CAN_BUS_MAZDA_RX8, CAN_BUS_NBC_FIAT, CAN_BUS_NBC_VAG, CAN_BUS_W202_C180,
+		CAN_BUS_GENESIS_COUPE, CAN_BUS_NISSAN_VQ, CAN_BUS_MQB, CAN_BUS_BMW_E90, CAN_BUS_Haltech, CAN_AIM_DASH };
+	for (auto dash : dashes) {
+		engineConfiguration->canNbcType = dash;
+		checkDashType();
+	}
+	check(hostFirmwareErrors == 0, "every dash type has messages", hostFirmwareErrors);
+
+	double tableNs = 0;
+	double legacyNs = 0;
+	for (auto& comparison : comparisons) {
+		tableNs += nanosecondsPerFrame(comparison.table);
+		legacyNs += nanosecondsPerFrame(comparison.legacy);
+	}
+	printf("time per frame on host: tables %.1f ns, hand written %.1f ns\n",
+			tableNs / efi::size(comparisons), legacyNs / efi::size(comparisons));
+
+	printCodeSize(argv[0]);
+
+	return hostFailures == 0 ? 0 : 1;
+}
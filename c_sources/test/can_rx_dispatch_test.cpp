@@ -0,0 +1,347 @@
+// Bus replay through the CAN RX listener index in can_rx.cpp: every listener has to see exactly the frames the
+// old walk over all listeners delivered, and the benchmark prints the cost per frame of both. AEM X-Series
+// wideband sensors are registered for their own IDs and get sample age and staleness from those alone.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#define EFI_CAN_SUPPORT 1
+#define EFI_WIDEBAND_FIRMWARE_UPDATE 0
+#define EFI_USE_OPENBLT 0
+#define EFI_CANBUS_SLAVE 0
+
+HOST_TEST_GLOBALS
+
+#define SCRIPT_TABLE_8 8
+
+enum imu_type_e { IMU_NONE, IMU_MM5_10, IMU_TYPE_MB_A0065422618 };
+
+struct {
+	bool usescriptTableForCanSniffingFiltering = false;
+	bool verboseCan = false;
+	bool verboseCan2 = false;
+	imu_type_e imuType = IMU_NONE;
+} config, *engineConfiguration = &config;
+
+struct {
+	struct {
+		struct {
+			float yaw, roll, x, y, z;
+		} accelerometer;
+	} sensors;
+} engineInstance, *engine = &engineInstance;
+
+class CanListener {
+public:
+	CanListener(uint32_t id) : m_id(id) { }
+	virtual ~CanListener() = default;
+
+	CanListener* getNext() const { return m_next; }
+	void setNext(CanListener* next) { m_next = next; }
+	uint32_t getId() const { return m_id; }
+
+	virtual void processFrame(const CANRxFrame& frame, efitick_t nowNt) {
+		if (acceptFrame(frame)) {
+			decodeFrame(frame, nowNt);
+		}
+	}
+
+	virtual bool acceptFrame(const CANRxFrame& frame) const {
+		return CAN_ID(frame) == m_id;
+	}
+
+protected:
+	virtual void decodeFrame(const CANRxFrame& frame, efitick_t nowNt) = 0;
+
+private:
+	CanListener* m_next = nullptr;
+	const uint32_t m_id;
+};
+
+enum class SensorType { Lambda1, Lambda2 };
+
+class CanSensorBase : public CanListener {
+public:
+	using CanListener::CanListener;
+	CanSensorBase(uint32_t id, SensorType, efitick_t) : CanListener(id) { }
+	void invalidate(UnexpectedCode = UnexpectedCode::Unknown) { invalidated++; }
+	void setValidValue(float value, efitick_t) { samples++; lastValue = value; }
+	void Register() { }
+	int invalidated = 0;
+	int samples = 0;
+	float lastValue = 0;
+};
+
+static void processCanRxVss(const CANRxFrame&, efitick_t) { }
+static void processCanBenchTest(const CANRxFrame&) { }
+static void processLuaCan(size_t, const CANRxFrame&) { }
+static void obdOnCanPacketRx(const CANRxFrame&, size_t) { }
+struct CANDriver { };
+void canBusLoadOnRx(size_t, const CANRxFrame&) { }
+
+#include "can_rx.cpp"
+
+#define OBD_WB_FW_Mismatch OBD_PCM_Processor_Fault
+#define SWAP_UINT16(x) ((uint16_t)(((x) << 8) | ((x) >> 8)))
+
+class AemXSeriesWideband : public CanSensorBase {
+public:
+	AemXSeriesWideband(uint8_t sensorIndex, SensorType type);
+	bool acceptFrame(const CANRxFrame& frame) const override;
+	void registerIds();
+
+	float tempC = 0, heaterDuty = 0, pumpDuty = 0, nernstVoltage = 0, esr = 0;
+	uint8_t faultCode = 0;
+
+protected:
+	void decodeFrame(const CANRxFrame& frame, efitick_t nowNt) override;
+
+private:
+	void decodeAemXSeries(const CANRxFrame& frame, efitick_t nowNt);
+	void decodeRusefiStandard(const CANRxFrame& frame, efitick_t nowNt);
+	void decodeRusefiDiag(const CANRxFrame& frame);
+	const uint8_t m_sensorIndex;
+};
+
+#define RUSEFI_WIDEBAND_VERSION 0xA0
+namespace wbo {
+struct StandardData {
+	uint8_t Version;
+	uint8_t Valid;
+	uint16_t Lambda;
+	uint16_t TemperatureC;
+	uint16_t pad;
+};
+
+struct DiagData {
+	uint16_t Esr;
+	uint16_t NernstDc;
+	uint8_t PumpDuty;
+	uint8_t Status;
+	uint8_t HeaterDuty;
+	uint8_t pad;
+};
+}
+
+#include "AemXSeriesLambda.cpp"
+
+class CountingListener : public CanListener {
+public:
+	using CanListener::CanListener;
+	uint32_t decoded = 0;
+	uint64_t payloadSum = 0;
+
+protected:
+	void decodeFrame(const CANRxFrame& frame, efitick_t) override {
+		decoded++;
+		payloadSum += frame.data64[0];
+	}
+};
+
+// catch-all listener with its own acceptFrame()
+class RangeListener : public CountingListener {
+public:
+	RangeListener(uint32_t first, uint32_t last) : CountingListener(0), m_first(first), m_last(last) { }
+
+	bool acceptFrame(const CANRxFrame& frame) const override {
+		return CAN_ID(frame) >= m_first && CAN_ID(frame) <= m_last;
+	}
+
+private:
+	uint32_t m_first;
+	uint32_t m_last;
+};
+
+// hits on all of a listener's exact slots
+static uint32_t exactHits(const CanListener& listener) {
+	uint32_t hits = 0;
+	for (size_t i = 0; i < exactListenerCount; i++) {
+		hits += exactListeners[i].listener == &listener ? exactListeners[i].hits : 0;
+	}
+	return hits;
+}
+
+int main() {
+	// what an ECU typically listens to: wideband controllers, VSS, CAN sensors, Lua and dash IDs
+	AemXSeriesWideband aem1(0, SensorType::Lambda1);
+	AemXSeriesWideband aem2(1, SensorType::Lambda2);
+	aem1.registerIds();
+	aem2.registerIds();
+
+	std::vector<CountingListener*> listeners;
+	for (uint32_t id = 0x1A0; id < 0x1A0 + 16; id++) {
+		listeners.push_back(new CountingListener(id));
+	}
+	for (uint32_t id = 0x400; id < 0x400 + 24; id++) {
+		listeners.push_back(new CountingListener(id));
+	}
+	// two listeners on the same ID, both have to get it
+	listeners.push_back(new CountingListener(0x405));
+	listeners.push_back(new RangeListener(0x180, 0x18F));
+
+	for (auto listener : listeners) {
+		registerCanListener(*listener);
+	}
+
+	// car bus replay: 200 IDs, about a quarter of the traffic is for us
+	std::mt19937 rng(78);
+	std::vector<CANRxFrame> trace(200'000);
+	for (auto& frame : trace) {
+		memset(&frame, 0, sizeof(frame));
+		uint32_t r = rng() % 200;
+		frame.SID = r < 16 ? 0x180 + r : r < 32 ? 0x190 + (r - 16) : r < 48 ? 0x1A0 + (r - 32) : r < 72 ? 0x400 + (r - 48) : 0x600 + r;
+		frame.DLC = 8;
+		frame.data64[0] = rng();
+		// rusEFI wideband standard frames carry the firmware version the sensor checks for
+		frame.data8[0] = frame.SID >= 0x190 && frame.SID < 0x1A0 && frame.SID % 2 == 0 ? RUSEFI_WIDEBAND_VERSION : frame.data8[0];
+	}
+
+	// reference: the old walk handing every frame to every listener
+	std::vector<uint32_t> expectedDecoded(listeners.size());
+	std::vector<uint64_t> expectedSum(listeners.size());
+	auto walkStart = std::chrono::steady_clock::now();
+	for (auto& frame : trace) {
+		for (CanListener* current = canListeners_head; current; current = current->getNext()) {
+			current->processFrame(frame, 0);
+		}
+	}
+	auto walkEnd = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < listeners.size(); i++) {
+		expectedDecoded[i] = listeners[i]->decoded;
+		expectedSum[i] = listeners[i]->payloadSum;
+		listeners[i]->decoded = 0;
+		listeners[i]->payloadSum = 0;
+	}
+	int expectedAemUpdates = aem1.samples + aem1.invalidated;
+	float expectedAemEsr = aem1.esr;
+	aem1.samples = aem1.invalidated = 0;
+	aem1.esr = 0;
+
+	auto indexStart = std::chrono::steady_clock::now();
+	for (auto& frame : trace) {
+		hostNowNt += 100;
+		serviceCanSubscribers(frame, hostNowNt);
+	}
+	auto indexEnd = std::chrono::steady_clock::now();
+
+	bool same = true;
+	for (size_t i = 0; i < listeners.size(); i++) {
+		same &= listeners[i]->decoded == expectedDecoded[i] && listeners[i]->payloadSum == expectedSum[i];
+	}
+	check(same, "index delivers the same frames as the walk", listeners.size());
+	check(listeners[5]->decoded > 0, "exact listener saw its frames", listeners[5]->decoded);
+	check(listeners.back()->decoded > 0, "catch-all listener saw its frames", listeners.back()->decoded);
+	check(aem1.samples + aem1.invalidated == expectedAemUpdates && aem1.esr == expectedAemEsr,
+			"AEM decodes the same frames as with the walk", expectedAemUpdates);
+
+	// AEM only pays for, and counts, frames on its own IDs: 0x180 + i, 0x190 + 2i and 0x191 + 2i
+	uint32_t aemFrames = 0;
+	efitick_t lastAemSampleNt = 0;
+	efitick_t frameNt = hostNowNt - 100 * (efitick_t)trace.size();
+	for (auto& frame : trace) {
+		frameNt += 100;
+		bool isSample = frame.SID == 0x181 || frame.SID == 0x192;
+		aemFrames += isSample || frame.SID == 0x193;
+		lastAemSampleNt = isSample ? frameNt : lastAemSampleNt;
+	}
+	check(exactHits(aem2) == aemFrames, "AEM hits are its own frames only", exactHits(aem2));
+	check(catchAllListenerCount == 1, "AEM not a catch-all listener", catchAllListenerCount);
+	check(getCanListenerSampleAgeNt(aem2, hostNowNt).value_or(-1) == hostNowNt - lastAemSampleNt,
+			"AEM sample age from its lambda frames", getCanListenerSampleAgeNt(aem2, hostNowNt).value_or(-1));
+
+	double walkNs = std::chrono::duration<double, std::nano>(walkEnd - walkStart).count() / trace.size();
+	double indexNs = std::chrono::duration<double, std::nano>(indexEnd - indexStart).count() / trace.size();
+	printf("benchmark: %d listeners, walk %.1f ns/frame, index %.1f ns/frame\n", (int)listeners.size(), walkNs, indexNs);
+
+	// driver stamped arrival reaches the listeners instead of the RX thread time, once per report
+	struct ArrivalListener : public CanListener {
+		using CanListener::CanListener;
+		efitick_t seenNt = 0;
+		void decodeFrame(const CANRxFrame&, efitick_t nowNt) override { seenNt = nowNt; }
+	};
+	ArrivalListener arrival(0x7F0);
+	registerCanListener(arrival);
+	CANRxFrame frame = {};
+	frame.SID = 0x7F0;
+	frame.DLC = 8;
+
+	canRxSetArrivalNtI(1, 5'000);
+	processCanRxMessage(1, frame, 5'250);
+	check(arrival.seenNt == 5'000, "driver arrival time used", arrival.seenNt);
+	processCanRxMessage(1, frame, 6'000);
+	check(arrival.seenNt == 6'000, "RX thread time without a fresh report", arrival.seenNt);
+	canRxSetArrivalNtI(0, 8'000);
+	processCanRxMessage(1, frame, 7'000);
+	check(arrival.seenNt == 7'000, "report for another bus not used", arrival.seenNt);
+	processCanRxMessage(0, frame, 7'500);
+	check(arrival.seenNt == 7'500, "arrival after RX thread pickup not used", arrival.seenNt);
+
+	// sensor staleness follows the sender rate as it is now, not the mean since boot
+	struct RateSensor : public CanSensorBase {
+		using CanSensorBase::CanSensorBase;
+		void decodeFrame(const CANRxFrame&, efitick_t) override { }
+	};
+	RateSensor sensor(0x7E8);
+	registerCanSensor(sensor);
+	frame.SID = 0x7E8;
+	auto sendEvery = [&](efitick_t periodNt, int count) {
+		for (int i = 0; i < count; i++) {
+			hostNowNt += periodNt;
+			serviceCanSubscribers(frame, hostNowNt);
+		}
+	};
+
+	sendEvery(MS2NT(50), 40);
+	checkCanSensorSampleAge(hostNowNt + MS2NT(100));
+	check(sensor.invalidated == 0, "slow sender two intervals late is not stale", sensor.invalidated);
+	check(getCanListenerSampleAgeNt(sensor, hostNowNt + MS2NT(100)).value_or(0) == MS2NT(100), "sample age",
+			getCanListenerSampleAgeNt(sensor, hostNowNt + MS2NT(100)).value_or(0));
+
+	// the mean since boot would still be about 30ms here and wait 90ms
+	sendEvery(MS2NT(10), 40);
+	checkCanSensorSampleAge(hostNowNt + MS2NT(40));
+	check(sensor.invalidated == 1, "sender gone fast is stale after a few of its new intervals", sensor.invalidated);
+
+	sendEvery(MS2NT(50), 40);
+	checkCanSensorSampleAge(hostNowNt + MS2NT(40));
+	check(sensor.invalidated == 1, "sender back to slow is not stale between frames", sensor.invalidated);
+
+	// AEM at 100Hz with its rusEFI diagnostic frame still coming: lambda is stale once the lambda frames stop
+	aem1.invalidated = 0;
+	CANRxFrame standard = {};
+	standard.SID = 0x190;
+	standard.DLC = 8;
+	standard.data8[0] = RUSEFI_WIDEBAND_VERSION;
+	standard.data8[1] = 1;
+	CANRxFrame diag = standard;
+	diag.SID = 0x191;
+	for (int i = 0; i < 40; i++) {
+		hostNowNt += MS2NT(10);
+		serviceCanSubscribers(standard, hostNowNt);
+		serviceCanSubscribers(diag, hostNowNt);
+	}
+	checkCanSensorSampleAge(hostNowNt + MS2NT(20));
+	check(aem1.invalidated == 0, "AEM fresh lambda not stale", aem1.invalidated);
+	for (int i = 0; i < 5; i++) {
+		hostNowNt += MS2NT(10);
+		serviceCanSubscribers(diag, hostNowNt);
+	}
+	checkCanSensorSampleAge(hostNowNt);
+	check(aem1.invalidated > 0, "AEM lambda stale while only diagnostics arrive", aem1.invalidated);
+	check(getCanListenerSampleAgeNt(aem1, hostNowNt).value_or(0) == MS2NT(50), "AEM sample age ignores diagnostics",
+			getCanListenerSampleAgeNt(aem1, hostNowNt).value_or(0));
+
+	// table full: reported, nothing overwritten
+	int errorsBefore = hostFirmwareErrors;
+	for (size_t i = exactListenerCount; i <= maxExactListeners; i++) {
+		registerCanListener(*new CountingListener(0x700 + i));
+	}
+	check(exactListenerCount == maxExactListeners, "exact table stops at capacity", exactListenerCount);
+	check(hostFirmwareErrors == errorsBefore + 1, "overflow reported once", hostFirmwareErrors - errorsBefore);
+
+	return hostFailures ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+// Unit tests and benchmark for etb_fast_loop.h: fixed-point saturation, tuning independent of sample rate and
+// jitter, and a closed-loop step response of the inner loop against the etb_plant_model.h throttle compared
+// to the same PID running from the ETB thread.
+
+#include "host_rusefi.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+HOST_TEST_GLOBALS
+
+typedef float percent_t;
+
+#include "etb_plant_model.h"
+#include "etb_fast_loop.h"
+
+// ETB thread rate
+static constexpr float slowPeriod = 0.002f;
+static constexpr float simStep = 1e-5f;
+
+// stiff tuning, more than ETB thread rate can hold
+static constexpr float pFactor = 120;
+static constexpr float iFactor = 500;
+static constexpr float dFactor = 0.8f;
+static constexpr float iTermLimit = 30;
+static constexpr float outputLimit = 90;
+
+static EtbPlantModel makePlant() {
+	EtbPlantModel plant;
+	plant.neutral = 20;
+	plant.preload = 8;
+	plant.spring = 0.3f;
+	plant.friction = 3;
+	plant.damping = 0.02f;
+	plant.inertia = 0.0004f;
+	return plant;
+}
+
+static EtbFastPid makeFastPid(float feedForward) {
+	EtbFastPid pid;
+	pid.feedForwardQ8 = ETB_Q8(feedForward);
+	pid.kpQ16 = ETB_Q16(pFactor);
+	pid.kiQ16 = ETB_Q16(iFactor);
+	pid.kdQ16 = ETB_Q16(dFactor);
+	pid.iTermMinQ16 = ETB_Q16(-iTermLimit);
+	pid.iTermMaxQ16 = ETB_Q16(iTermLimit);
+	pid.outputMinQ8 = ETB_Q8(-outputLimit);
+	pid.outputMaxQ8 = ETB_Q8(outputLimit);
+	return pid;
+}
+
+static void testSaturation() {
+	// old kd / period at 2 kHz: dFactor 20 wrapped around to a negative gain
+	check(ETB_Q16(20.0f * 2000) == INT32_MAX, "large gain saturates high", ETB_Q16(20.0f * 2000));
+	check(ETB_Q16(-20.0f * 2000) == INT32_MIN, "large gain saturates low", ETB_Q16(-20.0f * 2000));
+	check(ETB_Q16(1.5f) == 98304, "regular gain converts", ETB_Q16(1.5f));
+	check(ETB_Q8(-12.5f) == -3200, "negative percent converts", ETB_Q8(-12.5f));
+
+	// huge D gain on a fast error change stays at the output limit instead of wrapping
+	EtbFastPid pid = makeFastPid(0);
+	pid.kdQ16 = INT32_MAX;
+	pid.update(ETB_Q8(50), ETB_Q8(50), 100);
+	int32_t output = pid.update(ETB_Q8(50), ETB_Q8(0), 1);
+	check(output == ETB_Q8(outputLimit), "huge D term clamps to output limit", output);
+}
+
+/**
+ * Constant error for one second: integral must not depend on how often or how regularly samples arrive
+ */
+static float integrateConstantError(uint32_t nominalUs, uint32_t jitterUs) {
+	EtbFastPid pid = makeFastPid(0);
+	pid.kpQ16 = 0;
+	pid.kiQ16 = ETB_Q16(60);
+	pid.kdQ16 = 0;
+	srand(2);
+
+	uint32_t elapsedUs = 0;
+	int32_t output = 0;
+	while (elapsedUs < 1000000) {
+		uint32_t intervalUs = nominalUs;
+		if (jitterUs) {
+			intervalUs += rand() % (2 * jitterUs + 1) - jitterUs;
+		}
+		intervalUs = std::min(intervalUs, 1000000 - elapsedUs);
+		elapsedUs += intervalUs;
+		// 0.25% error * 60/s * 1s == 15%
+		output = pid.update(ETB_Q8(50.25f), ETB_Q8(50), intervalUs);
+	}
+
+	return (float)output / ETB_Q8_ONE;
+}
+
+static void testIntervalScaling() {
+	float at1k = integrateConstantError(1000, 0);
+	float at8k = integrateConstantError(125, 0);
+	float jittered = integrateConstantError(500, 200);
+
+	check(std::fabs(at1k - 15) < 0.2f, "integral at 1 kHz", at1k);
+	check(std::fabs(at8k - 15) < 0.2f, "integral at 8 kHz", at8k);
+	check(std::fabs(jittered - 15) < 0.2f, "integral at jittered 2 kHz", jittered);
+
+	// stalled ADC: gap is not integrated as if error had been there the whole time
+	EtbFastPid pid = makeFastPid(0);
+	pid.kpQ16 = 0;
+	pid.update(ETB_Q8(60), ETB_Q8(50), 500);
+	int32_t afterGap = pid.update(ETB_Q8(60), ETB_Q8(50), 100000);
+	check(afterGap == pid.update(ETB_Q8(60), ETB_Q8(50), 0), "gap skips integration", afterGap);
+}
+
+// TPS on 0.5 .. 4.5 volts into a 12 bit 5 volt ADC, converted the way EtbFastLoop::publish() sets it up
+struct Tps {
+	static constexpr float voltsPerCount = 5.0f / 4095;
+	static constexpr float tpsMin = 0.5f * 200;
+	static constexpr float tpsMax = 4.5f * 200;
+
+	Tps() {
+		// tpsMin and tpsMax are in TS units, 200 per volt
+		float percentPerVolt = 100.0f * 200 / (tpsMax - tpsMin);
+		slopeQ16 = ETB_Q16(percentPerVolt * voltsPerCount);
+		offsetQ8 = ETB_Q8(100.0f * tpsMin / (tpsMax - tpsMin));
+	}
+
+	int32_t readQ8(float position) const {
+		float volts = 0.5f + 4 * position / 100;
+		int32_t count = (int32_t)std::lround(volts / voltsPerCount);
+		return ((count * slopeQ16) >> 8) - offsetQ8;
+	}
+
+	int32_t slopeQ16;
+	int32_t offsetQ8;
+};
+
+struct Plate {
+	explicit Plate(const EtbPlantModel& plant) : plant(plant), x(plant.neutral) { }
+
+	void advance(float duty, float seconds) {
+		for (float t = 0; t < seconds; t += simStep) {
+			float a = (duty - plant.getStaticDuty(x) - plant.friction * etbSign(v) - plant.damping * v) / plant.inertia;
+			v += a * simStep;
+			x += v * simStep;
+			// mechanical stops
+			if (x < 0 || x > 100) {
+				x = x < 0 ? 0 : 100;
+				v = 0;
+			}
+		}
+	}
+
+	EtbPlantModel plant;
+	float x;
+	float v = 0;
+};
+
+struct StepResponse {
+	float overshoot;
+	float settleSeconds;
+	// peak to peak position over the last 100 ms, limit cycle amplitude
+	float ripple;
+};
+
+/**
+ * 20 -> 70 step and hold, feed-forward is the static duty at target as the ETB thread publishes it
+ * @param intervalUs inner loop interval, 0 for the float PID at ETB thread rate
+ */
+static StepResponse runStep(uint32_t intervalUs, uint32_t jitterUs) {
+	EtbPlantModel plant = makePlant();
+	Plate plate(plant);
+	Tps tps;
+	srand(3);
+
+	constexpr float from = 20;
+	constexpr float to = 70;
+	constexpr float duration = 0.5f;
+
+	float feedForward = plant.getStaticDuty(to);
+	EtbFastPid fastPid = makeFastPid(feedForward);
+
+	float integrator = 0;
+	float lastError = NAN;
+
+	StepResponse result = { 0, 0, 0 };
+	float lastOutside = 0;
+	float tailMin = 100;
+	float tailMax = 0;
+
+	// plate resting at start position
+	plate.x = from;
+	float t = 0;
+	while (t < duration) {
+		float position = tps.readQ8(plate.x) / (float)ETB_Q8_ONE;
+		float error = to - position;
+		float interval;
+		float duty;
+
+		if (intervalUs) {
+			uint32_t thisUs = intervalUs;
+			if (jitterUs) {
+				thisUs += rand() % (2 * jitterUs + 1) - jitterUs;
+			}
+			duty = fastPid.update(ETB_Q8(to), tps.readQ8(plate.x), thisUs) / (float)ETB_Q8_ONE;
+			interval = thisUs * 1e-6f;
+		} else {
+			interval = slowPeriod;
+			integrator = std::max(-iTermLimit, std::min(integrator + iFactor * error * interval, iTermLimit));
+			float derivative = std::isnan(lastError) ? 0 : (error - lastError) / interval;
+			lastError = error;
+			duty = feedForward + pFactor * error + integrator + dFactor * derivative;
+			duty = std::max(-outputLimit, std::min(duty, outputLimit));
+		}
+
+		plate.advance(duty, interval);
+		t += interval;
+
+		result.overshoot = std::max(result.overshoot, plate.x - to);
+		if (std::fabs(plate.x - to) > 0.02f * (to - from)) {
+			lastOutside = t;
+		}
+		if (t > duration - 0.1f) {
+			tailMin = std::min(tailMin, plate.x);
+			tailMax = std::max(tailMax, plate.x);
+		}
+	}
+
+	result.settleSeconds = lastOutside;
+	result.ripple = tailMax - tailMin;
+	return result;
+}
+
+static void testClosedLoop() {
+	StepResponse slow = runStep(0, 0);
+	StepResponse fast = runStep(500, 0);
+	StepResponse jittered = runStep(500, 150);
+	StepResponse faster = runStep(125, 0);
+
+	printf("ETB thread 500 Hz: overshoot %.2f%% settle %.1f ms ripple %.2f%%\n", slow.overshoot, slow.settleSeconds * 1e3f, slow.ripple);
+	printf("inner loop 2 kHz:  overshoot %.2f%% settle %.1f ms ripple %.2f%%\n", fast.overshoot, fast.settleSeconds * 1e3f, fast.ripple);
+	printf("2 kHz +-150 us:    overshoot %.2f%% settle %.1f ms ripple %.2f%%\n", jittered.overshoot, jittered.settleSeconds * 1e3f, jittered.ripple);
+	printf("inner loop 8 kHz:  overshoot %.2f%% settle %.1f ms ripple %.2f%%\n", faster.overshoot, faster.settleSeconds * 1e3f, faster.ripple);
+
+	check(fast.settleSeconds < 0.06f, "inner loop settles", fast.settleSeconds);
+	check(fast.overshoot < 1, "inner loop overshoot", fast.overshoot);
+	check(fast.ripple < 0.5f, "inner loop holds still", fast.ripple);
+	// same tuning from ETB thread keeps hunting
+	check(slow.ripple > 4 * fast.ripple, "ETB thread rate ripples with stiff tuning", slow.ripple);
+	// same gains at another rate or with jitter give the same response, they used to scale with the rate
+	check(std::fabs(jittered.settleSeconds - fast.settleSeconds) < 0.01f, "jitter does not change settling", jittered.settleSeconds);
+	check(std::fabs(faster.overshoot - fast.overshoot) < 0.5f, "8 kHz overshoot matches 2 kHz", faster.overshoot);
+	check(std::fabs(faster.settleSeconds - fast.settleSeconds) < 0.01f, "8 kHz settling matches 2 kHz", faster.settleSeconds);
+}
+
+static void benchmark() {
+	EtbFastPid pid = makeFastPid(10);
+	constexpr int iterations = 10000000;
+
+	volatile int32_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		sink = sink + pid.update(ETB_Q8(50), ETB_Q8(50) + (i & 0xff) - 128, 490 + (i & 0x1f));
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double nsPerSample = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	printf("update: %.1f ns per sample\n", nsPerSample);
+	check(nsPerSample < 200, "update cost on host", nsPerSample);
+}
+
+int main() {
+	testSaturation();
+	testIntervalScaling();
+	testClosedLoop();
+	benchmark();
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+// Unit tests for etb_plant_model.h: identification of a simulated throttle, refusal to fit preload without
+// crossing neutral, and the target differentiator and feed-forward limits used by EtbController::getOpenLoop.
+
+#include "host_rusefi.h"
+
+#include <cmath>
+#include <cstdlib>
+
+HOST_TEST_GLOBALS
+
+typedef float percent_t;
+
+#include "etb_plant_model.h"
+
+static constexpr float period = 0.002f;
+static constexpr size_t sampleCount = 3000;
+
+static EtbPlantModel makePlant() {
+	EtbPlantModel plant;
+	plant.neutral = 20;
+	plant.preload = 8;
+	plant.spring = 0.3f;
+	plant.friction = 3;
+	plant.damping = 0.02f;
+	plant.inertia = 0.0004f;
+	return plant;
+}
+
+/**
+ * Same shape as the firmware identification run: P loop following a triangle sweep from low to high and back,
+ * random +-15% duty held for 4 periods on top. Plate integrated with 20 sub steps per period.
+ */
+static void recordSweep(const EtbPlantModel& plant, float low, float high, float (&duty)[sampleCount], float (&position)[sampleCount]) {
+	float x = low;
+	float v = 0;
+	float excitation = 0;
+	srand(1);
+
+	for (size_t i = 0; i < sampleCount; i++) {
+		float phase = (float)i / sampleCount;
+		float sweep = phase < 0.5f ? 2 * phase : 2 * (1 - phase);
+		float setpoint = low + sweep * (high - low);
+
+		if (i % 4 == 0) {
+			excitation = rand() % 2 ? 15 : -15;
+		}
+		float u = excitation + 2 * (setpoint - x);
+		duty[i] = u;
+
+		for (int k = 0; k < 20; k++) {
+			float h = period / 20;
+			float a = (u - plant.getStaticDuty(x) - plant.friction * etbSign(v) - plant.damping * v) / plant.inertia;
+			v += a * h;
+			x += v * h;
+		}
+
+		position[i] = x;
+	}
+}
+
+static float duty[sampleCount];
+static float position[sampleCount];
+
+static void testIdentification() {
+	EtbPlantModel plant = makePlant();
+	// sweep starts below neutral like the firmware run does
+	recordSweep(plant, plant.neutral - 5, 90, duty, position);
+
+	EtbPlantIdentifier identifier;
+	identifier.reset(plant.neutral, period);
+	for (size_t i = 0; i < sampleCount; i++) {
+		identifier.addSample(duty[i], position[i]);
+	}
+
+	auto model = identifier.fit();
+	check(model.Valid, "fit with neutral crossed", model.Valid);
+	check(identifier.hasCrossedNeutral(), "neutral crossing detected", identifier.hasCrossedNeutral());
+	check(std::fabs(model.Value.preload - plant.preload) < 1, "preload", model.Value.preload);
+	check(std::fabs(model.Value.spring - plant.spring) < 0.05f, "spring", model.Value.spring);
+	check(std::fabs(model.Value.friction - plant.friction) < 1, "friction", model.Value.friction);
+	check(std::fabs(model.Value.damping - plant.damping) < 0.01f, "damping", model.Value.damping);
+	check(std::fabs(model.Value.inertia - plant.inertia) < 0.0002f, "inertia", model.Value.inertia);
+	check(identifier.getMinPosition() < plant.neutral && identifier.getMaxPosition() > plant.neutral,
+			"swept range spans neutral", identifier.getMaxPosition() - identifier.getMinPosition());
+}
+
+static void testNoNeutralCrossing() {
+	EtbPlantModel plant = makePlant();
+	// a sweep which starts above a high limp home position
+	recordSweep(plant, plant.neutral + 10, 90, duty, position);
+
+	EtbPlantIdentifier identifier;
+	identifier.reset(plant.neutral, period);
+	for (size_t i = 0; i < sampleCount; i++) {
+		identifier.addSample(duty[i], position[i]);
+	}
+
+	check(identifier.getMinPosition() > plant.neutral, "sweep stays above neutral", identifier.getMinPosition());
+	check(!identifier.hasCrossedNeutral(), "no neutral crossing detected", identifier.hasCrossedNeutral());
+	check(!identifier.fit().Valid, "preload is not fitted from one side", 0);
+}
+
+static void testTooFewSamples() {
+	EtbPlantModel plant = makePlant();
+	recordSweep(plant, plant.neutral - 5, 90, duty, position);
+
+	EtbPlantIdentifier identifier;
+	identifier.reset(plant.neutral, period);
+	for (size_t i = 0; i < 50; i++) {
+		identifier.addSample(duty[i], position[i]);
+	}
+
+	check(!identifier.fit().Valid, "too few samples do not fit", identifier.getSampleCount());
+}
+
+static void testTargetDerivative() {
+	EtbTargetDerivative derivative;
+
+	// seeded from the first target: a throttle at 40% is not seen as flying up from 0
+	derivative.update(40, period, 0.02f);
+	check(derivative.getVelocity() == 0 && derivative.getAcceleration() == 0, "seeded from first target", derivative.getVelocity());
+	derivative.update(40, period, 0.02f);
+	check(derivative.getVelocity() == 0, "still target has no velocity", derivative.getVelocity());
+
+	// 40 -> 80 step: velocity ramps and peaks well below the raw one period difference
+	float peakVelocity = 0;
+	float peakAcceleration = 0;
+	float firstVelocity = 0;
+	for (int i = 0; i < 200; i++) {
+		derivative.update(80, period, 0.02f);
+		if (i == 0) {
+			firstVelocity = derivative.getVelocity();
+		}
+		peakVelocity = std::max(peakVelocity, std::fabs(derivative.getVelocity()));
+		peakAcceleration = std::max(peakAcceleration, std::fabs(derivative.getAcceleration()));
+	}
+
+	float rawStepVelocity = 40 / period;
+	check(firstVelocity < rawStepVelocity / 50, "no velocity spike on step", firstVelocity);
+	check(peakVelocity < rawStepVelocity / 5, "peak velocity bounded", peakVelocity);
+	check(peakVelocity > 500, "step still produces feed-forward velocity", peakVelocity);
+	check(std::fabs(derivative.getVelocity()) < 1, "velocity decays once settled", derivative.getVelocity());
+	check(peakAcceleration < 1e6f, "acceleration bounded", peakAcceleration);
+
+	derivative.clear();
+	derivative.update(10, period, 0.02f);
+	check(derivative.getVelocity() == 0, "clear reseeds", derivative.getVelocity());
+}
+
+static void testFeedForward() {
+	EtbPlantModel plant = makePlant();
+
+	// dithering target velocity around zero must not flip the friction term between +-friction
+	float low = plant.getFeedForwardDuty(0.5f, 0);
+	float high = plant.getFeedForwardDuty(-0.5f, 0);
+	check(std::fabs(low - high) < 0.2f, "friction does not chatter around still target", low - high);
+
+	check(std::fabs(plant.getFeedForwardDuty(100, 0) - (plant.friction + plant.damping * 100)) < 1e-3f,
+			"full friction once moving", plant.getFeedForwardDuty(100, 0));
+
+	check(plant.getFeedForwardDuty(1e4f, 1e7f) == ETB_FEED_FORWARD_DYNAMIC_LIMIT, "dynamic term clamped high", plant.getFeedForwardDuty(1e4f, 1e7f));
+	check(plant.getFeedForwardDuty(-1e4f, -1e7f) == -ETB_FEED_FORWARD_DYNAMIC_LIMIT, "dynamic term clamped low", plant.getFeedForwardDuty(-1e4f, -1e7f));
+}
+
+int main() {
+	testIdentification();
+	testNoNeutralCrossing();
+	testTooFewSamples();
+	testTargetDerivative();
+	testFeedForward();
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,499 @@
+// Pump and rail ripple simulation around high_pressure_fuel_pump.cpp: a 4 lobe pump feeds a stiff rail drained by
+// injector pulses, and the controller runs off trigger_scheduler.cpp driven by a 72 tooth per cycle crank wheel.
+// Pressure has to be sampled exactly once per lobe at the lobe peak, including across VVT moves which go through
+// TriggerScheduler::moveQueuedEvent() without warnings, and the PI loop has to hold the target without chasing
+// the pumping ripple.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#define EFI_HPFP 1
+#define EFI_PROD_CODE 0
+
+HOST_TEST_GLOBALS
+
+typedef float angle_t;
+
+#define HPFP_MAX_LOBES 4
+#define TRIGGER_EVENT_UNDEFINED UINT32_MAX
+#define VBAT_FALLBACK_VALUE 12
+
+static angle_t tdcPosition() { return 0; }
+
+enum class SensorType { Rpm, Map, FuelPressureHigh, BatteryVoltage, Count };
+
+struct Sensor {
+	static float values[(int)SensorType::Count];
+
+	static expected<float> get(SensorType type) {
+		return values[(int)type];
+	}
+
+	static float getOrZero(SensorType type) {
+		return values[(int)type];
+	}
+};
+
+float Sensor::values[(int)SensorType::Count];
+
+enum hpfp_cam_e { HPFP_CAM_NONE, HPFP_CAM_IN1, HPFP_CAM_EX1, HPFP_CAM_IN2, HPFP_CAM_EX2 };
+
+struct {
+	int hpfpCamLobes = 4;
+	angle_t hpfpPeakPos = 10;
+	hpfp_cam_e hpfpCam = HPFP_CAM_IN1;
+	float hpfpPumpVolume = 0.5;
+	float hpfpCompensation[2][2] = {};
+	float hpfpCompensationLoadBins[2] = { 0, 1 };
+	float hpfpCompensationRpmBins[2] = { 0, 8000 };
+	float hpfpTarget[2][2] = { { 10000, 10000 }, { 10000, 10000 } };
+	float hpfpTargetLoadBins[2] = { 0, 250 };
+	float hpfpTargetRpmBins[2] = { 0, 8000 };
+	float hpfpTargetDecay = 0;
+	float hpfpPidP = 0.005;
+	float hpfpPidI = 0.002;
+	float hpfpLobeProfileQuantityBins[2] = { 0, 100 };
+	float hpfpLobeProfileAngle[2] = { 0, 90 };
+	float hpfpDeadtimeVoltsBins[2] = { 8, 16 };
+	float hpfpDeadtimeMS[2] = { 0, 0 };
+	angle_t hpfpMinAngle = 2;
+	angle_t hpfpActivationAngle = 30;
+	struct {
+		int cylindersCount = 4;
+	} specs;
+} config, *engineConfiguration = &config;
+
+// crank position of the simulation, unwrapped
+static double simAngle = 0;
+static angle_t simVvt = 0;
+
+static angle_t wrap720(double angle) {
+	angle = std::fmod(angle, 720.0);
+	return angle < 0 ? angle + 720 : angle;
+}
+
+class HpfpController;
+
+struct action_s {
+	action_s() = default;
+
+	template <typename TArg>
+	action_s(void (*callback)(TArg*), TArg* arg)
+		: m_callback((void (*)(void*))callback)
+		, m_arg(arg) {
+	}
+
+	void execute() const {
+		m_callback(m_arg);
+	}
+
+	void (*m_callback)(void*) = nullptr;
+	void* m_arg = nullptr;
+};
+
+struct scheduling_s {
+	efitick_t momentX = 0;
+};
+
+// crank wheel of the simulation, one tooth every 10 degrees of the engine cycle
+static constexpr angle_t toothAngle = 10;
+
+struct event_trigger_position_s {
+	uint32_t triggerEventIndex = 0;
+	angle_t angleOffsetFromTriggerEvent = 0;
+
+	void setAngle(angle_t angle) {
+		angle = wrap720(angle);
+		triggerEventIndex = (uint32_t)(angle / toothAngle);
+		angleOffsetFromTriggerEvent = angle - triggerEventIndex * toothAngle;
+	}
+
+	angle_t getAngle() const {
+		return triggerEventIndex * toothAngle + angleOffsetFromTriggerEvent;
+	}
+};
+
+struct AngleBasedEventBase {
+	scheduling_s scheduling;
+	action_s action;
+	AngleBasedEventBase* nextToothEvent = nullptr;
+
+	virtual bool shouldSchedule(uint32_t trgEventIndex, float currentPhase, float nextPhase) const = 0;
+	virtual float getAngleFromNow(float currentPhase) const = 0;
+};
+
+struct AngleBasedEventOld : public AngleBasedEventBase {
+	event_trigger_position_s position;
+
+	bool shouldSchedule(uint32_t trgEventIndex, float currentPhase, float nextPhase) const override;
+	float getAngleFromNow(float currentPhase) const override;
+};
+
+struct AngleBasedEventNew : public AngleBasedEventBase {
+	float enginePhase = 0;
+
+	bool shouldSchedule(uint32_t trgEventIndex, float currentPhase, float nextPhase) const override;
+	float getAngleFromNow(float currentPhase) const override;
+};
+
+// timer based part of the schedule, fires at a crank angle since RPM is constant
+struct SimTimer {
+	scheduling_s* scheduling;
+	double fireAngle;
+	action_s action;
+};
+
+static std::vector<SimTimer> simTimers;
+
+static void scheduleByAngle(scheduling_s* scheduling, efitick_t edgeTimestamp, angle_t angle, action_s action) {
+	scheduling->momentX = edgeTimestamp;
+	simTimers.push_back({ scheduling, simAngle + angle, action });
+}
+
+static bool isValidRpm(int rpm) { return rpm > 0; }
+
+static bool isPhaseInRange(float test, float current, float next) {
+	return current <= next ? test >= current && test < next : test >= current || test < next;
+}
+
+// utlist.h, only what trigger_scheduler.cpp uses
+#define LL_FOREACH2(head, el, next) for ((el) = (head); el; (el) = (el)->next)
+#define LL_FOREACH_SAFE2(head, el, tmp, next) for ((el) = (head); (el) && ((tmp) = (el)->next, 1); (el) = (tmp))
+#define LL_APPEND2(head, add, next) do { \
+		(add)->next = nullptr; \
+		if (head) { \
+			auto _tail = (head); \
+			while (_tail->next) { _tail = _tail->next; } \
+			_tail->next = (add); \
+		} else { \
+			(head) = (add); \
+		} \
+	} while (0)
+#define LL_DELETE2(head, del, next) do { \
+		if ((head) == (del)) { \
+			(head) = (head)->next; \
+		} else { \
+			auto _prev = (head); \
+			while (_prev->next && _prev->next != (del)) { _prev = _prev->next; } \
+			if (_prev->next) { _prev->next = (del)->next; } \
+		} \
+	} while (0)
+
+enum { CUSTOM_RE_ADDING_INTO_EXECUTION_QUEUE };
+
+static int warningCount = 0;
+static void warning(int, const char*) { warningCount++; }
+
+// event_queue.h, the membership assert warns whenever the element is found
+#define assertNotInListMethodBody(T, head, element, field) \
+	{ \
+		T* current; \
+		LL_FOREACH2(head, current, field) { \
+			if (current == element) { \
+				warning(CUSTOM_RE_ADDING_INTO_EXECUTION_QUEUE, "re-adding element into event_queue"); \
+				return true; \
+			} \
+		} \
+		return false; \
+	}
+
+class TriggerScheduler {
+public:
+	bool scheduleOrQueue(AngleBasedEventOld *event, uint32_t trgEventIndex, efitick_t edgeTimestamp,
+			angle_t angle, action_s action);
+	bool scheduleOrQueue(AngleBasedEventNew *event, uint32_t trgEventIndex, efitick_t edgeTimestamp,
+			angle_t angle, action_s action, float currentPhase, float nextPhase);
+	bool moveQueuedEvent(AngleBasedEventOld *event, angle_t angle);
+	void scheduleEventsUntilNextTriggerTooth(int rpm, uint32_t trgEventIndex, efitick_t edgeTimestamp,
+			float currentPhase, float nextPhase);
+
+	bool assertNotInList(AngleBasedEventBase *head, AngleBasedEventBase *element);
+
+	AngleBasedEventBase *m_angleBasedEventsHead = nullptr;
+};
+
+struct {
+	void setHigh();
+	void setLow();
+	bool isInitialized() const { return true; }
+} valvePin;
+
+struct {
+	decltype(valvePin)& hpfpValve = valvePin;
+} enginePins;
+
+class HpfpLobe {
+public:
+	void updateLobeAngles();
+	angle_t getVvtOffset() const;
+	void syncToEnginePhase(efitick_t nowNt);
+	angle_t findNextLobe();
+
+private:
+	angle_t m_lobeAngles[HPFP_MAX_LOBES] = {};
+	int m_lobeCount = 0;
+	angle_t m_peakPos = 0;
+	int m_lobe_index = 0;
+};
+
+class HpfpQuantity {
+public:
+	float calcFuelPercent(int rpm);
+	float calcPI(int rpm, float calc_fuel_percent);
+	angle_t pumpAngleFuel(int rpm, HpfpController *model);
+
+	void reset() {
+		m_I_sum_percent = 0;
+		m_pressureTarget_kPa = 0;
+	}
+
+	float m_I_sum_percent = 0;
+	float m_pressureTarget_kPa = 0;
+
+	static constexpr float fuelDensity = 0.72;
+};
+
+class HpfpController {
+public:
+	void onFastCallback();
+	void onCamUpdate(efitick_t nowNt);
+
+	static void pinTurnOn(HpfpController *self);
+	static void pinTurnOff(HpfpController *self);
+	static void onLobeSample(HpfpController *self);
+
+	void scheduleNextCycle();
+	void scheduleNextSample();
+
+	AngleBasedEventOld m_event;
+	AngleBasedEventOld m_sampleEvent;
+	HpfpQuantity m_quantity;
+	HpfpLobe m_lobe;
+	HpfpLobe m_sampleLobe;
+	volatile bool m_running = false;
+	angle_t m_deadtime = 0;
+	angle_t m_requested_pump = 0;
+	angle_t m_eventAngle = 0;
+	angle_t m_sampleAngle = 0;
+	angle_t m_eventVvt = 0;
+	angle_t m_sampleVvt = 0;
+
+	float fuel_requested_percent = 0;
+	float fuel_requested_percent_pi = 0;
+	bool noValve = false;
+	bool angleAboveMin = false;
+	bool isHpfpInactive = true;
+	angle_t di_nextStart = 0;
+};
+
+static TriggerScheduler triggerScheduler;
+static HpfpController hpfpController;
+
+struct {
+	struct {
+		float getVVTPosition(int, int) { return simVvt; }
+
+		expected<float> getCurrentEnginePhase(efitick_t) { return wrap720(simAngle); }
+	} triggerCentral;
+
+	struct {
+		float injectionMass[1] = { 0.025 };
+		float engineCycle = 720;
+	} engineState;
+
+	struct {
+		void cancel(scheduling_s* scheduling) {
+			simTimers.erase(std::remove_if(simTimers.begin(), simTimers.end(),
+				[&](const SimTimer& timer) { return timer.scheduling == scheduling; }), simTimers.end());
+		}
+	} executor;
+
+	struct {
+		uint32_t systemEventReuse = 0;
+	} outputChannels;
+
+	template <typename TModule>
+	TModule* module();
+} engineInstance, *engine = &engineInstance;
+
+template <>
+TriggerScheduler* decltype(engineInstance)::module<TriggerScheduler>() { return &triggerScheduler; }
+
+template <>
+HpfpController* decltype(engineInstance)::module<HpfpController>() { return &hpfpController; }
+
+#include "trigger_scheduler.cpp"
+#include "high_pressure_fuel_pump.cpp"
+
+/**
+ * Rail and pump. The spill valve closes when energized during the pump stroke and stays closed,
+ * held by pressure, until the lobe peak. The rail is a stiff volume drained by four injections per cycle.
+ */
+static constexpr float railKpaPerCc = 4000;
+static constexpr angle_t strokeAngle = 90;
+
+static bool valveLatched = false;
+static double valveEnergized = false;
+void decltype(valvePin)::setHigh() { valveEnergized = true; }
+void decltype(valvePin)::setLow() { valveEnergized = false; }
+
+static float railPressure = 5000;
+
+// pump stroke position 0..1 for a crank angle, zero outside the 90 degrees before a lobe peak
+static float strokePosition(double angle) {
+	angle_t sinceStart = wrap720(angle - config.hpfpPeakPos - simVvt + strokeAngle);
+	sinceStart = std::fmod(sinceStart, 720.f / config.hpfpCamLobes);
+	if (sinceStart > strokeAngle) {
+		return 0;
+	}
+	return (1 - std::cos(M_PI * sinceStart / strokeAngle)) / 2;
+}
+
+static int sampleCount = 0;
+static float worstSamplePhaseError = 0;
+static std::vector<float> sampledPressures;
+
+static void fireDue(float rpm, double fromAngle, double toAngle) {
+	// crank tooth, the scheduler hands over events due before the next one
+	if (std::floor(toAngle / toothAngle) != std::floor(fromAngle / toothAngle)) {
+		uint32_t toothIndex = (uint32_t)(wrap720(toAngle) / toothAngle);
+		triggerScheduler.scheduleEventsUntilNextTriggerTooth(rpm, toothIndex, hostNowNt, 0, 0);
+	}
+
+	// snapshot, actions schedule new timers
+	std::vector<SimTimer> timers;
+	timers.swap(simTimers);
+	for (auto& timer : timers) {
+		if (timer.fireAngle > toAngle) {
+			simTimers.push_back(timer);
+			continue;
+		}
+
+		if (timer.scheduling == &hpfpController.m_sampleEvent.scheduling) {
+			sampleCount++;
+			float spacing = 720.f / config.hpfpCamLobes;
+			float sinceLobe = std::fmod(wrap720(toAngle - config.hpfpPeakPos - simVvt), spacing);
+			float error = std::min(sinceLobe, spacing - sinceLobe);
+			worstSamplePhaseError = std::max(worstSamplePhaseError, error);
+			sampledPressures.push_back(railPressure);
+		}
+		timer.action.execute();
+	}
+}
+
+struct RunResult {
+	float meanPressure;
+	float railRipple;
+	float sampledSpread;
+	float lobes;
+};
+
+static RunResult run(float rpm, double seconds, bool moveVvt) {
+	constexpr double step = 0.5;
+	double usPerDegree = 1e6 / (rpm * 6);
+	hostNowNt = 0;
+	double endAngle = simAngle + seconds * rpm * 6;
+	double startAngle = simAngle;
+	double nextFastNt = hostNowNt;
+
+	Sensor::values[(int)SensorType::Rpm] = rpm;
+
+	float minRail = 1e9, maxRail = 0;
+	double sum = 0;
+	int count = 0;
+	sampledPressures.clear();
+
+	while (simAngle < endAngle) {
+		double from = simAngle;
+		float strokeBefore = strokePosition(from);
+		simAngle += step;
+		hostNowNt += (efitick_t)(step * usPerDegree);
+
+		// pump
+		float strokeNow = strokePosition(simAngle);
+		if (strokeNow > 0 && valveEnergized) {
+			valveLatched = true;
+		}
+		if (valveLatched && strokeNow > strokeBefore) {
+			railPressure += railKpaPerCc * config.hpfpPumpVolume * (strokeNow - strokeBefore);
+		}
+		if (strokeNow == 0) {
+			valveLatched = false;
+		}
+
+		// injectors, 30 degree pulses every 180, flow follows the square root of pressure
+		if (std::fmod(wrap720(simAngle), 180.) < 30) {
+			float ccPerInjection = engineInstance.engineState.injectionMass[0] / HpfpQuantity::fuelDensity;
+			railPressure -= railKpaPerCc * ccPerInjection * step / 30 * std::sqrt(std::max(railPressure, 0.f) / 10000);
+		}
+		Sensor::values[(int)SensorType::FuelPressureHigh] = railPressure;
+
+		fireDue(rpm, from, simAngle);
+
+		if (hostNowNt >= nextFastNt) {
+			nextFastNt += US2NT(5000);
+			hpfpController.onFastCallback();
+		}
+
+		// slow VVT sweep, cam updates twice per cycle
+		if (moveVvt && std::fmod(simAngle, 360.) < step) {
+			simVvt = 20 * std::sin((simAngle - startAngle) / 720 / 50 * 2 * M_PI);
+			onHpfpCamUpdate(hostNowNt);
+		}
+
+		// statistics over the second half of the run
+		if (simAngle > (startAngle + endAngle) / 2) {
+			minRail = std::min(minRail, railPressure);
+			maxRail = std::max(maxRail, railPressure);
+			sum += railPressure;
+			count++;
+		}
+	}
+
+	// same second half for the samples the controller saw
+	std::vector<float> tail(sampledPressures.begin() + sampledPressures.size() / 2, sampledPressures.end());
+	float spread = INFINITY;
+	if (!tail.empty()) {
+		spread = *std::max_element(tail.begin(), tail.end()) - *std::min_element(tail.begin(), tail.end());
+	}
+
+	return { (float)(sum / count), maxRail - minRail, spread, (float)((endAngle - startAngle) * config.hpfpCamLobes / 720) };
+}
+
+int main() {
+	Sensor::values[(int)SensorType::BatteryVoltage] = 14;
+	Sensor::values[(int)SensorType::Map] = 100;
+
+	// pump up the rail from 50 bar
+	run(3000, 3, false);
+
+	for (float rpm : { 1500.f, 3000.f, 6000.f }) {
+		sampleCount = 0;
+		worstSamplePhaseError = 0;
+
+		RunResult result = run(rpm, 3, false);
+		printf("%4.0f rpm: mean %.0f kPa, rail ripple %.0f kPa, spread at lobe peak %.0f kPa\n",
+				rpm, result.meanPressure, result.railRipple, result.sampledSpread);
+
+		check(std::abs(sampleCount - result.lobes) <= 1, "one pressure sample per lobe", sampleCount);
+		check(worstSamplePhaseError <= 1, "sampled at lobe peak, degrees", worstSamplePhaseError);
+		check(std::fabs(result.meanPressure - 10000) < 300, "mean rail pressure on target, kPa", result.meanPressure);
+		check(result.sampledSpread < result.railRipple / 4, "controller does not see pumping ripple, kPa", result.sampledSpread);
+	}
+
+	// cam phaser moving under the pump, both events follow and sampling keeps its lobe
+	sampleCount = 0;
+	worstSamplePhaseError = 0;
+	RunResult moving = run(3000, 3, true);
+	check(std::abs(sampleCount - moving.lobes) <= 1, "one sample per lobe while VVT moves", sampleCount);
+	// the angle lags by the VVT change since the last cam update or since the event was handed to the timer at its tooth,
+	// up to about 1.8 degrees at this sweep rate
+	check(worstSamplePhaseError <= 2, "sampled at moving lobe peak, degrees", worstSamplePhaseError);
+	check(std::fabs(moving.meanPressure - 10000) < 300, "mean rail pressure while VVT moves, kPa", moving.meanPressure);
+	check(warningCount == 0, "no scheduler warnings while events are moved", warningCount);
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,436 @@
+// AC compressor engagement at idle through idle_thread.cpp: an engine plant with inertia, manifold filling lag and
+// rpm dependent friction, deliberately mismatched from the air model (9 Nm against 8 Nm, 1.4 against 1.3 mg/Nm).
+// PID alone, the fixed AC position adder tuned at 850 rpm and air mass targeting are run at two idle targets,
+// the air model has to cut the PID-only dip at both, stay close to the adder hand tuned at 850 without being tuned
+// for the operating point, and land on target without leaning on the I term.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#define EFI_UNIT_TEST 1
+#define EFI_IDLE_CONTROL 1
+#define EFI_SHAFT_POSITION_INPUT 1
+#define EFI_ALTERNATOR_CONTROL 0
+#define EFI_TCU 0
+#define EFI_TUNER_STUDIO 0
+
+HOST_TEST_GLOBALS
+
+#define PERCENT_MULT 100.0f
+#define SLOW_CALLBACK_PERIOD_MS 50
+#define FAST_CALLBACK_PERIOD_MS 5
+#define US2MS(us) ((us) / 1000)
+#define MS2US(ms) ((ms) * 1000)
+
+typedef float percent_t;
+typedef float angle_t;
+typedef expected<float> SensorResult;
+
+static efitimeus_t getTimeNowUs() { return NT2US(getTimeNowNt()); }
+static float getFuelingLoad() { return 30; }
+
+// four stroke cycle in ms
+static float getEngineCycleDuration(float rpm) { return 120000 / rpm; }
+
+template <typename TBin, size_t TSize>
+static void setLinearCurve(TBin (&array)[TSize], float from, float to) {
+	for (size_t i = 0; i < TSize; i++) {
+		array[i] = from + (to - from) * i / (TSize - 1);
+	}
+}
+
+enum class SensorType { Clt, DriverThrottleIntent, VehicleSpeed, Count };
+
+struct Sensor {
+	static SensorResult get(SensorType type) {
+		return type == SensorType::Clt ? 90.0f : 0.0f;
+	}
+
+	static float getOrZero(SensorType type) {
+		return get(type).Value;
+	}
+};
+
+enum idle_mode_e { IM_AUTO, IM_MANUAL };
+enum idle_state_e { INIT, TPS_THRESHOLD, RPM_DEAD_ZONE, PID_VALUE, PID_UPPER, BLIP };
+
+static const char* getIdle_state_e(idle_state_e) { return ""; }
+
+struct pid_s {
+	float pFactor;
+	float iFactor;
+	float dFactor;
+	int16_t offset;
+	int16_t periodMs;
+	int16_t minValue;
+	int16_t maxValue;
+};
+
+struct engine_configuration_s {
+	struct {
+		float airmassPerTorque = 0;
+		float acTorque = 0;
+		float fan1Torque = 2;
+		float fan2Torque = 2;
+		float alternatorTorque = 10;
+		float gearTorque = 6;
+	} idleAirModel;
+	struct {
+		int cylindersCount = 4;
+	} specs;
+	bool idleAirMassMode = false;
+	float manIdlePosition = 25;
+	float acIdleExtraOffset = 0;
+	float fan1ExtraIdle = 0;
+	float fan2ExtraIdle = 0;
+	int acIdleRpmBump = 0;
+	float idlePidDeactivationTpsThreshold = 5;
+	int idlePidRpmUpperLimit = 300;
+	int maxIdleVss = 0;
+	int afterCrankingIACtaperDuration = 100;
+	bool overrideCrankingIacSetting = false;
+	float crankingIACposition = 50;
+	float iacByTpsTaper = 0;
+	int airTaperRpmRange = 0;
+	float airByRpmTaper = 0;
+	bool useIacTableForCoasting = false;
+	bool useIdleTimingPidControl = false;
+	float idle_antiwindupFreq = 0;
+	float idle_derivativeFilterLoss = 0;
+	int idlePidRpmDeadZone = 25;
+	int pidExtraForLowRpm = 0;
+	bool useIacPidMultTable = false;
+	int idlerpmpid_iTermMin = -30;
+	int idlerpmpid_iTermMax = 30;
+	idle_mode_e idleMode = IM_AUTO;
+	bool isVerboseIAC = false;
+	pid_s idleTimingPid = { };
+	// tuned by hand on the plant below with the AC off
+	pid_s idleRpmPid = { 0.05f, 0.05f, 0.002f, 0, 50, -30, 30 };
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+struct {
+	float cltIdleRpmBins[8];
+	float cltIdleRpm[8];
+	float cltIdleCorrBins[8];
+	float cltIdleCorr[8];
+	float cltCrankingCorrBins[8];
+	float cltCrankingCorr[8];
+	float idleAirFlowPositionBins[8];
+	float idleAirFlowRate[8];
+	float iacCoastingRpmBins[8];
+	float iacCoasting[8];
+	float iacPidMultTable[8][8];
+	float iacPidMultLoadBins[8];
+	float iacPidMultRpmBins[8];
+} persistentConfig, *config = &persistentConfig;
+
+/**
+ * PidIndustrial as the idle controller uses it: P + I + D with error amplification, I term clamped to
+ * iTermMin..iTermMax, sum clamped to min..max. Anti-windup and derivative filtering are left out.
+ */
+class PidIndustrial {
+public:
+	void initPidClass(const pid_s* parameters) {
+		m_parameters = parameters;
+		reset();
+	}
+
+	void reset() {
+		m_iTerm = 0;
+		m_previousError = 0;
+	}
+
+	bool isSame(const pid_s*) const { return true; }
+	void showPidStatus(const char*) { }
+	void setErrorAmplification(float coef) { m_errorAmplification = coef; }
+	float getIntegration() const { return m_iTerm; }
+
+	float getOutput(float target, float input, float dTime) {
+		float error = (target - input) * m_errorAmplification;
+		m_iTerm = clampF(iTermMin, m_iTerm + m_parameters->iFactor * dTime * error, iTermMax);
+		float dTerm = m_parameters->dFactor / dTime * (error - m_previousError);
+		m_previousError = error;
+		return clampF(m_parameters->minValue, m_parameters->pFactor * error + m_iTerm + dTerm + m_parameters->offset,
+				m_parameters->maxValue);
+	}
+
+	float antiwindupFreq = 0;
+	float derivativeFilterLoss = 0;
+	float iTermMin = -100;
+	float iTermMax = 100;
+
+private:
+	const pid_s* m_parameters = nullptr;
+	float m_errorAmplification = 1;
+	float m_iTerm = 0;
+	float m_previousError = 0;
+};
+
+typedef PidIndustrial Pid;
+
+struct AcController {
+	bool isAcEnabled() const { return m_acEnabled; }
+
+	bool acButtonState = false;
+	int acSwitchLastChangeTimeMs = -10000;
+	// clutch engages with the button here, no compressor delay
+	bool m_acEnabled = false;
+};
+
+struct RelayPin {
+	bool getLogicValue() const { return false; }
+};
+
+struct {
+	RelayPin fanRelay;
+	RelayPin fanRelay2;
+} enginePins;
+
+struct {
+	struct {
+		bool isRunning() const { return true; }
+		int getRevolutionCounterSinceStart() const { return 1000; }
+	} rpmCalculator;
+	struct {
+		struct {
+			float getInstantRpm() const { return 0; }
+		} instantRpm;
+	} triggerCentral;
+	efitimeus_t timeToStopIdleTest = 0;
+	efitimeus_t timeToStopBlip = 0;
+	float blipIdlePosition = 0;
+	AcController acController;
+
+	template <typename T>
+	struct ModuleRef {
+		T& module;
+		T& unmock() { return module; }
+	};
+
+	template <typename T>
+	ModuleRef<T> module() { return { acController }; }
+} engineInstance, *engine = &engineInstance;
+
+static void applyIACposition(percent_t) { }
+
+// members as idle_thread.h declares them
+struct IIdleController {
+	enum class Phase : uint8_t {
+		Cranking,
+		Idling,
+		Coasting,
+		CrankToIdleTaper,
+		Running,
+	};
+};
+
+class IdleController : public IIdleController {
+public:
+	void init();
+	void onSlowCallback();
+	void onConfigurationChange(engine_configuration_s const * previousConfiguration);
+
+	float getIdlePosition(float rpm);
+	int getTargetRpm(float clt);
+	Phase determinePhase(int rpm, int targetRpm, SensorResult tps, float vss, float crankingTaperFraction);
+	float getCrankingTaperFraction() const;
+	float getCrankingOpenLoop(float clt) const;
+	float getIdleLoadTorque() const;
+	percent_t getAirModelPosition(percent_t basePosition, float targetRpm);
+	percent_t getRunningOpenLoop(float rpm, float clt, SensorResult tps);
+	percent_t getOpenLoop(Phase phase, float rpm, float clt, SensorResult tps, float crankingTaperFraction);
+	float getIdleTimingAdjustment(int rpm);
+	float getIdleTimingAdjustment(int rpm, int targetRpm, Phase phase);
+	float getClosedLoop(Phase phase, float tpsPos, int rpm, int targetRpm);
+
+	PidIndustrial* getIdlePid() { return &industrialWithOverrideIdlePid; }
+
+	float luaAdd = 0;
+
+	int targetRpmByClt = 0;
+	int targetRpmAcBump = 0;
+	bool badTps = false;
+	bool looksLikeCoasting = false;
+	bool looksLikeRunning = false;
+	bool looksLikeCrankToIdle = false;
+	bool isCranking = false;
+	bool isIdleCoasting = false;
+	bool isIacTableForCoasting = false;
+	float iacByTpsTaper = 0;
+	float iacByRpmTaper = 0;
+	float idleLoadTorque = 0;
+	float idleAirflowTarget = 0;
+	bool needReset = false;
+	bool notIdling = false;
+	idle_state_e idleState = INIT;
+	bool isInDeadZone = false;
+	bool isVerboseIAC = false;
+	bool isBlipping = false;
+	float baseIdlePosition = 0;
+	bool useClosedLoop = false;
+	float currentIdlePosition = 0;
+
+private:
+	int m_lastTargetRpm = 0;
+	Phase m_lastPhase = Phase::Cranking;
+	float m_lastAutomaticPosition = 0;
+	bool shouldResetPid = false;
+	bool mustResetPid = false;
+	bool wasResetPid = false;
+	bool mightResetPid = false;
+	efitimeus_t restoreAfterPidResetTimeUs = 0;
+
+	Pid m_timingPid;
+	PidIndustrial industrialWithOverrideIdlePid;
+};
+
+#include "idle_thread.cpp"
+
+// plant, not what the model assumes
+#define PLANT_AC_TORQUE 9.0
+#define PLANT_AIR_PER_TORQUE 1.4
+// what the tune believes, 17% less air than the plant needs with the AC on
+#define MODEL_AC_TORQUE 8
+#define MODEL_AIR_PER_TORQUE 1.3f
+// engine, flywheel and torque converter, kg m^2
+#define PLANT_INERTIA 0.15
+#define MANIFOLD_LAG_S 0.15
+#define VALVE_FLOW_PER_PERCENT 0.4
+
+/**
+ * Cylinder air above what friction and pumping eat at this rpm turns into torque, valve flow reaches the
+ * cylinders through a first order manifold lag.
+ */
+struct IdlePlant {
+	double rpm;
+	double airflow;
+	double loadTorque = 0;
+
+	static double frictionAirmass(double rpm) {
+		return 90 + 0.03 * (rpm - 850);
+	}
+
+	static double cylinderAirmass(double airflowKgPerHour, double rpm) {
+		// kg/h is g/ms * 3600
+		return airflowKgPerHour / 3600 * getEngineCycleDuration(rpm) / 4 * 1000;
+	}
+
+	// valve position which holds this rpm with no load
+	static double balancePosition(double rpm) {
+		double airflow = frictionAirmass(rpm) / 1000 * 4 / getEngineCycleDuration(rpm) * 3600;
+		return airflow / VALVE_FLOW_PER_PERCENT;
+	}
+
+	void step(double position, double dt) {
+		airflow += (position * VALVE_FLOW_PER_PERCENT - airflow) * dt / MANIFOLD_LAG_S;
+		double torque = (cylinderAirmass(airflow, rpm) - frictionAirmass(rpm)) / PLANT_AIR_PER_TORQUE - loadTorque;
+		rpm += torque / PLANT_INERTIA * dt * 60 / (2 * M_PI);
+	}
+};
+
+enum class IdleMode { PidOnly, FixedAdder, AirModel };
+
+static const char* const modeNames[] = { "PID only", "fixed adder", "air model" };
+
+struct IdleResult {
+	float dip;
+	float errorAfter;
+	float integratorAfter;
+};
+
+static IdleResult runAcEngagement(IdleMode mode, float targetRpm) {
+	setLinearCurve(config->cltIdleRpmBins, -40, 100);
+	std::fill(std::begin(config->cltIdleRpm), std::end(config->cltIdleRpm), targetRpm);
+	setLinearCurve(config->cltIdleCorrBins, -40, 100);
+	std::fill(std::begin(config->cltIdleCorr), std::end(config->cltIdleCorr), 1);
+	setLinearCurve(config->idleAirFlowPositionBins, 0, 100);
+	setLinearCurve(config->idleAirFlowRate, 0, 100 * VALVE_FLOW_PER_PERCENT);
+
+	engineConfiguration->manIdlePosition = IdlePlant::balancePosition(targetRpm);
+	engineConfiguration->idleAirMassMode = mode == IdleMode::AirModel;
+	engineConfiguration->idleAirModel.acTorque = MODEL_AC_TORQUE;
+	engineConfiguration->idleAirModel.airmassPerTorque = MODEL_AIR_PER_TORQUE;
+	// what holds 850 with the AC on this plant, found by hand the way a tuner would
+	engineConfiguration->acIdleExtraOffset = mode == IdleMode::FixedAdder
+		? PLANT_AC_TORQUE * PLANT_AIR_PER_TORQUE / 1000 * 4 / getEngineCycleDuration(850) * 3600 / VALVE_FLOW_PER_PERCENT
+		: 0;
+
+	AcController& ac = engine->acController;
+	ac = AcController();
+
+	IdleController idle;
+	idle.init();
+
+	IdlePlant plant;
+	plant.rpm = targetRpm;
+	plant.airflow = engineConfiguration->manIdlePosition * VALVE_FLOW_PER_PERCENT;
+
+	const double dt = 0.001;
+	const double acOnSeconds = 5;
+	float position = engineConfiguration->manIdlePosition;
+	IdleResult result = { 0, 0, 0 };
+
+	for (int ms = 0; ms < 10000; ms++) {
+		hostNowNt = MS2NT(ms);
+		double t = ms * dt;
+
+		if (ms == acOnSeconds * 1000) {
+			ac.acButtonState = true;
+			ac.m_acEnabled = true;
+			ac.acSwitchLastChangeTimeMs = ms;
+			plant.loadTorque = PLANT_AC_TORQUE;
+		}
+
+		if (ms % SLOW_CALLBACK_PERIOD_MS == 0) {
+			position = idle.getIdlePosition(plant.rpm);
+		}
+		plant.step(position, dt);
+
+		if (t > acOnSeconds) {
+			result.dip = std::max<float>(result.dip, targetRpm - plant.rpm);
+		}
+	}
+
+	result.errorAfter = plant.rpm - targetRpm;
+	result.integratorAfter = idle.getIdlePid()->getIntegration();
+	return result;
+}
+
+static void checkAcDip(float targetRpm) {
+	IdleResult results[3];
+	for (int mode = 0; mode < 3; mode++) {
+		results[mode] = runAcEngagement((IdleMode)mode, targetRpm);
+		printf("target %.0f %-12s dip %5.1f rpm, 5 s later %+5.1f rpm, I term %5.2f%%\n", targetRpm, modeNames[mode],
+				results[mode].dip, results[mode].errorAfter, results[mode].integratorAfter);
+	}
+
+	IdleResult& pidOnly = results[(int)IdleMode::PidOnly];
+	IdleResult& fixedAdder = results[(int)IdleMode::FixedAdder];
+	IdleResult& airModel = results[(int)IdleMode::AirModel];
+
+	// the first ~150 ms of the dip is manifold filling, no feedforward gets that back
+	char what[96];
+	snprintf(what, sizeof(what), "target %.0f: air model dip against PID only", targetRpm);
+	check(airModel.dip < 0.7f * pidOnly.dip, what, airModel.dip / pidOnly.dip);
+	// the adder is exact at 850 while the model is 17% short, it gives back up to 10% more dip there and wins once
+	// the adder is off its operating point
+	snprintf(what, sizeof(what), "target %.0f: air model dip against adder tuned at 850", targetRpm);
+	check(airModel.dip <= (targetRpm == 850 ? 1.1f : 1.0f) * fixedAdder.dip, what, airModel.dip / fixedAdder.dip);
+	snprintf(what, sizeof(what), "target %.0f: air model back inside the dead zone", targetRpm);
+	check(fabsf(airModel.errorAfter) <= engineConfiguration->idlePidRpmDeadZone, what, airModel.errorAfter);
+	// the model carries the load, PID only trims what it got wrong
+	snprintf(what, sizeof(what), "target %.0f: air model I term against PID only", targetRpm);
+	check(fabsf(airModel.integratorAfter) < 0.4f * fabsf(pidOnly.integratorAfter), what,
+			airModel.integratorAfter / pidOnly.integratorAfter);
+}
+
+int main() {
+	checkAcDip(850);
+	checkAcDip(1100);
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+// Fixed point lambda and sensor temperature tables of the wideband firmware against the float curves they are
+// built from, for every sensor type: pump current swept through lambda_conversion.cpp, ESR through sampling.cpp.
+
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+// wideband_config.h
+#define VCC_VOLTS 3.3f
+#define ADC_MAX_COUNT 4095
+#define NERNST_INPUT_GAIN (1 / 0.8f)
+#define ESR_SUPPLY_R 22000
+#define VM_RESISTOR_VALUE 10
+#define PUMP_CURRENT_SENSE_GAIN 10
+#define LSU_SENSE_R 61.9f
+#define ESR_SENSE_ALPHA 0.1f
+#define PUMP_FILTER_ALPHA 0.01f
+
+// ChibiOS, single threaded here
+typedef int mutex_t;
+typedef int binary_semaphore_t;
+#define MUTEX_DECL(name) mutex_t name
+#define NORMALPRIO 128
+#define THD_WORKING_AREA(name, size) char name[size]
+
+static void chSysLock() { }
+static void chSysUnlock() { }
+static void chSysLockFromISR() { }
+static void chSysUnlockFromISR() { }
+static void chMtxLock(mutex_t*) { }
+static void chMtxUnlock(mutex_t*) { }
+static void chBSemObjectInit(binary_semaphore_t*, bool) { }
+static void chBSemWait(binary_semaphore_t*) { }
+static void chBSemSignalI(binary_semaphore_t*) { }
+static void chThdCreateStatic(void*, size_t, int, void (*)(void*), void*) { }
+
+struct ADCDriver { };
+static ADCDriver ADCD1;
+static void adcStart(ADCDriver*, void*) { }
+
+struct AnalogBurst
+{
+    int32_t NernstSum;
+    int32_t PumpCurrentSum;
+    int32_t VirtualGroundSum;
+    uint32_t BatteryVoltageSum;
+    uint32_t Frames;
+};
+
+static void StartAnalogBursts(void (*)(const AnalogBurst&)) { }
+
+// interpolation.h
+struct inter_point
+{
+    float x;
+    float y;
+};
+
+#define FIXED_TABLE_SIZE 129
+
+struct fixed_table
+{
+    int32_t x0;
+    int32_t invStep;
+    int16_t y[FIXED_TABLE_SIZE];
+};
+
+float interpolate_1d_float(const struct inter_point *p, int size, float x);
+void fixed_table_build(struct fixed_table *t, float (*reference)(float), float xMin, float xMax, float yScale);
+int32_t fixed_table_lookup(const struct fixed_table *t, int32_t x);
+
+// configuration
+enum class SensorType : uint8_t
+{
+    Lsu49 = 0,
+    Lsu42 = 1,
+    LsuAdv = 2,
+};
+
+static SensorType sensorType = SensorType::Lsu49;
+
+static SensorType GetSensorType()
+{
+    return sensorType;
+}
+
+float GetPumpNominalCurrent();
+
+#include "interpolation.cpp"
+#include "lambda_conversion.cpp"
+#include "sampling.cpp"
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, float value)
+{
+    printf("%s %s: %f\n", condition ? "PASS" : "FAIL", what, value);
+
+    if (!condition)
+    {
+        failures++;
+    }
+}
+
+struct SensorCase
+{
+    const char* name;
+    SensorType type;
+    const struct inter_point* ipToLambda;
+    int size;
+    float esrScale;
+    // lambda read at the lean end of the table, pump current 2 mA
+    float leanLimit;
+};
+
+static const SensorCase sensorCases[] =
+{
+    { "LSU 4.9", SensorType::Lsu49, lsu49_ip_to_lambda, ARRAY_SIZE(lsu49_ip_to_lambda), 1, 5.391f },
+    { "LSU 4.2", SensorType::Lsu42, lsu42_ip_to_lambda, ARRAY_SIZE(lsu42_ip_to_lambda), 80 / 300.0f, 4.000f },
+};
+
+static void SetPumpCurrent(float milliamps)
+{
+    constexpr float ratio = -1000 / (PUMP_CURRENT_SENSE_GAIN * LSU_SENSE_R);
+    pumpCurrentSenseVoltage = milliamps / ratio;
+}
+
+static void SetEsr(float ohms)
+{
+    // inverse of GetSensorInternalResistance
+    nernstAc = VCC_VOLTS / (ESR_SUPPLY_R / (ohms + VM_RESISTOR_VALUE) + 1);
+}
+
+static void CheckLambda(const SensorCase& c)
+{
+    char what[96];
+    float maxError = 0;
+    float maxErrorInRange = 0;
+
+    for (float ip = -3.5f; ip <= 2.0f; ip += 0.001f)
+    {
+        SetPumpCurrent(ip);
+        float lambda = GetLambda();
+        float reference = interpolate_1d_float(c.ipToLambda, c.size, GetPumpNominalCurrent());
+
+        float error = fabsf(lambda / reference - 1);
+        maxError = fmaxf(maxError, error);
+
+        if (reference >= 0.8f && reference <= 1.25f)
+        {
+            maxErrorInRange = fmaxf(maxErrorInRange, error);
+        }
+    }
+
+    snprintf(what, sizeof(what), "%s lambda max relative error", c.name);
+    Check(maxError < 0.005f, what, maxError);
+    snprintf(what, sizeof(what), "%s lambda max relative error, 0.8 to 1.25", c.name);
+    Check(maxErrorInRange < 0.003f, what, maxErrorInRange);
+
+    // no extrapolation at either end, the lean end goes well past the lambda 2 of the old linear fit
+    SetPumpCurrent(3);
+    snprintf(what, sizeof(what), "%s lambda past the lean end", c.name);
+    Check(fabsf(GetLambda() - c.leanLimit) < 0.01f, what, GetLambda());
+    SetPumpCurrent(-5);
+    snprintf(what, sizeof(what), "%s lambda past the rich end", c.name);
+    Check(fabsf(GetLambda() - c.ipToLambda[0].y) < 0.01f, what, GetLambda());
+}
+
+static void CheckTemperature(const SensorCase& c)
+{
+    char what[96];
+    float maxError = 0;
+    float maxErrorOperating = 0;
+
+    for (float esr = 80; esr <= 5000; esr += 0.5f)
+    {
+        SetEsr(esr * c.esrScale);
+        float temperature = GetSensorTemperature();
+        float normalized = GetSensorInternalResistance() / c.esrScale;
+        float reference = interpolate_1d_float(lsu49_r_to_temp, ARRAY_SIZE(lsu49_r_to_temp), normalized);
+
+        float error = fabsf(temperature - reference);
+        maxError = fmaxf(maxError, error);
+
+        // heater closed loop lives around the nominal ESR
+        if (normalized >= 200 && normalized <= 1000)
+        {
+            maxErrorOperating = fmaxf(maxErrorOperating, error);
+        }
+    }
+
+    snprintf(what, sizeof(what), "%s temperature max error, C", c.name);
+    Check(maxError < 6, what, maxError);
+    snprintf(what, sizeof(what), "%s temperature max error 200 to 1000 ohm normalized, C", c.name);
+    Check(maxErrorOperating < 2, what, maxErrorOperating);
+
+    // open sensor reads zero rather than the table end
+    SetEsr(6000 * c.esrScale);
+    snprintf(what, sizeof(what), "%s temperature above the table", c.name);
+    Check(GetSensorTemperature() == 0, what, GetSensorTemperature());
+}
+
+int main()
+{
+    for (const auto& c : sensorCases)
+    {
+        sensorType = c.type;
+        CheckLambda(c);
+        CheckTemperature(c);
+    }
+
+    // switching back rebuilds the table, 4.2 curve must not stick
+    sensorType = SensorType::Lsu49;
+    SetPumpCurrent(2);
+    Check(fabsf(GetLambda() - 5.391f) < 0.01f, "LSU 4.9 again after the other types", GetLambda());
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,264 @@
+// Drive replay through closed_loop_fuel.cpp with a VE table that is 10% rich at light load and 8% lean at
+// high load: STFT has to correct it first, then hand it over to the long term table until the engine fuels
+// right from LTFT alone. Learned cells have to survive a reboot through backup RAM and garbage has to be reset.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define EFI_SHAFT_POSITION_INPUT 1
+#define EFI_TUNER_STUDIO 1
+#define EFI_PROD_CODE 0
+
+HOST_TEST_GLOBALS
+
+#define FAST_CALLBACK_PERIOD_MS 5
+#define STFT_BANK_COUNT 2
+#define STFT_CELL_COUNT 4
+#define STOICH_RATIO 14.7f
+#define LTFT_RPM_COUNT 16
+#define LTFT_LOAD_COUNT 16
+
+enum class SensorType { Invalid, Rpm, Clt, Lambda1, Lambda2, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static expected<float> get(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+};
+
+template <int TDeadband>
+class Deadband {
+public:
+	bool gt(float lhs, float rhs) {
+		// sticky with the previous answer while inside the deadband
+		if (absF(lhs - rhs) > TDeadband) {
+			m_lastState = lhs > rhs;
+		}
+		return m_lastState;
+	}
+
+	bool lt(float lhs, float rhs) {
+		return gt(rhs, lhs);
+	}
+
+private:
+	bool m_lastState = false;
+};
+
+struct stft_cell_cfg_s {
+	float maxAdd;
+	float maxRemove;
+	float timeConstant;
+};
+
+struct stft_s {
+	float maxIdleRegionRpm = 1000;
+	float maxOverrunLoad = 25;
+	float minPowerLoad = 85;
+	float deadband = 0.5f;
+	float minClt = 60;
+	float minAfr = 10;
+	float maxAfr = 19;
+	float startupDelay = 10;
+	stft_cell_cfg_s cellCfgs[STFT_CELL_COUNT];
+};
+
+struct ltft_s {
+	bool enabled = true;
+	float timeConstant = 60;
+	float maxRate = 1;
+	float maxAdd = 15;
+	float maxRemove = -15;
+};
+
+struct {
+	bool fuelClosedLoopCorrectionEnabled = true;
+	bool stftIgnoreErrorMagnitude = false;
+	float noFuelTrimAfterDfcoTime = 2;
+	stft_s stft;
+	ltft_s ltft;
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+struct {
+	uint16_t ltftRpmBins[LTFT_RPM_COUNT];
+	uint16_t ltftLoadBins[LTFT_LOAD_COUNT];
+} persistentConfig, *config = &persistentConfig;
+
+struct LtftLearnData {
+	uint32_t Cookie;
+	float Table[LTFT_LOAD_COUNT][LTFT_RPM_COUNT];
+};
+
+struct DfcoController {
+	float getTimeSinceCut() const { return 100; }
+};
+
+struct {
+	struct {
+		bool isRunning() const { return true; }
+	} rpmCalculator;
+	struct {
+		struct {
+			float timeSinceCrankingInSecs = 100;
+		} running;
+	} engineState;
+	struct {
+		float targetLambda = 1;
+	} fuelComputerInstance, *fuelComputer = &fuelComputerInstance;
+	struct {
+		int fuelClosedLoopBinIdx;
+	} outputChannels;
+	DfcoController dfco;
+
+	template <typename T>
+	T* module() { return &dfco; }
+} engineInstance, *engine = &engineInstance;
+
+static float fuelingLoad;
+static float getFuelingLoad() { return fuelingLoad; }
+
+class ClosedLoopFuelCellBase {
+public:
+	void update(float lambdaDeadband, bool ignoreErrorMagnitude);
+	float getAdjustment() const;
+
+protected:
+	virtual float getLambdaError() const = 0;
+	virtual float getMaxAdjustment() const = 0;
+	virtual float getMinAdjustment() const = 0;
+	virtual float getIntegratorGain() const = 0;
+
+private:
+	float m_adjustment = 0;
+};
+
+class ClosedLoopFuelCellImpl final : public ClosedLoopFuelCellBase {
+public:
+	void configure(const stft_cell_cfg_s* configuration, SensorType lambdaSensor) {
+		m_config = configuration;
+		m_lambdaSensor = lambdaSensor;
+	}
+
+private:
+	const stft_cell_cfg_s* m_config = nullptr;
+	SensorType m_lambdaSensor = SensorType::Invalid;
+
+protected:
+	float getLambdaError() const override;
+	float getMaxAdjustment() const override;
+	float getMinAdjustment() const override;
+	float getIntegratorGain() const override;
+};
+
+struct ClosedLoopFuelResult {
+	float banks[STFT_BANK_COUNT] = { 1, 1 };
+};
+
+#include "closed_loop_fuel_cell.cpp"
+#include "closed_loop_fuel.cpp"
+
+// what the ECU VE table gets wrong: above 1 it thinks there is more air than there is and runs rich
+static float veScaleError(float rpm, float load) {
+	return 1.10f - 0.18f * (load - 20) / 80 + 0.02f * sinf(rpm / 800);
+}
+
+static float rpmAt(float t) {
+	return 3000 + 1500 * sinf(2 * M_PI * t / 610);
+}
+
+static float loadAt(float t) {
+	return 55 + 30 * sinf(2 * M_PI * t / 173);
+}
+
+// fueling error with LTFT alone, worst over the grid nodes the drive covers well
+static float openLoopError() {
+	float worst = 0;
+
+	for (size_t load = 0; load < LTFT_LOAD_COUNT; load++) {
+		for (size_t rpm = 0; rpm < LTFT_RPM_COUNT; rpm++) {
+			float r = config->ltftRpmBins[rpm];
+			float l = config->ltftLoadBins[load];
+			if (r < 2000 || r > 4000 || l < 35 || l > 75) {
+				continue;
+			}
+
+			float fuel = veScaleError(r, l) * getLongTermFuelTrim(r, l);
+			worst = std::max(worst, fabsf(fuel - 1));
+		}
+	}
+
+	return worst;
+}
+
+int main() {
+	for (size_t i = 0; i < LTFT_RPM_COUNT; i++) {
+		config->ltftRpmBins[i] = 500 + 500 * i;
+	}
+	for (size_t i = 0; i < LTFT_LOAD_COUNT; i++) {
+		config->ltftLoadBins[i] = 20 + 5 * i;
+	}
+	for (auto& cell : engineConfiguration->stft.cellCfgs) {
+		cell = { 20, -20, 2 };
+	}
+	sensorValues[(int)SensorType::Clt] = 90;
+
+	// power up with garbage in backup RAM
+	ltftStorage.get()->Cookie = 0x12345678;
+	ltftStorage.get()->Table[3][3] = NAN;
+	initLongTermFuelTrim();
+	check(ltftStorage.get()->Cookie == LTFT_COOKIE && ltftStorage.get()->Table[3][3] == 0, "garbage backup RAM reset", ltftStorage.get()->Table[3][3]);
+
+	float initialError = openLoopError();
+	check(initialError > 0.07f, "VE error before learning", initialError);
+
+	// four hours of driving, one fuel update per fast callback. LTFT is meant to be slow: at a 60 s
+	// time constant a cell visited a few percent of the time takes hours, not minutes
+	constexpr float dt = FAST_CALLBACK_PERIOD_MS * 0.001f;
+	ClosedLoopFuelResult stft;
+	float stftErrorSum = 0;
+	int stftErrorCount = 0;
+
+	for (int step = 0; step < 4 * 3600 / dt; step++) {
+		float t = step * dt;
+		float rpm = rpmAt(t);
+		fuelingLoad = loadAt(t);
+		sensorValues[(int)SensorType::Rpm] = rpm;
+
+		// lambda from last cycle's injection
+		float fuel = veScaleError(rpm, fuelingLoad) * getLongTermFuelTrim(rpm, fuelingLoad);
+		sensorValues[(int)SensorType::Lambda1] = engine->fuelComputer->targetLambda / (fuel * stft.banks[0]);
+		sensorValues[(int)SensorType::Lambda2] = engine->fuelComputer->targetLambda / (fuel * stft.banks[1]);
+
+		stft = fuelClosedLoopCorrection();
+
+		// last ten minutes
+		if (t > 230 * 60) {
+			stftErrorSum += fabsf(stft.banks[0] - 1);
+			stftErrorCount++;
+		}
+	}
+
+	float finalError = openLoopError();
+	check(finalError < 0.02f, "VE error with LTFT alone after four hours", finalError);
+
+	float stftMean = stftErrorSum / stftErrorCount;
+	check(stftMean < 0.01f, "mean STFT correction once learned", stftMean);
+
+	// far corner was never visited, nothing learned there
+	check(ltftStorage.get()->Table[LTFT_LOAD_COUNT - 1][LTFT_RPM_COUNT - 1] == 0, "unvisited cell untouched", ltftStorage.get()->Table[LTFT_LOAD_COUNT - 1][LTFT_RPM_COUNT - 1]);
+
+	// reboot keeps what was learned
+	float learned = getLongTermFuelTrim(3000, 50);
+	initLongTermFuelTrim();
+	check(getLongTermFuelTrim(3000, 50) == learned, "learned trim kept over reboot", learned);
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,448 @@
+// Scan tool polling through obd2.cpp: functional multi-PID requests, ISO-TP reassembly of multi-frame answers
+// with the flow control a tester sends, CAN TX thread pacing at 10 ms, response caching, flow control on the
+// wrong ID or bus and the N_Bs timeout once the tester goes quiet. A scan tool polling as fast as it can on the
+// simulated clock reports the PIDs per second it gets for single and six PID requests.
+
+#include "host_rusefi.h"
+
+#include <cmath>
+#include <deque>
+#include <vector>
+
+#define EFI_CAN_SUPPORT 1
+#define HAL_USE_CAN 1
+
+HOST_TEST_GLOBALS
+
+#define UNUSED(x) (void)(x)
+
+// obd2.h
+#define OBD_TEST_REQUEST 0x7DF
+#define OBD_TEST_RESPONSE 0x7E8
+#define _OBD_2 2
+#define OBD_CURRENT_DATA 1
+#define OBD_STORED_DIAGNOSTIC_TROUBLE_CODES 3
+#define OBD_PENDING_DIAGNOSTIC_TROUBLE_CODES 7
+
+#define PID_SUPPORTED_PIDS_REQUEST_01_20 0x00
+#define PID_MONITOR_STATUS 0x01
+#define PID_FUEL_SYSTEM_STATUS 0x03
+#define PID_ENGINE_LOAD 0x04
+#define PID_COOLANT_TEMP 0x05
+#define PID_STFT_BANK1 0x06
+#define PID_STFT_BANK2 0x08
+#define PID_INTAKE_MAP 0x0B
+#define PID_RPM 0x0C
+#define PID_SPEED 0x0D
+#define PID_TIMING_ADVANCE 0x0E
+#define PID_INTAKE_TEMP 0x0F
+#define PID_INTAKE_MAF 0x10
+#define PID_THROTTLE 0x11
+#define PID_SUPPORTED_PIDS_REQUEST_21_40 0x20
+#define PID_FUEL_AIR_RATIO_1 0x24
+#define PID_SUPPORTED_PIDS_REQUEST_41_60 0x40
+#define PID_FUEL_RATE 0x5E
+
+#define ODB_RPM_MULT 4
+#define ODB_TEMP_EXTRA 40
+#define ODB_TPS_BYTE_PERCENT 2.55f
+
+static float efiRound(float value, float precision) { return roundf(value / precision) * precision; }
+
+enum class SensorType { Clt, Iat, Map, Rpm, VehicleSpeed, Maf, Tps1, Lambda1, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+};
+
+static float fuelingLoad = 40;
+static float getFuelingLoad() { return fuelingLoad; }
+
+struct {
+	float stftCorrection[2] = { 1, 1 };
+	struct {
+		float timingAdvance[12];
+		struct {
+			float getConsumptionGramPerSecond() const { return 1.5f; }
+		} fuelConsumption;
+		struct {
+			int lastErrorCode;
+		} warnings;
+	} engineState;
+} engineInstance, *engine = &engineInstance;
+
+static int crankRevolution = 0;
+
+struct TriggerCentral {
+	struct {
+		int getCrankSynchronizationCounter() const { return crankRevolution; }
+	} triggerState;
+};
+
+static TriggerCentral triggerCentral;
+static TriggerCentral* getTriggerCentral() { return &triggerCentral; }
+
+// every frame obd2.cpp sends, with the time it went out
+struct SentFrame {
+	uint32_t id;
+	size_t busIndex;
+	uint8_t data[8];
+	efitick_t nowNt;
+};
+
+static std::deque<SentFrame> sentFrames;
+
+enum class CanCategory { OBD };
+
+class CanTxMessage {
+public:
+	CanTxMessage(CanCategory, uint32_t eid, uint8_t = 8, bool = false) : m_id(eid) { }
+
+	~CanTxMessage() {
+		SentFrame frame = { m_id, busIndex, {}, hostNowNt };
+		memcpy(frame.data, m_data, sizeof(m_data));
+		sentFrames.push_back(frame);
+	}
+
+	uint8_t& operator[](size_t index) { return m_data[index]; }
+
+	size_t busIndex = 0;
+
+private:
+	uint32_t m_id;
+	uint8_t m_data[8] = {};
+};
+
+#include "obd2.cpp"
+
+#define PHYSICAL_REQUEST 0x7E0
+
+static void rx(uint32_t id, size_t busIndex, std::initializer_list<uint8_t> bytes) {
+	CANRxFrame frame = {};
+	frame.IDE = CAN_IDE_STD;
+	frame.SID = id;
+	frame.DLC = 8;
+	size_t i = 0;
+	for (uint8_t byte : bytes) {
+		frame.data8[i++] = byte;
+	}
+	obdOnCanPacketRx(frame, busIndex);
+}
+
+// CAN TX thread at 100 Hz
+static void runTxThread(int milliseconds) {
+	for (int i = 0; i < milliseconds / 10; i++) {
+		hostNowNt += MS2NT(10);
+		obdSendPendingFrames(hostNowNt);
+	}
+}
+
+struct FlowControl {
+	uint8_t blockSize;
+	uint8_t stMin;
+};
+
+/**
+ * Tester side of ISO-TP: sends a mode 01 request, answers the first frame with flow control on the physical
+ * address, checks consecutive frame sequence numbers and separation and returns the reassembled payload
+ */
+static std::vector<uint8_t> poll(std::initializer_list<uint8_t> pids, FlowControl flowControl = { 0, 0 }, size_t busIndex = 0) {
+	std::vector<uint8_t> request = { (uint8_t)(pids.size() + 1), OBD_CURRENT_DATA };
+	request.insert(request.end(), pids);
+	request.resize(8);
+
+	CANRxFrame frame = {};
+	frame.SID = OBD_TEST_REQUEST;
+	frame.DLC = 8;
+	memcpy(frame.data8, request.data(), 8);
+	obdOnCanPacketRx(frame, busIndex);
+
+	std::vector<uint8_t> payload;
+	if (sentFrames.empty()) {
+		return payload;
+	}
+
+	SentFrame first = sentFrames.front();
+	sentFrames.pop_front();
+	if (first.id != OBD_TEST_RESPONSE || first.busIndex != busIndex) {
+		return payload;
+	}
+
+	if ((first.data[0] & 0xF0) == 0) {
+		payload.assign(first.data + 1, first.data + 1 + first.data[0]);
+		return payload;
+	}
+
+	size_t size = ((first.data[0] & 0xF) << 8) | first.data[1];
+	payload.assign(first.data + 2, first.data + 8);
+
+	uint8_t sequenceNumber = 1;
+	int framesInBlock = 0;
+	efitick_t previousNt = -1;
+	rx(PHYSICAL_REQUEST, busIndex, { 0x30, flowControl.blockSize, flowControl.stMin });
+
+	for (int cycle = 0; cycle < 100 && payload.size() < size; cycle++) {
+		runTxThread(10);
+
+		while (!sentFrames.empty()) {
+			SentFrame consecutive = sentFrames.front();
+			sentFrames.pop_front();
+
+			if ((consecutive.data[0] & 0xF0) != 0x20 || (consecutive.data[0] & 0xF) != sequenceNumber) {
+				printf("unexpected frame %02x, sequence %d\n", consecutive.data[0], sequenceNumber);
+				return {};
+			}
+			if (previousNt >= 0 && consecutive.nowNt - previousNt < US2NT(getSeparationTimeUs(flowControl.stMin))) {
+				printf("separation %d us below STmin\n", (int)(consecutive.nowNt - previousNt));
+				return {};
+			}
+			previousNt = consecutive.nowNt;
+			sequenceNumber = (sequenceNumber + 1) & 0xF;
+
+			size_t chunk = std::min<size_t>(size - payload.size(), 7);
+			payload.insert(payload.end(), consecutive.data + 1, consecutive.data + 1 + chunk);
+
+			if (flowControl.blockSize != 0 && ++framesInBlock == flowControl.blockSize && payload.size() < size) {
+				framesInBlock = 0;
+				// tester takes a moment before releasing the next block
+				runTxThread(30);
+				if (!sentFrames.empty()) {
+					printf("consecutive frame past the block size\n");
+					return {};
+				}
+				rx(PHYSICAL_REQUEST, busIndex, { 0x30, flowControl.blockSize, flowControl.stMin });
+			}
+		}
+	}
+
+	return payload;
+}
+
+static std::vector<uint8_t> expectedSixPids() {
+	// 41, then PID and value: load 40% -> 102, CLT 90 -> 130, RPM 2500 -> 10000, speed 88, TPS 25% -> 64, IAT 30 -> 70
+	return { 0x41, PID_ENGINE_LOAD, 102, PID_COOLANT_TEMP, 130, PID_RPM, 10000 >> 8, 10000 & 0xFF,
+			PID_SPEED, 88, PID_THROTTLE, 64, PID_INTAKE_TEMP, 70 };
+}
+
+// tester reaction time to any frame from the ECU, a fast scan tool on a PC
+#define TESTER_TURNAROUND_MS 1
+// N_Bs / N_Cr on the tester side: an answer which stops for that long is given up on
+#define TESTER_TIMEOUT_MS 1000
+
+struct PollRate {
+	int complete;
+	int failed;
+	float pidsPerSecond;
+};
+
+/**
+ * Scan tool at its maximum polling rate on a 1 ms simulated clock: next request as soon as the previous answer
+ * is in, flow control right after a first frame. CAN TX thread runs every 10 ms and paces consecutive frames,
+ * the engine turns at 2500 rpm so the response cache sees a new revolution every 24 ms.
+ */
+static PollRate measurePollRate(std::vector<uint8_t> pids, const std::vector<uint8_t>& expected, uint8_t stMin) {
+	constexpr int seconds = 10;
+
+	std::vector<uint8_t> request = { (uint8_t)(pids.size() + 1), OBD_CURRENT_DATA };
+	request.insert(request.end(), pids.begin(), pids.end());
+	request.resize(8);
+
+	sentFrames.clear();
+	sensorValues[(int)SensorType::Rpm] = 2500;
+	crankRevolution++;
+
+	PollRate result = {};
+	std::vector<uint8_t> payload;
+	size_t size = 0;
+	efitick_t lastFrameNt = -1;
+	efitick_t sendRequestNt = hostNowNt;
+	efitick_t sendFlowControlNt = -1;
+	efitick_t timeoutNt = -1;
+	efitick_t startNt = hostNowNt;
+
+	for (int ms = 1; ms <= seconds * 1000; ms++) {
+		hostNowNt += MS2NT(1);
+		if (ms % 24 == 0) {
+			crankRevolution++;
+		}
+		if (ms % 10 == 0) {
+			obdSendPendingFrames(hostNowNt);
+		}
+
+		if (sendRequestNt >= 0 && hostNowNt >= sendRequestNt) {
+			sendRequestNt = -1;
+			payload.clear();
+			size = 0;
+			lastFrameNt = -1;
+			timeoutNt = hostNowNt + MS2NT(TESTER_TIMEOUT_MS);
+			rx(OBD_TEST_REQUEST, 0, { request[0], request[1], request[2], request[3], request[4], request[5], request[6], request[7] });
+		}
+
+		if (sendFlowControlNt >= 0 && hostNowNt >= sendFlowControlNt) {
+			sendFlowControlNt = -1;
+			rx(PHYSICAL_REQUEST, 0, { 0x30, 0, stMin });
+		}
+
+		bool isDone = false;
+		bool isBroken = false;
+		while (!sentFrames.empty()) {
+			SentFrame frame = sentFrames.front();
+			sentFrames.pop_front();
+			timeoutNt = hostNowNt + MS2NT(TESTER_TIMEOUT_MS);
+
+			uint8_t type = frame.data[0] & 0xF0;
+			if (type == 0x00) {
+				payload.assign(frame.data + 1, frame.data + 1 + frame.data[0]);
+				isDone = true;
+			} else if (type == 0x10) {
+				size = ((frame.data[0] & 0xF) << 8) | frame.data[1];
+				payload.assign(frame.data + 2, frame.data + 8);
+				sendFlowControlNt = hostNowNt + MS2NT(TESTER_TURNAROUND_MS);
+			} else {
+				isBroken |= lastFrameNt >= 0 && frame.nowNt - lastFrameNt < US2NT(getSeparationTimeUs(stMin));
+				lastFrameNt = frame.nowNt;
+				payload.insert(payload.end(), frame.data + 1, frame.data + 1 + std::min<size_t>(size - payload.size(), 7));
+				isDone = payload.size() >= size;
+			}
+		}
+
+		if (isDone || (timeoutNt >= 0 && hostNowNt >= timeoutNt)) {
+			if (isDone && !isBroken && payload == expected) {
+				result.complete++;
+			} else {
+				result.failed++;
+			}
+			timeoutNt = -1;
+			sendRequestNt = hostNowNt + MS2NT(TESTER_TURNAROUND_MS);
+		}
+	}
+
+	result.pidsPerSecond = result.complete * pids.size() / (NT2US(hostNowNt - startNt) * 1e-6f);
+	return result;
+}
+
+int main() {
+	sensorValues[(int)SensorType::Clt] = 90;
+	sensorValues[(int)SensorType::Iat] = 30;
+	sensorValues[(int)SensorType::Rpm] = 2500;
+	sensorValues[(int)SensorType::VehicleSpeed] = 88;
+	sensorValues[(int)SensorType::Tps1] = 25;
+
+	// single PID, single frame
+	std::vector<uint8_t> rpm = poll({ PID_RPM });
+	check(rpm == std::vector<uint8_t>({ 0x41, PID_RPM, 10000 >> 8, 10000 & 0xFF }), "RPM single frame", rpm.size());
+
+	// six PIDs at once need a first frame and two consecutive frames
+	crankRevolution++;
+	hostNowNt += MS2NT(100);
+	std::vector<uint8_t> six = poll({ PID_ENGINE_LOAD, PID_COOLANT_TEMP, PID_RPM, PID_SPEED, PID_THROTTLE, PID_INTAKE_TEMP });
+	check(six == expectedSixPids(), "six PIDs, flow control without block size or separation", six.size());
+
+	// tester asking for one frame per block and 15 ms between frames
+	crankRevolution++;
+	hostNowNt += MS2NT(100);
+	six = poll({ PID_ENGINE_LOAD, PID_COOLANT_TEMP, PID_RPM, PID_SPEED, PID_THROTTLE, PID_INTAKE_TEMP }, { 1, 15 });
+	check(six == expectedSixPids(), "six PIDs, block size 1 and 15 ms separation", six.size());
+
+	// unsupported PIDs are left out, none supported means no answer at all
+	std::vector<uint8_t> partial = poll({ 0x99, PID_SPEED });
+	check(partial == std::vector<uint8_t>({ 0x41, PID_SPEED, 88 }), "unsupported PID left out", partial.size());
+	check(poll({ 0x99 }).empty() && sentFrames.empty(), "only unsupported PIDs, no answer", sentFrames.size());
+
+	// length byte claiming six PIDs in a four byte frame: only the two PIDs inside DLC are answered
+	CANRxFrame shortFrame = {};
+	shortFrame.SID = OBD_TEST_REQUEST;
+	shortFrame.DLC = 4;
+	uint8_t shortRequest[8] = { 7, OBD_CURRENT_DATA, PID_SPEED, PID_THROTTLE, PID_RPM, PID_COOLANT_TEMP, PID_INTAKE_TEMP, PID_ENGINE_LOAD };
+	memcpy(shortFrame.data8, shortRequest, sizeof(shortRequest));
+	obdOnCanPacketRx(shortFrame, 0);
+	bool isTwoPidAnswer = sentFrames.size() == 1 && sentFrames.front().data[0] == 5
+			&& sentFrames.front().data[2] == PID_SPEED && sentFrames.front().data[4] == PID_THROTTLE;
+	check(isTwoPidAnswer, "PIDs past DLC ignored", sentFrames.empty() ? 0 : sentFrames.front().data[0]);
+	sentFrames.clear();
+
+	// scan tool polling as fast as it can: a new value only shows once the cache window or revolution moved on
+	crankRevolution++;
+	poll({ PID_RPM });
+	sensorValues[(int)SensorType::Rpm] = 3000;
+	hostNowNt += MS2NT(5);
+	rpm = poll({ PID_RPM });
+	check(rpm[2] == 10000 >> 8, "RPM cached within the same revolution", rpm[2]);
+	crankRevolution++;
+	rpm = poll({ PID_RPM });
+	check(rpm[2] == 12000 >> 8, "RPM fresh on the next revolution", rpm[2]);
+
+	// scan tool polling back to back on the simulated clock, paced by CAN TX thread
+	std::vector<uint8_t> sixPids = { PID_ENGINE_LOAD, PID_COOLANT_TEMP, PID_RPM, PID_SPEED, PID_THROTTLE, PID_INTAKE_TEMP };
+	PollRate single = measurePollRate({ PID_RPM }, { 0x41, PID_RPM, 10000 >> 8, 10000 & 0xFF }, 0);
+	PollRate batched = measurePollRate(sixPids, expectedSixPids(), 0);
+	PollRate separated = measurePollRate(sixPids, expectedSixPids(), 5);
+	printf("max polling rate, 1 PID:              %5d polls, %6.1f PIDs/s\n", single.complete, single.pidsPerSecond);
+	printf("max polling rate, 6 PIDs, STmin 0:    %5d polls, %6.1f PIDs/s\n", batched.complete, batched.pidsPerSecond);
+	printf("max polling rate, 6 PIDs, STmin 5 ms: %5d polls, %6.1f PIDs/s\n", separated.complete, separated.pidsPerSecond);
+	check(single.failed == 0 && batched.failed == 0 && separated.failed == 0, "every polled answer complete", single.failed + batched.failed + separated.failed);
+	// single frame answers go out from RX right away, so only the tester's turnaround limits them. Consecutive
+	// frames wait for the next CAN TX thread cycle: one 10 ms cycle per six PIDs, two once STmin splits the frames
+	check(single.pidsPerSecond >= 900, "single PID polling rate, PIDs/s", single.pidsPerSecond);
+	check(batched.pidsPerSecond >= 550, "six PID polling rate, PIDs/s", batched.pidsPerSecond);
+	check(separated.pidsPerSecond >= 280, "six PID polling rate with 5 ms STmin, PIDs/s", separated.pidsPerSecond);
+
+	// flow control on the functional address is not meant for us
+	sentFrames.clear();
+	crankRevolution++;
+	rx(OBD_TEST_REQUEST, 0, { 7, OBD_CURRENT_DATA, PID_ENGINE_LOAD, PID_COOLANT_TEMP, PID_RPM, PID_SPEED, PID_THROTTLE, PID_INTAKE_TEMP });
+	check(sentFrames.size() == 1 && (sentFrames.front().data[0] & 0xF0) == 0x10, "first frame sent", sentFrames.size());
+	sentFrames.clear();
+	rx(OBD_TEST_REQUEST, 0, { 0x30, 0, 0 });
+	runTxThread(50);
+	check(sentFrames.empty(), "flow control on the functional ID ignored", sentFrames.size());
+
+	// nor from another bus, or in an extended frame
+	rx(PHYSICAL_REQUEST, 1, { 0x30, 0, 0 });
+	CANRxFrame extended = {};
+	extended.IDE = CAN_IDE_EXT;
+	extended.SID = PHYSICAL_REQUEST;
+	extended.EID = 0x18DA10F1;
+	extended.data8[0] = 0x30;
+	obdOnCanPacketRx(extended, 0);
+	runTxThread(50);
+	check(sentFrames.empty(), "flow control from another bus or extended ID ignored", sentFrames.size());
+
+	// N_Bs: a second after the first frame the transfer is dropped, late flow control releases nothing
+	runTxThread(900);
+	rx(PHYSICAL_REQUEST, 0, { 0x30, 0, 0 });
+	runTxThread(50);
+	check(sentFrames.empty() && !multiFrame.isActive, "late flow control after N_Bs", sentFrames.size());
+
+	// wait frames restart N_Bs, the transfer survives as long as the tester keeps asking to wait
+	crankRevolution++;
+	rx(OBD_TEST_REQUEST, 0, { 7, OBD_CURRENT_DATA, PID_ENGINE_LOAD, PID_COOLANT_TEMP, PID_RPM, PID_SPEED, PID_THROTTLE, PID_INTAKE_TEMP });
+	sentFrames.clear();
+	for (int i = 0; i < 3; i++) {
+		runTxThread(800);
+		rx(PHYSICAL_REQUEST, 0, { 0x31, 0, 0 });
+	}
+	runTxThread(800);
+	rx(PHYSICAL_REQUEST, 0, { 0x30, 0, 0 });
+	runTxThread(10);
+	check(sentFrames.size() == 2, "wait frames restart N_Bs", sentFrames.size());
+
+	// N_Bs between blocks as well
+	crankRevolution++;
+	rx(OBD_TEST_REQUEST, 0, { 7, OBD_CURRENT_DATA, PID_ENGINE_LOAD, PID_COOLANT_TEMP, PID_RPM, PID_SPEED, PID_THROTTLE, PID_INTAKE_TEMP });
+	sentFrames.clear();
+	rx(PHYSICAL_REQUEST, 0, { 0x30, 1, 0 });
+	runTxThread(10);
+	check(sentFrames.size() == 1, "first block of one frame", sentFrames.size());
+	runTxThread(1010);
+	check(!multiFrame.isActive, "N_Bs after a block without flow control", multiFrame.isActive);
+	rx(PHYSICAL_REQUEST, 0, { 0x30, 1, 0 });
+	runTxThread(10);
+	check(sentFrames.size() == 1, "late flow control between blocks", sentFrames.size());
+
+	return hostFailures == 0 ? 0 : 1;
+}
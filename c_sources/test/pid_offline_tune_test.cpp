@@ -0,0 +1,226 @@
+// Synthetic idle logs through pid_offline_tune.cpp: a known first and second order plant with dead time runs
+// under a sluggish PI with dither, gets written as an MLG and read back by the tool. The identified model has
+// to match the plant, the tuned gains have to meet the sensitivity target and beat the recorded loop.
+
+#define EFI_PID_OFFLINE_TUNE 1
+
+#include "pid_offline_tune/pch.h"
+
+HOST_TEST_GLOBALS
+
+#define main pidOfflineTuneMain
+#include "pid_offline_tune.cpp"
+#undef main
+
+#define LOG_PERIOD 0.02f
+#define LOG_SECONDS 120
+
+// next to the test executable, whatever directory the test runs from
+static std::string logFileName;
+
+struct TruePlant {
+	float gain;
+	float tau1;
+	float tau2;
+	int deadSamples;
+	float bias;
+};
+
+struct SyntheticLog {
+	std::vector<float> setpoint;
+	std::vector<float> measurement;
+	std::vector<float> output;
+};
+
+static SyntheticLog runRecordedLoop(const TruePlant& plant) {
+	SyntheticLog log;
+	uint32_t noiseState = 12345;
+	auto noise = [&noiseState]() {
+		noiseState = noiseState * 1103515245 + 12345;
+		return ((noiseState >> 16) & 0x7FFF) / 32767.0f - 0.5f;
+	};
+
+	float alpha1 = expf(-LOG_PERIOD / plant.tau1);
+	float alpha2 = plant.tau2 > 0 ? expf(-LOG_PERIOD / plant.tau2) : 0;
+	float x1 = 1000;
+	float x2 = 1000;
+	float integrator = 0;
+	std::vector<float> delay(plant.deadSamples + 1, 30);
+
+	for (int k = 0; k < LOG_SECONDS / LOG_PERIOD; k++) {
+		float t = k * LOG_PERIOD;
+		float setpoint = ((int)(t / 6) % 2) ? 1150 : 900;
+		float measurement = x2 + 4 * noise();
+
+		// the loop being replaced: slow PI plus a square wave dither so there is something to identify from
+		float error = setpoint - measurement;
+		integrator += 0.004f * error * LOG_PERIOD;
+		float dither = ((k / 37) % 2) ? 1.5f : -1.5f;
+		float output = clampF(10, 30 + 0.002f * error + integrator + dither, 60);
+
+		log.setpoint.push_back(setpoint);
+		log.measurement.push_back(measurement);
+		log.output.push_back(output);
+
+		delay.insert(delay.begin(), output);
+		delay.pop_back();
+		float target = plant.gain * delay.back() + plant.bias;
+		x1 = alpha1 * x1 + (1 - alpha1) * target;
+		x2 = plant.tau2 > 0 ? alpha2 * x2 + (1 - alpha2) * x1 : x1;
+	}
+
+	return log;
+}
+
+static void putBigEndian(std::vector<uint8_t>& data, uint32_t value, size_t size) {
+	for (size_t i = size; i-- > 0;) {
+		data.push_back(value >> (8 * i));
+	}
+}
+
+static void putFloat(std::vector<uint8_t>& data, float value) {
+	uint32_t raw;
+	memcpy(&raw, &value, sizeof(raw));
+	putBigEndian(data, raw, 4);
+}
+
+static void putFieldHeader(std::vector<uint8_t>& data, uint8_t type, const char* name, float scale) {
+	// type, name[34], units[10], display style, scale, shift, digits as in LogField::writeHeader
+	data.push_back(type);
+	char text[34 + 10 + 1] = {};
+	strncpy(text, name, 34);
+	data.insert(data.end(), text, text + sizeof(text));
+	putFloat(data, scale);
+	putFloat(data, 0);
+	data.push_back(2);
+}
+
+// same layout binary_logging.cpp writes: Time U32 ms, Target RPM U16, RPM F32, position S16 at 0.01
+static bool writeMlg(const SyntheticLog& log) {
+	std::vector<uint8_t> data;
+	const size_t fieldCount = 4;
+	const size_t recordLength = 4 + 2 + 4 + 2;
+
+	data.insert(data.end(), { 'M', 'L', 'V', 'L', 'G', 0, 0, 1, 0, 0, 0, 0, 0, 0 });
+	putBigEndian(data, MLQ_HEADER_SIZE + fieldCount * MLQ_FIELD_HEADER_SIZE, 4);
+	putBigEndian(data, recordLength, 2);
+	putBigEndian(data, fieldCount, 2);
+
+	putFieldHeader(data, 4, "Time", 0.001f);
+	putFieldHeader(data, 2, "Idle: Target RPM", 1);
+	putFieldHeader(data, 7, "RPM", 1);
+	putFieldHeader(data, 3, "Idle: Position", 0.01f);
+
+	for (size_t k = 0; k < log.setpoint.size(); k++) {
+		if (k == log.setpoint.size() / 2) {
+			// marker block in the middle of the log is skipped
+			data.insert(data.end(), { 1, 0, 0, 0 });
+			data.insert(data.end(), 50, 'm');
+		}
+
+		data.insert(data.end(), { 0, (uint8_t)k, 0, 0 });
+		size_t recordStart = data.size();
+		putBigEndian(data, (uint32_t)(k * LOG_PERIOD * 1000 + 0.5f), 4);
+		putBigEndian(data, (uint16_t)log.setpoint[k], 2);
+		putFloat(data, log.measurement[k]);
+		putBigEndian(data, (uint16_t)(int16_t)lrintf(log.output[k] * 100), 2);
+
+		uint8_t sum = 0;
+		for (size_t i = recordStart; i < data.size(); i++) {
+			sum += data[i];
+		}
+		data.push_back(sum);
+	}
+
+	FILE* f = fopen(logFileName.c_str(), "wb");
+	char what[160];
+	snprintf(what, sizeof(what), "log written to %s", logFileName.c_str());
+	check(f != nullptr, what, 0);
+	if (!f) {
+		return false;
+	}
+	fwrite(data.data(), 1, data.size(), f);
+	fclose(f);
+	return true;
+}
+
+static int runTool(std::vector<const char*> args) {
+	args.insert(args.begin(), "pid_offline_tune");
+	return pidOfflineTuneMain(args.size(), const_cast<char**>(args.data()));
+}
+
+static void checkPlant(const TruePlant& plant, int order) {
+	char what[96];
+	SyntheticLog synthetic = runRecordedLoop(plant);
+	if (!writeMlg(synthetic)) {
+		return;
+	}
+
+	MlgLog log;
+	check(readMlg(logFileName.c_str(), log), "MLG read back", 0);
+	check(log.records.size() == synthetic.setpoint.size(), "every data record read", log.records.size());
+	float position = log.records[100][log.indexOf("Idle: Position")];
+	check(fabsf(position - synthetic.output[100]) < 0.006f, "scaled S16 field decoded", position);
+
+	PlantModel model;
+	check(identifyAndRefinePlant(synthetic.output, synthetic.measurement, LOG_PERIOD, order, model), "plant identified", order);
+
+	snprintf(what, sizeof(what), "order %d gain", order);
+	check(fabsf(model.gain / plant.gain - 1) < 0.05f, what, model.gain);
+	snprintf(what, sizeof(what), "order %d slow time constant", order);
+	check(fabsf(model.tau1 / plant.tau1 - 1) < 0.1f, what, model.tau1);
+	if (order == 2) {
+		check(fabsf(model.tau2 / plant.tau2 - 1) < 0.25f, "order 2 fast time constant", model.tau2);
+	}
+	snprintf(what, sizeof(what), "order %d dead time, s", order);
+	check(fabsf(model.deadTime - plant.deadSamples * LOG_PERIOD) <= LOG_PERIOD + 1e-4f, what, model.deadTime);
+
+	// the command line keeps the second order model only when it is 10% better, same rule here
+	PlantModel otherOrder;
+	identifyAndRefinePlant(synthetic.output, synthetic.measurement, LOG_PERIOD, 3 - order, otherOrder);
+	PlantModel& first = order == 1 ? model : otherOrder;
+	PlantModel& second = order == 2 ? model : otherOrder;
+	bool isSecondPicked = second.residual < 0.9f * first.residual;
+	snprintf(what, sizeof(what), "order %d picked over order %d", order, 3 - order);
+	check(isSecondPicked == (order == 2), what, second.residual / first.residual);
+
+	float tauC = findTauCForMaxSensitivity(model, LOG_PERIOD, 1.6f);
+	PidGains gains = getSimcGains(model, tauC);
+	float ms = getMaxSensitivity(model, gains, LOG_PERIOD);
+	snprintf(what, sizeof(what), "order %d max sensitivity at the 1.6 target", order);
+	check(ms <= 1.6f && ms > 1.5f, what, ms);
+
+	// tuned gains with the Pid on the true plant, not the identified one
+	PlantModel truth = { order, plant.gain, plant.tau1, plant.tau2, plant.deadSamples * LOG_PERIOD, plant.bias, 0 };
+	LoopStats recorded = getLoopStats(synthetic.setpoint, synthetic.measurement, LOG_PERIOD);
+	LoopStats tuned = verifyClosedLoop(truth, gains, LOG_PERIOD, synthetic.setpoint, synthetic.measurement, synthetic.output);
+	printf("order %d: recorded IAE %.0f overshoot %.0f, tuned IAE %.0f overshoot %.0f\n", order,
+			recorded.iae, recorded.overshoot, tuned.iae, tuned.overshoot);
+	snprintf(what, sizeof(what), "order %d tuned IAE below half the recorded loop", order);
+	check(tuned.iae < 0.5f * recorded.iae, what, tuned.iae / recorded.iae);
+	// setpoint steps are 250 rpm
+	snprintf(what, sizeof(what), "order %d tuned overshoot, rpm", order);
+	check(tuned.overshoot < 0.15f * 250, what, tuned.overshoot);
+
+	// the whole command line on the same log
+	check(runTool({ logFileName.c_str(), "--setpoint", "Idle: Target RPM", "--measurement", "RPM", "--output", "Idle: Position" }) == 0,
+			"command line tuning", 0);
+}
+
+int main(int, char** argv) {
+	std::string executable = argv[0];
+	size_t slash = executable.find_last_of('/');
+	std::string directory = slash == std::string::npos ? "" : executable.substr(0, slash + 1);
+	logFileName = directory + "pid_offline_tune_test.mlg";
+
+	checkPlant({ 40, 0.6f, 0, 5, -200 }, 1);
+	checkPlant({ 40, 0.6f, 0.25f, 3, -200 }, 2);
+
+	check(runTool({ logFileName.c_str(), "--setpoint", "Idle: Target RPM", "--measurement", "RPM", "--output", "no such field" }) == -1,
+			"missing field refused", 0);
+	check(runTool({ (directory + "no_such_log.mlg").c_str(), "--setpoint", "a", "--measurement", "b", "--output", "c" }) == -1,
+			"missing file refused", 0);
+	check(runTool({ logFileName.c_str() }) == -1, "missing channel names refused", 0);
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,420 @@
+// Rev limiter through limp_manager.cpp: a four cylinder in gear at WOT runs into a 7000 rpm limit, fuel is
+// injected one engine cycle before its spark. The hard limit with its 50 rpm hysteresis from the fast callback is
+// compared with the per-event soft limiter on overshoot, how tight rpm holds once settled and how many events
+// pump unburnt fuel into the exhaust because their spark was cut after the fuel went in.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define EFI_UNIT_TEST 1
+#define EFI_LAUNCH_CONTROL 1
+#define EFI_SHAFT_POSITION_INPUT 1
+#define EFI_SIMULATOR 1
+
+HOST_TEST_GLOBALS
+
+#define MAX_CYLINDER_COUNT 12
+#define FAST_CALLBACK_PERIOD_MS 5
+
+typedef float angle_t;
+typedef int brain_pin_e;
+
+static bool isBrainPinValid(brain_pin_e pin) { return pin != 0; }
+static float getInjectorDutyCycle(int) { return 50; }
+
+enum class SensorType { Rpm, Clt, Map, OilPressure, VehicleSpeed, DriverThrottleIntent, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static expected<float> get(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static bool hasSensor(SensorType) {
+		return false;
+	}
+};
+
+enum vvt_mode_e { VVT_INACTIVE, VVT_MAP_V_TWIN };
+enum operation_mode_e {
+	FOUR_STROKE_CRANK_SENSOR,
+	FOUR_STROKE_SYMMETRICAL_CRANK_SENSOR,
+	FOUR_STROKE_THREE_TIMES_CRANK_SENSOR,
+	FOUR_STROKE_TWELVE_TIMES_CRANK_SENSOR,
+};
+enum launchActivationMode_e { SWITCH_INPUT_LAUNCH, CLUTCH_INPUT_LAUNCH, ALWAYS_ACTIVE_LAUNCH };
+
+struct {
+	operation_mode_e getOperationMode() const { return FOUR_STROKE_CRANK_SENSOR; }
+} engineRotationState;
+
+static decltype(engineRotationState)* getEngineRotationState() { return &engineRotationState; }
+
+struct {
+	bool isInjectionEnabled = true;
+	bool isIgnitionEnabled = true;
+	bool useCltBasedRpmLimit = false;
+	float cltRevLimitRpmBins[4];
+	float cltRevLimitRpm[4];
+	int rpmHardLimit = 7000;
+	bool cutFuelOnHardLimit = true;
+	bool cutSparkOnHardLimit = true;
+	vvt_mode_e vvtMode[1] = { VVT_INACTIVE };
+	bool isPhaseSyncRequiredForIgnition = false;
+	struct {
+		int cylindersCount = 4;
+	} specs;
+	float boostCutPressure = 0;
+	uint16_t minOilPressureAfterStart = 0;
+	bool isCylinderCleanupEnabled = false;
+
+	float rpmSoftLimitWindowSize = 0;
+	float rpmSoftLimitLookaheadMs = 30;
+	float rpmSoftLimitTimingRetard = 10;
+	float rpmSoftLimitRetardBand = 0.25f;
+	float rpmSoftLimitFuelCutBand = 0;
+
+	bool launchControlEnabled = false;
+	launchActivationMode_e launchActivationMode = ALWAYS_ACTIVE_LAUNCH;
+	brain_pin_e launchActivatePin = 0;
+	bool launchActivateInverted = false;
+	brain_pin_e clutchDownPin = 0;
+	int launchSpeedThreshold = 0;
+	int launchTpsThreshold = 0;
+	int launchRpm = 0;
+	int hardCutRpmRange = 0;
+	float launchActivateDelay = 0;
+	bool launchSparkCutEnable = false;
+	bool launchFuelCutEnable = false;
+	bool launchSoftSparkCut = false;
+	float launchFuelAdderPercent = 0;
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+class Timer {
+public:
+	void reset() { }
+	bool hasElapsedSec(float) const { return false; }
+
+	float getElapsedSecondsAndReset(efitick_t nowNt) {
+		float elapsed = m_hasReset ? NT2US(nowNt - m_lastResetNt) * 1e-6f : 1e6f;
+		m_lastResetNt = nowNt;
+		m_hasReset = true;
+		return elapsed;
+	}
+
+private:
+	efitick_t m_lastResetNt = 0;
+	bool m_hasReset = false;
+};
+
+// members as launch_control.h declares them
+class SoftSparkLimiter {
+public:
+	void setTargetSkipRatio(float targetSkipRatio);
+	float getTargetSkipRatio() const;
+	void reset();
+	bool shouldSkip(size_t cylinderIndex, float skipRatio);
+
+private:
+	float targetSkipRatio = 0;
+	float m_engineError = 0;
+	float m_cylinderError[MAX_CYLINDER_COUNT];
+};
+
+class LaunchControlBase {
+public:
+	LaunchControlBase();
+
+	void update();
+	bool getFuelCoefficient() const;
+	bool isInsideSpeedCondition() const;
+	bool isInsideTpsCondition() const;
+	bool isInsideSwitchCondition();
+	bool isInsideRPMCondition(int rpm) const;
+	bool isLaunchConditionMet(int rpm);
+	bool isLaunchRpmRetardCondition() const;
+	bool isLaunchSparkRpmRetardCondition() const;
+	bool isLaunchFuelRpmRetardCondition() const;
+	float getSparkSkipRatio(int rpm) const;
+
+	int retardThresholdRpm = 0;
+	bool isLaunchCondition = false;
+	bool combinedConditions = false;
+	bool launchActivatePinState = false;
+	bool isSwitchActivated = false;
+	bool isClutchActivated = false;
+	bool activateSwitchCondition = false;
+	bool rpmCondition = false;
+	bool speedCondition = false;
+	bool tpsCondition = false;
+
+private:
+	Timer m_launchTimer;
+};
+
+enum class ClearReason : uint8_t {
+	None,
+	Settings,
+	HardLimit,
+	EnginePhase,
+	FaultRevLimit,
+	BoostCut,
+	OilPressure,
+	StopRequested,
+	InjectorDutyCycle,
+	FloodClear,
+	LaunchCut,
+	IgnitionOff,
+	EtbProblem,
+	Fatal,
+};
+
+struct Clearable {
+	Clearable() : m_value(true) { }
+	Clearable(bool value) : m_value(value) {
+		if (!m_value) {
+			clearReason = ClearReason::Settings;
+		}
+	}
+
+	void clear(ClearReason reason) {
+		m_value = false;
+		clearReason = reason;
+	}
+
+	operator bool() const {
+		return m_value;
+	}
+
+	ClearReason clearReason = ClearReason::None;
+
+private:
+	bool m_value = true;
+};
+
+struct LimpState {
+	const bool value;
+	const ClearReason reason;
+
+	operator bool() const {
+		return value;
+	}
+};
+
+class Hysteresis {
+public:
+	bool test(float value, float rising, float falling) {
+		if (value > rising) {
+			m_state = true;
+		} else if (value < falling) {
+			m_state = false;
+		}
+		return m_state;
+	}
+
+private:
+	bool m_state = false;
+};
+
+struct ShutdownController {
+	bool isEngineStop(efitick_t) const { return false; }
+};
+
+// members as limp_manager.h declares them
+class LimpManager {
+public:
+	ShutdownController shutdownController;
+
+	void onFastCallback();
+	void updateState(int rpm, efitick_t nowNt);
+	void onIgnitionStateChanged(bool ignitionOn);
+	void etbProblem();
+	void fatalError();
+
+	bool allowElectronicThrottle() const;
+	bool allowTriggerInput() const;
+	LimpState allowInjection() const;
+	LimpState allowIgnition() const;
+
+	void updateSoftRevLimit(float rpm, efitick_t nowNt);
+	angle_t getSoftLimitTimingRetard() const;
+	float getSoftLimitCutRatio() const;
+	float getSoftLimitFuelShare() const;
+	float getSoftLimitSparkSkipRatio() const;
+	bool shouldSkipInjection(size_t cylinderIndex);
+
+private:
+	void setFaultRevLimit(int limit);
+
+	Hysteresis m_revLimitHysteresis;
+	Hysteresis m_boostCutHysteresis;
+	Hysteresis m_injectorDutyCutHysteresis;
+
+	float m_revLimit = 0;
+	int m_faultRevLimit = 10000;
+	bool m_hadOilPressureAfterStart = false;
+	bool m_ignitionOn = true;
+
+	Clearable m_allowEtb;
+	Clearable m_allowInjection;
+	Clearable m_allowIgnition;
+	Clearable m_allowTriggerInput;
+	Clearable m_transientAllowInjection = true;
+	Clearable m_transientAllowIgnition = true;
+
+	Timer m_softLimitTimer;
+	float m_softLimitLastRpm = 0;
+	float m_softLimitRpmRate = 0;
+	float m_softLimitTorqueRatio = 0;
+	SoftSparkLimiter m_softLimitFuelCut;
+};
+
+struct {
+	struct {
+		struct {
+			bool hasSynchronizedPhase() const { return true; }
+		} triggerState;
+	} triggerCentral;
+	struct {
+		bool isRunning() const { return true; }
+		float getSecondsSinceEngineStart(efitick_t) const { return 100; }
+	} rpmCalculator;
+	struct {
+		bool clutchDownState = false;
+	} engineState;
+	bool isMainRelayEnabled() const { return true; }
+	LaunchControlBase launchController;
+	SoftSparkLimiter softSparkLimiter;
+} engineInstance, *engine = &engineInstance;
+
+#include "launch_control.cpp"
+#include "limp_manager.cpp"
+
+// in gear at WOT: engine plus vehicle reflected to the crank in kg m^2, mean torque of a fired event over its
+// 180 degrees, friction and road load
+#define DRIVELINE_INERTIA 0.5
+#define FIRED_TORQUE 260.0
+#define LOAD_TORQUE 60.0
+// torque lost per degree of retard from MBT
+#define RETARD_TORQUE_LOSS 0.015
+
+struct LimiterResult {
+	float overshoot;
+	float peakToPeak;
+	float unburntShare;
+};
+
+static LimiterResult runLimiter(float softWindow, float fuelCutBand) {
+	engineConfiguration->rpmSoftLimitWindowSize = softWindow;
+	engineConfiguration->rpmSoftLimitFuelCutBand = fuelCutBand;
+
+	// engine is a global in the firmware, so the limp manager starts zeroed
+	LimpManager limp = LimpManager();
+	engine->softSparkLimiter.reset();
+
+	const double dt = 0.00005;
+	double rpm = 6000;
+	double angle = 0;
+	size_t event = 0;
+	// fuel for an event goes in one engine cycle, four events, ahead of its spark
+	bool isFueled[4] = { true, true, true, true };
+	double torque = FIRED_TORQUE;
+
+	int settledEvents = 0;
+	int unburntEvents = 0;
+	float maximum = 0;
+	float settledMaximum = 0;
+	float settledMinimum = 1e6;
+
+	for (int step = 0; step * dt < 3; step++) {
+		double t = step * dt;
+		hostNowNt = US2NT(t * 1e6);
+
+		if (step % (int)(FAST_CALLBACK_PERIOD_MS * 0.001 / dt) == 0) {
+			limp.updateState(rpm, hostNowNt);
+		}
+
+		angle += rpm / 60 * 360 * dt;
+		if (angle >= 180) {
+			angle -= 180;
+			size_t cylinder = event % 4;
+
+			// spark for the fuel which went in a cycle ago
+			limp.updateSoftRevLimit(rpm, hostNowNt);
+			bool isSparked = limp.allowIgnition() && !engine->softSparkLimiter.shouldSkip(cylinder, limp.getSoftLimitSparkSkipRatio());
+			torque = isSparked && isFueled[cylinder] ? FIRED_TORQUE * (1 - RETARD_TORQUE_LOSS * limp.getSoftLimitTimingRetard()) : 0;
+
+			bool isSettled = t > 1.5;
+			if (isSettled) {
+				settledEvents++;
+				unburntEvents += !isSparked && isFueled[cylinder];
+			}
+
+			// and fuel for this cylinder's next cycle
+			isFueled[cylinder] = limp.allowInjection() && !limp.shouldSkipInjection(cylinder);
+			event++;
+		}
+
+		rpm += (torque - LOAD_TORQUE) / DRIVELINE_INERTIA * dt * 60 / (2 * M_PI);
+
+		maximum = std::max<float>(maximum, rpm);
+		if (t > 1.5) {
+			settledMaximum = std::max<float>(settledMaximum, rpm);
+			settledMinimum = std::min<float>(settledMinimum, rpm);
+		}
+	}
+
+	return { maximum - engineConfiguration->rpmHardLimit, settledMaximum - settledMinimum, (float)unburntEvents / settledEvents };
+}
+
+static void printResult(const char* name, const LimiterResult& result) {
+	printf("%-32s overshoot %+4.0f rpm, settled %4.0f rpm peak to peak, %4.1f%% unburnt-fuel events\n", name,
+			result.overshoot, result.peakToPeak, 100 * result.unburntShare);
+}
+
+// further events scheduled from the same trigger edge must keep the rpm rate the first one measured
+static void checkSameEdgeEvents() {
+	engineConfiguration->rpmSoftLimitWindowSize = 300;
+	LimpManager limp = LimpManager();
+	limp.updateState(6500, 0);
+
+	// 2000 rpm/s, an event every 5 ms
+	float rpm = 6500;
+	efitick_t nowNt = 0;
+	for (int i = 0; i < 20; i++) {
+		nowNt += MS2NT(5);
+		rpm += 10;
+		limp.updateSoftRevLimit(rpm, nowNt);
+	}
+
+	float retard = limp.getSoftLimitTimingRetard();
+	limp.updateSoftRevLimit(rpm, nowNt);
+	check(retard > 0 && limp.getSoftLimitTimingRetard() == retard, "second event on the same edge keeps the retard", limp.getSoftLimitTimingRetard());
+}
+
+int main() {
+	float defaultFuelCutBand = engineConfiguration->rpmSoftLimitFuelCutBand;
+
+	LimiterResult hard = runLimiter(0, defaultFuelCutBand);
+	LimiterResult soft = runLimiter(300, defaultFuelCutBand);
+	LimiterResult lateFuel = runLimiter(300, 0.5f);
+	printResult("hard 50 rpm hysteresis", hard);
+	printResult("soft window 300", soft);
+	printResult("soft window 300, fuel band 0.5", lateFuel);
+
+	check(soft.overshoot <= 0, "soft limiter overshoot", soft.overshoot);
+	check(soft.peakToPeak < 0.6f * hard.peakToPeak, "soft limiter settled band against hard limit", soft.peakToPeak / hard.peakToPeak);
+	check(soft.unburntShare < 0.5f * hard.unburntShare, "soft limiter unburnt-fuel events against hard limit", soft.unburntShare / hard.unburntShare);
+	check(soft.unburntShare < lateFuel.unburntShare, "fuel cut from the first cut event against fuel band 0.5", soft.unburntShare);
+
+	checkSameEdgeEvents();
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+// Synthetic nernst and pump current waveforms through the ESR demodulator and sampling.cpp, read back the way
+// CAN and UART do: GetSensorInternalResistance and GetLambda. A warming sensor has its ESR falling and its nernst
+// DC drifting while the ADC adds noise, ohms and lambda have to track the true values.
+
+#include "host_rusefi.h"
+
+#include <cmath>
+#include <random>
+
+HOST_TEST_GLOBALS
+
+// wideband_config.h
+#define VCC_VOLTS 3.3f
+#define ADC_MAX_COUNT 4095
+#define NERNST_INPUT_GAIN (1 / 0.8f)
+#define ESR_SUPPLY_R 22000
+#define VM_RESISTOR_VALUE 10
+#define PUMP_CURRENT_SENSE_GAIN 10
+#define LSU_SENSE_R 61.9f
+#define ESR_SENSE_ALPHA 0.1f
+#define PUMP_FILTER_ALPHA 0.01f
+
+// ChibiOS, single threaded here, the test runs the sampling thread body itself
+typedef int binary_semaphore_t;
+#define NORMALPRIO 128
+#define THD_WORKING_AREA(name, size) char name[size]
+
+static bool isDemodSignaled = false;
+
+static void chSysLock() { }
+static void chSysUnlock() { }
+static void chSysLockFromISR() { }
+static void chSysUnlockFromISR() { }
+static void chBSemObjectInit(binary_semaphore_t*, bool) { }
+static void chBSemWait(binary_semaphore_t*) { }
+static void chBSemSignalI(binary_semaphore_t*) { isDemodSignaled = true; }
+static void chThdCreateStatic(void*, size_t, int, void (*)(void*), void*) { }
+
+struct ADCDriver { };
+static ADCDriver ADCD1;
+static void adcStart(ADCDriver*, void*) { }
+
+struct AnalogBurst
+{
+    int32_t NernstSum;
+    int32_t PumpCurrentSum;
+    int32_t VirtualGroundSum;
+    uint32_t BatteryVoltageSum;
+    uint32_t Frames;
+};
+
+static void StartAnalogBursts(void (*)(const AnalogBurst&)) { }
+
+// interpolation.h
+struct inter_point
+{
+    float x;
+    float y;
+};
+
+#define FIXED_TABLE_SIZE 129
+
+struct fixed_table
+{
+    int32_t x0;
+    int32_t invStep;
+    int16_t y[FIXED_TABLE_SIZE];
+};
+
+float interpolate_1d_float(const struct inter_point *p, int size, float x);
+void fixed_table_build(struct fixed_table *t, float (*reference)(float), float xMin, float xMax, float yScale);
+int32_t fixed_table_lookup(const struct fixed_table *t, int32_t x);
+
+// configuration
+enum class SensorType : uint8_t
+{
+    Lsu49 = 0,
+    Lsu42 = 1,
+};
+
+static SensorType GetSensorType()
+{
+    return SensorType::Lsu49;
+}
+
+float GetPumpNominalCurrent();
+
+#include "interpolation.cpp"
+#include "lambda_conversion.cpp"
+#include "sampling.cpp"
+
+#define FRAMES_PER_HALF 28
+
+// ADC counts per volt at the pin
+static constexpr float countsPerVolt = ADC_MAX_COUNT / VCC_VOLTS;
+
+struct Warmup
+{
+    // sensor ESR falls exponentially from cold to hot
+    float coldEsr;
+    float hotEsr;
+    float tauHalves;
+    // nernst DC at the ADC pin cold, and how far it drifts with the same time constant while the cell warms, volts
+    float nernstDc;
+    float nernstDcDrift;
+    // true pump current, mA
+    float pumpCurrent;
+    float noiseLsb;
+};
+
+struct TrackingError
+{
+    // worst ESR error relative to the true ESR once the filter has a value, single updates so ADC noise included
+    float esr;
+    // ESR relative error at the end, sensor hot
+    float finalEsr;
+    // worst lambda error relative to the characteristic once the pump filter settled
+    float lambda;
+};
+
+static float GetTrueEsr(const Warmup& w, float half)
+{
+    return w.hotEsr + (w.coldEsr - w.hotEsr) * expf(-half / w.tauHalves);
+}
+
+static float GetNernstDc(const Warmup& w, float half)
+{
+    return w.nernstDc + w.nernstDcDrift * (1 - expf(-half / w.tauHalves));
+}
+
+// Runs halfPeriods excitation halves through the ADC interrupt handler and the sampling thread body
+static TrackingError Run(const Warmup& w, int halfPeriods)
+{
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> noise(0, w.noiseLsb);
+
+    demodulator = EsrDemodulator();
+    nernstAc = 0;
+    pumpCurrentSenseVoltage = 0;
+
+    constexpr float virtualGround = VCC_VOLTS / 2;
+    constexpr float pumpRatio = -1000 / (PUMP_CURRENT_SENSE_GAIN * LSU_SENSE_R);
+    float pumpVolts = virtualGround + w.pumpCurrent / pumpRatio;
+    float trueLambda = interpolate_1d_float(lsu49_ip_to_lambda, ARRAY_SIZE(lsu49_ip_to_lambda), w.pumpCurrent);
+
+    TrackingError error = {};
+
+    for (int half = 0; half < halfPeriods; half++)
+    {
+        float phase = (half & 1) ? 1 : -1;
+        // nernst AC at Vm is the sensor side of the divider fed 3.3v pk-pk through ESR_SUPPLY_R
+        float esr = GetTrueEsr(w, half);
+        float acAtPin = VCC_VOLTS / (ESR_SUPPLY_R / (esr + VM_RESISTOR_VALUE) + 1) / NERNST_INPUT_GAIN;
+
+        AnalogBurst burst = {};
+        for (int i = 0; i < FRAMES_PER_HALF; i++)
+        {
+            float nernstVolts = GetNernstDc(w, half + (float)i / FRAMES_PER_HALF) + phase * acAtPin / 2;
+            burst.NernstSum += (int32_t)lroundf(nernstVolts * countsPerVolt + noise(rng));
+            burst.PumpCurrentSum += (int32_t)lroundf(pumpVolts * countsPerVolt + noise(rng));
+            burst.VirtualGroundSum += (int32_t)lroundf(virtualGround * countsPerVolt + noise(rng));
+        }
+        burst.Frames = FRAMES_PER_HALF;
+
+        OnAnalogBurst(burst);
+
+        if (!isDemodSignaled)
+        {
+            continue;
+        }
+
+        isDemodSignaled = false;
+        ProcessDemodResult(demodReady);
+
+        // ESR filter is ~10 halves, pump current filter ~100
+        float esrError = fabsf(GetSensorInternalResistance() / esr - 1);
+        if (half >= 100)
+        {
+            error.esr = fmaxf(error.esr, esrError);
+        }
+        error.finalEsr = esrError;
+
+        if (half >= 1000)
+        {
+            error.lambda = fmaxf(error.lambda, fabsf(GetLambda() / trueLambda - 1));
+        }
+    }
+
+    return error;
+}
+
+static void CheckWarmup(const char* name, const Warmup& w, float maxEsrError, float maxFinalEsrError, float maxLambdaError)
+{
+    char what[128];
+    TrackingError error = Run(w, 20000);
+
+    snprintf(what, sizeof(what), "%s ESR max relative error while warming", name);
+    check(error.esr < maxEsrError, what, error.esr);
+    snprintf(what, sizeof(what), "%s ESR relative error hot", name);
+    check(error.finalEsr < maxFinalEsrError, what, error.finalEsr);
+    snprintf(what, sizeof(what), "%s lambda max relative error", name);
+    check(error.lambda < maxLambdaError, what, error.lambda);
+}
+
+int main()
+{
+    // cold start to operating temperature with the nernst DC moving along, up to 1 mV per half: the slope cancelling
+    // keeps the ramp out of the AC, else the ESR would read high the most while the sensor is cold
+    CheckWarmup("lean, 2 LSB noise", { 1200, 300, 500, 1.2f, 0.5f, 0.671f, 2 }, 0.02f, 0.005f, 0.003f);
+    CheckWarmup("rich, 2 LSB noise", { 1200, 300, 500, 1.8f, -0.5f, -0.405f, 2 }, 0.02f, 0.005f, 0.003f);
+    // small AC of a hot sensor and more noise, 300 ohm is only 45 counts pk-pk at the pin
+    CheckWarmup("stoichiometric, 6 LSB noise", { 600, 300, 1000, 1.5f, 0, 0, 6 }, 0.06f, 0.03f, 0.005f);
+
+    // filter run once per update must settle like the per half period one did
+    constexpr float alpha = 0.01f;
+    float perHalf = 0, perUpdate = 0;
+    for (int i = 0; i < 100 * ESR_BURSTS_PER_UPDATE; i++)
+    {
+        perHalf += alpha * (1 - perHalf);
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        perUpdate += AlphaPerUpdate(alpha) * (1 - perUpdate);
+    }
+    check(fabsf(perHalf - perUpdate) < 1e-4f, "step response, per update alpha", perUpdate);
+
+    return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,515 @@
+// 1-2 upshift through the tcu.cpp shift sequencer and the tc_4l6x.cpp pressure control against a drivetrain model:
+// the offgoing clutch lets go over 50 ms, the oncoming clutch has to fill before it carries torque and fills slower
+// at lower pressure, engine torque comes down with spark retard. Shift pressure from the 1-2 shift table alone is
+// compared with fill, torque and inertia phases timed from the scheduler. Then gear_detector.cpp on a noisy ratio
+// over three upshifts.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#define EFI_TCU 1
+#define EFI_TUNER_STUDIO 0
+
+HOST_TEST_GLOBALS
+
+#define GEARS_COUNT 8
+
+typedef float angle_t;
+typedef float percent_t;
+
+enum class SensorType { Rpm, VehicleSpeed, InputShaftSpeed, DriverThrottleIntent, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static expected<float> get(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static bool hasSensor(SensorType type) {
+		return type != SensorType::InputShaftSpeed;
+	}
+};
+
+enum gear_e {
+	REVERSE = -1,
+	NEUTRAL = 0,
+	GEAR_1 = 1,
+	GEAR_2 = 2,
+	GEAR_3 = 3,
+	GEAR_4 = 4,
+};
+
+struct engine_configuration_s {
+	uint8_t totalGearsCount = 4;
+	// 4L60E
+	float gearRatio[GEARS_COUNT] = { 3.06f, 1.63f, 1.0f, 0.7f };
+	float finalGearRatio = 3.42f;
+	float driveWheelRevPerKm = 500;
+
+	uint16_t tcu_shiftFillMs = 0;
+	uint8_t tcu_shiftFillDuty = 100;
+	uint16_t tcu_shiftTorquePhaseMs = 0;
+	uint16_t tcu_shiftInertiaTimeoutMs = 500;
+	uint8_t tcu_shiftTorqueRetard = 15;
+	int8_t tcu_shiftTorquePhaseDutyAdder = 0;
+	int8_t tcu_shiftInertiaPhaseDutyAdder = 0;
+
+	// pins, only init() looks at them
+	int tcu_solenoid[6] = {};
+	int tcu_solenoid_mode[6] = {};
+	int tcu_tcc_onoff_solenoid = 0;
+	int tcu_tcc_onoff_solenoid_mode = 0;
+	int tcu_tcc_pwm_solenoid = 0;
+	int tcu_tcc_pwm_solenoid_mode = 0;
+	int tcu_tcc_pwm_solenoid_freq = 0;
+	int tcu_pc_solenoid_pin = 0;
+	int tcu_pc_solenoid_pin_mode = 0;
+	int tcu_pc_solenoid_freq = 0;
+	int tcu_32_solenoid_pin = 0;
+	int tcu_32_solenoid_pin_mode = 0;
+	int tcu_32_solenoid_freq = 0;
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+// pressure control duty per gear and shift, over cylinder air mass
+#define PC_DUTY_IN_GEAR 40
+#define PC_DUTY_12 30
+
+struct persistent_config_s {
+	uint8_t tcuSolenoidTable[10][6] = {};
+	float tcu_pcAirmassBins[2] = { 0, 1 };
+	uint8_t tcu_pcValsR[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcValsN[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals1[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals2[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals3[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals4[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals12[2] = { PC_DUTY_12, PC_DUTY_12 };
+	uint8_t tcu_pcVals23[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals34[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals21[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals32[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_pcVals43[2] = { PC_DUTY_IN_GEAR, PC_DUTY_IN_GEAR };
+	uint8_t tcu_tccTpsBins[2] = { 0, 100 };
+	uint8_t tcu_tccLockSpeed[2] = {};
+	uint8_t tcu_tccUnlockSpeed[2] = {};
+	uint8_t tcu_32SpeedBins[2] = { 0, 100 };
+	uint8_t tcu_32Vals[2] = {};
+} persistentConfig, *config = &persistentConfig;
+
+struct scheduling_s { };
+
+struct action_s {
+	template <typename TParam>
+	action_s(void (*callback)(TParam*), TParam* param)
+		: m_callback(reinterpret_cast<void (*)(void*)>(callback))
+		, m_param(param) { }
+
+	void execute() const { m_callback(m_param); }
+
+private:
+	void (*m_callback)(void*);
+	void* m_param;
+};
+
+/**
+ * Runs whatever is due, one pending action per scheduling_s as in the firmware executor
+ */
+struct HostExecutor {
+	struct Pending {
+		scheduling_s* scheduling;
+		efitick_t timeNt;
+		action_s action;
+	};
+
+	void scheduleByTimestampNt(const char*, scheduling_s* scheduling, efitick_t timeNt, action_s action) {
+		cancel(scheduling);
+		pending.push_back({ scheduling, timeNt, action });
+	}
+
+	void cancel(scheduling_s* scheduling) {
+		pending.erase(std::remove_if(pending.begin(), pending.end(),
+				[=](const Pending& p) { return p.scheduling == scheduling; }), pending.end());
+	}
+
+	void executeAll(efitick_t nowNt) {
+		for (size_t i = 0; i < pending.size(); i++) {
+			if (pending[i].timeNt <= nowNt) {
+				Pending due = pending[i];
+				pending.erase(pending.begin() + i);
+				due.action.execute();
+				i = -1;
+			}
+		}
+	}
+
+	std::vector<Pending> pending;
+};
+
+class Timer {
+public:
+	void reset() { m_lastResetNt = getTimeNowNt(); }
+	float getElapsedSeconds() const { return NT2US(getTimeNowNt() - m_lastResetNt) * 1e-6f; }
+
+private:
+	efitick_t m_lastResetNt = 0;
+};
+
+// members as gear_detector.h declares them
+class GearDetector {
+public:
+	void onConfigurationChange(engine_configuration_s const * previousConfig);
+	void onSlowCallback();
+
+	float getGearboxRatio() const;
+	size_t getCurrentGear() const;
+	float getGearConfidence() const;
+	float getDriveshaftRpm() const;
+	float getRpmInGear(size_t gear) const;
+	float computeGearboxRatio() const;
+	size_t determineGearFromRatio(float ratio) const;
+
+private:
+	float getGearConfidence(size_t gear, float filteredRatio, float rawRatio) const;
+
+	float m_gearThresholds[GEARS_COUNT - 1];
+	float m_gearboxRatio = 0;
+	float m_filteredRatio = 0;
+	float m_gearConfidence = 0;
+	size_t m_currentGear = 0;
+};
+
+// members as tcu.h declares them
+enum class ShiftPhase : uint8_t {
+	None,
+	Fill,
+	Torque,
+	Inertia,
+};
+
+class TransmissionControllerBase {
+public:
+	virtual ~TransmissionControllerBase() = default;
+
+	virtual void init();
+	virtual void update(gear_e);
+	virtual gear_e setCurrentGear(gear_e);
+	virtual gear_e getCurrentGear() const;
+
+	void beginShift(gear_e from, gear_e to, efitick_t nowNt);
+	void onShiftPhaseEnd(efitick_t nowNt);
+	float isShiftCompleted();
+
+	ShiftPhase getShiftPhase() const { return m_shiftPhase; }
+
+protected:
+	virtual void applyShiftPressure(ShiftPhase phase);
+	void setShiftPhase(ShiftPhase phase, efitick_t endNt);
+	void postState();
+	void measureShiftTime(gear_e);
+
+	gear_e currentGear = NEUTRAL;
+	ShiftPhase m_shiftPhase = ShiftPhase::None;
+
+private:
+	gear_e m_shiftFrom = NEUTRAL;
+	gear_e m_shiftTo = NEUTRAL;
+	efitick_t m_inertiaDeadline = 0;
+	scheduling_s m_shiftPhaseEvent;
+
+	bool m_shiftTime = false;
+	Timer m_shiftTimer;
+	gear_e m_shiftTimeGear = NEUTRAL;
+};
+
+struct FuelComputer {
+	float sdAirMassInOneCylinder = 0.5f;
+} fuelComputerInstance;
+
+struct {
+	HostExecutor executor;
+	GearDetector gearDetector;
+	FuelComputer* fuelComputer = &fuelComputerInstance;
+
+	struct {
+		float lastShiftTime;
+	} outputChannels;
+
+	template <typename T>
+	T* module() { return &gearDetector; }
+} engineInstance, *engine = &engineInstance;
+
+#include "tcu.cpp"
+#include "gear_detector.cpp"
+
+struct OutputPin {
+	void initPin(const char*, int, const int*) { }
+	void setValue(int) { }
+};
+
+struct {
+	OutputPin tcuSolenoids[6];
+	OutputPin tcuTccOnoffSolenoid;
+	OutputPin tcuTccPwmSolenoid;
+	OutputPin tcuPcSolenoid;
+	OutputPin tcu32Solenoid;
+} enginePins;
+
+// the pressure control solenoid duty is what the clutch model reads
+class SimplePwm {
+public:
+	SimplePwm(const char*) { }
+	void setSimplePwmDutyCycle(float dutyCycle) { duty = dutyCycle; }
+
+	float duty = 0;
+};
+
+static void startSimplePwm(SimplePwm*, const char*, HostExecutor*, OutputPin*, int, float) { }
+
+// members as tc_4l6x.h declares them
+class Gm4l6xTransmissionController : public TransmissionControllerBase {
+public:
+	void update(gear_e) override;
+	void init() override;
+
+protected:
+	void applyShiftPressure(ShiftPhase phase) override;
+
+private:
+	gear_e setCurrentGear(gear_e) override;
+	void setTccState();
+	void setPcState(gear_e);
+	void set32State(gear_e);
+
+	bool isShifting = false;
+	gear_e shiftingFrom = NEUTRAL;
+};
+
+#include "tc_4l6x.cpp"
+
+// engine, converter and input shaft in kg m^2, WOT torque, what retard costs per degree
+#define INPUT_INERTIA 0.25
+#define ENGINE_TORQUE 250.0
+#define RETARD_TORQUE_LOSS 0.02
+// oncoming clutch fills in 60 ms at full duty, slower at less; filled, it carries this much per % of duty
+#define FILL_MS_AT_FULL_DUTY 60.0
+#define CLUTCH_TORQUE_PER_DUTY 13.0
+#define OFFGOING_CAPACITY 600.0
+#define OFFGOING_RELEASE_MS 50.0
+
+#define RPM_TO_RAD_S (2 * M_PI / 60)
+
+struct ShiftResult {
+	float shiftMs;
+	float flare;
+	float retardMs;
+	// pressure control duty in % as the controller set it during each phase, and once the shift is over
+	float dutyByPhase[4];
+	float dutyAfterShift;
+};
+
+static ShiftResult runUpshift(bool isSequenced) {
+	engineConfiguration->tcu_shiftFillMs = isSequenced ? 60 : 0;
+	engineConfiguration->tcu_shiftTorquePhaseMs = isSequenced ? 100 : 0;
+	// more pressure while the oncoming clutch takes the load over, less once retard has taken torque away
+	engineConfiguration->tcu_shiftTorquePhaseDutyAdder = isSequenced ? 20 : 0;
+	engineConfiguration->tcu_shiftInertiaPhaseDutyAdder = isSequenced ? -5 : 0;
+
+	engine->gearDetector = GearDetector();
+	engine->gearDetector.onConfigurationChange(nullptr);
+	engine->executor.pending.clear();
+
+	Gm4l6xTransmissionController tcu;
+	gear_e selectedGear = GEAR_1;
+
+	// output shaft speed holds through the shift, the vehicle is much heavier than the engine
+	const double outputRpm = 5500 / engineConfiguration->gearRatio[0];
+	double engineRpm = 5500;
+	double fill = 0;
+	bool isOffgoingLocked = true;
+	bool isOncomingLocked = false;
+
+	const double dt = 0.0001;
+	ShiftResult result = {};
+	efitick_t shiftStartNt = 0;
+
+	for (int step = 0; step * dt < 1.5; step++) {
+		hostNowNt = US2NT(step * dt * 1e6);
+		engine->executor.executeAll(hostNowNt);
+
+		sensorValues[(int)SensorType::Rpm] = engineRpm;
+		sensorValues[(int)SensorType::VehicleSpeed] = outputRpm / engineConfiguration->finalGearRatio * 60 / engineConfiguration->driveWheelRevPerKm;
+
+		if (step == 1000) {
+			shiftStartNt = hostNowNt;
+			selectedGear = GEAR_2;
+		}
+
+		// slow callback
+		if (step % 500 == 0) {
+			engine->gearDetector.onSlowCallback();
+			tcu.update(selectedGear);
+		}
+
+		double duty = 100 * pcPwm.duty;
+		// whole percent, duty went through 0.01 * pct
+		if (shiftStartNt != 0 && !isOncomingLocked) {
+			result.dutyByPhase[(int)tcu.getShiftPhase()] = std::round(duty);
+		}
+		if (isOncomingLocked && tcu.getShiftPhase() == ShiftPhase::None) {
+			result.dutyAfterShift = std::round(duty);
+		}
+		bool isShifting = shiftStartNt != 0 && !isOncomingLocked;
+
+		double retard = getTransmissionTimingRetard();
+		double engineTorque = ENGINE_TORQUE * (1 - RETARD_TORQUE_LOSS * retard);
+		if (retard > 0) {
+			result.retardMs += dt * 1000;
+		}
+
+		double offgoingCapacity = 0;
+		double oncomingCapacity = 0;
+		if (shiftStartNt != 0) {
+			double sinceShiftMs = NT2US(hostNowNt - shiftStartNt) / 1000.0;
+			offgoingCapacity = OFFGOING_CAPACITY * clampF(0, 1 - sinceShiftMs / OFFGOING_RELEASE_MS, 1);
+			fill = std::min(1.0, fill + duty / 100 * dt * 1000 / FILL_MS_AT_FULL_DUTY);
+			oncomingCapacity = fill >= 1 ? CLUTCH_TORQUE_PER_DUTY * duty : 0;
+		} else {
+			offgoingCapacity = OFFGOING_CAPACITY;
+		}
+
+		double firstGearRpm = outputRpm * engineConfiguration->gearRatio[0];
+		double secondGearRpm = outputRpm * engineConfiguration->gearRatio[1];
+
+		if (isOncomingLocked) {
+			engineRpm = secondGearRpm;
+		} else {
+			// oncoming clutch slips above its synchronous speed and pulls the engine down
+			double torque = engineTorque - oncomingCapacity;
+
+			if (isOffgoingLocked && fabs(torque) <= offgoingCapacity) {
+				engineRpm = firstGearRpm;
+			} else {
+				isOffgoingLocked = false;
+				// offgoing clutch drags against the engine running away above first gear speed
+				if (engineRpm > firstGearRpm) {
+					torque -= offgoingCapacity;
+				}
+				engineRpm += torque / INPUT_INERTIA * dt / RPM_TO_RAD_S;
+			}
+
+			if (engineRpm <= secondGearRpm && oncomingCapacity >= engineTorque) {
+				isOncomingLocked = true;
+				engineRpm = secondGearRpm;
+				result.shiftMs = NT2US(hostNowNt - shiftStartNt) / 1000.0;
+			}
+		}
+
+		if (isShifting) {
+			result.flare = std::max<float>(result.flare, engineRpm - 5500);
+		}
+	}
+
+	return result;
+}
+
+static void checkUpshift() {
+	ShiftResult tables = runUpshift(false);
+	ShiftResult sequenced = runUpshift(true);
+
+	printf("1-2 at 5500 rpm, tables only:                        shift %3.0f ms, flare %4.0f rpm\n", tables.shiftMs, tables.flare);
+	printf("1-2 at 5500 rpm, fill 60 ms + torque 100 ms + retard: shift %3.0f ms, flare %4.0f rpm, retard for %3.0f ms\n",
+			sequenced.shiftMs, sequenced.flare, sequenced.retardMs);
+	printf("pressure control duty: fill %.0f%%, torque phase %.0f%%, inertia phase %.0f%%, in 2nd %.0f%%\n",
+			sequenced.dutyByPhase[(int)ShiftPhase::Fill], sequenced.dutyByPhase[(int)ShiftPhase::Torque],
+			sequenced.dutyByPhase[(int)ShiftPhase::Inertia], sequenced.dutyAfterShift);
+
+	check(tables.dutyByPhase[(int)ShiftPhase::None] == PC_DUTY_12, "unsequenced shift runs on the 1-2 shift table", tables.dutyByPhase[(int)ShiftPhase::None]);
+	check(sequenced.dutyByPhase[(int)ShiftPhase::Fill] == engineConfiguration->tcu_shiftFillDuty, "fill phase duty", sequenced.dutyByPhase[(int)ShiftPhase::Fill]);
+	check(sequenced.dutyByPhase[(int)ShiftPhase::Torque] == PC_DUTY_12 + 20, "torque phase duty, 1-2 table trimmed", sequenced.dutyByPhase[(int)ShiftPhase::Torque]);
+	check(sequenced.dutyByPhase[(int)ShiftPhase::Inertia] == PC_DUTY_12 - 5, "inertia phase duty, 1-2 table trimmed", sequenced.dutyByPhase[(int)ShiftPhase::Inertia]);
+	check(tables.dutyAfterShift == PC_DUTY_IN_GEAR && sequenced.dutyAfterShift == PC_DUTY_IN_GEAR, "2nd gear table once the shift is over", sequenced.dutyAfterShift);
+
+	check(tables.shiftMs > 0 && sequenced.shiftMs > 0, "both shifts complete", sequenced.shiftMs);
+	check(sequenced.shiftMs < 0.75f * tables.shiftMs, "sequenced shift time against tables only", sequenced.shiftMs / tables.shiftMs);
+	check(sequenced.flare < 0.5f * tables.flare, "sequenced flare against tables only", sequenced.flare / tables.flare);
+	check(tables.retardMs == 0, "no retard without sequencing", tables.retardMs);
+	// inertia phase starts after fill and torque phase, retard has to last until the ratio is there
+	float inertiaMs = sequenced.shiftMs - engineConfiguration->tcu_shiftFillMs - engineConfiguration->tcu_shiftTorquePhaseMs;
+	check(sequenced.retardMs > 0.9f * inertiaMs, "retard held through the inertia phase", sequenced.retardMs / inertiaMs);
+}
+
+/**
+ * Deterministic gaussian-ish noise, sum of uniforms
+ */
+static float ratioNoise() {
+	static uint32_t state = 12345;
+	float sum = 0;
+	for (int i = 0; i < 4; i++) {
+		state = state * 1664525 + 1013904223;
+		sum += (state >> 8) / 16777216.0f - 0.5f;
+	}
+	return sum * 1.7f;
+}
+
+static void checkGearDetection() {
+	engine->gearDetector = GearDetector();
+	GearDetector& detector = engine->gearDetector;
+	detector.onConfigurationChange(nullptr);
+
+	const float* ratios = engineConfiguration->gearRatio;
+	size_t lastRawGear = 0;
+	size_t lastGear = 0;
+	int rawChanges = 0;
+	int changes = 0;
+	float worstLatencyMs = 0;
+	float shiftEndMs = 0;
+
+	// slow callback, three upshifts each taking 600 ms of ratio change as a part throttle shift does, 4% ratio noise
+	for (int ms = 0; ms < 8000; ms += 50) {
+		int shift = std::min(ms / 2000, 3);
+		float progress = clampF(0, (ms - shift * 2000) / 600.0f, 1);
+		float ratio = shift == 0 ? ratios[0] : ratios[shift - 1] + (ratios[shift] - ratios[shift - 1]) * progress;
+		float noisyRatio = ratio * (1 + 0.04f * ratioNoise());
+
+		float vssKph = 60;
+		sensorValues[(int)SensorType::VehicleSpeed] = vssKph;
+		float driveshaftRpm = vssKph * engineConfiguration->driveWheelRevPerKm / 60 * engineConfiguration->finalGearRatio;
+		sensorValues[(int)SensorType::Rpm] = noisyRatio * driveshaftRpm;
+
+		detector.onSlowCallback();
+
+		size_t rawGear = detector.determineGearFromRatio(detector.computeGearboxRatio());
+		if (ms > 0 && rawGear != lastRawGear) {
+			rawChanges++;
+		}
+		lastRawGear = rawGear;
+
+		size_t gear = detector.getCurrentGear();
+		if (ms > 0 && gear != lastGear) {
+			changes++;
+			shiftEndMs = shift * 2000 + 600;
+			worstLatencyMs = std::max<float>(worstLatencyMs, ms - shiftEndMs);
+		}
+		lastGear = gear;
+	}
+
+	printf("three upshifts with 4%% ratio noise: raw ratio reports %d gear changes, filtered detector %d\n", rawChanges, changes);
+	check(changes == 3, "filtered detector reports exactly the three shifts", changes);
+	check(rawChanges > 3, "raw ratio alone flickers", rawChanges);
+	check(worstLatencyMs <= 300, "gear reported within 300 ms of the ratio settling", worstLatencyMs);
+}
+
+int main() {
+	checkUpshift();
+	checkGearDetection();
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+// SoftSparkLimiter cut pattern through launch_control.cpp: for 3 to 12 cylinders and ratios across 0..1 the cuts
+// in any one cycle stay within two events of the target and every cylinder gets its share, which engine-wide
+// sigma-delta alone does not. Then a free revving four cylinder on the launch limiter, 20 ms hard cut against the
+// per-event ramp.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#define EFI_LAUNCH_CONTROL 1
+#define EFI_SIMULATOR 1
+
+HOST_TEST_GLOBALS
+
+#define MAX_CYLINDER_COUNT 12
+
+typedef int brain_pin_e;
+
+static bool isBrainPinValid(brain_pin_e pin) { return pin != 0; }
+
+enum class SensorType { Rpm, VehicleSpeed, DriverThrottleIntent, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static expected<float> get(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+};
+
+enum launchActivationMode_e { SWITCH_INPUT_LAUNCH, CLUTCH_INPUT_LAUNCH, ALWAYS_ACTIVE_LAUNCH };
+
+struct {
+	bool launchControlEnabled = true;
+	launchActivationMode_e launchActivationMode = ALWAYS_ACTIVE_LAUNCH;
+	brain_pin_e launchActivatePin = 0;
+	bool launchActivateInverted = false;
+	brain_pin_e clutchDownPin = 0;
+	int launchSpeedThreshold = 10;
+	int launchTpsThreshold = 10;
+	int launchRpm = 3000;
+	int hardCutRpmRange = 500;
+	float launchActivateDelay = 0;
+	bool launchSparkCutEnable = true;
+	bool launchFuelCutEnable = false;
+	bool launchSoftSparkCut = true;
+	float launchFuelAdderPercent = 0;
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+class Timer {
+public:
+	void reset() { }
+	bool hasElapsedSec(float seconds) const { return seconds <= 0; }
+};
+
+// members as launch_control.h declares them
+class SoftSparkLimiter {
+public:
+	void setTargetSkipRatio(float targetSkipRatio);
+	float getTargetSkipRatio() const;
+	void reset();
+	bool shouldSkip(size_t cylinderIndex, float skipRatio);
+
+private:
+	float targetSkipRatio = 0;
+	float m_engineError = 0;
+	float m_cylinderError[MAX_CYLINDER_COUNT];
+};
+
+class LaunchControlBase {
+public:
+	LaunchControlBase();
+
+	void update();
+	bool getFuelCoefficient() const;
+	bool isInsideSpeedCondition() const;
+	bool isInsideTpsCondition() const;
+	bool isInsideSwitchCondition();
+	bool isInsideRPMCondition(int rpm) const;
+	bool isLaunchConditionMet(int rpm);
+	bool isLaunchRpmRetardCondition() const;
+	bool isLaunchSparkRpmRetardCondition() const;
+	bool isLaunchFuelRpmRetardCondition() const;
+	float getSparkSkipRatio(int rpm) const;
+
+	int retardThresholdRpm = 0;
+	bool isLaunchCondition = false;
+	bool combinedConditions = false;
+	bool launchActivatePinState = false;
+	bool isSwitchActivated = false;
+	bool isClutchActivated = false;
+	bool activateSwitchCondition = false;
+	bool rpmCondition = false;
+	bool speedCondition = false;
+	bool tpsCondition = false;
+
+private:
+	Timer m_launchTimer;
+};
+
+struct {
+	struct {
+		bool clutchDownState = false;
+	} engineState;
+	SoftSparkLimiter softSparkLimiter;
+} engineInstance, *engine = &engineInstance;
+
+#include "launch_control.cpp"
+
+// cut sequence over 200 cycles, true for a skipped event
+static std::vector<bool> runPattern(size_t cylinders, float ratio, bool isEngineWideOnly) {
+	std::vector<bool> skipped;
+	engine->softSparkLimiter.reset();
+	float engineError = 0;
+
+	for (size_t event = 0; event < 200 * cylinders; event++) {
+		if (isEngineWideOnly) {
+			engineError += ratio;
+			bool skip = engineError >= 1;
+			engineError -= skip ? 1 : 0;
+			skipped.push_back(skip);
+		} else {
+			skipped.push_back(engine->softSparkLimiter.shouldSkip(event % cylinders, ratio));
+		}
+	}
+
+	return skipped;
+}
+
+static void checkDistribution() {
+	float worstWindow = 0;
+	float worstCylinder = 0;
+	float worstEngineWideCylinder = 0;
+
+	for (size_t cylinders : { 3, 4, 5, 6, 8, 12 }) {
+		for (int k = 1; k < 40; k++) {
+			float ratio = k / 40.0f;
+
+			std::vector<bool> skipped = runPattern(cylinders, ratio, false);
+			for (size_t start = 0; start + cylinders <= skipped.size(); start++) {
+				int cuts = std::count(skipped.begin() + start, skipped.begin() + start + cylinders, true);
+				worstWindow = std::max(worstWindow, fabsf(cuts - ratio * cylinders));
+			}
+
+			std::vector<bool> engineWide = runPattern(cylinders, ratio, true);
+			for (size_t cylinder = 0; cylinder < cylinders; cylinder++) {
+				int cuts = 0;
+				int engineWideCuts = 0;
+				for (size_t event = cylinder; event < skipped.size(); event += cylinders) {
+					cuts += skipped[event];
+					engineWideCuts += engineWide[event];
+				}
+				worstCylinder = std::max(worstCylinder, fabsf(cuts / 200.0f - ratio));
+				worstEngineWideCylinder = std::max(worstEngineWideCylinder, fabsf(engineWideCuts / 200.0f - ratio));
+			}
+		}
+	}
+
+	check(worstWindow < 2, "cuts in any one cycle window against target", worstWindow);
+	check(worstCylinder < 0.01f, "per cylinder cut ratio against target", worstCylinder);
+	check(worstEngineWideCylinder > 0.25f, "engine-wide sigma-delta alone locks onto cylinders", worstEngineWideCylinder);
+
+	// four cylinder at 50%: every cylinder is cut, none of them every time
+	std::vector<bool> half = runPattern(4, 0.5f, false);
+	for (size_t cylinder = 0; cylinder < 4; cylinder++) {
+		int cuts = 0;
+		for (size_t event = cylinder; event < half.size(); event += 4) {
+			cuts += half[event];
+		}
+		char what[64];
+		snprintf(what, sizeof(what), "50%% on four cylinders, #%d cut ratio", (int)cylinder + 1);
+		check(fabsf(cuts / 200.0f - 0.5f) < 0.01f, what, cuts / 200.0f);
+	}
+}
+
+// free revving four cylinder at WOT: kg m^2, Nm per firing cylinder averaged over its 180 degrees, friction
+#define ENGINE_INERTIA 0.2
+#define FIRED_TORQUE 120.0
+static double frictionTorque(double rpm) {
+	return 20 + 0.005 * rpm;
+}
+
+struct HoldResult {
+	float mean;
+	float peakToPeak;
+	float maximum;
+};
+
+static HoldResult runLaunchHold(bool isSoftCut) {
+	engineConfiguration->launchSoftSparkCut = isSoftCut;
+	sensorValues[(int)SensorType::DriverThrottleIntent] = 100;
+	sensorValues[(int)SensorType::VehicleSpeed] = 0;
+
+	LaunchControlBase launch;
+	engine->softSparkLimiter.reset();
+
+	const double dt = 0.0001;
+	double rpm = 2000;
+	double angle = 0;
+	int event = 0;
+	bool isFired = true;
+	bool isHardCut = false;
+
+	double sum = 0;
+	int samples = 0;
+	HoldResult result = { 0, 0, 0 };
+	float minimum = 1e6;
+
+	for (int step = 0; step < 30000; step++) {
+		// limp manager and launch update run from the 20 ms callback on the averaged rpm
+		if (step % 200 == 0) {
+			sensorValues[(int)SensorType::Rpm] = rpm;
+			launch.update();
+			isHardCut = launch.isLaunchSparkRpmRetardCondition();
+		}
+
+		// one spark event every 180 degrees, decided with the instant rpm at that event
+		angle += rpm / 60 * 360 * dt;
+		if (angle >= 180) {
+			angle -= 180;
+			float ratio = launch.getSparkSkipRatio(rpm);
+			isFired = !isHardCut && !engine->softSparkLimiter.shouldSkip(event % 4, ratio);
+			event++;
+		}
+
+		double torque = (isFired ? FIRED_TORQUE : 0) - frictionTorque(rpm);
+		rpm += torque / ENGINE_INERTIA * dt * 60 / (2 * M_PI);
+
+		// settled on the limiter
+		if (step * dt > 1.5) {
+			sum += rpm;
+			samples++;
+			result.maximum = std::max<float>(result.maximum, rpm);
+			minimum = std::min<float>(minimum, rpm);
+		}
+	}
+
+	result.mean = sum / samples;
+	result.peakToPeak = result.maximum - minimum;
+	return result;
+}
+
+static void checkLaunchHold() {
+	HoldResult hard = runLaunchHold(false);
+	HoldResult soft = runLaunchHold(true);
+
+	printf("launch 3000 + 500, 20 ms hard cut:  mean %.0f rpm, %.0f rpm peak to peak\n", hard.mean, hard.peakToPeak);
+	printf("launch 3000 + 500, per-event ramp:  mean %.0f rpm, %.0f rpm peak to peak\n", soft.mean, soft.peakToPeak);
+
+	// a single cut event is worth about 50 rpm on this engine, that is the floor for any cut pattern
+	check(soft.peakToPeak < 0.65f * hard.peakToPeak, "per-event ramp peak to peak against hard cut", soft.peakToPeak / hard.peakToPeak);
+	check(soft.mean > engineConfiguration->launchRpm && soft.maximum < engineConfiguration->launchRpm + engineConfiguration->hardCutRpmRange,
+			"per-event ramp holds inside the ramp", soft.mean);
+	check(hard.maximum > engineConfiguration->launchRpm + engineConfiguration->hardCutRpmRange, "hard cut overshoots its threshold", hard.maximum);
+}
+
+int main() {
+	checkDistribution();
+	checkLaunchHold();
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+// strtof_rusefi.cpp against host strtof, bit for bit and end pointer for end pointer: hand picked edge
+// cases, then a seeded corpus of shortest round trip, long, halfway, subnormal and hex inputs. Then the
+// numerals of a generated calibration script parsed the way the Lua lexer does, new parser against the old one,
+// and with LUA_DIR set a real luaL_loadbuffer() of that script with either parser behind lua_str2number().
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+HOST_TEST_GLOBALS
+
+#include "strtof_rusefi.cpp"
+
+#if HOST_LUA
+// Lua core built at the end of this file, make LUA_DIR=...
+static double timeLuaCompile(const std::string& script, float (*parser)(const char*, char**));
+#endif
+
+namespace legacy {
+// digit-by-digit parser strtof_rusefi.cpp replaced, copied from lua.cpp
+float strtof_rusefi(const char* str, char** endPtr) {
+	bool afterDecimalPoint = false;
+	float div = 1;
+
+	if (endPtr) {
+		*endPtr = const_cast<char*>(str);
+	}
+
+	float integerPart = 0;
+	float fractionalPart = 0;
+
+	while (*str != '\0') {
+		char c = *str;
+		int digitVal = c - '0';
+
+		if (c >= '0' && c <= '9') {
+			if (!afterDecimalPoint) {
+				integerPart = 10 * integerPart + digitVal;
+			} else {
+				fractionalPart = 10 * fractionalPart + digitVal;
+				div *= 10;
+			}
+		} else if (c == '.') {
+			afterDecimalPoint = true;
+		} else {
+			break;
+		}
+
+		str++;
+	}
+
+	if (endPtr) {
+		*endPtr = const_cast<char*>(str);
+	}
+
+	return integerPart + fractionalPart / div;
+}
+}
+
+static uint32_t toBits(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static int mismatches = 0;
+
+static bool compareWithHost(const char* input) {
+	char* hostEnd;
+	char* ourEnd;
+	float expected = strtof(input, &hostEnd);
+	float actual = strtof_rusefi(input, &ourEnd);
+
+	if (toBits(expected) == toBits(actual) && hostEnd == ourEnd) {
+		return true;
+	}
+
+	// the corpus is large, only the first few are worth reading
+	if (mismatches++ < 10) {
+		printf("mismatch \"%s\": host %a end %d, ours %a end %d\n", input,
+				expected, (int)(hostEnd - input), actual, (int)(ourEnd - input));
+	}
+	return false;
+}
+
+static const char* const edgeCases[] = {
+	"0", "-0", "+0", "0.0", "00000.00000e99", "0e-99999", ".5", "5.", "-.5e1",
+	"1", "3.14159", "0.1", "1e10", "1E-10", "  \t\n42", "16777216", "16777217", "16777219",
+	// exactly halfway between two floats, ties to even both ways
+	"16777217.0", "16777219.0", "33554434", "33554438",
+	"1.00000005960464477539062500", "1.00000017881393432617187500",
+	"1.000000059604644775390625000000000000000000000000000000000000000000001",
+	"1.000000059604644775390624999999999999999999999999999999999999999999999",
+	// largest float, halfway to the next binade, overflow
+	"3.4028234663852886e38", "3.4028235677973366e38", "3.4028235677973367e38", "3.5e38", "1e39", "-1e39", "1e99999",
+	// smallest normal, subnormals, underflow
+	"1.17549435e-38", "1.1754942e-38", "1.4e-45", "1.401298464324817e-45", "7.006492321624085e-46",
+	"7.006492321624086e-46", "7e-46", "1e-46", "1e-99999",
+	// hex floats
+	"0x1p0", "0x1.8p3", "-0X.8P-1", "0x1.fffffep127", "0x1.ffffffp127", "0x1p-149", "0x1p-150",
+	"0xABCDEF.123", "0x1.0000010000000000000000001p0", "0x", "0x.p1", "0xg",
+	// the number stops where the syntax does
+	"1e", "1e+", "1e-x", "2.5x", "1..2", "--1", "+-1", "", " ", ".", "-", "e5", "x12", "1p4", "0x1e5",
+	"12345678901234567890123456789", "0.000000000000000000000000000000000000000000001234567890123456789",
+};
+
+static void generateCorpus(std::vector<std::string>& corpus) {
+	std::mt19937_64 random(77);
+	char buffer[160];
+
+	for (int i = 0; i < 200'000; i++) {
+		// any bit pattern, shortest and long round trip
+		uint32_t bits = (uint32_t)random();
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		if (!std::isfinite(value)) {
+			continue;
+		}
+		snprintf(buffer, sizeof(buffer), "%.9g", value);
+		corpus.push_back(buffer);
+		snprintf(buffer, sizeof(buffer), "%.*e", (int)(random() % 30), value);
+		corpus.push_back(buffer);
+		snprintf(buffer, sizeof(buffer), "%a", value);
+		corpus.push_back(buffer);
+
+		// halfway to the next float and a hair either side of it
+		float next = nextafterf(value, INFINITY);
+		if (std::isfinite(next)) {
+			double halfway = ((double)value + next) / 2;
+			snprintf(buffer, sizeof(buffer), "%.60g", halfway);
+			corpus.push_back(buffer);
+			snprintf(buffer, sizeof(buffer), "%.17g", nextafter(halfway, 0.0));
+			corpus.push_back(buffer);
+			snprintf(buffer, sizeof(buffer), "%.17g", nextafter(halfway, INFINITY));
+			corpus.push_back(buffer);
+		}
+
+		// decimal mantissa and exponent picked independently
+		snprintf(buffer, sizeof(buffer), "%llu.%llue%d", (unsigned long long)(random() % 100'000'000),
+				(unsigned long long)random(), (int)(random() % 100) - 60);
+		corpus.push_back(buffer);
+	}
+
+	// the subnormal range on its own
+	for (int i = 0; i < 50'000; i++) {
+		uint32_t bits = (uint32_t)random() & 0x007FFFFF;
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		snprintf(buffer, sizeof(buffer), "%.40e", (double)value + (double)(random() % 3 - 1) * 0x1p-151);
+		corpus.push_back(buffer);
+	}
+}
+
+// calibration style script: tables of small decimals, rpm and pressure values, some scientific notation
+static std::string generateScript(bool withExponents = true) {
+	std::mt19937 random(1977);
+	std::string script;
+	char buffer[64];
+
+	for (int table = 0; table < 200; table++) {
+		script += "local table" + std::to_string(table) + " = { ";
+		for (int i = 0; i < 64; i++) {
+			switch (random() % 5) {
+			case 0:
+				snprintf(buffer, sizeof(buffer), "%d, ", (int)(random() % 8000));
+				break;
+			case 1:
+				snprintf(buffer, sizeof(buffer), "%.1f, ", (random() % 10000) / 10.0);
+				break;
+			case 2:
+				snprintf(buffer, sizeof(buffer), "%.3f, ", (random() % 100000) / 1000.0);
+				break;
+			case 3:
+				snprintf(buffer, sizeof(buffer), withExponents ? "%.2e, " : "%.7f, ", (random() % 10000) * 1e-7);
+				break;
+			default:
+				snprintf(buffer, sizeof(buffer), "%.4f, ", (random() % 10000) / 10000.0);
+				break;
+			}
+			script += buffer;
+		}
+		script += "}\n";
+	}
+
+	return script;
+}
+
+// numerals as llex.c read_numeral() hands them to lua_str2number: digits, dots, letters and an exponent sign
+static std::vector<std::string> lexNumerals(const std::string& script) {
+	std::vector<std::string> numerals;
+
+	for (size_t i = 0; i < script.size(); i++) {
+		char c = script[i];
+		bool startsNumeral = (c >= '0' && c <= '9') && (i == 0 || !isalnum((unsigned char)script[i - 1]));
+		if (!startsNumeral) {
+			continue;
+		}
+
+		size_t end = i;
+		while (end < script.size()) {
+			char n = script[end];
+			bool isExponentSign = (n == '+' || n == '-') && (script[end - 1] | 0x20) == 'e';
+			if (!isalnum((unsigned char)n) && n != '.' && !isExponentSign) {
+				break;
+			}
+			end++;
+		}
+		numerals.push_back(script.substr(i, end - i));
+		i = end;
+	}
+
+	return numerals;
+}
+
+template <typename TParser>
+static double timeParser(const std::vector<std::string>& numerals, TParser parser, float& checksum) {
+	auto start = std::chrono::steady_clock::now();
+
+	for (const auto& numeral : numerals) {
+		char* end;
+		checksum += parser(numeral.c_str(), &end);
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / numerals.size();
+}
+
+// best of many short interleaved runs, so that neither parser gets all the warm caches or all the scheduler noise
+static void compareParseTime(const std::vector<std::string>& numerals, double& newNs, double& legacyNs, float& checksum) {
+	newNs = legacyNs = 1e9;
+	for (int run = 0; run < 200; run++) {
+		newNs = std::min(newNs, timeParser(numerals, strtof_rusefi, checksum));
+		legacyNs = std::min(legacyNs, timeParser(numerals, legacy::strtof_rusefi, checksum));
+	}
+}
+
+int main() {
+	int edgeFailures = 0;
+	for (const char* input : edgeCases) {
+		edgeFailures += !compareWithHost(input);
+	}
+	check(edgeFailures == 0, "edge cases same as host strtof", edgeFailures);
+
+	// endPtr may be null, failure returns zero and leaves the pointer at the input
+	char* end = nullptr;
+	const char* junk = "  abc";
+	float junkValue = strtof_rusefi(junk, &end);
+	check(strtof_rusefi("2.5", nullptr) == 2.5f, "null endPtr", strtof_rusefi("2.5", nullptr));
+	check(junkValue == 0 && end == junk, "no number leaves endPtr at the input", end - junk);
+
+	// just above halfway to the smallest subnormal rounds up. glibc 2.36 strtof drops the sticky bit here
+	// and returns zero, its strtod gets it right
+	float aboveHalfway = strtof_rusefi("0x1.000001p-150", nullptr);
+	check(aboveHalfway == (float)strtod("0x1.000001p-150", nullptr) && aboveHalfway == 0x1p-149f,
+			"hex just above the subnormal halfway", aboveHalfway * 0x1p149);
+
+	std::vector<std::string> corpus;
+	generateCorpus(corpus);
+	int corpusFailures = 0;
+	for (const auto& input : corpus) {
+		corpusFailures += !compareWithHost(input.c_str());
+	}
+	printf("corpus of %d inputs\n", (int)corpus.size());
+	check(corpusFailures == 0, "corpus same as host strtof", corpusFailures);
+
+	std::string script = generateScript();
+	std::vector<std::string> numerals = lexNumerals(script);
+
+	// the old parser was off by an ulp or more on some plain decimals and stopped at the exponent of the rest
+	int legacyInexact = 0;
+	int scriptFailures = 0;
+	for (const auto& numeral : numerals) {
+		float reference = strtof(numeral.c_str(), nullptr);
+		legacyInexact += legacy::strtof_rusefi(numeral.c_str(), nullptr) != reference;
+		scriptFailures += strtof_rusefi(numeral.c_str(), nullptr) != reference;
+	}
+	check(scriptFailures == 0, "script numerals exact", scriptFailures);
+	printf("old parser inexact on %d of %d script numerals\n", legacyInexact, (int)numerals.size());
+
+	float checksum = 0;
+	double newNs;
+	double legacyNs;
+	compareParseTime(numerals, newNs, legacyNs, checksum);
+	printf("script of %d bytes, %d numerals: %.1f ns per numeral, old parser %.1f ns (checksum %f)\n",
+			(int)script.size(), (int)numerals.size(), newNs, legacyNs, checksum);
+	check(newNs <= legacyNs, "script numerals parse time against the old parser", newNs / legacyNs);
+
+#if HOST_LUA
+	// the old parser stops at an exponent and Lua rejects the numeral, so compare on a script without any
+	std::string plainScript = generateScript(/*withExponents*/false);
+	double compileMs = 1e9;
+	double legacyCompileMs = 1e9;
+	for (int run = 0; run < 21; run++) {
+		compileMs = std::min(compileMs, timeLuaCompile(plainScript, strtof_rusefi));
+		legacyCompileMs = std::min(legacyCompileMs, timeLuaCompile(plainScript, legacy::strtof_rusefi));
+	}
+	printf("luaL_loadbuffer of %d bytes: %.3f ms, old parser %.3f ms, with exponents %.3f ms\n",
+			(int)plainScript.size(), compileMs, legacyCompileMs, timeLuaCompile(script, strtof_rusefi));
+	check(compileMs <= legacyCompileMs, "script compile time against the old parser", compileMs / legacyCompileMs);
+#else
+	printf("script compile time not measured, build with LUA_DIR set to the Lua sources\n");
+#endif
+
+	return hostFailures == 0 ? 0 : 1;
+}
+
+#if HOST_LUA
+// Lua core in this translation unit the way onelua.c builds it, with lua_str2number() switchable between
+// the two parsers. Last in the file so that Lua's macros stay out of the code above
+#define LUA_CORE
+#define LUA_LIB
+#define ltable_c
+#define lvm_c
+#include "luaconf.h"
+
+#undef lua_str2number
+static float (*luaStr2number)(const char*, char**);
+#define lua_str2number(s, p) ((lua_Number)luaStr2number((s), (p)))
+
+#undef LUAI_FUNC
+#undef LUAI_DDEC
+#undef LUAI_DDEF
+#define LUAI_FUNC static
+#define LUAI_DDEC(def) /* empty */
+#define LUAI_DDEF static
+
+#include "lzio.c"
+#include "lctype.c"
+#include "lopcodes.c"
+#include "lmem.c"
+#include "lundump.c"
+#include "ldump.c"
+#include "lstate.c"
+#include "lgc.c"
+#include "llex.c"
+#include "lcode.c"
+#include "lparser.c"
+#include "ldebug.c"
+#include "lfunc.c"
+#include "lobject.c"
+#include "ltm.c"
+#include "lstring.c"
+#include "ltable.c"
+#include "ldo.c"
+#include "lvm.c"
+#include "lapi.c"
+#include "lauxlib.c"
+
+static double timeLuaCompile(const std::string& script, float (*parser)(const char*, char**)) {
+	luaStr2number = parser;
+	lua_State* l = luaL_newstate();
+
+	auto start = std::chrono::steady_clock::now();
+	int status = luaL_loadbuffer(l, script.data(), script.size(), "calibration");
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (status != LUA_OK) {
+		check(false, lua_tostring(l, -1), status);
+	}
+
+	lua_close(l);
+	return elapsed.count();
+}
+#endif
@@ -0,0 +1,2 @@
+// host test stand-in, the test defines what it needs
+#pragma once
@@ -0,0 +1,175 @@
+/**
+ * Bare minimum of firmware types and helpers for host tests which include a firmware .cpp directly.
+ * Anything specific to one unit (configuration fields, listener classes...) is defined by its test.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+typedef int64_t efitick_t;
+typedef int64_t efitimeus_t;
+
+// host ticks are microseconds
+#define US2NT(us) ((efitick_t)(us))
+#define NT2US(nt) ((nt) / 1)
+#define MS2NT(ms) US2NT((ms) * 1000)
+
+extern efitick_t hostNowNt;
+inline efitick_t getTimeNowNt() { return hostNowNt; }
+
+#define CAN_IDE_STD 0
+#define CAN_IDE_EXT 1
+#define CAN_RTR_DATA 0
+
+struct CANRxFrame {
+	uint8_t DLC;
+	uint8_t RTR;
+	uint8_t IDE;
+	uint32_t SID;
+	uint32_t EID;
+	union {
+		uint8_t data8[8];
+		uint16_t data16[4];
+		uint32_t data32[2];
+		uint64_t data64[1];
+	};
+};
+
+#define CAN_SID(f) ((f).SID)
+#define CAN_EID(f) ((f).EID)
+#define CAN_ISX(f) ((f).IDE)
+#define CAN_ID(f) (CAN_ISX(f) ? CAN_EID(f) : CAN_SID(f))
+
+namespace chibios_rt {
+struct CriticalSectionLocker {
+	CriticalSectionLocker() { }
+	~CriticalSectionLocker() { }
+};
+}
+
+// single threaded here
+typedef int mutex_t;
+#define MUTEX_DECL(name) mutex_t name
+inline void chMtxLock(mutex_t*) { }
+inline void chMtxUnlock(mutex_t*) { }
+
+struct unexpected_t { };
+static constexpr unexpected_t unexpected{};
+
+template <class TValue>
+struct expected {
+	bool Valid;
+	TValue Value;
+
+	expected(const unexpected_t&) : Valid(false), Value{} { }
+	expected(TValue value) : Valid(true), Value(value) { }
+
+	explicit operator bool() const {
+		return Valid;
+	}
+
+	TValue value_or(TValue valueIfInvalid) const {
+		return Valid ? Value : valueIfInvalid;
+	}
+};
+
+enum class UnexpectedCode : char {
+	Unknown = 0,
+	Timeout,
+	High,
+	Low,
+	Inconsistent,
+	Configuration,
+};
+
+enum obd_code_e {
+	OBD_PCM_Processor_Fault = 6000,
+};
+
+extern int hostFirmwareErrors;
+inline void firmwareError(obd_code_e, const char* format, ...) {
+	hostFirmwareErrors++;
+	printf("firmwareError: %s\n", format);
+}
+
+inline void addConsoleAction(const char*, void (*)()) { }
+
+#define efiPrintf(...) do { printf(__VA_ARGS__); printf("\n"); } while (0)
+
+namespace efi {
+template <typename T, size_t N>
+constexpr size_t size(const T (&)[N]) {
+	return N;
+}
+}
+
+// efilib.h
+inline int minI(int i1, int i2) { return i1 < i2 ? i1 : i2; }
+inline int maxI(int i1, int i2) { return i1 > i2 ? i1 : i2; }
+inline int absI(int value) { return value < 0 ? -value : value; }
+inline float minF(float i1, float i2) { return i1 < i2 ? i1 : i2; }
+inline float maxF(float i1, float i2) { return i1 > i2 ? i1 : i2; }
+inline float absF(float value) { return value < 0 ? -value : value; }
+inline float clampF(float min, float clamp, float max) { return maxF(min, minF(clamp, max)); }
+inline float clampPercentValue(float value) { return clampF(0, value, 100); }
+
+// interpolation.h, linear between the two nearest bins and flat outside the table
+inline float interpolateClamped(float x1, float y1, float x2, float y2, float x) {
+	if (x <= x1) {
+		return y1;
+	}
+	if (x >= x2) {
+		return y2;
+	}
+	return y1 + (y2 - y1) * (x - x1) / (x2 - x1);
+}
+
+template <typename TBin, size_t TSize>
+void findInterpolationBin(const TBin (&bins)[TSize], float value, size_t& index, float& fraction) {
+	value = clampF(bins[0], value, bins[TSize - 1]);
+	index = 0;
+	while (index < TSize - 2 && value >= bins[index + 1]) {
+		index++;
+	}
+	fraction = (value - bins[index]) / (bins[index + 1] - bins[index]);
+}
+
+template <typename TBin, typename TValue, size_t TSize>
+float interpolate2d(float value, const TBin (&bins)[TSize], const TValue (&values)[TSize]) {
+	size_t i;
+	float fraction;
+	findInterpolationBin(bins, value, i, fraction);
+	return values[i] + (values[i + 1] - values[i]) * fraction;
+}
+
+template <typename TValue, size_t TRowNum, size_t TColNum, typename TRowBin, typename TColBin>
+float interpolate3d(const TValue (&table)[TRowNum][TColNum], const TRowBin (&rowBins)[TRowNum], float rowValue,
+		const TColBin (&columnBins)[TColNum], float columnValue) {
+	size_t row, column;
+	float rowFraction, columnFraction;
+	findInterpolationBin(rowBins, rowValue, row, rowFraction);
+	findInterpolationBin(columnBins, columnValue, column, columnFraction);
+
+	float top = table[row][column] + (table[row][column + 1] - table[row][column]) * columnFraction;
+	float bottom = table[row + 1][column] + (table[row + 1][column + 1] - table[row + 1][column]) * columnFraction;
+	return top + (bottom - top) * rowFraction;
+}
+
+#define HOST_TEST_GLOBALS \
+	efitick_t hostNowNt = 0; \
+	int hostFirmwareErrors = 0; \
+	int hostFailures = 0;
+
+/**
+ * Test result helper, prints every check and counts failures for the exit code
+ */
+extern int hostFailures;
+inline void check(bool condition, const char* what, double value) {
+	printf("%s %s: %f\n", condition ? "PASS" : "FAIL", what, value);
+	if (!condition) {
+		hostFailures++;
+	}
+}
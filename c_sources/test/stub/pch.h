@@ -0,0 +1,3 @@
+// Host tests define whatever firmware types the unit under test needs before including its .cpp,
+// so the precompiled header is empty here.
+#pragma once
@@ -0,0 +1,55 @@
+/**
+ * What pid_offline_tune.cpp takes from the firmware pch.h when built on host: MLG layout constants and
+ * the rusEFI Pid, the math helpers come from host_rusefi.h. The Pid here follows Pid::getOutput from
+ * efilib pid.cpp, which is not part of this tree: P + I + D + offset, I term clamped to iTermMin/iTermMax,
+ * sum clamped to pid_s min/max.
+ */
+#pragma once
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+
+#define MLQ_HEADER_SIZE 22
+#define MLQ_FIELD_HEADER_SIZE 55
+
+// same field types as the generated configuration, output limits are whole units
+struct pid_s {
+	float pFactor;
+	float iFactor;
+	float dFactor;
+	int16_t offset;
+	int16_t periodMs;
+	int16_t minValue;
+	int16_t maxValue;
+};
+
+class Pid {
+public:
+	explicit Pid(pid_s* parameters) : m_parameters(parameters) { }
+
+	void reset() {
+		m_iTerm = 0;
+		m_previousError = 0;
+	}
+
+	float getOutput(float target, float input, float dTime) {
+		float error = target - input;
+
+		float pTerm = m_parameters->pFactor * error;
+		m_iTerm = clampF(iTermMin, m_iTerm + m_parameters->iFactor * dTime * error, iTermMax);
+		float dTerm = m_parameters->dFactor / dTime * (error - m_previousError);
+		m_previousError = error;
+
+		float output = pTerm + m_iTerm + dTerm + m_parameters->offset;
+		return clampF(m_parameters->minValue, output, m_parameters->maxValue);
+	}
+
+	float iTermMin = -1000000.0f;
+	float iTermMax = 1000000.0f;
+
+private:
+	const pid_s* m_parameters;
+	float m_iTerm = 0;
+	float m_previousError = 0;
+};
@@ -0,0 +1,2 @@
+// host test stand-in, the test defines the image it streams
+#pragma once
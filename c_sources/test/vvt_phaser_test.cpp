@@ -0,0 +1,446 @@
+// Cam phaser step response through vvt.cpp: the phaser is an integrator behind a lagging oil control valve and
+// its position is only measured on cam edges. The same PID runs from the fixed rate timer and once per cam
+// measurement, at idle and at high rpm, with a 20 and a 50 ms timer. The synchronous mode has to use the time
+// between cam edges as dt, and respond better than the timer once cam edges come faster than timer ticks.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define EFI_UNIT_TEST 1
+#define EFI_AUX_PID 1
+#define EFI_SHAFT_POSITION_INPUT 1
+#define EFI_TUNER_STUDIO 0
+
+HOST_TEST_GLOBALS
+
+#define SCRIPT_TABLE_8 8
+#define CAM_INPUTS_COUNT 1
+#define CAMS_PER_BANK 1
+#define MS_PER_SECOND 1000
+#define PERCENT_TO_DUTY(x) ((x) * 0.01f)
+#define GET_PERIOD_LIMITED(pid) std::max<int>(10, (pid)->periodMs)
+#define UNUSED(x) (void)(x)
+
+typedef float angle_t;
+typedef float percent_t;
+typedef int brain_pin_e;
+
+static bool isBrainPinValid(brain_pin_e pin) { return pin != 0; }
+
+enum class SensorType { Rpm, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+};
+
+static float getFuelingLoad() { return 50; }
+
+struct pid_s {
+	float pFactor;
+	float iFactor;
+	float dFactor;
+	int16_t offset;
+	int16_t periodMs;
+	int16_t minValue;
+	int16_t maxValue;
+};
+
+struct {
+	pid_s auxPid[CAM_INPUTS_COUNT];
+	brain_pin_e vvtPins[CAM_INPUTS_COUNT] = { 1 };
+	int vvtOutputFrequency[CAM_INPUTS_COUNT] = { 300 };
+	bool vvtTriggerSynchronousControl = false;
+	bool invertVvtControlIntake = false;
+	bool invertVvtControlExhaust = false;
+	bool isVerboseAuxPid1 = false;
+	int vvtControlMinRpm = 400;
+	int vvtActivationDelayMs = 0;
+	struct {
+		int rpm = 400;
+	} cranking;
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+struct {
+	int8_t vvtTable1[SCRIPT_TABLE_8][SCRIPT_TABLE_8];
+	int8_t vvtTable2[SCRIPT_TABLE_8][SCRIPT_TABLE_8];
+	uint16_t vvtTable1LoadBins[SCRIPT_TABLE_8];
+	uint16_t vvtTable1RpmBins[SCRIPT_TABLE_8];
+	uint16_t vvtTable2LoadBins[SCRIPT_TABLE_8];
+	uint16_t vvtTable2RpmBins[SCRIPT_TABLE_8];
+} persistentConfig, *config = &persistentConfig;
+
+class LocalVersionHolder {
+public:
+	bool isOld(int globalVersion) {
+		bool isOld = globalVersion > m_localVersion;
+		m_localVersion = globalVersion;
+		return isOld;
+	}
+
+private:
+	int m_localVersion = 0;
+};
+
+// position the cam decoder recorded at the last cam edge
+static float measuredCamPosition;
+
+struct {
+	LocalVersionHolder auxParametersVersion;
+	int globalConfigurationVersion = 0;
+	int getGlobalConfigurationVersion() const { return globalConfigurationVersion; }
+
+	struct {
+		expected<float> getVVTPosition(int, int) const { return measuredCamPosition; }
+	} triggerCentral;
+	struct {
+		float getSecondsSinceEngineStart(efitick_t) const { return 100; }
+	} rpmCalculator;
+	struct { } executor;
+} engineInstance, *engine = &engineInstance;
+
+class ValueProvider3D {
+public:
+	virtual float getValue(float xColumn, float yRow) const = 0;
+};
+
+// the test drives the target directly, table content does not matter
+static float targetPosition;
+
+template <int TColNum, int TRowNum, typename TValue, typename TColumn, typename TRow>
+class Map3D : public ValueProvider3D {
+public:
+	void init(const TValue (&)[TRowNum][TColNum], const TRow (&)[TRowNum], const TColumn (&)[TColNum]) { }
+	float getValue(float, float) const override { return targetPosition; }
+};
+
+/**
+ * Pid::getOutput from efilib pid.cpp, which is not part of this tree: P + I + D + offset with error amplification,
+ * the derivative over the dt it is given, I term and sum clamped
+ */
+class Pid {
+public:
+	void initPidClass(const pid_s* parameters) {
+		m_parameters = parameters;
+		reset();
+	}
+
+	void reset() {
+		m_iTerm = 0;
+		m_previousError = 0;
+	}
+
+	void setErrorAmplification(float coef) { m_errorAmplification = coef; }
+
+	float getOutput(float target, float input, float dTime) {
+		updates++;
+		dTimeSum += dTime;
+
+		float error = (target - input) * m_errorAmplification;
+
+		m_pTerm = m_parameters->pFactor * error;
+		m_iTerm = clampF(-100, m_iTerm + m_parameters->iFactor * dTime * error, 100);
+		m_dTerm = m_parameters->dFactor / dTime * (error - m_previousError);
+		m_previousError = error;
+
+		return clampF(m_parameters->minValue, m_pTerm + m_iTerm + m_dTerm + m_parameters->offset, m_parameters->maxValue);
+	}
+
+	float getP() const { return m_pTerm; }
+	float getI() const { return m_iTerm; }
+	float getD() const { return m_dTerm; }
+	float getIntegration() const { return m_iTerm; }
+
+	// not in the firmware Pid, lets the test see how often and with which dt it ran
+	int updates = 0;
+	float dTimeSum = 0;
+
+private:
+	const pid_s* m_parameters = nullptr;
+	float m_errorAmplification = 1;
+	float m_pTerm = 0;
+	float m_iTerm = 0;
+	float m_dTerm = 0;
+	float m_previousError = 0;
+};
+
+struct SimplePwm {
+	float duty = 0;
+	void setSimplePwmDutyCycle(float dutyCycle) { duty = dutyCycle; }
+};
+
+struct OutputPin {
+	void deInit() { }
+};
+
+template <typename TExecutor>
+static void startSimplePwmExt(SimplePwm*, const char*, TExecutor*, brain_pin_e, OutputPin*, float, float) { }
+
+template <typename TInput, typename TOutput>
+class ClosedLoopController {
+public:
+	void update() {
+		setOutput(getOutput());
+	}
+
+private:
+	expected<TOutput> getOutput() {
+		expected<TInput> setpoint = getSetpoint();
+		if (!setpoint) {
+			return unexpected;
+		}
+
+		expected<TInput> observation = observePlant();
+		if (!observation) {
+			return unexpected;
+		}
+
+		expected<TOutput> openLoop = getOpenLoop(setpoint.Value);
+		expected<TOutput> closedLoop = getClosedLoop(setpoint.Value, observation.Value);
+		if (!openLoop || !closedLoop) {
+			return unexpected;
+		}
+
+		return openLoop.Value + closedLoop.Value;
+	}
+
+	virtual expected<TInput> observePlant() const = 0;
+	virtual expected<TInput> getSetpoint() = 0;
+	virtual expected<TOutput> getOpenLoop(TInput setpoint) = 0;
+	virtual expected<TOutput> getClosedLoop(TInput setpoint, TInput observation) = 0;
+	virtual void setOutput(expected<TOutput> outputValue) = 0;
+};
+
+// members as vvt.h declares them
+class VvtController : public ClosedLoopController<angle_t, percent_t> {
+public:
+	void init(int index, int bankIndex, int camIndex, const ValueProvider3D* targetMap);
+	void start() { }
+	int getPeriodMs();
+	void PeriodicTask();
+	void onCamSample(efitick_t nowNt);
+	void processPendingUpdates();
+
+	expected<angle_t> observePlant() const override;
+	expected<angle_t> getSetpoint() override;
+	expected<percent_t> getOpenLoop(angle_t target) override;
+	expected<percent_t> getClosedLoop(angle_t target, angle_t observation) override;
+	void setOutput(expected<percent_t> outputValue) override;
+
+	SimplePwm m_pwm;
+	OutputPin m_pin;
+
+	int index = 0;
+	int m_bank = 0;
+	int m_cam = 0;
+	Pid m_pid;
+	const ValueProvider3D* m_targetMap = nullptr;
+
+	efitick_t m_lastUpdateNt = 0;
+	bool m_isCamFasterThanTimer = false;
+	efitick_t m_camSampleNt = 0;
+	float m_updatePeriodSeconds = 0;
+	bool m_pidResetPending = false;
+	bool m_camUpdatePending = false;
+	bool m_timedUpdatePending = false;
+};
+
+#include "vvt.cpp"
+
+#define SIM_STEP_US 20
+#define TIMER_PERIOD_MS 20
+#define STEP_TARGET 30
+#define STEP_MS 3000
+
+/**
+ * Oil control valve spool follows the duty with a lag, the phaser moves at a rate proportional to how far the
+ * spool is from its hold position and stops at the ends of its range
+ */
+struct CamPhaser {
+	float spool = 50;
+	float position = 0;
+
+	void step(float dutyPercent, float dt) {
+		spool += (dutyPercent - spool) * dt / 0.015f;
+		position = clampF(0, position + 3 * (spool - 50) * dt, 50);
+	}
+};
+
+struct StepResponse {
+	float iae;
+	float overshoot;
+	float finalError;
+	// dt the PID got on average over the step, and how many updates ran
+	float meanDt;
+	int updates;
+};
+
+static StepResponse runStep(float rpm, int edgesPerCamRevolution, bool isTriggerSynchronous, int timerPeriodMs) {
+	VvtController& vvt = instances[0];
+	engineConfiguration->vvtTriggerSynchronousControl = isTriggerSynchronous;
+	if (edgesPerCamRevolution == 1) {
+		// one measurement per revolution only holds still with soft gains
+		engineConfiguration->auxPid[0] = { 2, 2, 0.05f, 50, (int16_t)timerPeriodMs, 0, 100 };
+	} else {
+		// tight enough that the loop is limited by how old its measurement is rather than by how fast the phaser
+		// moves, soft gains are slew limited and respond the same in both modes
+		engineConfiguration->auxPid[0] = { 6, 6, 0.1f, 50, (int16_t)timerPeriodMs, 0, 100 };
+	}
+	engine->globalConfigurationVersion++;
+	vvt.init(0, 0, 0, &vvtTable1);
+	vvt.m_pid.reset();
+	sensorValues[(int)SensorType::Rpm] = rpm;
+
+	CamPhaser phaser;
+	measuredCamPosition = 0;
+	targetPosition = 0;
+
+	// cam edges evenly spread over the cam revolution, not lined up with the timer
+	efitick_t camPeriodNt = US2NT(120e6 / rpm / edgesPerCamRevolution);
+	efitick_t nextCamNt = hostNowNt + camPeriodNt / 3;
+	efitick_t nextTimerNt = hostNowNt + MS2NT(timerPeriodMs);
+	efitick_t stepNt = hostNowNt + MS2NT(300);
+	efitick_t endNt = stepNt + MS2NT(STEP_MS);
+
+	StepResponse response = {};
+
+	for (; hostNowNt < endNt; hostNowNt += US2NT(SIM_STEP_US)) {
+		if (hostNowNt >= stepNt && targetPosition != STEP_TARGET) {
+			targetPosition = STEP_TARGET;
+			vvt.m_pid.updates = 0;
+			vvt.m_pid.dTimeSum = 0;
+		}
+
+		if (hostNowNt >= nextCamNt) {
+			nextCamNt += camPeriodNt;
+			measuredCamPosition = phaser.position;
+			onVvtCamMeasurement(0, hostNowNt);
+		}
+
+		// the timer keeps running in both modes, in synchronous mode it only steps in when cam edges stop
+		if (hostNowNt >= nextTimerNt) {
+			nextTimerNt += MS2NT(timerPeriodMs);
+			vvt.PeriodicTask();
+		}
+
+		phaser.step(vvt.m_pwm.duty * 100, SIM_STEP_US * 1e-6f);
+
+		if (hostNowNt >= stepNt) {
+			response.iae += fabsf(targetPosition - phaser.position) * SIM_STEP_US * 1e-6f;
+			response.overshoot = std::max(response.overshoot, phaser.position - STEP_TARGET);
+		}
+	}
+
+	response.finalError = fabsf(phaser.position - STEP_TARGET);
+	response.updates = vvt.m_pid.updates;
+	response.meanDt = vvt.m_pid.dTimeSum / vvt.m_pid.updates;
+	return response;
+}
+
+
+/**
+ * @param minIaeGain and minOvershootGain how much better than timer mode cam synchronous mode has to be once cam
+ * edges are faster than the timer
+ */
+static void checkStepResponse(float rpm, int edgesPerCamRevolution, int timerPeriodMs, float minIaeGain = 0,
+		float minOvershootGain = 0) {
+	char what[96];
+	StepResponse timed = runStep(rpm, edgesPerCamRevolution, false, timerPeriodMs);
+	StepResponse synchronous = runStep(rpm, edgesPerCamRevolution, true, timerPeriodMs);
+	float camInterval = 120 / rpm / edgesPerCamRevolution;
+
+	printf("%.0f rpm, %d cam edges per revolution, %d ms timer: timer IAE %.2f overshoot %.2f deg, %d updates;"
+			" cam synchronous IAE %.2f overshoot %.2f deg, %d updates\n", rpm, edgesPerCamRevolution, timerPeriodMs,
+			timed.iae, timed.overshoot, timed.updates, synchronous.iae, synchronous.overshoot, synchronous.updates);
+
+	snprintf(what, sizeof(what), "%.0f rpm %d ms timer mode dt is the task period", rpm, timerPeriodMs);
+	check(fabsf(timed.meanDt - timerPeriodMs / 1000.0f) < 1e-4f, what, timed.meanDt);
+	snprintf(what, sizeof(what), "%.0f rpm %d ms timer mode settles", rpm, timerPeriodMs);
+	check(timed.finalError < 0.5f, what, timed.finalError);
+	snprintf(what, sizeof(what), "%.0f rpm %d ms cam synchronous settles", rpm, timerPeriodMs);
+	check(synchronous.finalError < 0.5f, what, synchronous.finalError);
+
+	if (camInterval * 1000 > timerPeriodMs) {
+		// cam slower than the timer: holding the output for a whole cam interval is worse, timer keeps the loop
+		snprintf(what, sizeof(what), "%.0f rpm slow cam runs from the timer", rpm);
+		check(synchronous.updates == timed.updates && fabsf(synchronous.meanDt - timed.meanDt) < 1e-4f, what,
+				synchronous.updates);
+		snprintf(what, sizeof(what), "%.0f rpm slow cam responds as timer mode", rpm);
+		check(fabsf(synchronous.iae / timed.iae - 1) < 0.01f, what, synchronous.iae / timed.iae);
+		return;
+	}
+
+	snprintf(what, sizeof(what), "%.0f rpm %d ms one update per cam edge", rpm, timerPeriodMs);
+	check(abs(synchronous.updates - (int)(STEP_MS / 1000.0f / camInterval)) <= 1, what, synchronous.updates);
+	snprintf(what, sizeof(what), "%.0f rpm %d ms cam synchronous dt is the cam edge interval", rpm, timerPeriodMs);
+	check(fabsf(synchronous.meanDt / camInterval - 1) < 0.01f, what, synchronous.meanDt);
+
+	// every measurement used as soon as it is there: better than the timer acting on a position up to a tick old
+	snprintf(what, sizeof(what), "%.0f rpm %d ms cam synchronous IAE against timer", rpm, timerPeriodMs);
+	check(synchronous.iae < (1 - minIaeGain) * timed.iae, what, synchronous.iae / timed.iae);
+	snprintf(what, sizeof(what), "%.0f rpm %d ms cam synchronous overshoot against timer", rpm, timerPeriodMs);
+	check(synchronous.overshoot < (1 - minOvershootGain) * timed.overshoot, what,
+			synchronous.overshoot / timed.overshoot);
+}
+
+// timer ticks only run the loop while cam edges are slower than the timer or stopped
+static void checkTimerUpdates() {
+	VvtController& vvt = instances[0];
+	engineConfiguration->vvtTriggerSynchronousControl = true;
+	engineConfiguration->auxPid[0].periodMs = TIMER_PERIOD_MS;
+
+	// cam edges faster than the timer: every update is a cam update with the edge interval as dt
+	vvt.m_pid.updates = 0;
+	for (int i = 0; i < 20; i++) {
+		hostNowNt += MS2NT(5);
+		onVvtCamMeasurement(0, hostNowNt);
+		if (i % 4 == 3) {
+			vvt.PeriodicTask();
+		}
+	}
+	check(vvt.m_pid.updates == 20, "no timer updates while cam edges are faster", vvt.m_pid.updates);
+	check(fabsf(vvt.m_updatePeriodSeconds - 0.005f) < 1e-5f, "cam update dt", vvt.m_updatePeriodSeconds);
+
+	// cam edges stop, engine stalled: timer drives the loop once the last edge is a period old
+	vvt.m_pid.updates = 0;
+	for (int i = 0; i < 10; i++) {
+		hostNowNt += MS2NT(TIMER_PERIOD_MS);
+		vvt.PeriodicTask();
+	}
+	check(vvt.m_pid.updates == 9, "timer takes over once cam edges stop", vvt.m_pid.updates);
+	check(fabsf(vvt.m_updatePeriodSeconds - TIMER_PERIOD_MS / 1000.0f) < 1e-5f, "timed update dt",
+			vvt.m_updatePeriodSeconds);
+
+	// configuration change: timer posts the PID reset, the VVT thread applies it before the update
+	targetPosition = STEP_TARGET;
+	measuredCamPosition = 0;
+	hostNowNt += MS2NT(TIMER_PERIOD_MS);
+	vvt.PeriodicTask();
+	check(vvt.m_pid.getIntegration() > 0, "integrator wound up", vvt.m_pid.getIntegration());
+	measuredCamPosition = STEP_TARGET;
+	engine->globalConfigurationVersion++;
+	hostNowNt += MS2NT(TIMER_PERIOD_MS);
+	vvt.PeriodicTask();
+	check(vvt.m_pid.getIntegration() == 0, "configuration change resets the PID", vvt.m_pid.getIntegration());
+}
+
+int main() {
+	// one cam edge per revolution, slower than the timer at idle and at 2000 rpm
+	checkStepResponse(800, 1, TIMER_PERIOD_MS);
+	checkStepResponse(2000, 1, TIMER_PERIOD_MS);
+	// four edge cam, two to four measurements per 20 ms timer period
+	checkStepResponse(3000, 4, TIMER_PERIOD_MS);
+	checkStepResponse(6000, 4, TIMER_PERIOD_MS);
+	// five to ten measurements per 50 ms timer period, the timer acts on a much older position
+	checkStepResponse(3000, 4, 50, 0.05f, 0.15f);
+	checkStepResponse(6000, 4, 50, 0.05f, 0.15f);
+
+	checkTimerUpdates();
+
+	return hostFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+// wall_fuel.cpp against the closed form of the Aquino film model: a tip-in at constant rpm has to follow the
+// geometric solution event by event, a film left alone through fuel cut has to decay as exp(-t / tau) whatever
+// the injection intervals, and through an rpm ramp the cylinder has to get exactly the fuel asked for from a film
+// which decays in continuous time.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define EFI_TUNER_STUDIO 0
+
+HOST_TEST_GLOBALS
+
+static bool cisnan(float value) { return std::isnan(value); }
+
+/**
+ * expf_taylor() from efilib.cpp, which is not part of this tree: four terms around -1, flat below -2
+ */
+static float expf_taylor(float x) {
+	if (x < -2) {
+		return 0.818f;
+	} else if (x > 0) {
+		return 1;
+	}
+
+	x = x + 1;
+
+	float xPower = x;
+	int fac = 1;
+	float sum = 1;
+
+	for (int i = 1; i <= 4; i++) {
+		fac *= i;
+		sum += xPower / fac;
+		xPower *= x;
+	}
+
+	return sum / 2.71828182845904523536f;
+}
+
+enum class SensorType { Rpm, Clt, Map, Count };
+
+static float sensorValues[(int)SensorType::Count];
+
+struct Sensor {
+	static expected<float> get(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static float getOrZero(SensorType type) {
+		return sensorValues[(int)type];
+	}
+
+	static bool hasSensor(SensorType) {
+		return true;
+	}
+};
+
+enum class PE { WallFuelAdjust };
+
+struct ScopePerf {
+	explicit ScopePerf(PE) { }
+};
+
+struct {
+	bool complexWallModel = false;
+	bool wwUseTables = false;
+	float wwaeTau = 0.3f;
+	float wwaeBeta = 0.4f;
+	float wwCltBins[8];
+	float wwTauCltValues[8];
+	float wwBetaCltValues[8];
+	float wwMapBins[8];
+	float wwTauMapValues[8];
+	float wwBetaMapValues[8];
+} engineConfigurationInstance, *engineConfiguration = &engineConfigurationInstance;
+
+struct {
+	float wwTauTable[8][8];
+	float wwBetaTable[8][8];
+} persistentConfig, *config = &persistentConfig;
+
+class Timer {
+public:
+	void reset(efitick_t nowNt) { m_lastResetNt = nowNt; }
+	float getElapsedSeconds(efitick_t nowNt) const { return NT2US(nowNt - m_lastResetNt) * 1e-6f; }
+
+private:
+	efitick_t m_lastResetNt = 0;
+};
+
+// members as wall_fuel.h declares them
+class WallFuelController {
+public:
+	void onFastCallback();
+
+	bool getEnable() const { return m_enable; }
+	float getAlpha() const { return m_alpha; }
+	float getAlpha(float secondsOnWall) const;
+	float getBeta() const { return m_beta; }
+
+private:
+	float computeTau() const;
+	float computeBeta() const;
+
+	bool m_enable = false;
+	float m_alpha = 0;
+	float m_beta = 0;
+	float m_tau = 0;
+};
+
+class WallFuel {
+public:
+	float adjust(float desiredMassGrams);
+	float adjust(float desiredMassGrams, efitick_t nowNt);
+	float getWallFuel() const;
+	void resetWF();
+
+	int invocationCounter = 0;
+	float wallFuelCorrection = 0;
+
+private:
+	float wallFuel = 0;
+	Timer m_lastInjection;
+	bool m_hasLastInjection = false;
+};
+
+struct {
+	struct {
+		bool isCranking() const { return false; }
+	} rpmCalculator;
+	WallFuelController wallFuelController;
+
+	template <typename T>
+	T* module() { return &wallFuelController; }
+} engineInstance, *engine = &engineInstance;
+
+#include "wall_fuel.cpp"
+
+#define TAU 0.3f
+#define BETA 0.4f
+
+static WallFuelController& controller = engine->wallFuelController;
+
+static void setRpm(float rpm) {
+	sensorValues[(int)SensorType::Rpm] = rpm;
+	controller.onFastCallback();
+}
+
+/**
+ * Port with the same film physics in continuous time: what is left after 'seconds' on the wall is exp(-t / tau),
+ * a fraction beta of every injection lands on the wall. Returns the fuel which reached the cylinder.
+ */
+struct FilmPort {
+	double film = 0;
+
+	double inject(double commanded, double secondsSinceLast) {
+		double alpha = exp(-secondsSinceLast / TAU);
+		double toCylinder = (1 - BETA) * commanded + (1 - alpha) * film;
+		film = alpha * film + BETA * commanded;
+		return toCylinder;
+	}
+};
+
+// constant rpm, desired fuel steps from 20 to 30 mg: M_k and film F_k follow the closed form
+static void checkTipIn() {
+	setRpm(2000);
+	double cycle = 120.0 / 2000;
+	// every event but the first sees its own interval
+	float alpha = controller.getAlpha(cycle);
+	float beta = controller.getBeta();
+
+	WallFuel wallFuel;
+	efitick_t nowNt = 1;
+	for (int i = 0; i < 200; i++) {
+		wallFuel.adjust(0.020f, nowNt);
+		nowNt += US2NT(cycle * 1e6);
+	}
+	double steadyFilm = beta * 0.020 / (1 - alpha);
+	check(fabs(wallFuel.getWallFuel() / steadyFilm - 1) < 1e-4, "steady film beta M / (1 - alpha)", wallFuel.getWallFuel());
+
+	// F_k+1 = r F_k + beta d / (1 - beta), r = (alpha - beta) / (1 - beta)
+	double r = (alpha - beta) / (1 - beta);
+	double newSteadyFilm = beta * 0.030 / (1 - alpha);
+	double worst = 0;
+	for (int k = 0; k < 40; k++) {
+		double film = newSteadyFilm + (steadyFilm - newSteadyFilm) * pow(r, k);
+		double expected = (0.030 - (1 - alpha) * film) / (1 - beta);
+		double commanded = wallFuel.adjust(0.030f, nowNt);
+		nowNt += US2NT(cycle * 1e6);
+		worst = std::max(worst, fabs(commanded - expected) / expected);
+	}
+	check(worst < 1e-4, "tip-in follows the closed form", worst);
+
+	float firstPulse = (0.030f - (1 - alpha) * steadyFilm) / (1 - beta);
+	printf("tip-in 20 -> 30 mg at 2000 rpm: alpha %.4f beta %.2f, first pulse %.2f mg\n", alpha, beta, firstPulse * 1000);
+}
+
+// retention for any time on the wall is exp(-t / tau), there is no nominal shortcut to fall off of
+static void checkRetention() {
+	setRpm(3000);
+
+	double worst = 0;
+	for (float seconds = 0; seconds < 12 * TAU; seconds += 0.0007f) {
+		worst = std::max(worst, (double)fabsf(controller.getAlpha(seconds) - expf(-seconds / TAU)));
+	}
+	check(worst < 5e-4, "retention within 5e-4 of exp(-t / tau)", worst);
+	check(controller.getAlpha(0) == 1, "no time on the wall retains everything", controller.getAlpha(0));
+	check(controller.getAlpha(10 * TAU) == 0, "nothing left past ten tau", controller.getAlpha(10 * TAU));
+}
+
+// fuel cut: no fuel asked for, the film only decays. Retained film depends on time alone, not on how it is split up
+static void checkFuelCutDecay() {
+	setRpm(3000);
+
+	for (float gapTaus : { 0.2f, 0.5f, 1.0f, 3.0f, 6.0f, 9.0f }) {
+		WallFuel wallFuel;
+		efitick_t nowNt = 1;
+		for (int i = 0; i < 200; i++) {
+			wallFuel.adjust(0.020f, nowNt);
+			nowNt += MS2NT(40);
+		}
+		float filmBefore = wallFuel.getWallFuel();
+
+		// first event after the gap: desired zero, commanded clamps to zero, film has decayed over the whole gap
+		nowNt += US2NT(gapTaus * TAU * 1e6) - MS2NT(40);
+		wallFuel.adjust(0, nowNt);
+		float retained = wallFuel.getWallFuel() / filmBefore;
+
+		char what[96];
+		snprintf(what, sizeof(what), "film retained after %.1f tau of fuel cut", gapTaus);
+		check(fabsf(retained - expf(-gapTaus)) < 2e-3f, what, retained);
+	}
+}
+
+// rpm ramp with irregular intervals: fuel reaching the cylinder from a continuous time film is what was asked for
+static void checkRpmRamp() {
+	WallFuel wallFuel;
+	FilmPort port;
+	efitick_t nowNt = 1;
+	double lastInjectionSeconds = 0;
+	bool isFirst = true;
+	double worst = 0;
+	double sum = 0;
+	int events = 0;
+
+	for (double t = 0; t < 6; ) {
+		float rpm = t < 1 ? 1500 : t < 3 ? 1500 + 2500 * (t - 1) : 6500 - 2000 * (t - 3);
+		rpm = std::max(rpm, 1000.0f);
+		// nominal alpha follows the rpm, as the 5 ms fast callback does
+		setRpm(rpm);
+
+		float desired = t < 2 ? 0.015f : 0.035f;
+		double sinceLast = t - lastInjectionSeconds;
+		lastInjectionSeconds = t;
+		nowNt = 1 + US2NT(t * 1e6);
+		float commanded = wallFuel.adjust(desired, nowNt);
+		// first event after a reset uses the nominal cycle, so does the port
+		double toCylinder = port.inject(commanded, isFirst ? 120 / rpm : sinceLast);
+		isFirst = false;
+
+		if (t > 0.5) {
+			double error = fabs(toCylinder / desired - 1);
+			worst = std::max(worst, error);
+			sum += error;
+			events++;
+		}
+
+		// one injection per cycle with some jitter, as a changing rpm gives
+		t += 120 / rpm * (1 + 0.08 * sin(t * 37));
+	}
+
+	printf("rpm ramp: %d events, cylinder fuel error mean %.3f%% worst %.3f%%\n", events, 100 * sum / events, 100 * worst);
+	check(worst < 0.002, "cylinder gets the fuel asked for through the ramp", worst);
+}
+
+int main() {
+	checkRetention();
+	checkTipIn();
+	checkFuelCutDecay();
+	checkRpmRamp();
+
+	return hostFailures == 0 ? 0 : 1;
+}
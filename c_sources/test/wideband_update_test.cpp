@@ -0,0 +1,477 @@
+// Loopback of the wideband firmware update: rusefi_wideband.cpp on the ECU side streams an image over a simulated
+// 500 kbit/s bus to one or more copies of the real bootloader.cpp, each running its own RunBootloaderLoop on a
+// thread driven in lockstep with simulated time. Every controller has to end up with the exact image, through the
+// windowed transfer with lost data frames and acks, through the ack per frame fallback, and the transfer time of
+// each is printed.
+
+#include "host_rusefi.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define EFI_WIDEBAND_FIRMWARE_UPDATE 1
+#define EFI_CAN_SUPPORT 1
+
+HOST_TEST_GLOBALS
+
+// bus and bootloader timing
+#define FRAME_BIT_US 2
+#define FLASH_WRITE_US_PER_BYTE 25
+#define FLASH_PAGE_ERASE_US 20000
+
+// not a whole number of cumulative ack intervals, so the tail is only confirmed by a progress query
+#define IMAGE_SIZE (25600 - 16)
+
+uint8_t build_wideband_image_bin[IMAGE_SIZE];
+
+uint32_t crc32(const uint8_t* buf, uint32_t size) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < size; i++) {
+		crc ^= buf[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+/**
+ * One bootloader on the bus, its loop runs on its own thread but only ever while the bus hands it a frame
+ */
+struct SimController {
+	const char* name;
+	void (*threadFunction)(void*);
+	uintptr_t* appFlashAddr;
+	uint32_t* uid;
+
+	// configuration of the scenario
+	bool isPresent = false;
+	// bootloader from before windowed transfer, never sees opcodes 6 and 7
+	bool isLegacy = false;
+	int dropDataFrameIndex = -1;
+	int dropAckNumber = -1;
+
+	uint8_t image[26 * 1024];
+	efitick_t busyUntil = 0;
+	// time of the bootloader while it handles a frame
+	efitick_t clock = 0;
+	int ackCount = 0;
+
+	// lockstep handoff with the controller thread
+	enum { Starting, Waiting, Processing, Done } state = Starting;
+	CANRxFrame inbox;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::thread thread;
+};
+
+static thread_local SimController* currentController = nullptr;
+
+struct PendingFrame {
+	efitick_t readyAt;
+	CANRxFrame frame;
+	// nullptr for the ECU
+	SimController* sender;
+};
+
+static std::vector<PendingFrame> pendingFrames;
+static efitick_t busFreeAt = 0;
+
+// extended frame with stuffing and interframe space
+static efitick_t frameTimeUs(uint8_t dlc) {
+	return (70 + 8 * dlc) * 115 / 100 * FRAME_BIT_US;
+}
+
+// ECU side ChibiOS and CAN TX
+
+typedef int thread_t;
+typedef uint32_t eventmask_t;
+#define EVENT_MASK(n) ((eventmask_t)1 << (n))
+#define TIME_MS2I(ms) (ms)
+
+static thread_t ecuThread;
+static bool isEcuEventPending = false;
+
+static thread_t* chThdGetSelfX() { return &ecuThread; }
+static void chEvtSignal(thread_t*, eventmask_t) { isEcuEventPending = true; }
+
+static eventmask_t chEvtGetAndClearEvents(eventmask_t mask) {
+	eventmask_t result = isEcuEventPending ? mask : 0;
+	isEcuEventPending = false;
+	return result;
+}
+
+enum class CanCategory { WBO_SERVICE };
+
+class CanTxMessage {
+public:
+	CanTxMessage(CanCategory, uint32_t eid, uint8_t dlc, bool isExtended) {
+		memset(&m_frame, 0, sizeof(m_frame));
+		m_frame.IDE = isExtended ? CAN_IDE_EXT : CAN_IDE_STD;
+		m_frame.EID = eid;
+		m_frame.DLC = dlc;
+	}
+
+	~CanTxMessage() {
+		pendingFrames.push_back({ hostNowNt, m_frame, nullptr });
+	}
+
+	uint8_t& operator[](size_t index) {
+		return m_frame.data8[index];
+	}
+
+private:
+	CANRxFrame m_frame;
+};
+
+// transfer time as reported by the update
+static float lastTransferSeconds;
+
+class Timer {
+public:
+	void reset() { m_start = hostNowNt; }
+
+	float getElapsedSeconds() const {
+		lastTransferSeconds = (hostNowNt - m_start) * 1e-6f;
+		return lastTransferSeconds;
+	}
+
+private:
+	efitick_t m_start = 0;
+};
+
+enum class SensorType { BatteryVoltage };
+struct Sensor {
+	static float getOrZero(SensorType) { return 14; }
+};
+
+struct {
+	struct {
+		bool getLogicValue() const { return true; }
+	} o2heater;
+} enginePins;
+
+// bootloader side ChibiOS, HAL and flash
+
+typedef int msg_t;
+typedef uint16_t flashdata_t;
+typedef CANRxFrame CANTxFrame;
+
+#define MSG_OK 0
+#define CAN_ANY_MAILBOX 0
+#define TIME_INFINITE -1
+
+static int CAND1;
+static int canConfig500;
+
+static void canStart(int*, int*) { }
+#define halInit()
+#define chSysInit()
+#define chSysDisable()
+#define rccDisableCAN1()
+#define chThdCreateStatic(...)
+#define palSetPadMode(...)
+#define palTogglePad(...)
+#define THD_WORKING_AREA(name, size) uint8_t name[size]
+#define THD_FUNCTION(name, arg) void name(void* arg)
+
+msg_t canReceiveTimeout(int*, int, CANRxFrame* frame, int) {
+	auto c = currentController;
+	std::unique_lock<std::mutex> lock(c->mutex);
+	c->state = SimController::Waiting;
+	c->cv.notify_all();
+	c->cv.wait(lock, [c] { return c->state == SimController::Processing; });
+	*frame = c->inbox;
+	return MSG_OK;
+}
+
+msg_t canTransmitTimeout(int*, int, const CANTxFrame* frame, int) {
+	auto c = currentController;
+	if (c->ackCount++ == c->dropAckNumber) {
+		return MSG_OK;
+	}
+	pendingFrames.push_back({ c->clock, *frame, c });
+	return MSG_OK;
+}
+
+struct Flash {
+	static void Write(uintptr_t address, const uint8_t* data, size_t size) {
+		memcpy(reinterpret_cast<uint8_t*>(address), data, size);
+		currentController->clock += size * FLASH_WRITE_US_PER_BYTE;
+	}
+
+	static void ErasePage(size_t) {
+		auto c = currentController;
+		memset(c->image, 0xFF, sizeof(c->image));
+		c->clock += FLASH_PAGE_ERASE_US;
+	}
+};
+
+void chThdSleepMilliseconds(int ms);
+static eventmask_t chEvtWaitAnyTimeout(eventmask_t mask, int timeoutMs);
+
+// same bootloader on every controller, each copy with its own state and chip UID
+#define main bootloaderMain
+// boot_app() and isAppValid() work on the linker placed app flash, neither is called here
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+#pragma GCC diagnostic ignored "-Warray-bounds"
+
+namespace wbo0 {
+uint32_t hostUid[3];
+#define UID_BASE ((uintptr_t)hostUid)
+#include "bootloader.cpp"
+#undef UID_BASE
+}
+
+namespace wbo1 {
+uint32_t hostUid[3];
+#define UID_BASE ((uintptr_t)hostUid)
+#include "bootloader.cpp"
+#undef UID_BASE
+}
+
+namespace wbo2 {
+uint32_t hostUid[3];
+#define UID_BASE ((uintptr_t)hostUid)
+#include "bootloader.cpp"
+#undef UID_BASE
+}
+
+#undef main
+
+#define SIM_BOOTLOADER_LINKER_SYMBOLS(ns) \
+	uint32_t ns::__appflash_start__[64]; \
+	uint32_t ns::__appflash_size__; \
+	uint32_t ns::__ram_vectors_start__[64]; \
+	uint32_t ns::__ram_vectors_size__; \
+	uint32_t ns::crc32(const uint8_t* buf, uint32_t size) { return ::crc32(buf, size); }
+
+SIM_BOOTLOADER_LINKER_SYMBOLS(wbo0)
+SIM_BOOTLOADER_LINKER_SYMBOLS(wbo1)
+SIM_BOOTLOADER_LINKER_SYMBOLS(wbo2)
+
+static SimController controllers[] = {
+	{ "wbo0", wbo0::BootloaderThread, &wbo0::appFlashAddr, wbo0::hostUid },
+	{ "wbo1", wbo1::BootloaderThread, &wbo1::appFlashAddr, wbo1::hostUid },
+	{ "wbo2", wbo2::BootloaderThread, &wbo2::appFlashAddr, wbo2::hostUid },
+};
+
+#include "rusefi_wideband.cpp"
+
+static void waitForController(SimController& c, std::unique_lock<std::mutex>& lock) {
+	c.cv.wait(lock, [&c] { return c.state == SimController::Waiting || c.state == SimController::Done; });
+}
+
+static void startController(SimController& c) {
+	c.state = SimController::Starting;
+	c.busyUntil = 0;
+	c.ackCount = 0;
+	*c.appFlashAddr = reinterpret_cast<uintptr_t>(c.image);
+	memset(c.image, 0xFF, sizeof(c.image));
+
+	c.thread = std::thread([&c] {
+		currentController = &c;
+		c.threadFunction(nullptr);
+
+		std::lock_guard<std::mutex> lock(c.mutex);
+		c.state = SimController::Done;
+		c.cv.notify_all();
+	});
+
+	std::unique_lock<std::mutex> lock(c.mutex);
+	waitForController(c, lock);
+}
+
+static void controllerReceive(SimController& c, const CANRxFrame& frame, efitick_t arrivedAt) {
+	uint8_t opcode = (CAN_EID(frame) >> 16) & 0x0F;
+	bool isBootloaderFrame = CAN_ISX(frame) && (CAN_EID(frame) >> 20) == 0x0EF;
+
+	if (isBootloaderFrame && c.isLegacy && (opcode == 6 || opcode == 7)) {
+		return;
+	}
+
+	if (isBootloaderFrame && opcode == 6 && (int)(CAN_EID(frame) & 0xFFFF) == c.dropDataFrameIndex) {
+		// missed once, the retransmission gets through
+		c.dropDataFrameIndex = -1;
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(c.mutex);
+	if (c.state != SimController::Waiting) {
+		return;
+	}
+
+	c.clock = std::max(arrivedAt, c.busyUntil);
+	c.inbox = frame;
+	c.state = SimController::Processing;
+	c.cv.notify_all();
+	waitForController(c, lock);
+	c.busyUntil = c.clock;
+}
+
+/**
+ * Puts the next frame on the bus if it completes by the deadline, lowest ID wins arbitration among ready frames
+ */
+static bool deliverNextFrame(efitick_t deadline) {
+	if (pendingFrames.empty()) {
+		return false;
+	}
+
+	auto next = pendingFrames.begin();
+	for (auto it = pendingFrames.begin(); it != pendingFrames.end(); ++it) {
+		efitick_t start = std::max(it->readyAt, busFreeAt);
+		efitick_t nextStart = std::max(next->readyAt, busFreeAt);
+		if (start < nextStart || (start == nextStart && CAN_EID(it->frame) < CAN_EID(next->frame))) {
+			next = it;
+		}
+	}
+
+	efitick_t end = std::max(next->readyAt, busFreeAt) + frameTimeUs(next->frame.DLC);
+	if (end > deadline) {
+		return false;
+	}
+
+	PendingFrame frame = *next;
+	pendingFrames.erase(next);
+	busFreeAt = end;
+	hostNowNt = std::max(hostNowNt, end);
+
+	for (auto& c : controllers) {
+		if (c.isPresent && &c != frame.sender) {
+			controllerReceive(c, frame.frame, end);
+		}
+	}
+
+	if (frame.sender && isWidebandBootloaderAck(frame.frame)) {
+		handleWidebandBootloaderAck(frame.frame);
+	}
+
+	return true;
+}
+
+static eventmask_t chEvtWaitAnyTimeout(eventmask_t mask, int timeoutMs) {
+	efitick_t deadline = hostNowNt + MS2NT(timeoutMs);
+
+	while (!isEcuEventPending) {
+		if (!deliverNextFrame(deadline)) {
+			hostNowNt = deadline;
+			return 0;
+		}
+	}
+
+	isEcuEventPending = false;
+	return mask;
+}
+
+void chThdSleepMilliseconds(int ms) {
+	if (currentController) {
+		currentController->clock += MS2NT(ms);
+		return;
+	}
+
+	efitick_t deadline = hostNowNt + MS2NT(ms);
+	while (deliverNextFrame(deadline)) {
+	}
+	hostNowNt = deadline;
+}
+
+/**
+ * Runs a whole update against the present controllers, true if every one of them got the exact image and booted it
+ */
+static bool runUpdate(const char* scenario) {
+	printf("== %s\n", scenario);
+
+	pendingFrames.clear();
+	busFreeAt = hostNowNt;
+
+	for (auto& c : controllers) {
+		if (c.isPresent) {
+			startController(c);
+		}
+	}
+
+	efitick_t startNt = hostNowNt;
+	updateWidebandFirmware();
+	// let the reboot ack out
+	chThdSleepMilliseconds(200);
+
+	bool isOk = true;
+	for (auto& c : controllers) {
+		if (!c.isPresent) {
+			continue;
+		}
+
+		bool isBooted;
+		{
+			std::lock_guard<std::mutex> lock(c.mutex);
+			isBooted = c.state == SimController::Done;
+		}
+
+		bool isImageOk = memcmp(c.image, build_wideband_image_bin, IMAGE_SIZE) == 0;
+		isOk = isOk && isBooted && isImageOk;
+
+		if (!isBooted) {
+			// stuck waiting for a frame which will never come, boot it by hand to end its thread
+			CANRxFrame frame = {};
+			frame.IDE = CAN_IDE_EXT;
+			frame.EID = 0xEF0'0000;
+			controllerReceive(c, frame, hostNowNt);
+			frame.EID = 0xEF3'0000;
+			controllerReceive(c, frame, hostNowNt);
+		}
+		c.thread.join();
+	}
+
+	printf("%s: image sent in %.2f s, whole update %.2f s\n", scenario, lastTransferSeconds, (hostNowNt - startNt) * 1e-6);
+	return isOk;
+}
+
+static void setScenario(int count, bool isLegacy) {
+	for (int i = 0; i < (int)efi::size(controllers); i++) {
+		auto& c = controllers[i];
+		c.isPresent = i < count;
+		c.isLegacy = isLegacy;
+		c.dropDataFrameIndex = -1;
+		c.dropAckNumber = -1;
+	}
+}
+
+int main() {
+	for (size_t i = 0; i < IMAGE_SIZE; i++) {
+		build_wideband_image_bin[i] = (i * 2654435761u) >> 24;
+	}
+
+	for (size_t i = 0; i < efi::size(controllers); i++) {
+		controllers[i].uid[0] = 0x00470031 + i * 0x01010101;
+		controllers[i].uid[1] = 0x31365111 + i * 0x00100000;
+		controllers[i].uid[2] = 0x20383843 ^ (i * 0x5A5A);
+	}
+
+	check(wbo0::getControllerTag() != wbo1::getControllerTag() && wbo1::getControllerTag() != wbo2::getControllerTag()
+			&& wbo0::getControllerTag() != wbo2::getControllerTag(), "controllers answer with different ack tags", 0);
+
+	setScenario(1, true);
+	check(runUpdate("one old bootloader, ack per frame"), "ack per frame image written and booted", 0);
+	float legacySeconds = lastTransferSeconds;
+
+	setScenario(1, false);
+	check(runUpdate("one bootloader, windowed"), "windowed image written and booted", 0);
+	float windowedSeconds = lastTransferSeconds;
+
+	setScenario(3, false);
+	// one controller misses a data frame and one of its cumulative acks
+	controllers[1].dropDataFrameIndex = 1000;
+	controllers[1].dropAckNumber = 300;
+	check(runUpdate("three bootloaders, windowed, lost frames"), "parallel images written and booted", 0);
+	float parallelSeconds = lastTransferSeconds;
+
+	printf("windowed transfer %.2fx faster than ack per frame\n", legacySeconds / windowedSeconds);
+	check(windowedSeconds < legacySeconds / 1.3f, "windowed transfer faster than ack per frame, s", windowedSeconds);
+	// data frames are shared, only the acks of each controller add bus time
+	check(parallelSeconds < windowedSeconds * 1.5f, "three controllers in one pass, s", parallelSeconds);
+
+	return hostFailures == 0 ? 0 : 1;
+}
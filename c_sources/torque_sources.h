@@ -0,0 +1,12 @@
+/**
+ * @file torque_sources.h
+ *
+ * Torque other controllers put on or take off the crank, read by the idle air model and spark logic
+ */
+
+#pragma once
+
+// duty currently commanded to the alternator field, see alternator_controller.cpp
+percent_t getAlternatorDuty();
+// timing pulled through the inertia phase of an upshift, see tcu.cpp
+angle_t getTransmissionTimingRetard();
@@ -26,6 +26,7 @@
 #include "status_loop.h"
 #include "engine_sniffer.h"
 #include "auto_generated_sync_edge.h"
+#include "cam_listeners.h"
 
 #if EFI_TUNER_STUDIO
 #include "tunerstudio.h"
@@ -385,6 +386,14 @@ void hwHandleVvtCamSignal(TriggerValue front, efitick_t nowNt, int index) {
 	// Only record VVT position if we have full engine sync - may be bogus before that point
 	if (tc->triggerState.hasSynchronizedPhase()) {
 		tc->vvtPosition[bankIndex][camIndex] = vvtPosition;
+
+#if EFI_AUX_PID
+		onVvtCamMeasurement(index, nowNt);
+#endif // EFI_AUX_PID
+
+#if EFI_HPFP
+		onHpfpCamUpdate(nowNt);
+#endif // EFI_HPFP
 	} else {
 		tc->vvtPosition[bankIndex][camIndex] = 0;
 	}
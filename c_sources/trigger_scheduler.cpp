@@ -72,6 +72,29 @@ bool TriggerScheduler::scheduleOrQueue(AngleBasedEventOld *event,
 	}
 }
 
+/**
+ * Moves an event which is still waiting in the angle based queue to a new angle. Events which were already
+ * handed over to the time based executor, or are being handed over right now, are left where they are.
+ *
+ * @return true if the event was still queued and got moved
+ */
+bool TriggerScheduler::moveQueuedEvent(AngleBasedEventOld *event, angle_t angle) {
+	chibios_rt::CriticalSectionLocker csl;
+
+	// plain search, being in the list is expected here and not worth a warning
+	// while scheduleEventsUntilNextTriggerTooth works on its detached copy, nothing is found here
+	AngleBasedEventBase *current;
+	LL_FOREACH2(m_angleBasedEventsHead, current, nextToothEvent)
+	{
+		if (current == event) {
+			event->position.setAngle(angle);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 bool TriggerScheduler::scheduleOrQueue(AngleBasedEventNew *event,
 		uint32_t trgEventIndex,
 		efitick_t edgeTimestamp,
@@ -9,9 +9,13 @@
 
 #include "local_version_holder.h"
 #include "vvt.h"
+#include "cam_listeners.h"
 
 #define NO_PIN_PERIOD 500
 
+// longest dt the I and D terms see, the first update after the loop sat idle would otherwise integrate all of it
+#define VVT_UPDATE_MAX_DT_MS 100
+
 #if defined(HAS_OS_ACCESS)
 #error "Unexpected OS ACCESS HERE"
 #endif /* HAS_OS_ACCESS */
@@ -21,6 +25,9 @@ using vvt_map_t = Map3D<SCRIPT_TABLE_8, SCRIPT_TABLE_8, int8_t, uint16_t, uint16
 static vvt_map_t vvtTable1;
 static vvt_map_t vvtTable2;
 
+static void wakeVvtThread();
+static void startVvtThread();
+
 void VvtController::init(int index, int bankIndex, int camIndex, const ValueProvider3D* targetMap) {
 	this->index = index;
 	m_bank = bankIndex;
@@ -38,11 +45,109 @@ int VvtController::getPeriodMs() {
 }
 
 void VvtController::PeriodicTask() {
-	if (engine->auxParametersVersion.isOld(engine->getGlobalConfigurationVersion())) {
+	bool isPidConfigChanged = engine->auxParametersVersion.isOld(engine->getGlobalConfigurationVersion());
+
+	if (!engineConfiguration->vvtTriggerSynchronousControl) {
+		if (isPidConfigChanged) {
+			m_pid.reset();
+		}
+
+		m_updatePeriodSeconds = getPeriodMs() / 1000.0f;
+		update();
+		return;
+	}
+
+	// in trigger synchronous mode PID state belongs to VVT thread, timer context only posts requests
+	startVvtThread();
+
+	bool hasRequest;
+
+	{
+		chibios_rt::CriticalSectionLocker csl;
+
+		if (isPidConfigChanged) {
+			m_pidResetPending = true;
+		}
+
+		// cam slower than the timer, one edge per revolution at idle, or no cam measurements at all with the
+		// engine stopped: timer drives the loop on the latest position
+		m_timedUpdatePending = !m_isCamFasterThanTimer || getTimeNowNt() - m_camSampleNt > MS2NT(getPeriodMs());
+
+		hasRequest = m_pidResetPending || m_timedUpdatePending;
+	}
+
+	if (hasRequest) {
+		wakeVvtThread();
+	}
+}
+
+/**
+ * Invoked from cam capture with the timestamp of the edge which produced a new position.
+ * Only records the sample, control update runs on VVT thread so that the capture handler stays short.
+ */
+void VvtController::onCamSample(efitick_t nowNt) {
+	if (!isBrainPinValid(engineConfiguration->vvtPins[index])) {
+		return;
+	}
+
+	bool isCamUpdate;
+
+	{
+		chibios_rt::CriticalSectionLocker csl;
+
+		// holding the output for a whole cam revolution responds worse than timer ticks on a stale position,
+		// cam edges only run the loop when they come more often than the timer
+		m_isCamFasterThanTimer = nowNt - m_camSampleNt < MS2NT(getPeriodMs());
+		m_camSampleNt = nowNt;
+		// if previous measurement was not consumed yet the update picks up the latest position anyway
+		m_camUpdatePending = m_isCamFasterThanTimer;
+		isCamUpdate = m_camUpdatePending;
+	}
+
+	if (isCamUpdate) {
+		wakeVvtThread();
+	}
+}
+
+/**
+ * Invoked from VVT thread
+ */
+void VvtController::processPendingUpdates() {
+	bool isPidReset;
+	bool isCamUpdate;
+	bool isTimedUpdate;
+	efitick_t camSampleNt;
+
+	{
+		chibios_rt::CriticalSectionLocker csl;
+
+		isPidReset = m_pidResetPending;
+		isCamUpdate = m_camUpdatePending;
+		isTimedUpdate = m_timedUpdatePending;
+		camSampleNt = m_camSampleNt;
+
+		m_pidResetPending = false;
+		m_camUpdatePending = false;
+		m_timedUpdatePending = false;
+	}
+
+	if (isPidReset) {
 		m_pid.reset();
 	}
 
-	update();
+	if (isCamUpdate || isTimedUpdate) {
+		// I and D terms use actual time since the previous update: the cam edge interval, which varies with RPM,
+		// or the timer period. A cam update is timed from its edge, unless a timer update already ran after that edge
+		efitick_t updateNt = isCamUpdate ? camSampleNt : getTimeNowNt();
+		if (updateNt < m_lastUpdateNt) {
+			updateNt = getTimeNowNt();
+		}
+		float dt = m_lastUpdateNt == 0 ? getPeriodMs() / 1000.0f : NT2US(updateNt - m_lastUpdateNt) * 1e-6f;
+		m_lastUpdateNt = updateNt;
+		m_updatePeriodSeconds = clampF(0.0005f, dt, VVT_UPDATE_MAX_DT_MS / 1000.0f);
+
+		update();
+	}
 }
 
 expected<angle_t> VvtController::observePlant() const {
@@ -88,11 +193,11 @@ expected<percent_t> VvtController::getClosedLoop(angle_t target, angle_t observa
 	bool isInverted = shouldInvertVvt(m_cam);
 	m_pid.setErrorAmplification(isInverted ? -1.0f : 1.0f);
 	
-	float retVal = m_pid.getOutput(target, observation);
+	float retVal = m_pid.getOutput(target, observation, m_updatePeriodSeconds);
 
 	if (engineConfiguration->isVerboseAuxPid1) {
-		efiPrintf("aux duty: %.2f/value=%.2f/p=%.2f/i=%.2f/d=%.2f int=%.2f", retVal, observation,
-				m_pid.getP(), m_pid.getI(), m_pid.getD(), m_pid.getIntegration());
+		efiPrintf("aux duty: %.2f/value=%.2f/p=%.2f/i=%.2f/d=%.2f int=%.2f dt=%.4f", retVal, observation,
+				m_pid.getP(), m_pid.getI(), m_pid.getD(), m_pid.getIntegration(), m_updatePeriodSeconds);
 	}
 
 #if EFI_TUNER_STUDIO
@@ -138,6 +243,63 @@ static char vvtOutputNames[CAM_INPUTS_COUNT][13] = {
 
 static VvtController instances[CAM_INPUTS_COUNT];
 
+#if EFI_UNIT_TEST
+static void startVvtThread() {
+}
+
+static void wakeVvtThread() {
+	for (auto& instance : instances) {
+		instance.processPendingUpdates();
+	}
+}
+#else
+class VvtThread : public ThreadController<UTILITY_THREAD_STACK_SIZE> {
+public:
+	VvtThread() : ThreadController("vvt", PRIO_VVT) {}
+	void ThreadTask() override;
+};
+
+static VvtThread vvtThread;
+static chibios_rt::BinarySemaphore vvtSem(/* taken =*/ true);
+static bool isVvtThreadStarted = false;
+
+/**
+ * Invoked from periodic timer once trigger synchronous mode is on, the thread and its stack are only
+ * spent on configurations which use the mode
+ */
+static void startVvtThread() {
+	{
+		chibios_rt::CriticalSectionLocker csl;
+
+		// every cam has its own timer
+		if (isVvtThreadStarted) {
+			return;
+		}
+		isVvtThreadStarted = true;
+	}
+
+	vvtThread.start();
+}
+
+/**
+ * Invoked from cam capture or periodic timer, either may be interrupt context
+ */
+static void wakeVvtThread() {
+	chibios_rt::CriticalSectionLocker csl;
+	vvtSem.signalI();
+}
+
+void VvtThread::ThreadTask() {
+	while (true) {
+		vvtSem.wait();
+
+		for (auto& instance : instances) {
+			instance.processPendingUpdates();
+		}
+	}
+}
+#endif // EFI_UNIT_TEST
+
 static void turnVvtPidOn(int index) {
 	if (!isBrainPinValid(engineConfiguration->vvtPins[index])) {
 		return;
@@ -151,6 +313,14 @@ static void turnVvtPidOn(int index) {
 			engineConfiguration->vvtOutputFrequency[0], 0.1);
 }
 
+void onVvtCamMeasurement(int index, efitick_t nowNt) {
+	if (!engineConfiguration->vvtTriggerSynchronousControl || index >= CAM_INPUTS_COUNT) {
+		return;
+	}
+
+	instances[index].onCamSample(nowNt);
+}
+
 void startVvtControlPins() {
 	for (int i = 0;i <CAM_INPUTS_COUNT;i++) {
 		turnVvtPidOn(i);
@@ -188,4 +358,12 @@ void initVvtActuators() {
 	}
 }
 
+#else
+
+static void startVvtThread() {
+}
+
+static void wakeVvtThread() {
+}
+
 #endif
@@ -9,9 +9,18 @@
 
 void WallFuel::resetWF() {
 	wallFuel = 0;
+	m_hasLastInjection = false;
 }
 
 float WallFuel::adjust(float desiredMassGrams) {
+	return adjust(desiredMassGrams, getTimeNowNt());
+}
+
+/**
+ * Each injection event owns its film, so with sequential injection every cylinder's port is modelled
+ * separately and decays over the time since that cylinder last injected.
+ */
+float WallFuel::adjust(float desiredMassGrams, efitick_t nowNt) {
 	invocationCounter++;
 	if (cisnan(desiredMassGrams)) {
 		return desiredMassGrams;
@@ -48,8 +57,19 @@ float WallFuel::adjust(float desiredMassGrams) {
 		return desiredMassGrams;
 	}
 
-	float alpha = engine->module<WallFuelController>()->getAlpha();
-	float beta = engine->module<WallFuelController>()->getBeta();
+	// Time on the wall is this port's own injection interval, which differs from the average
+	// cycle time while RPM is changing. First event after a reset uses the nominal cycle.
+	float alpha;
+	if (m_hasLastInjection) {
+		alpha = engine->module<WallFuelController>()->getAlpha(m_lastInjection.getElapsedSeconds(nowNt));
+	} else {
+		alpha = engine->module<WallFuelController>()->getAlpha();
+	}
+	m_lastInjection.reset(nowNt);
+	m_hasLastInjection = true;
+
+	// same stability limit as for the nominal alpha
+	float beta = minF(engine->module<WallFuelController>()->getBeta(), alpha);
 
 	float fuelFilmMass = wallFuel;
 	float M_cmd = (desiredMassGrams - (1 - alpha) * fuelFilmMass) / (1 - beta);
@@ -86,6 +106,42 @@ float WallFuel::getWallFuel() const {
 	return wallFuel;
 }
 
+// film retained after (step * i) time constants on the wall, exp(-x) for x in 0..10
+#define WALL_FILM_DECAY_STEPS_PER_TAU 16
+#define WALL_FILM_DECAY_TAUS 10
+#define WALL_FILM_DECAY_SIZE (WALL_FILM_DECAY_STEPS_PER_TAU * WALL_FILM_DECAY_TAUS + 1)
+
+static struct WallFilmDecayTable {
+	WallFilmDecayTable() {
+		for (int i = 0; i < WALL_FILM_DECAY_SIZE; i++) {
+			values[i] = expf(-(float)i / WALL_FILM_DECAY_STEPS_PER_TAU);
+		}
+	}
+
+	float values[WALL_FILM_DECAY_SIZE];
+} wallFilmDecay;
+
+/**
+ * Film retained after spending given time on the wall. Linear interpolation in a 1/16 tau table is within
+ * 5e-4 of exp(-t / tau), this runs once per injection so no expf here.
+ */
+float WallFuelController::getAlpha(float secondsOnWall) const {
+	float x = secondsOnWall / m_tau * WALL_FILM_DECAY_STEPS_PER_TAU;
+
+	if (!(x > 0)) {
+		return 1;
+	}
+
+	// past ten time constants nothing is left
+	if (x >= WALL_FILM_DECAY_SIZE - 1) {
+		return 0;
+	}
+
+	int index = (int)x;
+	float fraction = x - index;
+	return wallFilmDecay.values[index] + fraction * (wallFilmDecay.values[index + 1] - wallFilmDecay.values[index]);
+}
+
 float WallFuelController::computeTau() const {
 	if (!engineConfiguration->complexWallModel) {
 		return engineConfiguration->wwaeTau;
@@ -95,6 +151,14 @@ float WallFuelController::computeTau() const {
 	// CLT failure, this is not critical to get perfect
 	float clt = Sensor::get(SensorType::Clt).value_or(90);
 
+	if (engineConfiguration->wwUseTables) {
+		return interpolate3d(
+			config->wwTauTable,
+			engineConfiguration->wwMapBins, Sensor::get(SensorType::Map).value_or(60),
+			engineConfiguration->wwCltBins, clt
+		);
+	}
+
 	float tau = interpolate2d(
 		clt,
 		engineConfiguration->wwCltBins,
@@ -124,6 +188,16 @@ float WallFuelController::computeBeta() const {
 	// CLT failure, this is not critical to get perfect
 	float clt = Sensor::get(SensorType::Clt).value_or(90);
 
+	if (engineConfiguration->wwUseTables) {
+		float beta = interpolate3d(
+			config->wwBetaTable,
+			engineConfiguration->wwMapBins, Sensor::get(SensorType::Map).value_or(60),
+			engineConfiguration->wwCltBins, clt
+		);
+
+		return clampF(0, beta, 1);
+	}
+
 	float beta = interpolate2d(
 		clt,
 		engineConfiguration->wwCltBins,
@@ -171,7 +245,9 @@ void WallFuelController::onFastCallback() {
 		return;
 	}
 
-	float alpha = expf_taylor(-120 / (rpm * tau));
+	// one engine cycle on the wall
+	float cycleSeconds = 120 / rpm;
+	float alpha = expf_taylor(-cycleSeconds / tau);
 
 	// If beta is larger than alpha, the system is underdamped.
 	// For reasonable values {tau, beta}, this should only be possible
@@ -184,6 +260,7 @@ void WallFuelController::onFastCallback() {
 	// Store parameters so the model can read them
 	m_alpha = alpha;
 	m_beta = beta;
+	m_tau = tau;
 	m_enable = true;
 
 #if EFI_TUNER_STUDIO